@@ -0,0 +1,78 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Runs the behaviour checks of -check one after the other and collects what failed. A check
+    // fails by throwing, Expect and ExpectThrows throw a CheckFailedException.
+    public class CheckRunner
+    {
+        private readonly List<String> _failures = new List<String>();
+
+        public int Passed { get; private set; }
+
+        public List<String> Failures
+        {
+            get { return _failures; }
+        }
+
+        public void Run(String name, Action check)
+        {
+            try
+            {
+                check();
+                Passed++;
+                Console.WriteLine("passed {0}", name);
+            }
+            catch (Exception ex)
+            {
+                _failures.Add(String.Format("{0}: {1}", name, ex.Message));
+                Console.WriteLine("FAILED {0} [{1}]", name, ex);
+            }
+        }
+
+        public static void Expect(bool condition, String format, params object[] args)
+        {
+            if (!condition)
+            {
+                throw new CheckFailedException(String.Format(format, args));
+            }
+        }
+
+        public static T ExpectThrows<T>(Action action) where T : Exception
+        {
+            try
+            {
+                action();
+            }
+            catch (T ex)
+            {
+                return ex;
+            }
+            throw new CheckFailedException(String.Format("Expected [{0}] to be thrown", typeof(T).Name));
+        }
+
+        // Value of a metric of the default registry, as exported, 0 while it is not registered
+        public static long Metric(String name, String labels)
+        {
+            IMetric metric = MetricsRegistry.Default.Metrics.FirstOrDefault(m => m.Name == name && m.Labels == labels);
+            return metric == null ? 0 : metric.Value;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("CheckRunner Passed [{0}] Failed [{1}]", Passed, _failures.Count);
+        }
+    }
+
+    public class CheckFailedException : Exception
+    {
+        public CheckFailedException(String message)
+            : base(message)
+        {
+        }
+    }
+}
@@ -0,0 +1,98 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What a CompactCodeline gives back of the codeline it was built from, for codelines as the
+    // SDK marshals them: every string a whole char[] buffer of MMMReaderCodelineData, padded with
+    // NULs, and NULs inside a field kept where the reader sent them
+    public static class CompactCodelineChecks
+    {
+        // MAX_CODELINE_LENGTH, MAX_CODELINE_FIELD_LENGTH and MAX_OPTIONAL_DATA_LENGTH of the SDK
+        private const int CODELINE_LENGTH = 200;
+        private const int FIELD_LENGTH = 40;
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("compact_codeline_round_trip", () =>
+            {
+                for (int serial = 0; serial < 3; serial++)
+                {
+                    MMM.Readers.CodelineData expected = Marshalled(SimulatedSwipeReader.Passport(serial));
+                    ExpectRoundTrip(expected, CompactCodeline.From(expected));
+                }
+            });
+            checks.Run("compact_codeline_embedded_nuls", () =>
+            {
+                MMM.Readers.CodelineData expected = Marshalled(SimulatedSwipeReader.Passport(1));
+                expected.Surname = Buffer("ERIK\0SSON", FIELD_LENGTH);
+                expected.Line3 = Buffer("\0\0<<", CODELINE_LENGTH);
+                // all NULs, the reader sent nothing
+                expected.OptionalData2 = Buffer(String.Empty, FIELD_LENGTH);
+                expected.SecondName = Buffer("MÄRIA", FIELD_LENGTH);
+                expected.Forenames = null;
+                CompactCodeline codeline = CompactCodeline.From(expected);
+                ExpectRoundTrip(expected, codeline);
+
+                CheckRunner.Expect(codeline.Surname == "ERIK\0SSON", "surname read as [{0}]", codeline.Surname.Replace("\0", "\\0"));
+                CheckRunner.Expect(codeline.FieldLength(CodelineField.LINE3) == 4, "line 3 stored with [{0}] bytes", codeline.FieldLength(CodelineField.LINE3));
+                CheckRunner.Expect(codeline.Field(CodelineField.OPTIONAL_DATA2) == String.Empty, "NUL buffer read as [{0}]", codeline.Field(CodelineField.OPTIONAL_DATA2));
+                CheckRunner.Expect(codeline.Field(CodelineField.SECOND_NAME) == "MÄRIA", "second name read as [{0}]", codeline.Field(CodelineField.SECOND_NAME));
+                CheckRunner.Expect(codeline.Field(CodelineField.FORENAMES) == null && codeline.FieldLength(CodelineField.FORENAMES) == -1, "null field read as not null");
+            });
+        }
+
+        // The codeline with every string in a NUL padded buffer of the SDK's size
+        public static MMM.Readers.CodelineData Marshalled(MMM.Readers.CodelineData data)
+        {
+            data.Data = Buffer(data.Data, CODELINE_LENGTH);
+            data.Line1 = Buffer(data.Line1, CODELINE_LENGTH);
+            data.Line2 = Buffer(data.Line2, CODELINE_LENGTH);
+            data.Line3 = Buffer(data.Line3, CODELINE_LENGTH);
+            data.DocId = Buffer(data.DocId, FIELD_LENGTH);
+            data.DocType = Buffer(data.DocType, FIELD_LENGTH);
+            data.Surname = Buffer(data.Surname, FIELD_LENGTH);
+            data.Forename = Buffer(data.Forename, FIELD_LENGTH);
+            data.SecondName = Buffer(data.SecondName, FIELD_LENGTH);
+            data.Forenames = Buffer(data.Forenames, FIELD_LENGTH);
+            data.IssuingState = Buffer(data.IssuingState, FIELD_LENGTH);
+            data.Nationality = Buffer(data.Nationality, FIELD_LENGTH);
+            data.DocNumber = Buffer(data.DocNumber, FIELD_LENGTH);
+            data.Sex = Buffer(data.Sex, FIELD_LENGTH);
+            data.OptionalData1 = Buffer(data.OptionalData1, FIELD_LENGTH);
+            data.OptionalData2 = Buffer(data.OptionalData2, FIELD_LENGTH);
+            return data;
+        }
+
+        private static String Buffer(String value, int length)
+        {
+            var buffer = new char[length];
+            value.CopyTo(0, buffer, 0, value.Length);
+            return new String(buffer);
+        }
+
+        // Every string as it was scanned, NULs included, and the other fields as compared for a
+        // scan record
+        private static void ExpectRoundTrip(MMM.Readers.CodelineData expected, CompactCodeline codeline)
+        {
+            MMM.Readers.CodelineData actual = codeline.ToCodelineData();
+            for (int i = 0; i < CompactCodeline.FieldCount; i++)
+            {
+                String expectedValue = ScanRecordCodec.StringAt(ref expected, i);
+                String actualValue = ScanRecordCodec.StringAt(ref actual, i);
+                CheckRunner.Expect(String.Equals(expectedValue, actualValue, StringComparison.Ordinal), "[{0}] given back as [{1}], expected [{2}]",
+                    (CodelineField)i, Visible(actualValue), Visible(expectedValue));
+            }
+            List<String> differences = ScanRecordCodecChecks.Differences(expected, actual);
+            CheckRunner.Expect(differences.Count == 0, "codeline differs in [{0}]", String.Join(", ", differences));
+        }
+
+        private static String Visible(String value)
+        {
+            return value == null ? "null" : value.TrimEnd('\0').Replace("\0", "\\0") + String.Format(" and {0} NULs", value.Length - value.TrimEnd('\0').Length);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Remote;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // In process tray app: counts the notifications it gets and signals the benchmark waiting
+    // for them instead of going through the named pipe
+    public class CountingSubscriber : ISubscriber
+    {
+        private readonly CountdownEvent _received;
+        private long _scans;
+        private long _deliveries;
+
+        public CountingSubscriber()
+            : this(null)
+        {
+        }
+
+        // received, when given, is signalled for every scan
+        public CountingSubscriber(CountdownEvent received)
+        {
+            _received = received;
+        }
+
+        public long Scans
+        {
+            get { return Interlocked.Read(ref _scans); }
+        }
+
+        public long Deliveries
+        {
+            get { return Interlocked.Read(ref _deliveries); }
+        }
+
+        public void HandlerScan(ScanResult result)
+        {
+            Interlocked.Increment(ref _scans);
+            if (_received != null)
+            {
+                _received.Signal();
+            }
+        }
+
+        public void HandleScanDelivered(ScanDeliveryResult result)
+        {
+            Interlocked.Increment(ref _deliveries);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Text;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware;
+using RestSharp;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // How DeliveryChannel counts answers, sizes its window and queues, against a
+    // LocalScanStoreServer answering as scripted. Every check has a channel of its own.
+    public static class DeliveryChannelChecks
+    {
+        private static readonly TimeSpan WAIT = TimeSpan.FromSeconds(5);
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("delivery_channel_5xx_failed_window_kept", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(500);
+                    var channel = new DeliveryChannel(new Uri(server.BaseUrl), 4, 4, WAIT);
+                    String host = Host(server);
+                    long failed = CheckRunner.Metric("alika_delivery_channel_failed_total", host);
+                    long delivered = CheckRunner.Metric("alika_delivery_channel_delivered_total", host);
+                    IRestResponse response = channel.Execute<Answer>(new Uri(server.BaseUrl), Request());
+                    CheckRunner.Expect((int)response.StatusCode == 500, "answered [{0}]", response.StatusCode);
+                    failed = CheckRunner.Metric("alika_delivery_channel_failed_total", host) - failed;
+                    delivered = CheckRunner.Metric("alika_delivery_channel_delivered_total", host) - delivered;
+                    CheckRunner.Expect(failed == 1 && delivered == 0, "counted [{0}] failed [{1}] delivered", failed, delivered);
+                    // as served on /metrics
+                    var exported = new StringWriter();
+                    MetricsRegistry.Default.WritePrometheus(exported);
+                    String sample = String.Format("alika_delivery_channel_failed_total{{{0}}} ", host);
+                    CheckRunner.Expect(exported.ToString().Contains(sample), "[{0}] not exported", sample);
+                    CheckRunner.Expect(channel.Window == 4, "window [{0}], expected 4", channel.Window);
+                    CheckRunner.Expect(server.LastRequestLine.StartsWith("POST /scans "), "request line [{0}]", server.LastRequestLine);
+                }
+            });
+            checks.Run("delivery_channel_503_halves_window", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(503);
+                    var channel = new DeliveryChannel(new Uri(server.BaseUrl), 4, 4, WAIT);
+                    channel.Execute<Answer>(new Uri(server.BaseUrl), Request());
+                    CheckRunner.Expect(channel.Window == 2, "window [{0}], expected 2", channel.Window);
+                    channel.Execute<Answer>(new Uri(server.BaseUrl), Request());
+                    CheckRunner.Expect(channel.Window == 3, "window [{0}] after a 2xx, expected 3", channel.Window);
+                }
+            });
+            checks.Run("delivery_channel_queues_beyond_window", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Delay = TimeSpan.FromMilliseconds(100);
+                    var channel = new DeliveryChannel(new Uri(server.BaseUrl), 1, 4, WAIT);
+                    long queued = CheckRunner.Metric("alika_delivery_channel_queued_total", Host(server));
+                    var deliveries = Enumerable.Range(0, 3).Select(i => channel.ExecuteAsync<Answer>(new Uri(server.BaseUrl), Request())).ToArray();
+                    CheckRunner.Expect(channel.InFlight == 1 && channel.WaitingCount == 2, "[{0}] in flight and [{1}] waiting", channel.InFlight, channel.WaitingCount);
+                    CheckRunner.Expect(Task.WaitAll(deliveries, WAIT), "deliveries not completed");
+                    CheckRunner.Expect(deliveries.All(d => d.Result.StatusCode == HttpStatusCode.OK), "not all answered 200");
+                    queued = CheckRunner.Metric("alika_delivery_channel_queued_total", Host(server)) - queued;
+                    CheckRunner.Expect(queued == 2, "[{0}] deliveries queued, expected 2", queued);
+                }
+            });
+            checks.Run("delivery_channel_queue_timeout_fails", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Delay = TimeSpan.FromMilliseconds(500);
+                    var channel = new DeliveryChannel(new Uri(server.BaseUrl), 1, 4, TimeSpan.FromMilliseconds(100));
+                    Task<IRestResponse<Answer>> first = channel.ExecuteAsync<Answer>(new Uri(server.BaseUrl), Request());
+                    Task<IRestResponse<Answer>> second = channel.ExecuteAsync<Answer>(new Uri(server.BaseUrl), Request());
+                    var ex = CheckRunner.ExpectThrows<AggregateException>(() => second.Wait(WAIT));
+                    CheckRunner.Expect(ex.InnerException is PosHardwareException, "failed with [{0}]", ex.InnerException);
+                    CheckRunner.Expect(first.Wait(WAIT) && first.Result.StatusCode == HttpStatusCode.OK, "first delivery not answered");
+                    CheckRunner.Expect(server.Requests == 1, "store got [{0}] requests, expected 1", server.Requests);
+                }
+            });
+            checks.Run("delivery_channel_caller_queue_timeout_fails", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Delay = TimeSpan.FromMilliseconds(1000);
+                    var channel = new DeliveryChannel(new Uri(server.BaseUrl), 1, 4, WAIT);
+                    Task<IRestResponse<Answer>> first = channel.ExecuteAsync<Answer>(new Uri(server.BaseUrl), Request());
+                    // what is left of the delivery's deadline, far below the channel's timeout
+                    Task<IRestResponse<Answer>> second = channel.ExecuteAsync<Answer>(new Uri(server.BaseUrl), Request(), TimeSpan.FromMilliseconds(100));
+                    var ex = CheckRunner.ExpectThrows<AggregateException>(() => second.Wait(WAIT));
+                    CheckRunner.Expect(ex.InnerException is PosHardwareException, "failed with [{0}]", ex.InnerException);
+                    CheckRunner.Expect(!first.IsCompleted, "second delivery waited for the first to be answered");
+                    CheckRunner.Expect(first.Wait(WAIT) && first.Result.StatusCode == HttpStatusCode.OK, "first delivery not answered");
+                    CheckRunner.Expect(server.Requests == 1, "store got [{0}] requests, expected 1", server.Requests);
+                }
+            });
+        }
+
+        // Label of the channel's metrics
+        private static String Host(LocalScanStoreServer server)
+        {
+            return "host=\"" + new Uri(server.BaseUrl).Authority + "\"";
+        }
+
+        private static RestRequest Request()
+        {
+            var request = new RestRequest(Method.POST);
+            request.Timeout = (int)WAIT.TotalMilliseconds;
+            request.AddParameter("application/json", "{}", ParameterType.RequestBody);
+            return request;
+        }
+
+        private class Answer
+        {
+        }
+    }
+}
@@ -0,0 +1,165 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Net;
+using System.Net.Sockets;
+using System.Text;
+using CH.Alika.POS.Hardware;
+using RestSharp;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What DeliveryPolicy sends again, against a LocalScanStoreServer answering as scripted.
+    // Every check has a server of its own, so it also has a circuit breaker of its own.
+    public static class DeliveryPolicyChecks
+    {
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("delivery_policy_5xx_not_retried", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(500);
+                    server.RejectionBody = "{\"Title\":\"Scan Refused\",\"Text\":\"Unknown guest\",\"Severity\":\"error\"}";
+                    var ex = CheckRunner.ExpectThrows<ScanStoreRejectedException>(() => Deliver(Policy(), server.BaseUrl));
+                    CheckRunner.Expect(server.Requests == 1, "store got [{0}] requests, expected 1", server.Requests);
+                    DeliveryNotification notification = new ScanStoreEvent(ex).Notification;
+                    CheckRunner.Expect(ex.StatusCode == 500 && notification != null && notification.Title == "Scan Refused",
+                        "store's answer lost [{0}] [{1}]", ex.StatusCode, notification);
+                }
+            });
+            checks.Run("delivery_policy_timeout_not_retried", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Delay = TimeSpan.FromMilliseconds(500);
+                    var policy = Policy();
+                    policy.AttemptTimeout = TimeSpan.FromMilliseconds(100);
+                    CheckRunner.ExpectThrows<PosHardwareException>(() => Deliver(policy, server.BaseUrl));
+                    CheckRunner.Expect(server.Requests == 1, "store got [{0}] requests, expected 1", server.Requests);
+                }
+            });
+            checks.Run("delivery_policy_429_retried", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(429, 429);
+                    IRestResponse response = Deliver(Policy(), server.BaseUrl);
+                    CheckRunner.Expect(response.StatusCode == HttpStatusCode.OK, "answered [{0}]", response.StatusCode);
+                    CheckRunner.Expect(server.Requests == 3, "store got [{0}] requests, expected 3", server.Requests);
+                }
+            });
+            checks.Run("delivery_policy_retries_keep_scan_key", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(429, 429);
+                    String key = DeliveryPolicy.IdempotencyKey(0x1234abcdL);
+                    Deliver(Policy(), server.BaseUrl, key);
+                    IList<String> keys = server.IdempotencyKeys;
+                    CheckRunner.Expect(keys.Count == 3 && keys.All(k => k == key), "store got keys [{0}], expected [{1}]", String.Join(", ", keys), key);
+                    CheckRunner.Expect(DeliveryPolicy.IdempotencyKey(0x1234abcdL) == key, "key of a trace id changed");
+                    CheckRunner.Expect(DeliveryPolicy.IdempotencyKey(new long[] { 1, 2 }) == DeliveryPolicy.IdempotencyKey(new long[] { 1, 2 }), "key of a batch changed");
+                    CheckRunner.Expect(DeliveryPolicy.IdempotencyKey(new long[] { 1, 2 }) != DeliveryPolicy.IdempotencyKey(new long[] { 2, 1 }), "batches in another order share a key");
+                }
+            });
+            checks.Run("delivery_policy_connect_failure_retried", () =>
+            {
+                var policy = Policy();
+                policy.MaxRetries = 2;
+                long attempts = CheckRunner.Metric("alika_delivery_attempts_total", null);
+                var ex = CheckRunner.ExpectThrows<PosHardwareException>(() => Deliver(policy, ClosedBaseUrl()));
+                CheckRunner.Expect(ex.InnerException is WebException, "inner exception [{0}]", ex.InnerException);
+                attempts = CheckRunner.Metric("alika_delivery_attempts_total", null) - attempts;
+                CheckRunner.Expect(attempts == 3, "[{0}] attempts, expected 3", attempts);
+            });
+            checks.Run("delivery_policy_idempotent_store_5xx_retried", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(503, 500);
+                    var policy = Policy();
+                    policy.IdempotentStore = true;
+                    IRestResponse response = Deliver(policy, server.BaseUrl);
+                    CheckRunner.Expect(response.StatusCode == HttpStatusCode.OK, "answered [{0}]", response.StatusCode);
+                    CheckRunner.Expect(server.Requests == 3, "store got [{0}] requests, expected 3", server.Requests);
+                }
+            });
+            checks.Run("delivery_policy_retries_exhausted_throws", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(503, 503, 503);
+                    var policy = Policy();
+                    policy.IdempotentStore = true;
+                    policy.MaxRetries = 1;
+                    CheckRunner.ExpectThrows<PosHardwareException>(() => Deliver(policy, server.BaseUrl));
+                    CheckRunner.Expect(server.Requests == 2, "store got [{0}] requests, expected 2", server.Requests);
+                }
+            });
+            checks.Run("delivery_policy_deadline_throws", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Script(429, 429, 429, 429);
+                    var policy = Policy();
+                    policy.InitialBackoff = TimeSpan.FromMilliseconds(400);
+                    policy.Deadline = TimeSpan.FromMilliseconds(100);
+                    long exceeded = CheckRunner.Metric("alika_delivery_deadlines_exceeded_total", null);
+                    CheckRunner.ExpectThrows<PosHardwareException>(() => Deliver(policy, server.BaseUrl));
+                    CheckRunner.Expect(CheckRunner.Metric("alika_delivery_deadlines_exceeded_total", null) == exceeded + 1, "deadline not counted");
+                }
+            });
+            checks.Run("delivery_policy_no_hedge_unless_idempotent", () =>
+            {
+                using (var server = new LocalScanStoreServer())
+                {
+                    server.Delay = TimeSpan.FromMilliseconds(200);
+                    var policy = Policy();
+                    policy.HedgeAfter = TimeSpan.FromMilliseconds(50);
+                    IRestResponse response = Deliver(policy, server.BaseUrl);
+                    CheckRunner.Expect(response.StatusCode == HttpStatusCode.OK, "answered [{0}]", response.StatusCode);
+                    CheckRunner.Expect(server.Requests == 1, "store got [{0}] requests, expected 1", server.Requests);
+                }
+            });
+        }
+
+        private static DeliveryPolicy Policy()
+        {
+            var policy = new DeliveryPolicy();
+            policy.InitialBackoff = TimeSpan.FromMilliseconds(10);
+            policy.MaxBackoff = TimeSpan.FromMilliseconds(20);
+            policy.AttemptTimeout = TimeSpan.FromSeconds(5);
+            return policy;
+        }
+
+        private static IRestResponse Deliver(DeliveryPolicy policy, String baseUrl)
+        {
+            return Deliver(policy, baseUrl, DeliveryPolicy.IdempotencyKey(0));
+        }
+
+        private static IRestResponse Deliver(DeliveryPolicy policy, String baseUrl, String key)
+        {
+            return policy.Execute(key, CircuitBreaker.For(baseUrl), (idempotencyKey, timeoutMs) =>
+            {
+                var request = new RestRequest(Method.POST);
+                request.Timeout = timeoutMs;
+                request.AddHeader(DeliveryPolicy.IDEMPOTENCY_KEY_HEADER, idempotencyKey);
+                request.AddParameter("application/json", "{}", ParameterType.RequestBody);
+                var client = new RestClient();
+                client.BaseUrl = new Uri(baseUrl);
+                return client.Execute(request);
+            });
+        }
+
+        // A port nothing listens on, connections to it are refused
+        private static String ClosedBaseUrl()
+        {
+            var listener = new TcpListener(IPAddress.Loopback, 0);
+            listener.Start();
+            int port = ((IPEndPoint)listener.LocalEndpoint).Port;
+            listener.Stop();
+            return String.Format("http://127.0.0.1:{0}/scans", port);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // In which order DeliveryScheduler picks the scans of its lanes, on a single delivery thread
+    // held by a first scan until both lanes are queued up
+    public static class DeliverySchedulerChecks
+    {
+        private static readonly TimeSpan WAIT = TimeSpan.FromSeconds(5);
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("delivery_scheduler_live_first", () =>
+            {
+                String order = Order(DeliveryScheduler.DefaultMaxLiveInARow, "BBLL");
+                CheckRunner.Expect(order == "LLBB", "picked [{0}], expected LLBB", order);
+            });
+            checks.Run("delivery_scheduler_backlog_not_starved", () =>
+            {
+                String order = Order(2, "LLLLLLBB");
+                CheckRunner.Expect(order == "LLBLLBLL", "picked [{0}], expected LLBLLBLL", order);
+            });
+        }
+
+        // Queues the lanes in the order given, L for live and B for backlog, and returns the
+        // order the scheduler ran them in
+        private static String Order(int maxLiveInARow, String queued)
+        {
+            var picked = new StringBuilder();
+            var holding = new ManualResetEvent(false);
+            var held = new ManualResetEvent(false);
+            var tasks = new List<Task<int>>();
+            using (var scheduler = new DeliveryScheduler(1, 1, maxLiveInARow))
+            {
+                tasks.Add(scheduler.Enqueue(DeliveryLane.LIVE, () => { holding.Set(); held.WaitOne(WAIT); return 0; }));
+                CheckRunner.Expect(holding.WaitOne(WAIT), "timed out waiting for the first delivery");
+                foreach (char lane in queued)
+                {
+                    char picks = lane;
+                    tasks.Add(scheduler.Enqueue(lane == 'L' ? DeliveryLane.LIVE : DeliveryLane.BACKLOG, () =>
+                    {
+                        lock (picked)
+                        {
+                            picked.Append(picks);
+                        }
+                        return 0;
+                    }));
+                }
+                held.Set();
+                CheckRunner.Expect(Task.WaitAll(tasks.ToArray(), WAIT), "timed out waiting for the deliveries");
+            }
+            return picked.ToString();
+        }
+    }
+}
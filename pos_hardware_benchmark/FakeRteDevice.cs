@@ -0,0 +1,142 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // A swipe reader speaking RTE at the far end of an in memory ISerialPort. Every command
+    // block the host writes is handed to Answer, which returns the bytes the reader sends back
+    // (null for none), and Send puts bytes on the line at any time. A <NAK> from the host makes
+    // it send its last block again, as the reader does, so a block garbled on the line by
+    // SendGarbled arrives intact the second time.
+    public class FakeRteDevice : ISerialPort
+    {
+        private static readonly TimeSpan READ_TIMEOUT = TimeSpan.FromMilliseconds(50);
+
+        private readonly bool _useBcc;
+        private readonly RteFrameParser _parser;
+        private readonly Queue<byte> _line = new Queue<byte>();
+        private byte[] _lastBlock;
+        private int _commands;
+        private int _naks;
+
+        // device and command code of a command block to the bytes sent back
+        public Func<byte, byte, byte[]> Answer { get; set; }
+
+        public FakeRteDevice(bool useBcc)
+        {
+            _useBcc = useBcc;
+            _parser = new RteFrameParser(useBcc);
+            Answer = (device, code) => new byte[] { RteFrameParser.ACK };
+        }
+
+        public int Commands
+        {
+            get { return Thread.VolatileRead(ref _commands); }
+        }
+
+        public int NaksReceived
+        {
+            get { return Thread.VolatileRead(ref _naks); }
+        }
+
+        // A message block of the reader
+        public byte[] Message(char device, char type, String text)
+        {
+            return RteFrameParser.Encode((byte)device, (byte)type, Encoding.ASCII.GetBytes(text), _useBcc);
+        }
+
+        public void Send(byte[] bytes)
+        {
+            Send(bytes, bytes);
+        }
+
+        // The block with its last byte, the BCC, flipped on the line
+        public void SendGarbled(byte[] block)
+        {
+            byte[] garbled = (byte[])block.Clone();
+            garbled[garbled.Length - 1] ^= 0x55;
+            Send(garbled, block);
+        }
+
+        private void Send(byte[] bytes, byte[] sent)
+        {
+            lock (_line)
+            {
+                if (bytes.Length > 1)
+                {
+                    _lastBlock = sent;
+                }
+                foreach (byte b in bytes)
+                {
+                    _line.Enqueue(b);
+                }
+                Monitor.PulseAll(_line);
+            }
+        }
+
+        public void Open()
+        {
+        }
+
+        public int Read(byte[] buffer, int offset, int count)
+        {
+            lock (_line)
+            {
+                if (_line.Count == 0)
+                {
+                    Monitor.Wait(_line, READ_TIMEOUT);
+                }
+                int n = 0;
+                while (n < count && _line.Count > 0)
+                {
+                    buffer[offset + n++] = _line.Dequeue();
+                }
+                return n;
+            }
+        }
+
+        public void Write(byte[] buffer, int offset, int count)
+        {
+            _parser.Append(buffer, offset, count);
+            RteFrame frame;
+            while (_parser.TryParse(out frame))
+            {
+                if (frame.Kind == RteFrameKind.NAK)
+                {
+                    Interlocked.Increment(ref _naks);
+                    byte[] last;
+                    lock (_line)
+                    {
+                        last = _lastBlock;
+                    }
+                    if (last != null)
+                    {
+                        Send(last);
+                    }
+                }
+                else if (frame.IsMessage)
+                {
+                    Interlocked.Increment(ref _commands);
+                    byte[] answer = Answer(frame.Device, frame.Text.Count > 0 ? frame.Text.Array[frame.Text.Offset] : (byte)0);
+                    if (answer != null)
+                    {
+                        Send(answer);
+                    }
+                }
+            }
+        }
+
+        public void Dispose()
+        {
+        }
+
+        public override string ToString()
+        {
+            return String.Format("FakeRteDevice Commands [{0}] NaksReceived [{1}]", Commands, NaksReceived);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Scan store in front of another that times every scan from the reader callback that
+    // delivered it until the inner store acknowledged it. HardwareService puts a scan on the
+    // thread of the reader callback, so the replay marks the start right before the callback
+    // and the put picks it up on the same thread.
+    public class LatencyScanStore : IScanStore
+    {
+        private readonly IScanStore _inner;
+        private readonly long[] _ticks;
+        private readonly CountdownEvent _pending;
+        private long _started;
+        private int _completed = 0;
+        private int _failures = 0;
+
+        public event EventHandler<ScanStoreEvent> OnScanStoreEvent
+        {
+            add { _inner.OnScanStoreEvent += value; }
+            remove { _inner.OnScanStoreEvent -= value; }
+        }
+
+        public LatencyScanStore(IScanStore inner, int scans)
+        {
+            _inner = inner;
+            _ticks = new long[scans];
+            _pending = new CountdownEvent(scans);
+        }
+
+        public void MarkStarted()
+        {
+            _started = Stopwatch.GetTimestamp();
+        }
+
+        public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
+        {
+            long started = _started;
+            return _inner.CodeLineDataPutAsync(e).ContinueWith(put =>
+            {
+                Complete(started, put.IsFaulted || put.Result.IsException);
+                return put.Result;
+            }, TaskContinuationOptions.ExecuteSynchronously);
+        }
+
+        private void Complete(long started, bool failed)
+        {
+            long elapsed = Stopwatch.GetTimestamp() - started;
+            if (failed)
+            {
+                Interlocked.Increment(ref _failures);
+            }
+            int index = Interlocked.Increment(ref _completed) - 1;
+            if (index < _ticks.Length)
+            {
+                _ticks[index] = elapsed;
+                _pending.Signal();
+            }
+        }
+
+        // Latencies of all scans once the inner store acknowledged them
+        public long[] Wait(TimeSpan timeout)
+        {
+            if (!_pending.Wait(timeout))
+            {
+                throw new PosHardwareException(String.Format("Scan store acknowledged [{0}] of [{1}] scans within [{2}]",
+                    _ticks.Length - _pending.CurrentCount, _ticks.Length, timeout));
+            }
+            if (_failures > 0)
+            {
+                throw new PosHardwareException(String.Format("Scan store failed to deliver [{0}] of [{1}] scans", _failures, _ticks.Length));
+            }
+            return (long[])_ticks.Clone();
+        }
+
+        public void Dispose()
+        {
+            _inner.Dispose();
+            _pending.Dispose();
+        }
+    }
+}
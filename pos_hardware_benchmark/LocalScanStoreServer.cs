@@ -0,0 +1,244 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Scan store endpoint on the loopback interface that answers every POST at once with a
+    // delivered balloon, keeping connections alive. For the checks, the next answers can be
+    // scripted to fail and all answers can be held back. A plain socket server rather than an
+    // HttpListener, which needs a URL reservation when not run as administrator.
+    public class LocalScanStoreServer : IDisposable
+    {
+        private const String RESPONSE_BODY = "{\"Title\":\"Document Scan Delivered\",\"Text\":\"Benchmark scan store\",\"Severity\":\"info\"}";
+
+        private readonly TcpListener _listener;
+        private readonly Thread _acceptThread;
+        private readonly Queue<int> _script = new Queue<int>();
+        private long _requests;
+        private volatile String _lastRequestLine;
+        private readonly List<String> _idempotencyKeys = new List<String>();
+
+        public LocalScanStoreServer()
+        {
+            _listener = new TcpListener(IPAddress.Loopback, 0);
+            _listener.Start();
+            _acceptThread = new Thread(Accept);
+            _acceptThread.Name = "LocalScanStoreAccept";
+            _acceptThread.IsBackground = true;
+            _acceptThread.Start();
+        }
+
+        public String BaseUrl
+        {
+            get { return String.Format("http://127.0.0.1:{0}/scans", ((IPEndPoint)_listener.LocalEndpoint).Port); }
+        }
+
+        // Requests received, counted before they are answered
+        public long Requests
+        {
+            get { return Interlocked.Read(ref _requests); }
+        }
+
+        // Method, path and version of the last request
+        public String LastRequestLine
+        {
+            get { return _lastRequestLine; }
+        }
+
+        // Idempotency-Key header of every request in turn, null for a request without one
+        public IList<String> IdempotencyKeys
+        {
+            get
+            {
+                lock (_idempotencyKeys)
+                {
+                    return _idempotencyKeys.ToList();
+                }
+            }
+        }
+
+        // Body of the scripted answers other than 200, none by default
+        public String RejectionBody { get; set; }
+
+        // Answers are held back this long, for attempts timing out
+        public TimeSpan Delay { get; set; }
+
+        // The next requests are answered with these statuses in turn, the ones after with 200 again
+        public void Script(params int[] statuses)
+        {
+            lock (_script)
+            {
+                foreach (int status in statuses)
+                {
+                    _script.Enqueue(status);
+                }
+            }
+        }
+
+        // Store config for the given protocol version pointing at this server, see ScanStoreRestImpl
+        public String WriteConfig(String directory, String protocolVersion, String transport)
+        {
+            String fileName = Path.Combine(directory, String.Format("AlikaPosBenchmark-{0}-v{1}-{2}.txt",
+                ((IPEndPoint)_listener.LocalEndpoint).Port, protocolVersion, transport ?? "default"));
+            String config = String.Format("{{\"BaseUrl\":\"{0}\",\"ClientId\":\"benchmark\",\"AccessKey\":\"benchmark\",\"ProtocolVersion\":\"{1}\",\"Transport\":{2}}}",
+                BaseUrl, protocolVersion, transport == null ? "null" : "\"" + transport + "\"");
+            File.WriteAllText(fileName, config);
+            return fileName;
+        }
+
+        private void Accept()
+        {
+            while (true)
+            {
+                TcpClient client;
+                try
+                {
+                    client = _listener.AcceptTcpClient();
+                }
+                catch (Exception)
+                {
+                    // stopped
+                    return;
+                }
+                var connection = new Thread(Serve);
+                connection.Name = "LocalScanStoreConnection";
+                connection.IsBackground = true;
+                connection.Start(client);
+            }
+        }
+
+        private void Serve(object state)
+        {
+            using (var client = (TcpClient)state)
+            {
+                client.NoDelay = true;
+                NetworkStream stream = client.GetStream();
+                byte[] delivered = Response(200);
+                byte[] buffer = new byte[64 * 1024];
+                try
+                {
+                    while (true)
+                    {
+                        String headers = ReadHeaders(stream, buffer);
+                        if (headers == null)
+                        {
+                            return;
+                        }
+                        if (headers.IndexOf("Expect: 100-continue", StringComparison.OrdinalIgnoreCase) >= 0)
+                        {
+                            byte[] proceed = Encoding.ASCII.GetBytes("HTTP/1.1 100 Continue\r\n\r\n");
+                            stream.Write(proceed, 0, proceed.Length);
+                        }
+                        Skip(stream, buffer, ContentLength(headers));
+                        _lastRequestLine = headers.Substring(0, headers.IndexOf("\r\n"));
+                        lock (_idempotencyKeys)
+                        {
+                            _idempotencyKeys.Add(Header(headers, "Idempotency-Key"));
+                        }
+                        Interlocked.Increment(ref _requests);
+                        int status = NextStatus();
+                        byte[] response = status == 200 ? delivered : Response(status);
+                        if (Delay > TimeSpan.Zero)
+                        {
+                            Thread.Sleep(Delay);
+                        }
+                        stream.Write(response, 0, response.Length);
+                    }
+                }
+                catch (IOException)
+                {
+                    // the client went away
+                }
+            }
+        }
+
+        private int NextStatus()
+        {
+            lock (_script)
+            {
+                return _script.Count > 0 ? _script.Dequeue() : 200;
+            }
+        }
+
+        private byte[] Response(int status)
+        {
+            if (status == 200)
+            {
+                return Encoding.ASCII.GetBytes(String.Format(
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: {0}\r\n\r\n{1}", RESPONSE_BODY.Length, RESPONSE_BODY));
+            }
+            String body = RejectionBody ?? String.Empty;
+            return Encoding.ASCII.GetBytes(String.Format(
+                "HTTP/1.1 {0} Scripted\r\nContent-Type: application/json\r\nContent-Length: {1}\r\n\r\n{2}", status, body.Length, body));
+        }
+
+        // Reads up to and including the blank line ending the headers, null when the client
+        // closed the connection
+        private static String ReadHeaders(NetworkStream stream, byte[] buffer)
+        {
+            int length = 0;
+            while (length < 4 || buffer[length - 4] != '\r' || buffer[length - 3] != '\n' || buffer[length - 2] != '\r' || buffer[length - 1] != '\n')
+            {
+                int b = stream.ReadByte();
+                if (b < 0)
+                {
+                    return null;
+                }
+                if (length == buffer.Length)
+                {
+                    throw new IOException("Request headers too long");
+                }
+                buffer[length++] = (byte)b;
+            }
+            return Encoding.ASCII.GetString(buffer, 0, length);
+        }
+
+        private static int ContentLength(String headers)
+        {
+            String length = Header(headers, "Content-Length");
+            return length == null ? 0 : Int32.Parse(length);
+        }
+
+        private static String Header(String headers, String name)
+        {
+            foreach (String line in headers.Split(new[] { "\r\n" }, StringSplitOptions.RemoveEmptyEntries))
+            {
+                int colon = line.IndexOf(':');
+                if (colon > 0 && String.Equals(line.Substring(0, colon).Trim(), name, StringComparison.OrdinalIgnoreCase))
+                {
+                    return line.Substring(colon + 1).Trim();
+                }
+            }
+            return null;
+        }
+
+        private static void Skip(NetworkStream stream, byte[] buffer, int count)
+        {
+            while (count > 0)
+            {
+                int read = stream.Read(buffer, 0, Math.Min(count, buffer.Length));
+                if (read == 0)
+                {
+                    throw new IOException("Request body truncated");
+                }
+                count -= read;
+            }
+        }
+
+        public void Dispose()
+        {
+            _listener.Stop();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("LocalScanStoreServer BaseUrl [{0}] Requests [{1}]", BaseUrl, Requests);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Takes every scan at once and raises no events, so that a stage in front of the store
+    // measures only itself
+    public class NullScanStore : IScanStore
+    {
+        private readonly Task<ScanStoreEvent> _stored;
+
+        public event EventHandler<ScanStoreEvent> OnScanStoreEvent
+        {
+            add { }
+            remove { }
+        }
+
+        public NullScanStore()
+        {
+            var completion = new TaskCompletionSource<ScanStoreEvent>();
+            completion.SetResult(new ScanStoreEvent("{}"));
+            _stored = completion.Task;
+        }
+
+        public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
+        {
+            return _stored;
+        }
+
+        public void Dispose()
+        {
+        }
+    }
+}
@@ -0,0 +1,383 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+using CH.Alika.POS.Service;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Times every stage a scan passes through, from the reader callback to the scan store's
+    // HTTP endpoint, with local stand-ins for the reader, the tray apps and the cloud. Results
+    // are printed and written as JSON so that releases can be compared. With -replay a swipe
+    // stream recorded by the service is replayed instead, see TrafficReplay. With -baseline the
+    // run fails when a stage regressed against an earlier results file, see RegressionGate.
+    // With -check the behaviour checks run instead, see CheckRunner.
+    //
+    //   AlikaPosBenchmark.exe [-scans 5000] [-subscribers 2] [-out AlikaPosBenchmark.json]
+    //                         [-replay AlikaPosTraffic.swt] [-speeds 1,10,100]
+    //                         [-baseline baseline.json] [-latencytolerance 25] [-allocationtolerance 10]
+    //   AlikaPosBenchmark.exe -check
+    //
+    // Exit codes: 0 passed, 1 bad option, 2 failed to run, 3 regressed against the baseline,
+    // 4 a check failed
+    class Program
+    {
+        private const int TRAY_BURSTS = 20;
+        private const int TRAY_BURST_SIZE = 200;
+
+        static int Main(string[] args)
+        {
+            // for the allocation counts, cannot be turned off again
+            AppDomain.MonitoringIsEnabled = true;
+            if (args.Length == 1 && args[0] == "-check")
+            {
+                return Check();
+            }
+            int scans = 5000;
+            int subscriberCount = 2;
+            String output = "AlikaPosBenchmark.json";
+            String traffic = null;
+            String speeds = "1,10,100";
+            String baseline = null;
+            double latencyTolerance = 0.25;
+            double allocationTolerance = 0.10;
+            for (int i = 0; i + 1 < args.Length; i += 2)
+            {
+                switch (args[i])
+                {
+                    case "-scans": scans = Int32.Parse(args[i + 1]); break;
+                    case "-subscribers": subscriberCount = Int32.Parse(args[i + 1]); break;
+                    case "-out": output = args[i + 1]; break;
+                    case "-replay": traffic = args[i + 1]; break;
+                    case "-speeds": speeds = args[i + 1]; break;
+                    case "-baseline": baseline = args[i + 1]; break;
+                    case "-latencytolerance": latencyTolerance = Int32.Parse(args[i + 1]) / 100.0; break;
+                    case "-allocationtolerance": allocationTolerance = Int32.Parse(args[i + 1]) / 100.0; break;
+                    default:
+                        Console.WriteLine("Unknown option [{0}]", args[i]);
+                        return 1;
+                }
+            }
+
+            var report = new BenchmarkReport()
+            {
+                Tool = "AlikaPosBenchmark",
+                Version = typeof(ScanStoreCloud).Assembly.GetName().Version.ToString(),
+                Machine = Environment.MachineName,
+                ProcessorCount = Environment.ProcessorCount,
+                Runtime = Environment.Version.ToString(),
+                StartedUtc = DateTime.UtcNow,
+                Scans = scans,
+                Subscribers = subscriberCount,
+                Traffic = traffic,
+                Stages = new List<StageResult>(),
+                Tray = new List<TrayStressResult>(),
+                Regressions = new List<String>()
+            };
+            try
+            {
+                if (traffic == null)
+                {
+                    Run(report);
+                }
+                else
+                {
+                    Replay(report, speeds.Split(',').Select(s => Double.Parse(s, System.Globalization.CultureInfo.InvariantCulture)).ToArray());
+                }
+                if (baseline != null)
+                {
+                    var before = Newtonsoft.Json.JsonConvert.DeserializeObject<BenchmarkReport>(File.ReadAllText(baseline));
+                    report.Regressions.AddRange(RegressionGate.Compare(before, report, latencyTolerance, allocationTolerance));
+                }
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine("Benchmark failed [{0}]", ex);
+                return 2;
+            }
+
+            File.WriteAllText(output, Newtonsoft.Json.JsonConvert.SerializeObject(report, Newtonsoft.Json.Formatting.Indented));
+            Console.WriteLine("Results written to [{0}]", Path.GetFullPath(output));
+            foreach (String regression in report.Regressions)
+            {
+                Console.WriteLine("Regression: {0}", regression);
+            }
+            return report.Regressions.Any() ? 3 : 0;
+        }
+
+        private static int Check()
+        {
+            var checks = new CheckRunner();
+            DeliveryPolicyChecks.Run(checks);
+            DeliveryChannelChecks.Run(checks);
+            DeliverySchedulerChecks.Run(checks);
+            RteProtocolChecks.Run(checks);
+            ReaderRecoveryChecks.Run(checks);
+            SwipeDecoderChecks.Run(checks);
+            ScanLogChecks.Run(checks);
+            ScanFieldCipherChecks.Run(checks);
+            ScanRecordCodecChecks.Run(checks);
+            CompactCodelineChecks.Run(checks);
+            ScanBatchCodecChecks.Run(checks);
+            SwipeSettingsSnapshotChecks.Run(checks);
+            Console.WriteLine("Done [{0}]", checks);
+            foreach (String failure in checks.Failures)
+            {
+                Console.WriteLine("Failed: {0}", failure);
+            }
+            return checks.Failures.Any() ? 4 : 0;
+        }
+
+        private static void Replay(BenchmarkReport report, double[] speeds)
+        {
+            var replay = new TrafficReplay(SwipeTrafficRecording.Load(report.Traffic));
+            report.Scans = replay.Scans;
+            String directory = Path.Combine(Path.GetTempPath(), "AlikaPosBenchmark");
+            Directory.CreateDirectory(directory);
+
+            using (var server = new LocalScanStoreServer())
+            {
+                Console.WriteLine("Replaying [{0}] against [{1}]", replay, server);
+                String config = server.WriteConfig(directory, "2", null);
+                // unmeasured, gets the code jitted and the connections opened
+                replay.Run("replay_warmup", speeds.Max(), config, report.Subscribers);
+                foreach (double speed in speeds)
+                {
+                    report.Stages.Add(replay.Run(String.Format(System.Globalization.CultureInfo.InvariantCulture, "replay_{0}x", speed),
+                        speed, config, report.Subscribers));
+                }
+                Console.WriteLine("Done [{0}]", server);
+            }
+        }
+
+        private static void Run(BenchmarkReport report)
+        {
+            int count = report.Scans;
+            int warmup = Math.Max(1, Math.Min(500, count / 10));
+            String directory = Path.Combine(Path.GetTempPath(), "AlikaPosBenchmark");
+            Directory.CreateDirectory(directory);
+
+            using (var server = new LocalScanStoreServer())
+            using (var reader = new SimulatedSwipeReader())
+            using (var received = new CountdownEvent(0))
+            {
+                Console.WriteLine("Benchmarking against [{0}] with [{1}]", server, reader);
+
+                // one event per simulated document, reused by the stages behind the reader
+                var scanned = new List<CodeLineScanEvent>();
+                EventHandler<CodeLineScanEvent> collect = delegate(Object sender, CodeLineScanEvent e) { scanned.Add(e); };
+                reader.OnCodeLineScanEvent += collect;
+                for (int i = 0; i < 64; i++)
+                {
+                    reader.Swipe();
+                }
+                reader.OnCodeLineScanEvent -= collect;
+                CodeLineScanEvent[] events = scanned.ToArray();
+                report.Stages.Add(StageRunner.Run("swipe_dispatch", warmup, count, i => reader.Swipe()));
+
+                // the codelines as the SDK marshals them, held as they are against their compact copy
+                MMM.Readers.CodelineData[] marshalled = Enumerable.Range(0, 64)
+                    .Select(s => CompactCodelineChecks.Marshalled(SimulatedSwipeReader.Passport(s))).ToArray();
+                report.Stages.Add(StageRunner.RunRetained("codeline_retained_struct", warmup, count, i =>
+                    CompactCodelineChecks.Marshalled(marshalled[i % marshalled.Length])));
+                report.Stages.Add(StageRunner.RunRetained("codeline_retained_compact", warmup, count, i =>
+                    CompactCodeline.From(marshalled[i % marshalled.Length])));
+
+                var frames = new SyntheticSwipeFrames(29);
+                var framesDispatcher = new ScanSourceEventDispatcher(frames);
+                var assembler = new SwipeRecordAssembler();
+                framesDispatcher.OnScanSourceEvent += assembler.HandleScanSourceEvent;
+                report.Stages.Add(StageRunner.Run("swipe_decode", warmup, count, i => frames.Play(framesDispatcher, i)));
+
+                var subscribers = new SubscriberGroup();
+                for (int i = 0; i < report.Subscribers; i++)
+                {
+                    subscribers.Add(new SubscriberAsync(new CountingSubscriber(received)));
+                }
+                SwipeSettingsStages(report, warmup, count, directory);
+
+                report.Stages.Add(StageRunner.Run("subscriber_notify_all", warmup, count, i =>
+                {
+                    received.Reset(report.Subscribers);
+                    subscribers.NotifyAll(events[i % events.Length]);
+                    received.Wait();
+                }));
+
+                var service = new HardwareService(new NullScanStore(), subscribers);
+                report.Stages.Add(StageRunner.Run("hardware_service_handle_scan", warmup, count, i =>
+                {
+                    received.Reset(report.Subscribers);
+                    service.HandleCodeLineScan(reader, events[i % events.Length]);
+                    received.Wait();
+                }));
+
+                // the payload sizes of the protocols, compared in the results
+                long payloadV2 = (long)events.Average(e => ScanPayloadJsonWriter.WriteV2("benchmark", "benchmark", e.CodeLineData).Length);
+                long payloadV3 = (long)events.Average(e => ScanRecordCodec.EncodeEnvelope("benchmark", "benchmark", e.CodeLineData).Length);
+                report.Stages.Add(StageRunner.Run("payload_encode_v2", warmup, count, i =>
+                    ScanPayloadJsonWriter.WriteV2("benchmark", "benchmark", events[i % events.Length].CodeLineData), payloadV2));
+                report.Stages.Add(StageRunner.Run("record_encode_v3", warmup, count, i =>
+                    ScanRecordCodec.EncodeEnvelope("benchmark", "benchmark", events[i % events.Length].CodeLineData), payloadV3));
+
+                foreach (int size in ScanBatchCodecChecks.BatchSizes)
+                {
+                    report.Stages.Add(BatchEncode(size, count));
+                }
+
+                using (var cipher = new ScanFieldCipher(ScanFieldCipherChecks.Key(0)))
+                {
+                    byte[][] sealedRecords = events.Select(e => ScanFieldCipherChecks.Seal(cipher, e.CodeLineData)).ToArray();
+                    long sealedBytes = (long)sealedRecords.Average(r => r.Length);
+                    var writer = new CompactWriter(512);
+                    report.Stages.Add(StageRunner.Run("cipher_seal", warmup, count, i =>
+                    {
+                        writer.Reset();
+                        cipher.WriteRecord(ref writer, events[i % events.Length].CodeLineData, i);
+                    }, sealedBytes));
+                    report.Stages.Add(StageRunner.Run("cipher_open", warmup, count, i =>
+                        ScanFieldCipherChecks.Open(cipher, sealedRecords[i % sealedRecords.Length]), sealedBytes));
+                }
+
+                String scanLogDirectory = ScanLogChecks.NewDirectory();
+                try
+                {
+                    using (ScanLog scanLog = ScanLogChecks.Open(scanLogDirectory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        report.Stages.Add(StageRunner.Run("scan_log_append", warmup, count, i =>
+                            scanLog.Append(i + 1, events[i % events.Length].CodeLineData)));
+                        report.Stages.Add(StageRunner.Run("scan_log_get", warmup, count, i =>
+                            scanLog.Get(i + 1)));
+                    }
+                }
+                finally
+                {
+                    ScanLogChecks.Delete(scanLogDirectory);
+                }
+
+                String configV2 = server.WriteConfig(directory, "2", null);
+                String configV3 = server.WriteConfig(directory, "3", null);
+                String configPersistent = server.WriteConfig(directory, "2", ScanStoreRestImpl.PERSISTENT_TRANSPORT);
+                report.Stages.Add(StageRunner.Run("rest_put_v2", warmup, count, i =>
+                    Put(configV2, events[i % events.Length])));
+                report.Stages.Add(StageRunner.Run("rest_put_v3", warmup, count, i =>
+                    Put(configV3, events[i % events.Length])));
+                report.Stages.Add(StageRunner.Run("rest_put_v2_persistent", warmup, count, i =>
+                    Put(configPersistent, events[i % events.Length])));
+
+                using (var cloud = new ScanStoreCloud(configV2))
+                {
+                    report.Stages.Add(StageRunner.Run("scan_store_cloud_put", warmup, count, i =>
+                    {
+                        ScanStoreEvent stored = cloud.CodeLineDataPutAsync(events[i % events.Length]).Result;
+                        if (stored.IsException)
+                        {
+                            throw new PosHardwareException("Scan store benchmark delivery failed", stored.Exception);
+                        }
+                    }));
+                }
+                subscribers.Dispose();
+                Console.WriteLine("Done [{0}]", server);
+            }
+
+            report.Tray.Add(TrayNotificationStress.Run("tray_post_per_event", false, TRAY_BURSTS, TRAY_BURST_SIZE));
+            report.Tray.Add(TrayNotificationStress.Run("tray_coalesced", true, TRAY_BURSTS, TRAY_BURST_SIZE));
+        }
+
+        // The SDK parsing its INI files against the snapshot of what it parsed, for the SDK's own
+        // config directory. Skipped where the SDK is not installed. At most 500 operations, as
+        // the SDK may take milliseconds.
+        private static void SwipeSettingsStages(BenchmarkReport report, int warmup, int count, String directory)
+        {
+            var settings = new MMM.Readers.Modules.Swipe.SwipeSettings();
+            String configDir;
+            MMM.Readers.ErrorCode loaded;
+            try
+            {
+                configDir = MMM.Readers.Modules.Reader.GetConfigDir();
+                loaded = MMM.Readers.Modules.Reader.LoadSwipeSettings(ref settings);
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine("Swipe settings stages skipped, the SDK could not be loaded [{0}]", ex.Message);
+                return;
+            }
+            if (loaded != MMM.Readers.ErrorCode.NO_ERROR_OCCURRED)
+            {
+                Console.WriteLine("Swipe settings stages skipped, the SDK did not load its settings [{0}]", loaded);
+                return;
+            }
+            int operations = Math.Min(count, 500);
+            report.Stages.Add(StageRunner.Run("swipe_settings_ini", Math.Min(warmup, 50), operations, i =>
+                MMM.Readers.Modules.Reader.LoadSwipeSettings(ref settings)));
+
+            String snapshot = Path.Combine(directory, "SwipeSettings.snapshot");
+            SwipeSettingsSnapshot.Save(snapshot, configDir, settings);
+            report.Stages.Add(StageRunner.Run("swipe_settings_snapshot", Math.Min(warmup, 50), operations, i =>
+            {
+                if (!SwipeSettingsSnapshot.TryLoad(snapshot, configDir, out settings))
+                {
+                    throw new PosHardwareException("Swipe settings snapshot was not used");
+                }
+            }));
+        }
+
+        // Times whole batches and reports per scan, every scan of a batch taking an equal share
+        // of its time, allocations and bytes
+        private static StageResult BatchEncode(int size, int scans)
+        {
+            List<MMM.Readers.CodelineData> batch = ScanBatchCodecChecks.Scans(size);
+            int batches = Math.Max(3, scans / size);
+            long bytes = 0;
+            for (int i = 0; i < Math.Max(1, batches / 10); i++)
+            {
+                bytes = ScanBatchCodec.EncodeBatch("benchmark", "benchmark", batch).Length;
+            }
+            GC.Collect();
+            GC.WaitForPendingFinalizers();
+            GC.Collect();
+
+            var ticks = new long[batches * size];
+            long allocatedBefore = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize;
+            var total = System.Diagnostics.Stopwatch.StartNew();
+            for (int i = 0; i < batches; i++)
+            {
+                long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                ScanBatchCodec.EncodeBatch("benchmark", "benchmark", batch);
+                long perScan = (System.Diagnostics.Stopwatch.GetTimestamp() - start) / size;
+                for (int j = 0; j < size; j++)
+                {
+                    ticks[i * size + j] = perScan;
+                }
+            }
+            total.Stop();
+            long allocated = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize - allocatedBefore;
+            return StageRunner.Summarize("batch_encode_" + size, ticks, total.Elapsed, allocated, bytes / size);
+        }
+
+        private static void Put(String configFileName, CodeLineScanEvent e)
+        {
+            new ScanStoreRestImpl(configFileName, e).CodeLineDataPut(e);
+        }
+    }
+
+    public class BenchmarkReport
+    {
+        public String Tool { get; set; }
+        public String Version { get; set; }
+        public String Machine { get; set; }
+        public int ProcessorCount { get; set; }
+        public String Runtime { get; set; }
+        public DateTime StartedUtc { get; set; }
+        public int Scans { get; set; }
+        public int Subscribers { get; set; }
+        // recording replayed, null for the stage benchmark
+        public String Traffic { get; set; }
+        public List<StageResult> Stages { get; set; }
+        // tray notification bursts, see TrayNotificationStress
+        public List<TrayStressResult> Tray { get; set; }
+        public List<String> Regressions { get; set; }
+    }
+}
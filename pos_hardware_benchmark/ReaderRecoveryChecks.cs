@@ -0,0 +1,93 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+using EventCode = MMM.Readers.FullPage.EventCode;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // When ReaderRecoveryMonitor takes a reconnected reader as connected, against a scan source
+    // whose Reconnect always returns
+    public static class ReaderRecoveryChecks
+    {
+        private static readonly TimeSpan DELAY = TimeSpan.FromMilliseconds(10);
+        private static readonly TimeSpan WAIT = TimeSpan.FromSeconds(5);
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("recovery_waits_for_connected_event", () =>
+            {
+                var source = new ReconnectingSource();
+                using (var monitor = new ReaderRecoveryMonitor(source, DELAY, DELAY, 3, WAIT))
+                {
+                    monitor.ConnectionLost("check");
+                    WaitFor(() => source.Reconnects == 1);
+                    Thread.Sleep(100);
+                    CheckRunner.Expect(monitor.State == ReaderConnectionState.RECOVERING, "state [{0}] before the connected event", monitor.State);
+                    monitor.HandleScanSourceEvent(source, new ScanSourceEvent(EventCode.SWIPE_READER_CONNECTED));
+                    CheckRunner.Expect(monitor.State == ReaderConnectionState.CONNECTED, "state [{0}] after the connected event", monitor.State);
+                }
+            });
+            checks.Run("recovery_connected_after_timeout_without_event", () =>
+            {
+                var source = new ReconnectingSource();
+                using (var monitor = new ReaderRecoveryMonitor(source, DELAY, DELAY, 3, TimeSpan.FromMilliseconds(100)))
+                {
+                    monitor.ConnectionLost("check");
+                    WaitFor(() => monitor.State == ReaderConnectionState.CONNECTED);
+                    CheckRunner.Expect(source.Reconnects == 1, "[{0}] reconnects, expected 1", source.Reconnects);
+                }
+            });
+            checks.Run("recovery_retried_when_dropped_after_reconnect", () =>
+            {
+                var source = new ReconnectingSource();
+                using (var monitor = new ReaderRecoveryMonitor(source, DELAY, DELAY, 3, WAIT))
+                {
+                    monitor.ConnectionLost("check");
+                    WaitFor(() => source.Reconnects == 1);
+                    monitor.HandleScanSourceEvent(source, new ScanSourceEvent(EventCode.SWIPE_READER_DISCONNECTED));
+                    WaitFor(() => source.Reconnects == 2);
+                    CheckRunner.Expect(monitor.State == ReaderConnectionState.RECOVERING, "state [{0}] after the second reconnect", monitor.State);
+                }
+            });
+        }
+
+        private static void WaitFor(Func<bool> condition)
+        {
+            var deadline = DateTime.UtcNow + WAIT;
+            while (!condition())
+            {
+                CheckRunner.Expect(DateTime.UtcNow < deadline, "timed out waiting");
+                Thread.Sleep(10);
+            }
+        }
+
+        private class ReconnectingSource : IRecoverableScanSource
+        {
+            private int _reconnects;
+
+            public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent = delegate { };
+            public event EventHandler<ScanSourceEvent> OnScanSourceEvent = delegate { };
+
+            public int Reconnects
+            {
+                get { return Thread.VolatileRead(ref _reconnects); }
+            }
+
+            public void Activate()
+            {
+            }
+
+            public void Reconnect()
+            {
+                Interlocked.Increment(ref _reconnects);
+            }
+
+            public void Dispose()
+            {
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Compares the stages of a run with those of the same name in a baseline run. A stage
+    // regressed when its p99 latency or its allocations per operation exceed the baseline by
+    // more than the tolerance; allocations get at least MinAllocationSlack bytes of slack so
+    // that a stage which allocated nothing does not fail on a stray byte count.
+    public static class RegressionGate
+    {
+        public const long MinAllocationSlack = 64;
+
+        public static List<String> Compare(BenchmarkReport baseline, BenchmarkReport current, double latencyTolerance, double allocationTolerance)
+        {
+            var regressions = new List<String>();
+            foreach (StageResult stage in current.Stages)
+            {
+                StageResult before = baseline.Stages.FirstOrDefault(s => s.Stage == stage.Stage);
+                if (before == null)
+                {
+                    continue;
+                }
+                double maxP99 = before.P99Us * (1 + latencyTolerance);
+                if (stage.P99Us > maxP99)
+                {
+                    regressions.Add(String.Format("Stage [{0}] p99 [{1:F1} us] exceeds baseline [{2:F1} us] by more than [{3:P0}]",
+                        stage.Stage, stage.P99Us, before.P99Us, latencyTolerance));
+                }
+                long maxAllocated = before.AllocatedBytesPerOperation + Math.Max(MinAllocationSlack, (long)(before.AllocatedBytesPerOperation * allocationTolerance));
+                if (stage.AllocatedBytesPerOperation > maxAllocated)
+                {
+                    regressions.Add(String.Format("Stage [{0}] allocates [{1} B/op] against baseline [{2} B/op], more than [{3:P0}]",
+                        stage.Stage, stage.AllocatedBytesPerOperation, before.AllocatedBytesPerOperation, allocationTolerance));
+                }
+            }
+            return regressions;
+        }
+    }
+}
@@ -0,0 +1,147 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // How RteProtocolEngine matches answers to commands and how RteSwipeReader raises what it
+    // reads, against a FakeRteDevice
+    public static class RteProtocolChecks
+    {
+        private static readonly TimeSpan COMMAND_TIMEOUT = TimeSpan.FromMilliseconds(200);
+        private static readonly TimeSpan WAIT = TimeSpan.FromSeconds(5);
+        // the specimen passport of ICAO 9303
+        private const String PASSPORT = "P<UTOERIKSSON<<ANNA<MARIA<<<<<<<<<<<<<<<<<<<\rL898902C36UTO7408122F1204159ZE184226B<<<<<10";
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("rte_answers_matched_by_device", () =>
+            {
+                var device = new FakeRteDevice(true);
+                device.Answer = (d, code) => null;
+                using (var engine = Start(device))
+                {
+                    Task<RteResponse> msr = engine.Inquire(Swipe.RTEProtocolDevice.MSR, Swipe.RTEProtocolTrackValue.DEVICE_DEFAULT);
+                    Task<RteResponse> ocr = engine.Inquire(Swipe.RTEProtocolDevice.OCR, Swipe.RTEProtocolTrackValue.DEVICE_DEFAULT);
+                    WaitFor(() => device.Commands == 2);
+                    // the OCR answers first
+                    device.Send(device.Message('O', 'D', "IOCR"));
+                    device.Send(device.Message('C', 'D', "IMSR"));
+                    CheckRunner.Expect(ocr.Wait(WAIT) && ocr.Result.Text == "IOCR", "OCR got [{0}]", ocr.IsCompleted ? ocr.Result.Text : "nothing");
+                    CheckRunner.Expect(msr.Wait(WAIT) && msr.Result.Text == "IMSR", "MSR got [{0}]", msr.IsCompleted ? msr.Result.Text : "nothing");
+                }
+            });
+            checks.Run("rte_message_answers_only_its_command", () =>
+            {
+                var device = new FakeRteDevice(true);
+                device.Answer = (d, code) => null;
+                using (var engine = Start(device))
+                {
+                    Task<RteResponse> led = engine.OperateLED(Swipe.RTEProtocolDevice.OCR, Swipe.RTEProtocolLEDStatus.GREEN, Swipe.RTEProtocolLEDOperation.ON);
+                    WaitFor(() => device.Commands == 1);
+                    // data of the OCR, but not the answer to an LED command
+                    device.Send(device.Message('O', 'D', "IOCR"));
+                    Thread.Sleep(50);
+                    CheckRunner.Expect(!led.IsCompleted, "LED command answered by a message");
+                    device.Send(new byte[] { RteFrameParser.ACK });
+                    CheckRunner.Expect(led.Wait(WAIT) && led.Result.Kind == RteFrameKind.ACK, "LED command not answered by its ACK");
+                }
+            });
+            checks.Run("rte_dropped_block_holds_no_ack", () =>
+            {
+                var parser = new RteFrameParser(true);
+                byte[] broken = RteFrameParser.Encode((byte)'O', (byte)'D', Encoding.ASCII.GetBytes("I\u0006\u0015"), true);
+                // no <STX> where it belongs, the block is dropped with the <ACK>/<NAK> in its text
+                broken[5] = (byte)'X';
+                parser.Append(broken, 0, broken.Length);
+                byte[] message = RteFrameParser.Encode((byte)'O', (byte)'U', Encoding.ASCII.GetBytes("IOCR"), true);
+                parser.Append(message, 0, message.Length);
+                var kinds = new List<RteFrameKind>();
+                RteFrame frame;
+                while (parser.TryParse(out frame))
+                {
+                    kinds.Add(frame.Kind);
+                }
+                CheckRunner.Expect(kinds.SequenceEqual(new[] { RteFrameKind.BAD_FRAME, RteFrameKind.MESSAGE }), "parsed [{0}]", String.Join(" ", kinds));
+            });
+            checks.Run("rte_late_answer_dropped", () =>
+            {
+                var device = new FakeRteDevice(true);
+                device.Answer = (d, code) => null;
+                using (var engine = Start(device))
+                {
+                    Task<RteResponse> first = engine.OperateLED(Swipe.RTEProtocolDevice.ATB, Swipe.RTEProtocolLEDStatus.GREEN, Swipe.RTEProtocolLEDOperation.ON);
+                    CheckRunner.ExpectThrows<AggregateException>(() => first.Wait(WAIT));
+                    device.Answer = (d, code) => new byte[] { RteFrameParser.ACK };
+                    Task<RteResponse> second = engine.OperateLED(Swipe.RTEProtocolDevice.ATB, Swipe.RTEProtocolLEDStatus.RED, Swipe.RTEProtocolLEDOperation.ON);
+                    Thread.Sleep(50);
+                    CheckRunner.Expect(device.Commands == 1, "second command sent while the first may still be answered");
+                    // the answer to the first command, too late
+                    device.Send(new byte[] { RteFrameParser.ACK });
+                    CheckRunner.Expect(second.Wait(WAIT) && second.Result.Kind == RteFrameKind.ACK, "second command not answered");
+                    CheckRunner.Expect(engine.LateResponses == 1, "[{0}] late responses, expected 1", engine.LateResponses);
+                    CheckRunner.Expect(device.Commands == 2, "[{0}] commands, expected 2", device.Commands);
+                }
+            });
+            checks.Run("rte_bad_bcc_answered_with_nak", () =>
+            {
+                var device = new FakeRteDevice(true);
+                using (var engine = Start(device))
+                using (var received = new ManualResetEvent(false))
+                {
+                    String text = null;
+                    engine.OnRteMessageEvent += (sender, e) => { text = e.Text; received.Set(); };
+                    device.SendGarbled(device.Message('O', 'U', "P<UTOERIKSSON<<ANNA<MARIA"));
+                    CheckRunner.Expect(received.WaitOne(WAIT) && text == "P<UTOERIKSSON<<ANNA<MARIA", "message not received");
+                    WaitFor(() => device.NaksReceived == 1);
+                    CheckRunner.Expect(engine.ChecksumErrors == 1, "[{0}] checksum errors, expected 1", engine.ChecksumErrors);
+                }
+            });
+            checks.Run("rte_swipe_reader_raises_codeline", () =>
+            {
+                var device = new FakeRteDevice(true);
+                using (var reader = new RteSwipeReader(() => device, true, false, COMMAND_TIMEOUT))
+                using (var received = new ManualResetEvent(false))
+                {
+                    var events = new List<MMM.Readers.FullPage.EventCode>();
+                    CodeLineScanEvent scan = null;
+                    reader.OnScanSourceEvent += (sender, e) => { lock (events) { events.Add(e.EventCode); } };
+                    reader.OnCodeLineScanEvent += (sender, e) => { scan = e; received.Set(); };
+                    reader.Activate();
+                    CheckRunner.Expect(device.Commands == 1, "[{0}] commands, expected the OCR enabled", device.Commands);
+                    device.Send(device.Message('O', 'U', PASSPORT));
+                    CheckRunner.Expect(received.WaitOne(WAIT), "codeline not raised");
+                    CheckRunner.Expect(scan.CodeLineData.DocNumber == "L898902C3", "document number [{0}]", scan.CodeLineData.DocNumber);
+                    CheckRunner.Expect(scan.CodeLineData.CodelineValidationResult == MMM.Readers.CheckDigitResult.CDR_Valid,
+                        "validation result [{0}]", scan.CodeLineData.CodelineValidationResult);
+                    lock (events)
+                    {
+                        CheckRunner.Expect(events.Contains(MMM.Readers.FullPage.EventCode.SWIPE_READER_CONNECTED), "connected not raised");
+                    }
+                }
+            });
+        }
+
+        private static RteProtocolEngine Start(FakeRteDevice device)
+        {
+            var engine = new RteProtocolEngine(device, true, false, COMMAND_TIMEOUT, RteProtocolEngine.DefaultMaxInFlight);
+            engine.Start();
+            return engine;
+        }
+
+        private static void WaitFor(Func<bool> condition)
+        {
+            var deadline = DateTime.UtcNow + WAIT;
+            while (!condition())
+            {
+                CheckRunner.Expect(DateTime.UtcNow < deadline, "timed out waiting");
+                Thread.Sleep(10);
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What ScanBatchCodec decodes from a batch it encoded, for the batch sizes the benchmark times
+    public static class ScanBatchCodecChecks
+    {
+        public static readonly int[] BatchSizes = { 1, 10, 100, ScanBatchCodec.MaxBatchSize };
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("scan_batch_round_trip", () =>
+            {
+                foreach (int size in BatchSizes)
+                {
+                    List<MMM.Readers.CodelineData> scans = Scans(size);
+                    String clientId;
+                    String accessKey;
+                    List<MMM.Readers.CodelineData> decoded = ScanBatchCodec.DecodeBatch(ScanBatchCodec.EncodeBatch("client", "key", scans), out clientId, out accessKey);
+                    CheckRunner.Expect(clientId == "client" && accessKey == "key", "batch of [{0}] decoded credentials [{1}] [{2}]", size, clientId, accessKey);
+                    CheckRunner.Expect(decoded.Count == size, "batch of [{0}] decoded [{1}] scans", size, decoded.Count);
+                    for (int i = 0; i < size; i++)
+                    {
+                        List<String> differences = ScanRecordCodecChecks.Differences(scans[i], decoded[i]);
+                        CheckRunner.Expect(differences.Count == 0, "scan [{0}] of a batch of [{1}] differs in [{2}]", i, size, String.Join(", ", differences));
+                    }
+                }
+            });
+            checks.Run("scan_batch_too_large_rejected", () =>
+            {
+                CheckRunner.ExpectThrows<ArgumentException>(() => ScanBatchCodec.EncodeBatch("client", "key", Scans(ScanBatchCodec.MaxBatchSize + 1)));
+            });
+        }
+
+        // Specimen passports, each with another document number
+        public static List<MMM.Readers.CodelineData> Scans(int count)
+        {
+            return Enumerable.Range(0, count).Select(i => SimulatedSwipeReader.Passport(i)).ToList();
+        }
+    }
+}
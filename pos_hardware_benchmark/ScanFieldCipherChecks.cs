@@ -0,0 +1,81 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Security.Cryptography;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What ScanFieldCipher opens again: a sealed record with the key and context it was sealed
+    // with, and nothing that was changed or sealed under another key
+    public static class ScanFieldCipherChecks
+    {
+        private const long CONTEXT = 42;
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("scan_field_cipher_round_trip", () =>
+            {
+                using (var cipher = new ScanFieldCipher(Key(0)))
+                {
+                    for (int serial = 0; serial < 3; serial++)
+                    {
+                        MMM.Readers.CodelineData expected = SimulatedSwipeReader.Passport(serial);
+                        MMM.Readers.CodelineData opened = Open(cipher, Seal(cipher, expected));
+                        foreach (String field in ScanRecordCodecChecks.Differences(expected, opened))
+                        {
+                            CheckRunner.Expect(false, "[{0}] differs after opening the sealed record", field);
+                        }
+                    }
+                }
+            });
+            checks.Run("scan_field_cipher_flipped_tag_rejected", () =>
+            {
+                using (var cipher = new ScanFieldCipher(Key(0)))
+                {
+                    byte[] record = Seal(cipher, SimulatedSwipeReader.Passport(1));
+                    // the tag ends the record
+                    record[record.Length - 1] ^= 0x01;
+                    CheckRunner.ExpectThrows<CryptographicException>(() => Open(cipher, record));
+                }
+            });
+            checks.Run("scan_field_cipher_wrong_key_rejected", () =>
+            {
+                byte[] record;
+                using (var cipher = new ScanFieldCipher(Key(0)))
+                {
+                    record = Seal(cipher, SimulatedSwipeReader.Passport(1));
+                }
+                using (var other = new ScanFieldCipher(Key(1)))
+                {
+                    CheckRunner.ExpectThrows<CryptographicException>(() => Open(other, record));
+                }
+            });
+        }
+
+        // Every key differs from the one of another seed
+        public static byte[] Key(int seed)
+        {
+            byte[] key = new byte[ScanFieldCipher.KeyLength];
+            for (int i = 0; i < key.Length; i++)
+            {
+                key[i] = (byte)(i + seed * 31);
+            }
+            return key;
+        }
+
+        public static byte[] Seal(ScanFieldCipher cipher, MMM.Readers.CodelineData data)
+        {
+            var writer = new CompactWriter(512);
+            cipher.WriteRecord(ref writer, data, CONTEXT);
+            return writer.ToArray();
+        }
+
+        public static MMM.Readers.CodelineData Open(ScanFieldCipher cipher, byte[] record)
+        {
+            var reader = new CompactReader(record, 0, record.Length);
+            return cipher.ReadRecord(ref reader, CONTEXT);
+        }
+    }
+}
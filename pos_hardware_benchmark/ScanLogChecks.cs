@@ -0,0 +1,169 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What a ScanLog holds after being closed and opened again, with the personal fields sealed
+    // as the service stores them. Every check has a directory of its own, deleted afterwards.
+    public static class ScanLogChecks
+    {
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("scan_log_truncated_tail_dropped", () =>
+            {
+                String directory = NewDirectory();
+                try
+                {
+                    using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        for (int i = 1; i <= 10; i++)
+                        {
+                            scanLog.Append(100 + i, SimulatedSwipeReader.Passport(i));
+                        }
+                    }
+                    // the last append cut short by a crash
+                    String last = Directory.GetFiles(directory, "scans-*.log").Max();
+                    using (var file = new FileStream(last, FileMode.Open, FileAccess.Write))
+                    {
+                        file.SetLength(file.Length - 5);
+                    }
+                    using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        CheckRunner.Expect(scanLog.Count == 9, "[{0}] scans after the cut, expected 9", scanLog.Count);
+                        CheckRunner.Expect(scanLog.Get(110) == null, "scan cut short was read");
+                        ExpectScan(scanLog.Get(109), 9);
+                        scanLog.Append(111, SimulatedSwipeReader.Passport(11));
+                    }
+                    using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        CheckRunner.Expect(scanLog.Count == 10, "[{0}] scans after appending past the cut, expected 10", scanLog.Count);
+                        ExpectScan(scanLog.Get(111), 11);
+                    }
+                }
+                finally
+                {
+                    Delete(directory);
+                }
+            });
+            checks.Run("scan_log_compaction_round_trip", () =>
+            {
+                String directory = NewDirectory();
+                try
+                {
+                    using (ScanLog scanLog = Open(directory, 4096))
+                    {
+                        scanLog.RetainSynced = TimeSpan.Zero;
+                        for (int i = 1; i <= 200; i++)
+                        {
+                            scanLog.Append(1000 + i, SimulatedSwipeReader.Passport(i % 7));
+                        }
+                        scanLog.MarkSynced(Enumerable.Range(1, 150).Select(s => (long)s));
+                        int segments = scanLog.SegmentCount;
+                        long reclaimed = scanLog.Compact();
+                        CheckRunner.Expect(reclaimed > 0 && scanLog.SegmentCount < segments, "compaction reclaimed [{0}] bytes, [{1}] of [{2}] segments left",
+                            reclaimed, scanLog.SegmentCount, segments);
+                        CheckRunner.Expect(scanLog.Get(1050) == null, "synced scan kept");
+                    }
+                    using (ScanLog scanLog = Open(directory, 4096))
+                    {
+                        CheckRunner.Expect(scanLog.UnsyncedCount == 50, "[{0}] unsynced scans, expected 50", scanLog.UnsyncedCount);
+                        for (int i = 151; i <= 200; i++)
+                        {
+                            ExpectScan(scanLog.Get(1000 + i), i % 7);
+                        }
+                        // 157, 164 and so on up to 199 are left
+                        String docNumber = SimulatedSwipeReader.Passport(3).DocNumber;
+                        IList<StoredScan> sameDocument = scanLog.FindByDocNumber(docNumber);
+                        CheckRunner.Expect(sameDocument.Count == 7 && sameDocument.All(s => s.CodeLineData.DocNumber == docNumber),
+                            "[{0}] scans found by document number, expected 7", sameDocument.Count);
+                    }
+                }
+                finally
+                {
+                    Delete(directory);
+                }
+            });
+            checks.Run("scan_log_unsynced_replayed_after_restart", () =>
+            {
+                String directory = NewDirectory();
+                try
+                {
+                    using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        for (int i = 1; i <= 5; i++)
+                        {
+                            scanLog.Append(100 + i, SimulatedSwipeReader.Passport(i));
+                        }
+                        scanLog.MarkSynced(new long[] { 1, 2 });
+                    }
+                    using (var server = new LocalScanStoreServer())
+                    {
+                        using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                        using (var cloud = new ScanStoreCloud(server.WriteConfig(directory, "2", null)))
+                        {
+                            IList<StoredScan> pending = scanLog.Unsynced(ScanBatchCodec.MaxBatchSize, null);
+                            CheckRunner.Expect(String.Join(",", pending.Select(s => s.TraceId)) == "103,104,105",
+                                "pending after restart [{0}]", String.Join(",", pending.Select(s => s.TraceId)));
+                            int delivered = cloud.CodeLineDataReplayBatchAsync(pending).Result;
+                            CheckRunner.Expect(delivered == 3, "[{0}] scans replayed, expected 3", delivered);
+                            scanLog.MarkSynced(pending.Take(delivered).Select(s => s.Sequence));
+                        }
+                        // a replay carries the key its live delivery had
+                        IList<String> keys = server.IdempotencyKeys;
+                        IList<String> expected = new long[] { 103, 104, 105 }.Select(t => DeliveryPolicy.IdempotencyKey(t)).ToList();
+                        CheckRunner.Expect(keys.SequenceEqual(expected), "store got keys [{0}], expected [{1}]", String.Join(", ", keys), String.Join(", ", expected));
+                    }
+                    using (ScanLog scanLog = Open(directory, ScanLog.DefaultMaxSegmentBytes))
+                    {
+                        CheckRunner.Expect(scanLog.UnsyncedCount == 0, "[{0}] scans unsynced after the replay", scanLog.UnsyncedCount);
+                    }
+                }
+                finally
+                {
+                    Delete(directory);
+                }
+            });
+        }
+
+        // A fixed key, so that the log can be opened again
+        public static ScanLog Open(String directory, int maxSegmentBytes)
+        {
+            byte[] key = new byte[ScanFieldCipher.KeyLength];
+            for (int i = 0; i < key.Length; i++)
+            {
+                key[i] = (byte)i;
+            }
+            return new ScanLog(directory, maxSegmentBytes, new ScanFieldCipher(key));
+        }
+
+        public static String NewDirectory()
+        {
+            return Path.Combine(Path.GetTempPath(), "AlikaPosBenchmark", "scanlog-" + Guid.NewGuid().ToString("N"));
+        }
+
+        public static void Delete(String directory)
+        {
+            try
+            {
+                Directory.Delete(directory, true);
+            }
+            catch (IOException)
+            {
+                // left for the next cleanup of the temp directory
+            }
+        }
+
+        private static void ExpectScan(StoredScan scan, int serial)
+        {
+            MMM.Readers.CodelineData expected = SimulatedSwipeReader.Passport(serial);
+            CheckRunner.Expect(scan != null, "scan of [{0}] missing", expected.DocNumber);
+            CheckRunner.Expect(scan.CodeLineData.DocNumber == expected.DocNumber && scan.CodeLineData.Line2 == expected.Line2
+                && scan.CodeLineData.Surname == expected.Surname && scan.CodeLineData.DateOfBirth.Year == expected.DateOfBirth.Year,
+                "scan read back as [{0}], expected [{1}]", scan.CodeLineData.DocNumber, expected.DocNumber);
+        }
+    }
+}
@@ -0,0 +1,142 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What ScanRecordCodec decodes from a record it encoded: every field a scan record keeps,
+    // the check digits of every type among them
+    public static class ScanRecordCodecChecks
+    {
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("scan_record_round_trip", () =>
+            {
+                ExpectRoundTrip(SimulatedSwipeReader.Passport(1), "passport");
+            });
+            checks.Run("scan_record_every_check_digit_type", () =>
+            {
+                var types = (MMM.Readers.CheckDigitType[])Enum.GetValues(typeof(MMM.Readers.CheckDigitType));
+                foreach (MMM.Readers.CheckDigitType type in types)
+                {
+                    ExpectRoundTrip(WithCheckDigits(new[] { type }), "check digit " + type);
+                }
+                // at most one of each type, as an MRZ has
+                ExpectRoundTrip(WithCheckDigits(types.Take(5).ToArray()), "all check digit types");
+            });
+            checks.Run("scan_record_flags_and_nul_padding", () =>
+            {
+                MMM.Readers.CodelineData data = SimulatedSwipeReader.Passport(2);
+                data.MrzOnRearSide = true;
+                data.ExpiredDocumentFlag = true;
+                data.ImageSource = 3;
+                data.CodelineValidationResult = MMM.Readers.CheckDigitResult.CDR_Warning;
+                // as the SDK's fixed length buffers come back
+                data.Surname = data.Surname + "\0\0\0";
+                ExpectRoundTrip(data, "flags and NUL padding");
+            });
+        }
+
+        private static void ExpectRoundTrip(MMM.Readers.CodelineData data, String scan)
+        {
+            String clientId;
+            String accessKey;
+            MMM.Readers.CodelineData decoded = ScanRecordCodec.DecodeEnvelope(ScanRecordCodec.EncodeEnvelope("client", "key", data), out clientId, out accessKey);
+            List<String> differences = Differences(data, decoded);
+            CheckRunner.Expect(differences.Count == 0, "[{0}] differs in [{1}]", scan, String.Join(", ", differences));
+            CheckRunner.Expect(clientId == "client" && accessKey == "key", "[{0}] decoded credentials [{1}] [{2}]", scan, clientId, accessKey);
+        }
+
+        // Every check digit with another result, line and position, so that a mixed up one shows
+        private static MMM.Readers.CodelineData WithCheckDigits(MMM.Readers.CheckDigitType[] types)
+        {
+            MMM.Readers.CodelineData data = SimulatedSwipeReader.Passport(3);
+            data.CheckDigitDataList = new MMM.Readers.CodelineCheckDigitData[5];
+            for (int i = 0; i < types.Length; i++)
+            {
+                var checkDigit = new MMM.Readers.CodelineCheckDigitData();
+                checkDigit.puCheckDigitType = types[i];
+                checkDigit.puResult = (MMM.Readers.CheckDigitResult)((int)types[i] % 4);
+                checkDigit.puCodelineNumber = 1 + (int)types[i] % 3;
+                checkDigit.puCodelinePos = 10 + 7 * (int)types[i];
+                checkDigit.puValueExpected = (char)('0' + (int)types[i]);
+                checkDigit.puValueRead = (char)('9' - (int)types[i]);
+                data.CheckDigitDataList[i] = checkDigit;
+            }
+            data.CheckDigitDataListCount = types.Length;
+            return data;
+        }
+
+        // Names of the fields kept by a scan record that differ; trailing NULs of the SDK's
+        // buffers are not kept
+        public static List<String> Differences(MMM.Readers.CodelineData expected, MMM.Readers.CodelineData actual)
+        {
+            var differences = new List<String>();
+            for (int i = 0; i < ScanRecordCodec.StringCount; i++)
+            {
+                if (Trim(ScanRecordCodec.StringAt(ref expected, i)) != Trim(ScanRecordCodec.StringAt(ref actual, i)))
+                {
+                    differences.Add("string " + i);
+                }
+            }
+            if (expected.LineCount != actual.LineCount)
+            {
+                differences.Add("LineCount");
+            }
+            if (!SameDate(expected.DateOfBirth, actual.DateOfBirth))
+            {
+                differences.Add("DateOfBirth");
+            }
+            if (!SameDate(expected.ExpiryDate, actual.ExpiryDate))
+            {
+                differences.Add("ExpiryDate");
+            }
+            if (expected.ShortSex != actual.ShortSex)
+            {
+                differences.Add("ShortSex");
+            }
+            if (expected.MrzOnRearSide != actual.MrzOnRearSide || expected.ExpiredDocumentFlag != actual.ExpiredDocumentFlag)
+            {
+                differences.Add("flags");
+            }
+            if (expected.CodelineValidationResult != actual.CodelineValidationResult)
+            {
+                differences.Add("CodelineValidationResult");
+            }
+            if (expected.ImageSource != actual.ImageSource)
+            {
+                differences.Add("ImageSource");
+            }
+            int count = expected.CheckDigitDataList == null ? 0 : expected.CheckDigitDataListCount;
+            if (count != actual.CheckDigitDataListCount)
+            {
+                differences.Add("CheckDigitDataListCount");
+                return differences;
+            }
+            foreach (MMM.Readers.CodelineCheckDigitData checkDigit in expected.CheckDigitDataList.Take(count))
+            {
+                // read back ordered by type
+                var read = actual.CheckDigitDataList.Take(count).FirstOrDefault(c => c.puCheckDigitType == checkDigit.puCheckDigitType);
+                if (read.puCheckDigitType != checkDigit.puCheckDigitType || read.puResult != checkDigit.puResult
+                    || read.puCodelineNumber != checkDigit.puCodelineNumber || read.puCodelinePos != checkDigit.puCodelinePos
+                    || read.puValueExpected != checkDigit.puValueExpected || read.puValueRead != checkDigit.puValueRead)
+                {
+                    differences.Add("check digit " + checkDigit.puCheckDigitType);
+                }
+            }
+            return differences;
+        }
+
+        private static String Trim(String value)
+        {
+            return value == null ? String.Empty : value.TrimEnd('\0');
+        }
+
+        private static bool SameDate(MMM.Readers.Date expected, MMM.Readers.Date actual)
+        {
+            return expected.Year == actual.Year && expected.Month == actual.Month && expected.Day == actual.Day;
+        }
+    }
+}
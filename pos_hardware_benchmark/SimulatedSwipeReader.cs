@@ -0,0 +1,153 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Stands in for MMMSwipeReader without a device: every Swipe delivers what the SDK delivers
+    // for a passport swipe through the same ScanSourceEventDispatcher, each time with another
+    // document number. The codelines are built up front so that a swipe only costs what the
+    // reader itself would.
+    public class SimulatedSwipeReader : IScanSource
+    {
+        private const int DOCUMENT_COUNT = 64;
+
+        private readonly ScanSourceEventDispatcher _dispatcher;
+        private readonly object[] _codelines = new object[DOCUMENT_COUNT];
+        private int _next = 0;
+
+        public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent
+        {
+            add { _dispatcher.OnCodeLineScanEvent += value; }
+            remove { _dispatcher.OnCodeLineScanEvent -= value; }
+        }
+
+        public event EventHandler<ScanSourceEvent> OnScanSourceEvent
+        {
+            add { _dispatcher.OnScanSourceEvent += value; }
+            remove { _dispatcher.OnScanSourceEvent -= value; }
+        }
+
+        public SimulatedSwipeReader()
+        {
+            _dispatcher = new ScanSourceEventDispatcher(this);
+            for (int i = 0; i < DOCUMENT_COUNT; i++)
+            {
+                // boxed once, as the SDK hands it over
+                _codelines[i] = Passport(i);
+            }
+        }
+
+        public void Activate()
+        {
+        }
+
+        public void Swipe()
+        {
+            _dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA);
+            _dispatcher.DataReceived(MMM.Readers.Modules.Swipe.SwipeItem.OCR_CODELINE, _codelines[_next]);
+            _dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.END_OF_SWIPE_DATA);
+            _next = (_next + 1) % DOCUMENT_COUNT;
+        }
+
+        // Single callbacks as the SDK makes them, for replaying recorded traffic
+        public void Data(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData)
+        {
+            _dispatcher.DataReceived(swipeItem, swipeData);
+        }
+
+        public void Event(MMM.Readers.FullPage.EventCode eventCode)
+        {
+            _dispatcher.EventReceived(eventCode);
+        }
+
+        public void Error(MMM.Readers.ErrorCode errorCode, String errorMessage)
+        {
+            _dispatcher.ErrorReceived(errorCode, errorMessage);
+        }
+
+        // ICAO 9303 specimen passport with the given serial in its document number
+        public static MMM.Readers.CodelineData Passport(int serial)
+        {
+            String docNumber = String.Format("L{0:D7}C", serial % 10000000);
+            String line1 = "P<UTOERIKSSON<<ANNA<MARIA<<<<<<<<<<<<<<<<<<<";
+            String line2 = docNumber + "3UTO7408122F1204159ZE184226B<<<<<10";
+            var data = new MMM.Readers.CodelineData();
+            data.Data = line1 + "\r" + line2;
+            data.LineCount = 2;
+            data.Line1 = line1;
+            data.Line2 = line2;
+            data.Line3 = String.Empty;
+            data.DocId = "P<";
+            data.DocType = "P";
+            data.Surname = "ERIKSSON";
+            data.Forename = "ANNA";
+            data.SecondName = "MARIA";
+            data.Forenames = "ANNA MARIA";
+            data.IssuingState = "UTO";
+            data.Nationality = "UTO";
+            data.DocNumber = docNumber;
+            data.Sex = "F";
+            data.ShortSex = (byte)'F';
+            data.OptionalData1 = "ZE184226B";
+            data.OptionalData2 = String.Empty;
+            var dateOfBirth = new MMM.Readers.Date();
+            dateOfBirth.Year = 1974;
+            dateOfBirth.Month = 8;
+            dateOfBirth.Day = 12;
+            data.DateOfBirth = dateOfBirth;
+            var expiryDate = new MMM.Readers.Date();
+            expiryDate.Year = 2012;
+            expiryDate.Month = 4;
+            expiryDate.Day = 15;
+            data.ExpiryDate = expiryDate;
+            data.CodelineValidationResult = MMM.Readers.CheckDigitResult.CDR_Valid;
+            data.CheckDigitDataList = new MMM.Readers.CodelineCheckDigitData[5];
+            data.CheckDigitDataListCount = 0;
+            return data;
+        }
+
+        // Specimen passport reshaped to a recorded codeline: its document type, issuing state,
+        // line lengths and validation result
+        public static MMM.Readers.CodelineData Document(SwipeTrafficEntry shape, int serial)
+        {
+            MMM.Readers.CodelineData data = Passport(serial);
+            String docType = shape.DocType ?? String.Empty;
+            String issuingState = shape.IssuingState ?? String.Empty;
+            String line1 = Fit((docType + "<<").Substring(0, 2) + (issuingState + "<<<").Substring(0, 3) + data.Line1.Substring(5), shape.LineLengths[0]);
+            String line2 = Fit(data.Line2, shape.LineLengths[1]);
+            String line3 = Fit("ERIKSSON<<ANNA<MARIA", shape.LineLengths[2]);
+            data.Data = String.Join("\r", new[] { line1, line2, line3 }.Where(l => !String.IsNullOrEmpty(l)).ToArray());
+            data.LineCount = shape.LineCount;
+            data.Line1 = line1;
+            data.Line2 = line2;
+            data.Line3 = line3;
+            data.DocType = docType;
+            data.IssuingState = issuingState;
+            data.Nationality = issuingState;
+            data.CodelineValidationResult = shape.ValidationResult;
+            return data;
+        }
+
+        // Cut or filled up to the length, null for a line that was null
+        private static String Fit(String line, int length)
+        {
+            if (length < 0)
+            {
+                return null;
+            }
+            return line.Length >= length ? line.Substring(0, length) : line.PadRight(length, '<');
+        }
+
+        public void Dispose()
+        {
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SimulatedSwipeReader Documents [{0}]", DOCUMENT_COUNT);
+        }
+    }
+}
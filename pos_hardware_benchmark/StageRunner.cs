@@ -0,0 +1,154 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Outcome of one stage, as written to the results file
+    public class StageResult
+    {
+        public String Stage { get; set; }
+        public int Operations { get; set; }
+        public double TotalMs { get; set; }
+        public double OperationsPerSecond { get; set; }
+        public double P50Us { get; set; }
+        public double P90Us { get; set; }
+        public double P99Us { get; set; }
+        public double MaxUs { get; set; }
+        // all threads of the process, so work a stage hands to the thread pool is included
+        public long AllocatedBytesPerOperation { get; set; }
+        // size of what an operation produces, such as a payload or a sealed record; 0 when the
+        // stage produces nothing to measure
+        public long OutputBytesPerOperation { get; set; }
+        // heap kept alive by what an operation returns, for stages run by RunRetained; 0 otherwise
+        public long RetainedBytesPerOperation { get; set; }
+
+        public override string ToString()
+        {
+            String line = String.Format("{0,-32} {1,10:F0} ops/s  p50 {2,9:F1} us  p90 {3,9:F1} us  p99 {4,9:F1} us  max {5,9:F1} us  {6,7} B/op",
+                Stage, OperationsPerSecond, P50Us, P90Us, P99Us, MaxUs, AllocatedBytesPerOperation);
+            if (OutputBytesPerOperation > 0)
+            {
+                line = String.Format("{0}  {1,7} B out", line, OutputBytesPerOperation);
+            }
+            return RetainedBytesPerOperation > 0 ? String.Format("{0}  {1,7} B held", line, RetainedBytesPerOperation) : line;
+        }
+    }
+
+    // Runs the operations of a stage one after the other, timing each of them. The warm up runs
+    // are not measured, they get the code jitted and the connections and pools filled.
+    public static class StageRunner
+    {
+        public static StageResult Run(String stage, int warmup, int count, Action<int> operation)
+        {
+            return Run(stage, warmup, count, operation, 0);
+        }
+
+        // outputBytes is the size of what one operation produces, see StageResult
+        public static StageResult Run(String stage, int warmup, int count, Action<int> operation, long outputBytes)
+        {
+            for (int i = 0; i < warmup; i++)
+            {
+                operation(i);
+            }
+            GC.Collect();
+            GC.WaitForPendingFinalizers();
+            GC.Collect();
+
+            TimeSpan total;
+            long allocated;
+            long[] ticks = Time(warmup, count, operation, out total, out allocated);
+            return Summarize(stage, ticks, total, allocated, outputBytes);
+        }
+
+        // Keeps what every timed operation returns until all of them ran, and reports the heap
+        // they keep alive per operation, as measured by full collections before and after
+        public static StageResult RunRetained(String stage, int warmup, int count, Func<int, object> operation)
+        {
+            for (int i = 0; i < warmup; i++)
+            {
+                operation(i);
+            }
+            var kept = new object[count];
+            long before = GC.GetTotalMemory(true);
+
+            TimeSpan total;
+            long allocated;
+            long[] ticks = Time(warmup, count, i => kept[i - warmup] = operation(i), out total, out allocated);
+            long after = GC.GetTotalMemory(true);
+            GC.KeepAlive(kept);
+
+            StageResult result = Result(stage, ticks, total, allocated, 0);
+            result.RetainedBytesPerOperation = Math.Max(0, after - before) / count;
+            Console.WriteLine(result);
+            return result;
+        }
+
+        // Result of operations timed elsewhere, ticks are Stopwatch ticks and get sorted
+        public static StageResult Summarize(String stage, long[] ticks, TimeSpan total, long allocated)
+        {
+            return Summarize(stage, ticks, total, allocated, 0);
+        }
+
+        public static StageResult Summarize(String stage, long[] ticks, TimeSpan total, long allocated, long outputBytes)
+        {
+            StageResult result = Result(stage, ticks, total, allocated, outputBytes);
+            Console.WriteLine(result);
+            return result;
+        }
+
+        private static long[] Time(int warmup, int count, Action<int> operation, out TimeSpan total, out long allocated)
+        {
+            var ticks = new long[count];
+            long allocatedBefore = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize;
+            var stopwatch = Stopwatch.StartNew();
+            for (int i = 0; i < count; i++)
+            {
+                long start = Stopwatch.GetTimestamp();
+                operation(warmup + i);
+                ticks[i] = Stopwatch.GetTimestamp() - start;
+            }
+            stopwatch.Stop();
+            total = stopwatch.Elapsed;
+            allocated = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize - allocatedBefore;
+            return ticks;
+        }
+
+        private static StageResult Result(String stage, long[] ticks, TimeSpan total, long allocated, long outputBytes)
+        {
+            if (ticks.Length == 0)
+            {
+                throw new PosHardwareException(String.Format("Stage [{0}] ran no operations", stage));
+            }
+            Array.Sort(ticks);
+            var result = new StageResult()
+            {
+                Stage = stage,
+                Operations = ticks.Length,
+                TotalMs = total.TotalMilliseconds,
+                OperationsPerSecond = ticks.Length / total.TotalSeconds,
+                P50Us = Percentile(ticks, 0.50),
+                P90Us = Percentile(ticks, 0.90),
+                P99Us = Percentile(ticks, 0.99),
+                MaxUs = Microseconds(ticks[ticks.Length - 1]),
+                AllocatedBytesPerOperation = allocated / ticks.Length,
+                OutputBytesPerOperation = outputBytes
+            };
+            return result;
+        }
+
+        private static double Percentile(long[] sorted, double percentile)
+        {
+            int index = (int)Math.Ceiling(percentile * sorted.Length) - 1;
+            return Microseconds(sorted[Math.Max(0, index)]);
+        }
+
+        private static double Microseconds(long ticks)
+        {
+            return ticks * 1000000.0 / Stopwatch.Frequency;
+        }
+    }
+}
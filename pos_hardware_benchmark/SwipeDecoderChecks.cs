@@ -0,0 +1,120 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // What SwipeDataDecoder makes of the items of every protocol, and of items it can not
+    // decode, from SyntheticSwipeFrames. The fuzzing is seeded, a failure repeats.
+    public static class SwipeDecoderChecks
+    {
+        private const int FUZZ_ITEMS = 20000;
+        private const int FUZZ_BLOCKS = 5000;
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("swipe_decoder_one_record_per_swipe", () =>
+            {
+                var frames = new SyntheticSwipeFrames(29);
+                var dispatcher = new ScanSourceEventDispatcher(frames);
+                var assembler = new SwipeRecordAssembler();
+                var records = new List<SwipeRecord>();
+                dispatcher.OnScanSourceEvent += assembler.HandleScanSourceEvent;
+                assembler.OnSwipeRecordEvent += delegate(Object sender, SwipeRecordEvent e) { records.Add(e.Record); };
+                for (int i = 0; i < SyntheticSwipeFrames.Protocols.Length; i++)
+                {
+                    frames.Play(dispatcher, i);
+                }
+                CheckRunner.Expect(records.Count == SyntheticSwipeFrames.Protocols.Length, "[{0}] records", records.Count);
+                for (int i = 0; i < records.Count; i++)
+                {
+                    SwipeRecord record = records[i];
+                    CheckRunner.Expect(record.Protocol == SyntheticSwipeFrames.Protocols[i], "record [{0}] has protocol [{1}]", i, record.Protocol);
+                    CheckRunner.Expect(record.Has(SyntheticSwipeFrames.ControlItemOf(record.Protocol)), "record [{0}] without its control item", i);
+                    CheckRunner.Expect(record.Has(Swipe.SwipeItem.OCR_CODELINE) && record.Codeline.DocNumber == "L0000001C",
+                        "record [{0}] has codeline [{1}]", i, record.Codeline);
+                    CheckRunner.Expect(record.Has(Swipe.SwipeItem.MSR_DATA) && record.Track2 == ";6011000990139424=2412101?",
+                        "record [{0}] has track 2 [{1}]", i, record.Track2);
+                }
+                CheckRunner.Expect(assembler.UndecodedItems == 0, "[{0}] items not decoded", assembler.UndecodedItems);
+            });
+            checks.Run("swipe_decoder_fuzz_items", () =>
+            {
+                var frames = new SyntheticSwipeFrames(29);
+                for (int i = 0; i < FUZZ_ITEMS; i++)
+                {
+                    Swipe.SwipeItem item = frames.RandomSwipeItem();
+                    object data = frames.RandomItem();
+                    var record = new SwipeRecord();
+                    bool decoded = SwipeDataDecoder.Decode(item, data, ref record);
+                    bool expected = Decodable(item, data);
+                    CheckRunner.Expect(decoded == expected, "item [{0}] with [{1}] decoded [{2}], expected [{3}]",
+                        item, data == null ? "null" : data.GetType().Name, decoded, expected);
+                    CheckRunner.Expect(decoded == !record.IsEmpty, "item [{0}] decoded [{1}] into [{2}]", item, decoded, record);
+                }
+            });
+            checks.Run("swipe_decoder_fuzz_rte_blocks", () =>
+            {
+                var frames = new SyntheticSwipeFrames(29);
+                var parser = new RteFrameParser(true);
+                int messages = 0;
+                for (int i = 0; i < FUZZ_BLOCKS; i++)
+                {
+                    byte[] block = frames.RandomRteBlock();
+                    // in pieces, as a serial port reads them
+                    int offset = 0;
+                    while (offset < block.Length)
+                    {
+                        int count = Math.Min(block.Length - offset, 1 + frames.Next(16));
+                        parser.Append(block, offset, count);
+                        offset += count;
+                        RteFrame frame;
+                        while (parser.TryParse(out frame))
+                        {
+                            if (frame.IsMessage)
+                            {
+                                messages++;
+                                MrzCodelineParser.Parse(frame.TextAsString());
+                            }
+                        }
+                    }
+                }
+                CheckRunner.Expect(messages > 0, "no message parsed out of [{0}] blocks", FUZZ_BLOCKS);
+            });
+        }
+
+        // Whether the data is of the type the SDK delivers for the item
+        private static bool Decodable(Swipe.SwipeItem item, object data)
+        {
+            if (data == null)
+            {
+                return false;
+            }
+            switch (item)
+            {
+                case Swipe.SwipeItem.WHOLE_DATA: return data is byte[];
+                case Swipe.SwipeItem.MESSAGE_CONTENT: return data is String;
+                case Swipe.SwipeItem.OCR_CODELINE: return data is MMM.Readers.CodelineData || data is CompactCodeline;
+                case Swipe.SwipeItem.MSR_DATA: return data is Swipe.MsrData;
+                case Swipe.SwipeItem.SWIPE_BARCODE_PDF417: return data is Swipe.SwipeBarcodePDF417Data;
+                case Swipe.SwipeItem.SWIPE_BARCODE_1D_128: return data is Swipe.SwipeBarcodeCode128Data;
+                case Swipe.SwipeItem.SWIPE_BARCODE_1D_3_OF_9: return data is Swipe.SwipeBarcodeCode39Data;
+                case Swipe.SwipeItem.ATB_DATA: return data is Swipe.AtbData;
+                case Swipe.SwipeItem.RTE_DATA: return data is Swipe.RTESwipeData;
+                case Swipe.SwipeItem.MUSE_DATA: return data is Swipe.MuseSwipeData;
+                case Swipe.SwipeItem.CUTE_DATA: return data is Swipe.CuteSwipeData;
+                case Swipe.SwipeItem.MAGMSR_DATA: return data is Swipe.MagtekMsrSwipeData;
+                case Swipe.SwipeItem.TECS_DATA: return data is Swipe.TecsSwipeData;
+                // only marked present
+                case Swipe.SwipeItem.RTE_QA_DATA:
+                case Swipe.SwipeItem.SWIPE_AAMVA_DATA:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+    }
+}
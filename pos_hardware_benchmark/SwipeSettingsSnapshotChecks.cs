@@ -0,0 +1,134 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // When SwipeSettingsSnapshot is used instead of the INI files, against a config directory and
+    // a root MMMReader.ini of its own. Every check has a directory of its own, deleted afterwards.
+    public static class SwipeSettingsSnapshotChecks
+    {
+        private const String ROOT_INI_FILE = "MMMReader.ini";
+
+        public static void Run(CheckRunner checks)
+        {
+            checks.Run("swipe_settings_snapshot_round_trip", () =>
+            {
+                Check((snapshot, configDir, rootDir) =>
+                {
+                    Swipe.SwipeSettings loaded;
+                    CheckRunner.Expect(SwipeSettingsSnapshot.TryLoad(snapshot, configDir, rootDir, out loaded), "snapshot not loaded");
+                    Swipe.SwipeSettings expected = Settings();
+                    CheckRunner.Expect(loaded.Hardware.DeviceType == expected.Hardware.DeviceType
+                        && loaded.Connection.PortNumber == expected.Connection.PortNumber
+                        && loaded.Connection.BaudRate == expected.Connection.BaudRate
+                        && new String(loaded.Protocol.ProtocolName) == new String(expected.Protocol.ProtocolName)
+                        && loaded.Protocol.RTE.UseBCC == expected.Protocol.RTE.UseBCC,
+                        "snapshot loaded other settings");
+                });
+            });
+            checks.Run("swipe_settings_snapshot_touched_ini_kept", () =>
+            {
+                Check((snapshot, configDir, rootDir) =>
+                {
+                    // copied over unchanged, e.g. by an installer
+                    Touch(Path.Combine(configDir, "Swipe.ini"));
+                    Touch(Path.Combine(rootDir, ROOT_INI_FILE));
+                    Swipe.SwipeSettings loaded;
+                    CheckRunner.Expect(SwipeSettingsSnapshot.TryLoad(snapshot, configDir, rootDir, out loaded), "snapshot dropped for an unchanged INI file");
+                });
+            });
+            checks.Run("swipe_settings_snapshot_changed_ini_invalidates", () =>
+            {
+                Check((snapshot, configDir, rootDir) =>
+                {
+                    // same length, so only the content hash tells
+                    Change(Path.Combine(configDir, "Swipe.ini"), "BaudRate=9600", "BaudRate=4800");
+                    Swipe.SwipeSettings loaded;
+                    CheckRunner.Expect(!SwipeSettingsSnapshot.TryLoad(snapshot, configDir, rootDir, out loaded), "snapshot used after Swipe.ini changed");
+                });
+            });
+            checks.Run("swipe_settings_snapshot_changed_root_ini_invalidates", () =>
+            {
+                Check((snapshot, configDir, rootDir) =>
+                {
+                    Change(Path.Combine(rootDir, ROOT_INI_FILE), "Config", "Cfg_2_");
+                    Swipe.SwipeSettings loaded;
+                    CheckRunner.Expect(!SwipeSettingsSnapshot.TryLoad(snapshot, configDir, rootDir, out loaded), "snapshot used after the root MMMReader.ini changed");
+                });
+            });
+            checks.Run("swipe_settings_snapshot_added_ini_invalidates", () =>
+            {
+                Check((snapshot, configDir, rootDir) =>
+                {
+                    File.WriteAllText(Path.Combine(configDir, "Extra.ini"), "[Extra]\r\n");
+                    Swipe.SwipeSettings loaded;
+                    CheckRunner.Expect(!SwipeSettingsSnapshot.TryLoad(snapshot, configDir, rootDir, out loaded), "snapshot used after an INI file was added");
+                });
+            });
+        }
+
+        // A snapshot saved for a config directory with two INI files and a root MMMReader.ini
+        private static void Check(Action<String, String, String> check)
+        {
+            String directory = Path.Combine(Path.GetTempPath(), "AlikaPosBenchmark", "swipesettings-" + Guid.NewGuid().ToString("N"));
+            try
+            {
+                String snapshot;
+                String configDir;
+                String rootDir;
+                Prepare(directory, out snapshot, out configDir, out rootDir);
+                check(snapshot, configDir, rootDir);
+            }
+            finally
+            {
+                ScanLogChecks.Delete(directory);
+            }
+        }
+
+        private static void Prepare(String directory, out String snapshot, out String configDir, out String rootDir)
+        {
+            rootDir = Path.Combine(directory, "bin");
+            configDir = Path.Combine(directory, "Config");
+            snapshot = Path.Combine(directory, "SwipeSettings.snapshot");
+            Directory.CreateDirectory(rootDir);
+            Directory.CreateDirectory(configDir);
+            File.WriteAllText(Path.Combine(rootDir, ROOT_INI_FILE), "[Settings]\r\nConfigDir=Config\r\n");
+            File.WriteAllText(Path.Combine(configDir, "Swipe.ini"), "[Connection]\r\nPortNumber=3\r\nBaudRate=9600\r\n[Protocol]\r\nName=RTE\r\nUseBCC=1\r\n");
+            File.WriteAllText(Path.Combine(configDir, "Reader.ini"), "[Hardware]\r\nDeviceType=1\r\n");
+            SwipeSettingsSnapshot.Save(snapshot, configDir, rootDir, Settings());
+        }
+
+        private static Swipe.SwipeSettings Settings()
+        {
+            var settings = new Swipe.SwipeSettings();
+            settings.Hardware.DeviceType = Swipe.DeviceType.RTE670X_FAMILY;
+            settings.Hardware.ConnectionType = Swipe.ConnectionType.SERIAL;
+            settings.Connection.PortNumber = 3;
+            settings.Connection.BaudRate = 9600;
+            settings.Connection.ByteSize = 8;
+            settings.Connection.Parity = Swipe.ParityType.NONE;
+            settings.Connection.StopBits = Swipe.StopBitType.ONE;
+            // the SDK's fixed size buffer
+            settings.Protocol.ProtocolName = "RTE".PadRight(32, '\0').ToCharArray();
+            settings.Protocol.CommandTimeout = 2000;
+            settings.Protocol.RTE.UseBCC = 1;
+            return settings;
+        }
+
+        private static void Touch(String path)
+        {
+            File.SetLastWriteTimeUtc(path, File.GetLastWriteTimeUtc(path).AddMinutes(1));
+        }
+
+        private static void Change(String path, String from, String to)
+        {
+            File.WriteAllText(path, File.ReadAllText(path).Replace(from, to));
+            Touch(path);
+        }
+    }
+}
@@ -0,0 +1,209 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Swipe items as the SDK delivers them for readers speaking RTE, MUSE, CUTE, MagTek MSR and
+    // TECS, for the swipe decoder's checks and its stage. Swipe plays one swipe of a protocol
+    // through a ScanSourceEventDispatcher with its items boxed up front, as the SDK hands them
+    // over. RandomItem makes items of any type, matching their swipe item or not, for fuzzing.
+    public class SyntheticSwipeFrames
+    {
+        public static readonly SwipeProtocol[] Protocols = new SwipeProtocol[]
+        {
+            SwipeProtocol.RTE, SwipeProtocol.MUSE, SwipeProtocol.CUTE, SwipeProtocol.MAGTEK_MSR, SwipeProtocol.TECS
+        };
+
+        private readonly Random _random;
+        private readonly object[] _controlItems;
+        private readonly object _msr;
+        private readonly MMM.Readers.CodelineData _codeline;
+
+        public SyntheticSwipeFrames(int seed)
+        {
+            _random = new Random(seed);
+            _controlItems = Protocols.Select(p => ControlItem(p)).ToArray();
+            var msr = new Swipe.MsrData();
+            msr.Track1 = "%B6011000990139424^ERIKSSON/ANNA^2412101?";
+            msr.Track2 = ";6011000990139424=2412101?";
+            msr.Track3 = String.Empty;
+            _msr = msr;
+            _codeline = SimulatedSwipeReader.Passport(1);
+        }
+
+        // The swipe item carrying the protocol's control values
+        public static Swipe.SwipeItem ControlItemOf(SwipeProtocol protocol)
+        {
+            switch (protocol)
+            {
+                case SwipeProtocol.RTE: return Swipe.SwipeItem.RTE_DATA;
+                case SwipeProtocol.MUSE: return Swipe.SwipeItem.MUSE_DATA;
+                case SwipeProtocol.CUTE: return Swipe.SwipeItem.CUTE_DATA;
+                case SwipeProtocol.MAGTEK_MSR: return Swipe.SwipeItem.MAGMSR_DATA;
+                default: return Swipe.SwipeItem.TECS_DATA;
+            }
+        }
+
+        // Start, control values, codeline, MSR tracks, end
+        public void Play(ScanSourceEventDispatcher dispatcher, int protocolIndex)
+        {
+            int index = protocolIndex % Protocols.Length;
+            dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA);
+            dispatcher.DataReceived(ControlItemOf(Protocols[index]), _controlItems[index]);
+            dispatcher.CodelineReceived(_codeline);
+            dispatcher.DataReceived(Swipe.SwipeItem.MSR_DATA, _msr);
+            dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.END_OF_SWIPE_DATA);
+        }
+
+        private object ControlItem(SwipeProtocol protocol)
+        {
+            switch (protocol)
+            {
+                case SwipeProtocol.RTE:
+                    var rte = new Swipe.RTESwipeData();
+                    rte.DeviceType = Swipe.RTEProtocolDevice.OCR;
+                    rte.MessageType = Swipe.RTEProtocolMessageType.UNSOLICITED_DATA;
+                    rte.BCC = (byte)_random.Next(256);
+                    rte.OCRFlagByte = (byte)_random.Next(256);
+                    return rte;
+                case SwipeProtocol.MUSE:
+                    var muse = new Swipe.MuseSwipeData();
+                    muse.DeviceType = Swipe.MuseProtocolDevice.OCR;
+                    muse.CrcHigh = (byte)_random.Next(256);
+                    muse.CrcLow = (byte)_random.Next(256);
+                    return muse;
+                case SwipeProtocol.CUTE:
+                    var cute = new Swipe.CuteSwipeData();
+                    cute.DeviceType = Swipe.CuteProtocolDevice.OCR;
+                    return cute;
+                case SwipeProtocol.MAGTEK_MSR:
+                    var magtek = new Swipe.MagtekMsrSwipeData();
+                    magtek.CardEncodeType = Swipe.MagtekMsrProtocolCardType.ISO_ABA;
+                    return magtek;
+                default:
+                    var tecs = new Swipe.TecsSwipeData();
+                    tecs.DeviceType = Swipe.TecsProtocolDevice.OCR;
+                    return tecs;
+            }
+        }
+
+        // Data of a random type with random content, null included
+        public object RandomItem()
+        {
+            switch (_random.Next(17))
+            {
+                case 0: return null;
+                case 1: return RandomBytes();
+                case 2: return RandomText();
+                case 3: return MrzCodelineParser.Parse(RandomText());
+                case 4: return CompactCodeline.From(MrzCodelineParser.Parse(RandomText()));
+                case 5:
+                    var msr = new Swipe.MsrData();
+                    msr.Track1 = RandomText();
+                    msr.Track2 = _random.Next(2) == 0 ? null : RandomText();
+                    return msr;
+                case 6:
+                    var pdf417 = new Swipe.SwipeBarcodePDF417Data();
+                    pdf417.DataField = RandomText();
+                    return pdf417;
+                case 7:
+                    var code128 = new Swipe.SwipeBarcodeCode128Data();
+                    code128.DataField = RandomText();
+                    return code128;
+                case 8:
+                    var code39 = new Swipe.SwipeBarcodeCode39Data();
+                    code39.DataField = RandomText();
+                    return code39;
+                case 9:
+                    var atb = new Swipe.AtbData();
+                    atb.Track1.Block1 = RandomText();
+                    atb.Track3.Block2 = RandomText();
+                    return atb;
+                case 10:
+                    var rte = new Swipe.RTESwipeData();
+                    rte.DeviceType = (Swipe.RTEProtocolDevice)_random.Next(65536);
+                    rte.MessageType = (Swipe.RTEProtocolMessageType)_random.Next(256);
+                    rte.BCC = (byte)_random.Next(256);
+                    rte.OCRFlagByte = (byte)_random.Next(256);
+                    return rte;
+                case 11:
+                    var muse = new Swipe.MuseSwipeData();
+                    muse.DeviceType = (Swipe.MuseProtocolDevice)_random.Next(65536);
+                    muse.CrcHigh = (byte)_random.Next(256);
+                    return muse;
+                case 12:
+                    var cute = new Swipe.CuteSwipeData();
+                    cute.DeviceType = (Swipe.CuteProtocolDevice)_random.Next(65536);
+                    return cute;
+                case 13:
+                    var magtek = new Swipe.MagtekMsrSwipeData();
+                    magtek.CardEncodeType = (Swipe.MagtekMsrProtocolCardType)_random.Next(256);
+                    return magtek;
+                case 14:
+                    var tecs = new Swipe.TecsSwipeData();
+                    tecs.DeviceType = (Swipe.TecsProtocolDevice)_random.Next(65536);
+                    return tecs;
+                case 15:
+                    return _random.Next();
+                default:
+                    return new Swipe.RTEQAData();
+            }
+        }
+
+        // Any swipe item, including ones the SDK does not define
+        public Swipe.SwipeItem RandomSwipeItem()
+        {
+            return (Swipe.SwipeItem)_random.Next(-1, (int)Swipe.SwipeItem.NUM_SWIPE_ITEMS + 2);
+        }
+
+        // An RTE message block of random text, cut, garbled or whole
+        public byte[] RandomRteBlock()
+        {
+            byte[] block = RteFrameParser.Encode((byte)'O', (byte)'U', Encoding.ASCII.GetBytes(RandomText()), true);
+            switch (_random.Next(3))
+            {
+                case 0:
+                    return block.Take(_random.Next(block.Length)).ToArray();
+                case 1:
+                    block[_random.Next(block.Length)] = (byte)_random.Next(256);
+                    return block;
+                default:
+                    return block;
+            }
+        }
+
+        public int Next(int maxValue)
+        {
+            return _random.Next(maxValue);
+        }
+
+        private byte[] RandomBytes()
+        {
+            byte[] bytes = new byte[_random.Next(64)];
+            _random.NextBytes(bytes);
+            return bytes;
+        }
+
+        // Random MRZ characters and line breaks, now and then in the shape of a passport
+        private String RandomText()
+        {
+            const String alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789<<<<\r";
+            int length = _random.Next(4) == 0 ? 89 : _random.Next(120);
+            var text = new StringBuilder(length);
+            for (int i = 0; i < length; i++)
+            {
+                text.Append(length == 89 && i == 44 ? '\r' : alphabet[_random.Next(alphabet.Length)]);
+            }
+            return text.ToString();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SyntheticSwipeFrames Protocols [{0}]", Protocols.Length);
+        }
+    }
+}
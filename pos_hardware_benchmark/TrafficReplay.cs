@@ -0,0 +1,126 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+using CH.Alika.POS.Service;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Replays a swipe stream recorded by the service (-recordtraffic) through the whole pipeline:
+    // the reader callbacks, HardwareService, the subscribers and ScanStoreCloud delivering to the
+    // local scan store. Callbacks are made at the recorded pace divided by the speed, and the
+    // latency of a scan is taken from its reader callback until the scan store acknowledged it.
+    // Idle gaps longer than MaxIdleGap, e.g. over night, are shortened to it. Codelines are
+    // synthesized from the recorded shapes before the replay starts.
+    public class TrafficReplay
+    {
+        public static readonly TimeSpan MaxIdleGap = TimeSpan.FromSeconds(5);
+        public static readonly TimeSpan DrainTimeout = TimeSpan.FromMinutes(2);
+        private const String ERROR_MESSAGE = "Replayed reader error";
+
+        private readonly SwipeTrafficRecording _recording;
+        // boxed codeline for every codeline entry, null for the others
+        private readonly object[] _codelines;
+        private readonly int _scans;
+
+        public TrafficReplay(SwipeTrafficRecording recording)
+        {
+            _recording = recording;
+            _codelines = new object[recording.Entries.Count];
+            for (int i = 0; i < _codelines.Length; i++)
+            {
+                SwipeTrafficEntry entry = recording.Entries[i];
+                if (entry.IsCodeline)
+                {
+                    _codelines[i] = SimulatedSwipeReader.Document(entry, _scans++);
+                }
+            }
+            if (_scans == 0)
+            {
+                throw new PosHardwareException("Swipe traffic recording holds no scans");
+            }
+        }
+
+        public int Scans
+        {
+            get { return _scans; }
+        }
+
+        public StageResult Run(String stage, double speed, String configFileName, int subscriberCount)
+        {
+            using (var reader = new SimulatedSwipeReader())
+            using (var store = new LatencyScanStore(new ScanStoreCloud(configFileName), _scans))
+            using (var subscribers = new SubscriberGroup())
+            {
+                for (int i = 0; i < subscriberCount; i++)
+                {
+                    subscribers.Add(new SubscriberAsync(new CountingSubscriber()));
+                }
+                var service = new HardwareService(store, subscribers);
+                reader.OnCodeLineScanEvent += service.HandleCodeLineScan;
+                long maxGap = (long)(MaxIdleGap.TotalSeconds * Stopwatch.Frequency);
+                double ticksPerMicrosecond = Stopwatch.Frequency / 1000000.0 / speed;
+
+                GC.Collect();
+                GC.WaitForPendingFinalizers();
+                GC.Collect();
+                long allocatedBefore = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize;
+                var clock = Stopwatch.StartNew();
+                long due = 0;
+                for (int i = 0; i < _codelines.Length; i++)
+                {
+                    SwipeTrafficEntry entry = _recording.Entries[i];
+                    due += Math.Min(maxGap, (long)(entry.DelayMicroseconds * ticksPerMicrosecond));
+                    WaitUntil(clock, due);
+                    switch (entry.EntryType)
+                    {
+                        case SwipeTrafficEntryType.DATA:
+                            if (_codelines[i] != null)
+                            {
+                                store.MarkStarted();
+                            }
+                            reader.Data(entry.SwipeItem, _codelines[i]);
+                            break;
+                        case SwipeTrafficEntryType.DEVICE_EVENT:
+                            reader.Event(entry.EventCode);
+                            break;
+                        default:
+                            reader.Error(entry.ErrorCode, ERROR_MESSAGE);
+                            break;
+                    }
+                }
+                long[] ticks = store.Wait(DrainTimeout);
+                clock.Stop();
+                long allocated = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize - allocatedBefore;
+                return StageRunner.Summarize(stage, ticks, clock.Elapsed, allocated);
+            }
+        }
+
+        // Sleeps through most of a long wait and spins the rest, a sleep may take a whole
+        // scheduler tick longer than asked for
+        private static void WaitUntil(Stopwatch clock, long due)
+        {
+            long remaining;
+            while ((remaining = due - clock.ElapsedTicks) > 0)
+            {
+                long remainingMs = remaining * 1000 / Stopwatch.Frequency;
+                if (remainingMs > 20)
+                {
+                    Thread.Sleep((int)Math.Min(remainingMs - 20, 1000));
+                }
+                else
+                {
+                    Thread.SpinWait(100);
+                }
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("TrafficReplay RecordedAt [{0:u}] Entries [{1}] Scans [{2}]", _recording.RecordedAtUtc, _recording.Entries.Count, _scans);
+        }
+    }
+}
@@ -0,0 +1,212 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Remote;
+using CH.Alika.POS.TrayApp;
+
+namespace CH.Alika.POS.Benchmark
+{
+    // Outcome of a tray notification stress run, as written to the results file
+    public class TrayStressResult
+    {
+        public String Name { get; set; }
+        public int Notifications { get; set; }
+        // callbacks run on the UI thread
+        public long UiUpdates { get; set; }
+        public long BalloonTips { get; set; }
+        public int MaxUiQueueDepth { get; set; }
+        // longest time from the last notification of a burst until the UI thread was idle
+        public double MaxDrainMs { get; set; }
+
+        public override string ToString()
+        {
+            return String.Format("{0,-32} {1,7} notifications  {2,7} UI updates  {3,7} balloon tips  max UI queue {4,5}  drained in {5,9:F1} ms",
+                Name, Notifications, UiUpdates, BalloonTips, MaxUiQueueDepth, MaxDrainMs);
+        }
+    }
+
+    // Bursts of scan and delivery notifications from several threads at once, as the service's
+    // callbacks deliver them to a tray app, against a stand-in for the UI thread whose updates
+    // take as long as showing a balloon tip and playing a sound. Measures how deep the UI
+    // thread's queue gets, once posting every notification as the tray app did and once through
+    // its NotificationCoalescer.
+    public static class TrayNotificationStress
+    {
+        public const int Threads = 4;
+        public static readonly TimeSpan UiUpdateTime = TimeSpan.FromMilliseconds(2);
+        // stands in for the tray app's BalloonDisplayTime, which would make the run take minutes
+        public static readonly TimeSpan Interval = TimeSpan.FromMilliseconds(100);
+
+        public static TrayStressResult Run(String name, bool coalesce, int bursts, int burstSize)
+        {
+            long balloonTips = 0;
+            Action<TrayNotification> show = n =>
+            {
+                balloonTips++;
+                Thread.Sleep(UiUpdateTime);
+            };
+            using (var ui = new UiThreadContext())
+            using (var coalescer = new NotificationCoalescer(ui, Interval, show))
+            {
+                Action<TrayNotification> offer;
+                if (coalesce)
+                {
+                    offer = coalescer.Offer;
+                }
+                else
+                {
+                    offer = n => ui.Post(state => show((TrayNotification)state), n);
+                }
+                double maxDrainMs = 0;
+                for (int burst = 0; burst < bursts; burst++)
+                {
+                    using (var start = new ManualResetEvent(false))
+                    {
+                        var threads = Enumerable.Range(0, Threads).Select(t => new Thread(() =>
+                        {
+                            start.WaitOne();
+                            for (int i = 0; i < burstSize / Threads; i++)
+                            {
+                                offer(i % 2 == 0 ? TrayNotification.ForScan(new ScanEvent()) : TrayNotification.ForDelivery(Delivered()));
+                            }
+                        })).ToList();
+                        threads.ForEach(t => t.Start());
+                        start.Set();
+                        threads.ForEach(t => t.Join());
+                    }
+                    long offered = Stopwatch.GetTimestamp();
+                    ui.WaitIdle(coalesce ? Interval : TimeSpan.Zero);
+                    maxDrainMs = Math.Max(maxDrainMs, (ui.LastIdle - offered) * 1000.0 / Stopwatch.Frequency);
+                }
+                var result = new TrayStressResult()
+                {
+                    Name = name,
+                    Notifications = bursts * (burstSize / Threads) * Threads,
+                    UiUpdates = ui.Updates,
+                    BalloonTips = balloonTips,
+                    MaxUiQueueDepth = ui.MaxDepth,
+                    MaxDrainMs = maxDrainMs
+                };
+                Console.WriteLine(result);
+                return result;
+            }
+        }
+
+        private static ScanDeliveryEvent Delivered()
+        {
+            return new ScanDeliveryEvent()
+            {
+                ScanDeliveryResult = new ScanDeliveryResult()
+                {
+                    WasDelivered = true,
+                    DeliveryResponse = "{\"Title\":\"Welcome\",\"Text\":\"Guest checked in\",\"Severity\":\"info\"}",
+                    NotificationTitle = "Welcome",
+                    NotificationText = "Guest checked in",
+                    NotificationSeverity = "info"
+                }
+            };
+        }
+
+        // Runs what is posted to it one after the other on a thread of its own, as the message
+        // loop of a tray app does, and counts what waits
+        private class UiThreadContext : SynchronizationContext, IDisposable
+        {
+            private readonly Queue<KeyValuePair<SendOrPostCallback, object>> _queue = new Queue<KeyValuePair<SendOrPostCallback, object>>();
+            private readonly Thread _thread;
+            private bool _running;
+            private bool _disposed;
+
+            public int MaxDepth { get; private set; }
+            public long Updates { get; private set; }
+            // Stopwatch timestamp at which the last callback finished
+            public long LastIdle { get; private set; }
+
+            public UiThreadContext()
+            {
+                _thread = new Thread(Run);
+                _thread.Name = "UiThreadContext";
+                _thread.IsBackground = true;
+                _thread.Start();
+            }
+
+            public override void Post(SendOrPostCallback d, object state)
+            {
+                lock (_queue)
+                {
+                    _queue.Enqueue(new KeyValuePair<SendOrPostCallback, object>(d, state));
+                    MaxDepth = Math.Max(MaxDepth, _queue.Count);
+                    Monitor.PulseAll(_queue);
+                }
+            }
+
+            // Until nothing is queued or running, and nothing was posted for quiet
+            public void WaitIdle(TimeSpan quiet)
+            {
+                while (true)
+                {
+                    lock (_queue)
+                    {
+                        while (_queue.Count > 0 || _running)
+                        {
+                            Monitor.Wait(_queue);
+                        }
+                    }
+                    if (quiet == TimeSpan.Zero)
+                    {
+                        return;
+                    }
+                    // the coalescer may still post the last notification of the burst
+                    Thread.Sleep(quiet + quiet);
+                    lock (_queue)
+                    {
+                        if (_queue.Count == 0 && !_running)
+                        {
+                            return;
+                        }
+                    }
+                }
+            }
+
+            private void Run()
+            {
+                while (true)
+                {
+                    KeyValuePair<SendOrPostCallback, object> item;
+                    lock (_queue)
+                    {
+                        while (_queue.Count == 0)
+                        {
+                            if (_disposed)
+                            {
+                                return;
+                            }
+                            Monitor.Wait(_queue);
+                        }
+                        item = _queue.Dequeue();
+                        _running = true;
+                    }
+                    item.Key(item.Value);
+                    lock (_queue)
+                    {
+                        _running = false;
+                        Updates++;
+                        LastIdle = Stopwatch.GetTimestamp();
+                        Monitor.PulseAll(_queue);
+                    }
+                }
+            }
+
+            public void Dispose()
+            {
+                lock (_queue)
+                {
+                    _disposed = true;
+                    Monitor.PulseAll(_queue);
+                }
+            }
+        }
+    }
+}
@@ -1,6 +1,7 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Net;
 using System.Text;
 using CH.Alika.POS.Hardware;
 using CH.Alika.POS.Remote;
@@ -17,9 +18,19 @@ namespace CH.Alika.POS.ConsoleApp
     class Program
     {
         private static readonly log4net.ILog log = log4net.LogManager.GetLogger(typeof(Program));
+        // served by the running Windows service, see MetricsHttpEndpoint in pos_hardware_service
+        private const String TRACE_URL = "http://localhost:9464/trace/?scans={0}";
 
         static void Main(string[] args)
         {
+            if (args.Length > 0 && args[0] == "-trace")
+            {
+                // -trace [scans] [file]: save the stages of the last scans of the service as a
+                // Chrome trace, for chrome://tracing or https://ui.perfetto.dev
+                int scans;
+                Environment.Exit(SaveScanTrace(args.Length > 1 && Int32.TryParse(args[1], out scans) ? scans : 20,
+                    args.Length > 2 ? args[2] : "AlikaPosTrace.json"));
+            }
             using (LogProvider.OpenNestedContext("AlikaPosConsole_MAIN"))
             {
                 log.Info("Starting AlikaPosConsole Application");
@@ -47,6 +58,25 @@ namespace CH.Alika.POS.ConsoleApp
             }
         }
 
+        static int SaveScanTrace(int scans, String fileName)
+        {
+            try
+            {
+                using (var client = new WebClient())
+                {
+                    client.DownloadFile(String.Format(TRACE_URL, scans), fileName);
+                }
+                Console.WriteLine("Saved the trace of the last [{0}] scans to [{1}]", scans, fileName);
+                return 0;
+            }
+            catch (WebException e)
+            {
+                log.ErrorFormat("Failure to get scan trace from service [{0}]", e.Message);
+                Console.WriteLine("Unable to get the scan trace, is the service running? [{0}]", e.Message);
+                return 1;
+            }
+        }
+
         static IScanner CreateScanner(bool useRemotelyLocatedScanner)
         {
             if (useRemotelyLocatedScanner)
@@ -13,16 +13,20 @@ namespace CH.Alika.POS.ConsoleApp
         private static String _configFileName = AppDomain.CurrentDomain.BaseDirectory + "AlikaPosConfig.txt";
         private MMMSwipeReader scanner;
         private IScanStore documentSink;
+        private SwipeRecordAssembler swipeRecords;
 
         public void Activate()
         {
             log.Info("Activating connection to local 3M Scanner and remote web service for delivery");
             scanner = new MMMSwipeReader();
             documentSink = new ScanStoreCloud(_configFileName);
+            swipeRecords = new SwipeRecordAssembler();
             try
             {
                 documentSink.OnScanStoreEvent += HandleScanSinkEvent;
                 scanner.OnScanSourceEvent += HandleScanSourceEvent;
+                scanner.OnScanSourceEvent += swipeRecords.HandleScanSourceEvent;
+                swipeRecords.OnSwipeRecordEvent += HandleSwipeRecordEvent;
                 scanner.OnCodeLineScanEvent += HandleCodeLineScanEvent;
                 scanner.Activate();
             }
@@ -63,6 +67,12 @@ namespace CH.Alika.POS.ConsoleApp
                 Console.WriteLine(e);
         }
 
+        static void HandleSwipeRecordEvent(object sender, SwipeRecordEvent e)
+        {
+            if (log.IsDebugEnabled())
+                Console.WriteLine(e);
+        }
+
         static void HandleScanSinkEvent(object sender, ScanStoreEvent e)
         {
             Console.WriteLine(e);
@@ -0,0 +1,158 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum CircuitState
+    {
+        CLOSED,
+        OPEN,
+        HALF_OPEN
+    }
+
+    // Stops delivering to a scan store that keeps failing. After FailureThreshold consecutive
+    // failures the circuit opens and deliveries fail straight away for OpenDuration; then a
+    // single probe delivery is let through, which closes the circuit again on success and
+    // reopens it on failure. Its metrics are labelled with its name, the store URL for the
+    // breakers of For.
+    public class CircuitBreaker
+    {
+        private static readonly ILog log = LogProvider.For<CircuitBreaker>();
+        public const int DefaultFailureThreshold = 5;
+        public static readonly TimeSpan DefaultOpenDuration = TimeSpan.FromSeconds(30);
+
+        private static readonly Dictionary<String, CircuitBreaker> breakers = new Dictionary<String, CircuitBreaker>();
+
+        private readonly String _name;
+        private readonly int _failureThreshold;
+        private readonly long _openDurationMs;
+        private readonly object _lock = new object();
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private readonly MetricCounter _opened;
+        private readonly MetricCounter _reopened;
+        private readonly MetricCounter _rejected;
+        private readonly MetricCounter _openMilliseconds;
+
+        private CircuitState _state = CircuitState.CLOSED;
+        private int _consecutiveFailures = 0;
+        private long _openedAtMs = 0;
+        private long _firstOpenedAtMs = 0;
+        private bool _probeInFlight = false;
+
+        public static CircuitBreaker For(String baseUrl)
+        {
+            lock (breakers)
+            {
+                CircuitBreaker breaker;
+                if (!breakers.TryGetValue(baseUrl, out breaker))
+                {
+                    breaker = new CircuitBreaker(baseUrl, DefaultFailureThreshold, DefaultOpenDuration);
+                    breakers.Add(baseUrl, breaker);
+                }
+                return breaker;
+            }
+        }
+
+        public CircuitBreaker(String name, int failureThreshold, TimeSpan openDuration)
+        {
+            _name = name;
+            _failureThreshold = Math.Max(1, failureThreshold);
+            _openDurationMs = Math.Max(0L, (long)openDuration.TotalMilliseconds);
+
+            String label = "store=\"" + name + "\"";
+            MetricsRegistry registry = MetricsRegistry.Default;
+            _opened = registry.Counter("alika_circuit_opened_total", "Times the circuit to a scan store opened after consecutive failures", label);
+            _reopened = registry.Counter("alika_circuit_reopened_total", "Times a probe failed and the circuit to a scan store opened again", label);
+            _rejected = registry.Counter("alika_circuit_rejected_total", "Deliveries failed straight away as the circuit to a scan store was open", label);
+            _openMilliseconds = registry.Counter("alika_circuit_open_milliseconds_total", "Time the circuit to a scan store was open until it closed again", label);
+            // the first breaker of a name, a later one adds to its counters only
+            registry.Gauge("alika_circuit_state", "State of the circuit to a scan store, 0 closed, 1 open, 2 half open", label, () => (long)State);
+        }
+
+        public CircuitState State
+        {
+            get { lock (_lock) { return _state; } }
+        }
+
+        public bool TryEnter()
+        {
+            lock (_lock)
+            {
+                switch (_state)
+                {
+                    case CircuitState.CLOSED:
+                        return true;
+                    case CircuitState.OPEN:
+                        if (_clock.ElapsedMilliseconds - _openedAtMs < _openDurationMs)
+                        {
+                            _rejected.Increment();
+                            return false;
+                        }
+                        log.InfoFormat("Circuit to [{0}] half open, probing", _name);
+                        _state = CircuitState.HALF_OPEN;
+                        _probeInFlight = true;
+                        return true;
+                    default:
+                        if (_probeInFlight)
+                        {
+                            _rejected.Increment();
+                            return false;
+                        }
+                        _probeInFlight = true;
+                        return true;
+                }
+            }
+        }
+
+        public void RecordSuccess()
+        {
+            lock (_lock)
+            {
+                _consecutiveFailures = 0;
+                if (_state != CircuitState.CLOSED)
+                {
+                    // time open counts from the first opening, not from the last failed probe
+                    long openMs = _clock.ElapsedMilliseconds - _firstOpenedAtMs;
+                    log.InfoFormat("Circuit to [{0}] closed after [{1}ms]", _name, openMs);
+                    _openMilliseconds.Add(openMs);
+                    _state = CircuitState.CLOSED;
+                    _probeInFlight = false;
+                }
+            }
+        }
+
+        public void RecordFailure()
+        {
+            lock (_lock)
+            {
+                _consecutiveFailures++;
+                if (_state == CircuitState.HALF_OPEN)
+                {
+                    log.WarnFormat("Probe to [{0}] failed, circuit reopened", _name);
+                    _state = CircuitState.OPEN;
+                    _probeInFlight = false;
+                    _openedAtMs = _clock.ElapsedMilliseconds;
+                    _reopened.Increment();
+                }
+                else if (_state == CircuitState.CLOSED && _consecutiveFailures >= _failureThreshold)
+                {
+                    log.WarnFormat("Circuit to [{0}] opened after [{1}] consecutive failures", _name, _consecutiveFailures);
+                    _state = CircuitState.OPEN;
+                    _openedAtMs = _clock.ElapsedMilliseconds;
+                    _firstOpenedAtMs = _openedAtMs;
+                    _opened.Increment();
+                }
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("CircuitBreaker Name [{0}] State [{1}] Opened [{2}] Rejected [{3}]", _name, State, _opened.Value, _rejected.Value);
+        }
+    }
+}
@@ -2,22 +2,53 @@
 using System.Collections.Generic;
 using System.Linq;
 using System.Text;
+using System.Threading;
 
 namespace CH.Alika.POS.Hardware
 {
     public class CodeLineScanEvent : EventArgs
     {
-        public MMM.Readers.CodelineData CodeLineData { get; private set; }
+        private readonly object _lock = new object();
+        private MMM.Readers.CodelineData _codeLineData;
+        private int _materialized;
+
+        public CompactCodeline Codeline { get; private set; }
+        // Scan the stages of its handling are traced under, see ScanTrace
+        public long TraceId { get; internal set; }
+        // Materialized from Codeline on the first read and kept, read single fields from Codeline
+        // where possible
+        public MMM.Readers.CodelineData CodeLineData
+        {
+            get
+            {
+                if (Thread.VolatileRead(ref _materialized) == 0)
+                {
+                    lock (_lock)
+                    {
+                        if (_materialized == 0)
+                        {
+                            _codeLineData = Codeline.ToCodelineData();
+                            Thread.VolatileWrite(ref _materialized, 1);
+                        }
+                    }
+                }
+                return _codeLineData;
+            }
+        }
         public bool IsInvalid
         {
             get
             {
-                return CodeLineData.CodelineValidationResult == MMM.Readers.CheckDigitResult.CDR_Invalid;
+                return Codeline.ValidationResult == MMM.Readers.CheckDigitResult.CDR_Invalid;
             }
         }
         public CodeLineScanEvent(MMM.Readers.CodelineData codeLineData)
+            : this(CompactCodeline.From(codeLineData))
+        {
+        }
+        public CodeLineScanEvent(CompactCodeline codeline)
         {
-            CodeLineData = codeLineData;
+            Codeline = codeline;
         }
     }
 }
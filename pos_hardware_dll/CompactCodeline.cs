@@ -0,0 +1,325 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Order of the string fields in a CompactCodeline, the same as in ScanRecordCodec
+    public enum CodelineField
+    {
+        DATA,
+        LINE1,
+        LINE2,
+        LINE3,
+        DOC_ID,
+        DOC_TYPE,
+        SURNAME,
+        FORENAME,
+        SECOND_NAME,
+        FORENAMES,
+        ISSUING_STATE,
+        NATIONALITY,
+        DOC_NUMBER,
+        SEX,
+        OPTIONAL_DATA1,
+        OPTIONAL_DATA2
+    }
+
+    // A scanned codeline held in one exact size byte array instead of the CodelineData the SDK
+    // marshals, which keeps alive a managed string for every fixed length buffer plus the check
+    // digit array for as long as any event refers to the scan.
+    //
+    //   buffer : [end offset of each string, ushort] [strings, UTF-8] [scalars and check digits]
+    //            [NUL padding of each padded string]
+    //
+    // Strings are stored without the NULs padding the SDK buffers and are only turned into
+    // managed strings when a field is read, each read allocates a new one and leaves out the
+    // padding. Scalars are varints in CodelineData field order and the padding is counted, so
+    // that ToCodelineData gives back what was scanned, NULs included, and the payloads sent to
+    // the store stay the same byte for byte. The array
+    // is built in a per thread buffer and copied out once; it is not rented from a pool as the
+    // scan is shared by the asynchronous stores and subscribers without a point at which it is
+    // known to be released.
+    public sealed class CompactCodeline
+    {
+        public const int FieldCount = ScanRecordCodec.StringCount;
+        private const int HEADER_LENGTH = FieldCount * 2;
+
+        [ThreadStatic]
+        private static byte[] _scratch;
+
+        private readonly byte[] _buffer;
+        // bit per field that was null rather than empty
+        private readonly ushort _nulls;
+
+        public MMM.Readers.CheckDigitResult ValidationResult { get; private set; }
+
+        private CompactCodeline(byte[] buffer, ushort nulls, MMM.Readers.CheckDigitResult validationResult)
+        {
+            _buffer = buffer;
+            _nulls = nulls;
+            ValidationResult = validationResult;
+        }
+
+        public static CompactCodeline From(MMM.Readers.CodelineData data)
+        {
+            var writer = new CompactWriter(_scratch ?? (_scratch = new byte[1024]));
+            ushort nulls = 0;
+            ushort padded = 0;
+            int paddedCount = 0;
+            for (int i = 0; i < HEADER_LENGTH; i++)
+            {
+                writer.WriteByte(0);
+            }
+            for (int i = 0; i < FieldCount; i++)
+            {
+                String value = ScanRecordCodec.StringAt(ref data, i);
+                if (value == null)
+                {
+                    nulls |= (ushort)(1 << i);
+                }
+                else
+                {
+                    int length = value.Length;
+                    while (length > 0 && value[length - 1] == '\0')
+                    {
+                        length--;
+                    }
+                    if (length < value.Length)
+                    {
+                        padded |= (ushort)(1 << i);
+                        paddedCount++;
+                    }
+                    writer.WriteChars(value, 0, length);
+                }
+                if (writer.Length > ushort.MaxValue)
+                {
+                    throw new PosHardwareException("Scanned codeline is too long");
+                }
+                writer.GetBuffer()[2 * i] = (byte)writer.Length;
+                writer.GetBuffer()[2 * i + 1] = (byte)(writer.Length >> 8);
+            }
+
+            writer.WriteVarint((uint)data.LineCount);
+            WriteDate(ref writer, data.DateOfBirth);
+            WriteDate(ref writer, data.ExpiryDate);
+            writer.WriteByte(data.ShortSex);
+            writer.WriteByte((byte)((data.MrzOnRearSide ? 1 : 0) | (data.ExpiredDocumentFlag ? 2 : 0)));
+            writer.WriteVarint((uint)data.ImageSource);
+            writer.WriteVarint((uint)data.CheckDigitDataListCount);
+            // list length plus one, zero for no list
+            writer.WriteVarint(data.CheckDigitDataList == null ? 0 : (uint)data.CheckDigitDataList.Length + 1);
+            if (data.CheckDigitDataList != null)
+            {
+                foreach (var checkDigit in data.CheckDigitDataList)
+                {
+                    writer.WriteVarint((uint)checkDigit.puCheckDigitType);
+                    writer.WriteVarint((uint)checkDigit.puCodelineNumber);
+                    writer.WriteVarint((uint)checkDigit.puCodelinePos);
+                    writer.WriteVarint(checkDigit.puValueExpected);
+                    writer.WriteVarint(checkDigit.puValueRead);
+                    writer.WriteVarint((uint)checkDigit.puResult);
+                }
+            }
+            writer.WriteVarint((uint)paddedCount);
+            for (int i = 0; i < FieldCount; i++)
+            {
+                if ((padded & (1 << i)) != 0)
+                {
+                    String value = ScanRecordCodec.StringAt(ref data, i);
+                    writer.WriteVarint((uint)i);
+                    writer.WriteVarint((uint)(value.Length - value.TrimEnd('\0').Length));
+                }
+            }
+            _scratch = writer.GetBuffer();
+            return new CompactCodeline(writer.ToArray(), nulls, data.CodelineValidationResult);
+        }
+
+        // Bytes held by the scan, not counting the object itself
+        public int Length
+        {
+            get { return _buffer.Length; }
+        }
+
+        public String Line1 { get { return Field(CodelineField.LINE1); } }
+        public String Line2 { get { return Field(CodelineField.LINE2); } }
+        public String DocType { get { return Field(CodelineField.DOC_TYPE); } }
+        public String Surname { get { return Field(CodelineField.SURNAME); } }
+        public String IssuingState { get { return Field(CodelineField.ISSUING_STATE); } }
+        public String DocNumber { get { return Field(CodelineField.DOC_NUMBER); } }
+
+        public int LineCount
+        {
+            get
+            {
+                int scalars = End(FieldCount - 1);
+                var reader = new CompactReader(_buffer, scalars, _buffer.Length - scalars);
+                return (int)reader.ReadVarint();
+            }
+        }
+
+        public String Field(CodelineField field)
+        {
+            int index = (int)field;
+            if ((_nulls & (1 << index)) != 0)
+            {
+                return null;
+            }
+            int start = Start(index);
+            return Encoding.UTF8.GetString(_buffer, start, End(index) - start);
+        }
+
+        // Ordinal comparison with an ASCII prefix without materializing the field
+        public bool FieldStartsWith(CodelineField field, String prefix)
+        {
+            int index = (int)field;
+            int start = Start(index);
+            if ((_nulls & (1 << index)) != 0 || End(index) - start < prefix.Length)
+            {
+                return false;
+            }
+            for (int i = 0; i < prefix.Length; i++)
+            {
+                if (_buffer[start + i] != prefix[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Stored length of the field, -1 when it is null
+        public int FieldLength(CodelineField field)
+        {
+            int index = (int)field;
+            if ((_nulls & (1 << index)) != 0)
+            {
+                return -1;
+            }
+            return End(index) - Start(index);
+        }
+
+        // Copies the field as CompactWriter.WriteString would write it, a null field as empty
+        internal void WriteField(ref CompactWriter writer, CodelineField field)
+        {
+            int index = (int)field;
+            int start = Start(index);
+            int length = (_nulls & (1 << index)) != 0 ? 0 : End(index) - start;
+            writer.WriteVarint((uint)length);
+            writer.WriteBytes(_buffer, start, length);
+        }
+
+        public MMM.Readers.CodelineData ToCodelineData()
+        {
+            var data = new MMM.Readers.CodelineData();
+            data.Data = Field(CodelineField.DATA);
+            data.Line1 = Field(CodelineField.LINE1);
+            data.Line2 = Field(CodelineField.LINE2);
+            data.Line3 = Field(CodelineField.LINE3);
+            data.DocId = Field(CodelineField.DOC_ID);
+            data.DocType = Field(CodelineField.DOC_TYPE);
+            data.Surname = Field(CodelineField.SURNAME);
+            data.Forename = Field(CodelineField.FORENAME);
+            data.SecondName = Field(CodelineField.SECOND_NAME);
+            data.Forenames = Field(CodelineField.FORENAMES);
+            data.IssuingState = Field(CodelineField.ISSUING_STATE);
+            data.Nationality = Field(CodelineField.NATIONALITY);
+            data.DocNumber = Field(CodelineField.DOC_NUMBER);
+            data.Sex = Field(CodelineField.SEX);
+            data.OptionalData1 = Field(CodelineField.OPTIONAL_DATA1);
+            data.OptionalData2 = Field(CodelineField.OPTIONAL_DATA2);
+            data.CodelineValidationResult = ValidationResult;
+
+            int scalars = End(FieldCount - 1);
+            var reader = new CompactReader(_buffer, scalars, _buffer.Length - scalars);
+            data.LineCount = (int)reader.ReadVarint();
+            data.DateOfBirth = ReadDate(ref reader);
+            data.ExpiryDate = ReadDate(ref reader);
+            data.ShortSex = reader.ReadByte();
+            byte flags = reader.ReadByte();
+            data.MrzOnRearSide = (flags & 1) != 0;
+            data.ExpiredDocumentFlag = (flags & 2) != 0;
+            data.ImageSource = (int)reader.ReadVarint();
+            data.CheckDigitDataListCount = (int)reader.ReadVarint();
+            int listLength = (int)reader.ReadVarint() - 1;
+            if (listLength >= 0)
+            {
+                data.CheckDigitDataList = new MMM.Readers.CodelineCheckDigitData[listLength];
+                for (int i = 0; i < listLength; i++)
+                {
+                    var checkDigit = new MMM.Readers.CodelineCheckDigitData();
+                    checkDigit.puCheckDigitType = (MMM.Readers.CheckDigitType)reader.ReadVarint();
+                    checkDigit.puCodelineNumber = (int)reader.ReadVarint();
+                    checkDigit.puCodelinePos = (int)reader.ReadVarint();
+                    checkDigit.puValueExpected = (char)reader.ReadVarint();
+                    checkDigit.puValueRead = (char)reader.ReadVarint();
+                    checkDigit.puResult = (MMM.Readers.CheckDigitResult)reader.ReadVarint();
+                    data.CheckDigitDataList[i] = checkDigit;
+                }
+            }
+            int paddedCount = (int)reader.ReadVarint();
+            for (int i = 0; i < paddedCount; i++)
+            {
+                var field = (CodelineField)reader.ReadVarint();
+                AppendNuls(ref data, field, (int)reader.ReadVarint());
+            }
+            return data;
+        }
+
+        private static void AppendNuls(ref MMM.Readers.CodelineData data, CodelineField field, int count)
+        {
+            String nuls = new String('\0', count);
+            switch (field)
+            {
+                case CodelineField.DATA: data.Data += nuls; break;
+                case CodelineField.LINE1: data.Line1 += nuls; break;
+                case CodelineField.LINE2: data.Line2 += nuls; break;
+                case CodelineField.LINE3: data.Line3 += nuls; break;
+                case CodelineField.DOC_ID: data.DocId += nuls; break;
+                case CodelineField.DOC_TYPE: data.DocType += nuls; break;
+                case CodelineField.SURNAME: data.Surname += nuls; break;
+                case CodelineField.FORENAME: data.Forename += nuls; break;
+                case CodelineField.SECOND_NAME: data.SecondName += nuls; break;
+                case CodelineField.FORENAMES: data.Forenames += nuls; break;
+                case CodelineField.ISSUING_STATE: data.IssuingState += nuls; break;
+                case CodelineField.NATIONALITY: data.Nationality += nuls; break;
+                case CodelineField.DOC_NUMBER: data.DocNumber += nuls; break;
+                case CodelineField.SEX: data.Sex += nuls; break;
+                case CodelineField.OPTIONAL_DATA1: data.OptionalData1 += nuls; break;
+                case CodelineField.OPTIONAL_DATA2: data.OptionalData2 += nuls; break;
+            }
+        }
+
+        private int Start(int index)
+        {
+            return index == 0 ? HEADER_LENGTH : End(index - 1);
+        }
+
+        private int End(int index)
+        {
+            return _buffer[2 * index] | _buffer[2 * index + 1] << 8;
+        }
+
+        private static void WriteDate(ref CompactWriter writer, MMM.Readers.Date date)
+        {
+            writer.WriteVarint((uint)date.Year);
+            writer.WriteVarint((uint)date.Month);
+            writer.WriteVarint((uint)date.Day);
+        }
+
+        private static MMM.Readers.Date ReadDate(ref CompactReader reader)
+        {
+            var date = new MMM.Readers.Date();
+            date.Year = (int)reader.ReadVarint();
+            date.Month = (int)reader.ReadVarint();
+            date.Day = (int)reader.ReadVarint();
+            return date;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("CompactCodeline ValidationResult [{0}] Length [{1}]", ValidationResult, Length);
+        }
+    }
+}
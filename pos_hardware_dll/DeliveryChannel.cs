@@ -0,0 +1,330 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Net;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+using RestSharp;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Long lived delivery session to one scan store host, shared by every delivery to it.
+    // Requests go out over a small set of kept-alive connections instead of one client (and
+    // possibly one TCP and TLS handshake) per scan. The channel owns the ServicePoint of its
+    // scheme, host and port, there is one channel per ServicePoint, so its connection limit is
+    // set once for the channel's window rather than by every store URL on the host. The number
+    // of requests in flight is a window that grows by one per 2xx answer and halves when the
+    // store signals overload with 429 or 503; any other answer or a transport failure counts
+    // as failed and leaves the window as it is. Deliveries beyond the window wait in a bounded
+    // queue, the next is started when a request in flight completes; when the queue is full, or
+    // a delivery waits longer than its queue timeout, the delivery fails so the scan is reported
+    // as undelivered rather than piling up. A delivery's queue timeout is the channel's unless
+    // the caller passes a shorter one, and the wait is taken off the request's own timeout.
+    // ExecuteAsync holds no thread while it waits, Execute blocks its caller until answered.
+    // Its metrics are labelled with the host and port.
+    public class DeliveryChannel
+    {
+        private static readonly ILog log = LogProvider.For<DeliveryChannel>();
+        public const int DefaultMaxConcurrent = 4;
+        public const int DefaultQueueCapacity = 32;
+        public static readonly TimeSpan DefaultQueueTimeout = TimeSpan.FromSeconds(30);
+        public static readonly TimeSpan DefaultIdleTimeout = TimeSpan.FromMinutes(5);
+
+        private static readonly Dictionary<String, DeliveryChannel> channels = new Dictionary<String, DeliveryChannel>();
+
+        private readonly RestClient _client;
+        private readonly Uri _baseUrl;
+        private readonly int _maxConcurrent;
+        private readonly int _queueCapacity;
+        private readonly int _queueTimeoutMs;
+        private readonly object _lock = new object();
+        private readonly MetricCounter _delivered;
+        private readonly MetricCounter _failed;
+        private readonly MetricCounter _rejected;
+        private readonly MetricCounter _queued;
+        private readonly Queue<Waiting> _waiting = new Queue<Waiting>();
+        private readonly Timer _expiry;
+
+        private int _window;
+        private int _inFlight = 0;
+        private bool _expiryArmed = false;
+        private int _expiryPeriodMs;
+
+        // The channel of the store URL's scheme, host and port
+        public static DeliveryChannel For(String baseUrl)
+        {
+            Uri host = new Uri(new Uri(baseUrl).GetLeftPart(UriPartial.Authority));
+            lock (channels)
+            {
+                DeliveryChannel channel;
+                if (!channels.TryGetValue(host.AbsoluteUri, out channel))
+                {
+                    channel = new DeliveryChannel(host, DefaultMaxConcurrent, DefaultQueueCapacity, DefaultQueueTimeout);
+                    channels.Add(host.AbsoluteUri, channel);
+                }
+                return channel;
+            }
+        }
+
+        // baseUrl is taken for its scheme, host and port, requests carry the path
+        public DeliveryChannel(Uri baseUrl, int maxConcurrent, int queueCapacity, TimeSpan queueTimeout)
+        {
+            _baseUrl = new Uri(baseUrl.GetLeftPart(UriPartial.Authority));
+            _maxConcurrent = Math.Max(1, maxConcurrent);
+            _queueCapacity = Math.Max(0, queueCapacity);
+            _queueTimeoutMs = Math.Max(0, (int)queueTimeout.TotalMilliseconds);
+            _window = _maxConcurrent;
+            _client = new RestClient();
+            _client.BaseUrl = _baseUrl;
+            _expiry = new Timer(state => ExpireWaiting(), null, Timeout.Infinite, Timeout.Infinite);
+
+            String label = "host=\"" + _baseUrl.Authority + "\"";
+            MetricsRegistry registry = MetricsRegistry.Default;
+            _delivered = registry.Counter("alika_delivery_channel_delivered_total", "Requests of a delivery channel answered 2xx", label);
+            _failed = registry.Counter("alika_delivery_channel_failed_total", "Requests of a delivery channel answered otherwise or not at all", label);
+            _rejected = registry.Counter("alika_delivery_channel_rejected_total", "Deliveries failed as a delivery channel's queue was full or the wait too long", label);
+            _queued = registry.Counter("alika_delivery_channel_queued_total", "Deliveries that waited for room in a delivery channel's window", label);
+            // read from the first channel of a host, there is one unless channels are created
+            // other than by For
+            registry.Gauge("alika_delivery_channel_window", "Requests a delivery channel lets be in flight", label, () => Window);
+            registry.Gauge("alika_delivery_channel_in_flight", "Requests of a delivery channel in flight", label, () => InFlight);
+            registry.Gauge("alika_delivery_channel_waiting", "Deliveries waiting in a delivery channel's queue", label, () => WaitingCount);
+
+            ServicePoint servicePoint = ServicePointManager.FindServicePoint(_baseUrl);
+            servicePoint.ConnectionLimit = _maxConcurrent;
+            // the store answers POSTs directly, waiting for 100-continue only costs a round trip
+            servicePoint.Expect100Continue = false;
+            servicePoint.UseNagleAlgorithm = false;
+            servicePoint.MaxIdleTime = (int)DefaultIdleTimeout.TotalMilliseconds;
+            // keeps idle connections alive through the site's NAT between opening hours scans
+            servicePoint.SetTcpKeepAlive(true, 30000, 5000);
+            log.InfoFormat("Delivery channel opened [{0}]", this);
+        }
+
+        public int Window
+        {
+            get { lock (_lock) { return _window; } }
+        }
+
+        public int InFlight
+        {
+            get { lock (_lock) { return _inFlight; } }
+        }
+
+        public int WaitingCount
+        {
+            get { lock (_lock) { return _waiting.Count; } }
+        }
+
+        // Waits on the caller's thread, see ExecuteAsync
+        public IRestResponse<T> Execute<T>(Uri url, IRestRequest request) where T : new()
+        {
+            return Execute<T>(url, request, TimeSpan.MaxValue);
+        }
+
+        public IRestResponse<T> Execute<T>(Uri url, IRestRequest request, TimeSpan queueTimeout) where T : new()
+        {
+            try
+            {
+                return ExecuteAsync<T>(url, request, queueTimeout).Result;
+            }
+            catch (AggregateException ex)
+            {
+                throw new PosHardwareException(ex.InnerException.Message, ex.InnerException);
+            }
+        }
+
+        // Sends the request to url, a URL on the channel's host, once the window has room for
+        // it. Fails with a PosHardwareException when the queue is full or the wait too long.
+        public Task<IRestResponse<T>> ExecuteAsync<T>(Uri url, IRestRequest request) where T : new()
+        {
+            return ExecuteAsync<T>(url, request, TimeSpan.MaxValue);
+        }
+
+        // queueTimeout bounds the wait for this delivery when shorter than the channel's, such
+        // as what is left of a delivery's deadline
+        public Task<IRestResponse<T>> ExecuteAsync<T>(Uri url, IRestRequest request, TimeSpan queueTimeout) where T : new()
+        {
+            var completion = new TaskCompletionSource<IRestResponse<T>>();
+            // relative to the channel's host
+            request.Resource = url.PathAndQuery;
+            int timeoutMs = (int)Math.Max(0L, Math.Min(_queueTimeoutMs, (long)queueTimeout.TotalMilliseconds));
+            int queued = Environment.TickCount;
+            var waiting = new Waiting(
+                () =>
+                {
+                    // the time in the queue counts against the request's timeout
+                    if (request.Timeout > 0)
+                    {
+                        request.Timeout = Math.Max(1, request.Timeout - (Environment.TickCount - queued));
+                    }
+                    _client.ExecuteAsync<T>(request, (response, handle) =>
+                    {
+                        Release(response);
+                        completion.TrySetResult(response);
+                    });
+                },
+                ex => completion.TrySetException(ex),
+                queued, timeoutMs);
+            lock (_lock)
+            {
+                if (_waiting.Count == 0 && _inFlight < _window)
+                {
+                    _inFlight++;
+                }
+                else if (_waiting.Count >= _queueCapacity)
+                {
+                    _rejected.Increment();
+                    completion.SetException(new PosHardwareException(String.Format("Delivery queue to [{0}] is full [{1}]", _baseUrl, _waiting.Count)));
+                    return completion.Task;
+                }
+                else
+                {
+                    _waiting.Enqueue(waiting);
+                    _queued.Increment();
+                    ArmExpiry(timeoutMs);
+                    return completion.Task;
+                }
+            }
+            Start(waiting);
+            return completion.Task;
+        }
+
+        private void Start(Waiting waiting)
+        {
+            try
+            {
+                waiting.Start();
+            }
+            catch (Exception ex)
+            {
+                Release(null);
+                waiting.Fail(ex);
+            }
+        }
+
+        private void Release(IRestResponse response)
+        {
+            var next = new List<Waiting>();
+            lock (_lock)
+            {
+                _inFlight--;
+                if (IsDelivered(response))
+                {
+                    _window = Math.Min(_maxConcurrent, _window + 1);
+                    _delivered.Increment();
+                }
+                else
+                {
+                    if (IsOverloaded(response))
+                    {
+                        int window = Math.Max(1, _window / 2);
+                        if (window != _window)
+                        {
+                            log.WarnFormat("Store [{0}] is overloaded, delivery window reduced to [{1}]", _baseUrl, window);
+                        }
+                        _window = window;
+                    }
+                    _failed.Increment();
+                }
+                while (_inFlight < _window && _waiting.Count > 0)
+                {
+                    _inFlight++;
+                    next.Add(_waiting.Dequeue());
+                }
+            }
+            foreach (Waiting waiting in next)
+            {
+                Start(waiting);
+            }
+        }
+
+        // Checks the queue a few times per the shortest queue timeout waiting
+        private void ArmExpiry(int timeoutMs)
+        {
+            int period = Math.Max(10, timeoutMs / 4);
+            if (!_expiryArmed || period < _expiryPeriodMs)
+            {
+                _expiryArmed = true;
+                _expiryPeriodMs = period;
+                _expiry.Change(period, period);
+            }
+        }
+
+        private void ExpireWaiting()
+        {
+            var expired = new List<Waiting>();
+            lock (_lock)
+            {
+                // timeouts differ, so any of them may be due; the others keep their order
+                int now = Environment.TickCount;
+                for (int i = _waiting.Count; i > 0; i--)
+                {
+                    Waiting waiting = _waiting.Dequeue();
+                    if (now - waiting.Queued >= waiting.TimeoutMs)
+                    {
+                        _rejected.Increment();
+                        expired.Add(waiting);
+                    }
+                    else
+                    {
+                        _waiting.Enqueue(waiting);
+                    }
+                }
+                if (_waiting.Count == 0 && _expiryArmed)
+                {
+                    _expiryArmed = false;
+                    _expiry.Change(Timeout.Infinite, Timeout.Infinite);
+                }
+            }
+            foreach (Waiting waiting in expired)
+            {
+                waiting.Fail(new PosHardwareException(String.Format("Timed out waiting for delivery to [{0}] after [{1}ms]", _baseUrl, waiting.TimeoutMs)));
+            }
+        }
+
+        private static bool IsDelivered(IRestResponse response)
+        {
+            if (response == null || response.ResponseStatus == ResponseStatus.TimedOut)
+            {
+                return false;
+            }
+            int status = (int)response.StatusCode;
+            return status >= 200 && status <= 299;
+        }
+
+        private static bool IsOverloaded(IRestResponse response)
+        {
+            return response != null &&
+                ((int)response.StatusCode == 429 || response.StatusCode == HttpStatusCode.ServiceUnavailable);
+        }
+
+        public override string ToString()
+        {
+            lock (_lock)
+            {
+                return String.Format("DeliveryChannel BaseUrl [{0}] Window [{1}/{2}] InFlight [{3}] Waiting [{4}/{5}] Delivered [{6}] Failed [{7}]",
+                    _baseUrl, _window, _maxConcurrent, _inFlight, _waiting.Count, _queueCapacity, _delivered.Value, _failed.Value);
+            }
+        }
+
+        private class Waiting
+        {
+            public Action Start { get; private set; }
+            public Action<Exception> Fail { get; private set; }
+            // Environment.TickCount when queued
+            public int Queued { get; private set; }
+            public int TimeoutMs { get; private set; }
+
+            public Waiting(Action start, Action<Exception> fail, int queued, int timeoutMs)
+            {
+                Start = start;
+                Fail = fail;
+                Queued = queued;
+                TimeoutMs = timeoutMs;
+            }
+        }
+    }
+}
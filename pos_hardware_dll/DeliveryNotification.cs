@@ -0,0 +1,85 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Balloon tip the scan store asks for in its response to a delivered scan, a flat object
+    // of Title, Text and Severity (info, warn, error or none). Parsed once by the service,
+    // see ScanStoreEvent.Notification, so tray apps get it ready to show. A response that is
+    // not such an object gives the default notification. A store refusing a scan may answer
+    // one as well, see ParseRejected.
+    public class DeliveryNotification
+    {
+        public const String DefaultTitle = "Document Scan Delivered";
+        public const String DefaultText = "A scanned document was delivered to cloud";
+        public const String DefaultSeverity = "info";
+
+        public String Title { get; private set; }
+        public String Text { get; private set; }
+        public String Severity { get; private set; }
+
+        public DeliveryNotification(String title, String text, String severity)
+        {
+            Title = title ?? DefaultTitle;
+            Text = text ?? DefaultText;
+            Severity = severity ?? DefaultSeverity;
+        }
+
+        public static DeliveryNotification Parse(String response)
+        {
+            NotificationJson json = Read(response);
+            return json != null ? new DeliveryNotification(json.Title, json.Text, json.Severity) : new DeliveryNotification(null, null, null);
+        }
+
+        // Notification in the answer to a scan the store did not take, null unless it names a
+        // Title; the defaults would claim the scan was delivered
+        public static DeliveryNotification ParseRejected(String response)
+        {
+            NotificationJson json = Read(response);
+            return json != null && json.Title != null ? new DeliveryNotification(json.Title, json.Text, json.Severity) : null;
+        }
+
+        // Delivery responses are a flat object, only unusual ones go through Newtonsoft
+        private static NotificationJson Read(String response)
+        {
+            if (String.IsNullOrEmpty(response))
+            {
+                return null;
+            }
+            Dictionary<String, String> members;
+            if (FlatJsonReader.TryRead(response, out members))
+            {
+                return new NotificationJson { Title = Member(members, "Title"), Text = Member(members, "Text"), Severity = Member(members, "Severity") };
+            }
+            try
+            {
+                return Newtonsoft.Json.JsonConvert.DeserializeObject<NotificationJson>(response);
+            }
+            catch (Exception)
+            {
+                // not a notification
+                return null;
+            }
+        }
+
+        private static String Member(Dictionary<String, String> members, String name)
+        {
+            String value;
+            return members.TryGetValue(name, out value) ? value : null;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("DeliveryNotification Title [{0}] Severity [{1}]", Title, Severity);
+        }
+
+        private class NotificationJson
+        {
+            public String Title { get; set; }
+            public String Text { get; set; }
+            public String Severity { get; set; }
+        }
+    }
+}
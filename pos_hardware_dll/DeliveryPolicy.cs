@@ -0,0 +1,290 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.Linq;
+using System.Net;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+using RestSharp;
+
+namespace CH.Alika.POS.Hardware
+{
+    // How hard a delivery tries before it is reported as failed. Every attempt gets at most
+    // AttemptTimeout and the delivery as a whole at most Deadline. A scan is a POST, so only
+    // failures where the store cannot have taken it are retried by default: no connection and
+    // 429. A store that drops duplicates by the Idempotency-Key header the attempts carry can
+    // set IdempotentStore, then timeouts and 5xx are retried as well, and with HedgeAfter set an
+    // attempt that has not answered by then is raced by a second identical request and the
+    // first answer wins. The key is derived from the scan's trace id, so a scan replayed after
+    // its live delivery timed out carries the key of the live delivery. Retries back off with jitter, stop after MaxRetries, at the deadline
+    // and while the store's circuit is open. A delivery that still fails throws.
+    public class DeliveryPolicy
+    {
+        private static readonly ILog log = LogProvider.For<DeliveryPolicy>();
+        public static readonly TimeSpan DefaultDeadline = TimeSpan.FromSeconds(30);
+        public static readonly TimeSpan DefaultAttemptTimeout = TimeSpan.FromSeconds(10);
+        public static readonly TimeSpan DefaultInitialBackoff = TimeSpan.FromMilliseconds(200);
+        public static readonly TimeSpan DefaultMaxBackoff = TimeSpan.FromSeconds(5);
+        public const int DefaultMaxRetries = 3;
+        public const String IDEMPOTENCY_KEY_HEADER = "Idempotency-Key";
+
+        // of all deliveries
+        private static readonly MetricCounter attemptsTotal = MetricsRegistry.Default.Counter(
+            "alika_delivery_attempts_total", "Requests sent to the scan store, hedges included");
+        private static readonly MetricCounter retriesTotal = MetricsRegistry.Default.Counter(
+            "alika_delivery_retries_total", "Deliveries sent again after a transient failure");
+        private static readonly MetricCounter hedgesTotal = MetricsRegistry.Default.Counter(
+            "alika_delivery_hedges_total", "Hedge requests sent as an attempt was slow");
+        private static readonly MetricCounter hedgesWonTotal = MetricsRegistry.Default.Counter(
+            "alika_delivery_hedges_won_total", "Hedge requests answered before the attempt they hedged");
+        private static readonly MetricCounter deadlinesExceededTotal = MetricsRegistry.Default.Counter(
+            "alika_delivery_deadlines_exceeded_total", "Deliveries given up as a retry would pass their deadline");
+        [ThreadStatic]
+        private static Random jitter;
+
+        public TimeSpan Deadline { get; set; }
+        public TimeSpan AttemptTimeout { get; set; }
+        public TimeSpan InitialBackoff { get; set; }
+        public TimeSpan MaxBackoff { get; set; }
+        public int MaxRetries { get; set; }
+        // TimeSpan.Zero disables hedging, only used with IdempotentStore
+        public TimeSpan HedgeAfter { get; set; }
+        // the store drops requests repeating an Idempotency-Key, so a request it may have taken
+        // can be sent again
+        public bool IdempotentStore { get; set; }
+
+        public DeliveryPolicy()
+        {
+            Deadline = DefaultDeadline;
+            AttemptTimeout = DefaultAttemptTimeout;
+            InitialBackoff = DefaultInitialBackoff;
+            MaxBackoff = DefaultMaxBackoff;
+            MaxRetries = DefaultMaxRetries;
+            HedgeAfter = TimeSpan.Zero;
+            IdempotentStore = false;
+        }
+
+        // The key of the delivery of a scan, the same for its live delivery and every replay;
+        // a key of its own for a scan that is not traced
+        public static String IdempotencyKey(long traceId)
+        {
+            return traceId != 0 ? traceId.ToString("x16", CultureInfo.InvariantCulture) : Guid.NewGuid().ToString("N");
+        }
+
+        // The key of a batch, the same for every upload of the same scans. It does not match the
+        // key of a scan delivered on its own, the store can only tell batches apart.
+        public static String IdempotencyKey(IList<long> traceIds)
+        {
+            if (traceIds.Count == 1)
+            {
+                return IdempotencyKey(traceIds[0]);
+            }
+            if (traceIds.Contains(0L))
+            {
+                return Guid.NewGuid().ToString("N");
+            }
+            // FNV-1a over the trace ids
+            ulong hash = 14695981039346656037UL;
+            foreach (long traceId in traceIds)
+            {
+                for (int shift = 0; shift < 64; shift += 8)
+                {
+                    hash = (hash ^ (byte)(traceId >> shift)) * 1099511628211UL;
+                }
+            }
+            return String.Format(CultureInfo.InvariantCulture, "batch-{0:x16}-{1}", hash, traceIds.Count);
+        }
+
+        // send is called once per attempt with the attempt's timeout and must build a new request
+        // carrying the idempotency key every time, see IdempotencyKey
+        public IRestResponse Execute(String idempotencyKey, CircuitBreaker breaker, Func<String, int, IRestResponse> send)
+        {
+            long deadlineMs = (long)Deadline.TotalMilliseconds;
+            var clock = Stopwatch.StartNew();
+            int retries = 0;
+            while (true)
+            {
+                if (!breaker.TryEnter())
+                {
+                    throw new PosHardwareException(String.Format("Not delivering, circuit is open [{0}]", breaker));
+                }
+                long remainingMs = deadlineMs - clock.ElapsedMilliseconds;
+                int timeoutMs = (int)Math.Max(1L, Math.Min(remainingMs, (long)AttemptTimeout.TotalMilliseconds));
+
+                IRestResponse response;
+                try
+                {
+                    attemptsTotal.Increment();
+                    response = SendHedged(send, idempotencyKey, timeoutMs);
+                }
+                catch
+                {
+                    breaker.RecordFailure();
+                    throw;
+                }
+
+                if (!IsTransient(response))
+                {
+                    breaker.RecordSuccess();
+                    return response;
+                }
+                breaker.RecordFailure();
+
+                if (!IsRetriable(response))
+                {
+                    throw Failed(String.Format("Delivery failed, not retried as the store may have taken it [{0}]", Describe(response)), response);
+                }
+                long backoffMs = NextBackoff(retries);
+                if (retries >= MaxRetries)
+                {
+                    throw Failed(String.Format("Delivery failed after [{0}] retries [{1}]", retries, Describe(response)), response);
+                }
+                if (clock.ElapsedMilliseconds + backoffMs >= deadlineMs)
+                {
+                    deadlinesExceededTotal.Increment();
+                    throw Failed(String.Format("Delivery deadline of [{0}ms] reached after [{1}] retries [{2}]", deadlineMs, retries, Describe(response)), response);
+                }
+                retries++;
+                retriesTotal.Increment();
+                log.InfoFormat("Delivery attempt failed [{0}], retry [{1}] in [{2}ms]", Describe(response), retries, backoffMs);
+                Thread.Sleep((int)backoffMs);
+            }
+        }
+
+        private IRestResponse SendHedged(Func<String, int, IRestResponse> send, String idempotencyKey, int timeoutMs)
+        {
+            int hedgeAfterMs = (int)HedgeAfter.TotalMilliseconds;
+            if (!IdempotentStore || hedgeAfterMs <= 0 || hedgeAfterMs >= timeoutMs)
+            {
+                return send(idempotencyKey, timeoutMs);
+            }
+
+            // blocking HTTP calls, kept off the thread pool so a hedge is not delayed by its growth
+            Task<IRestResponse> primary = Observed(Task.Factory.StartNew(() => send(idempotencyKey, timeoutMs), TaskCreationOptions.LongRunning));
+            if (((IAsyncResult)primary).AsyncWaitHandle.WaitOne(hedgeAfterMs))
+            {
+                return Result(primary);
+            }
+            hedgesTotal.Increment();
+            Task<IRestResponse> hedge = Observed(Task.Factory.StartNew(() => send(idempotencyKey, timeoutMs - hedgeAfterMs), TaskCreationOptions.LongRunning));
+            var attempts = new Task<IRestResponse>[] { primary, hedge };
+            int first = Task.WaitAny(attempts);
+            Task<IRestResponse> other = attempts[1 - first];
+            // a quick failure of one must not hide a success of the other
+            if (attempts[first].IsFaulted || IsTransient(attempts[first].Result))
+            {
+                try { other.Wait(); }
+                catch (AggregateException) { }
+                if (!other.IsFaulted && (attempts[first].IsFaulted || !IsTransient(other.Result)))
+                {
+                    first = 1 - first;
+                }
+            }
+            if (first == 1)
+            {
+                hedgesWonTotal.Increment();
+            }
+            return Result(attempts[first]);
+        }
+
+        private static IRestResponse Result(Task<IRestResponse> attempt)
+        {
+            try
+            {
+                return attempt.Result;
+            }
+            catch (AggregateException ex)
+            {
+                throw new PosHardwareException("Delivery attempt failed", ex.InnerException);
+            }
+        }
+
+        // An answer of the store is kept, see ScanStoreRejectedException
+        private static PosHardwareException Failed(String message, IRestResponse response)
+        {
+            log.Warn(message);
+            if (response.ResponseStatus == ResponseStatus.Completed && response.StatusCode != 0)
+            {
+                return new ScanStoreRejectedException(message, (int)response.StatusCode, response.Content, response.ErrorException);
+            }
+            return new PosHardwareException(message, response.ErrorException);
+        }
+
+        // The losing attempt is never awaited, its exception must not surface as unobserved
+        private static Task<IRestResponse> Observed(Task<IRestResponse> task)
+        {
+            task.ContinueWith(t => { var ignored = t.Exception; }, TaskContinuationOptions.OnlyOnFaulted);
+            return task;
+        }
+
+        public static bool IsTransient(IRestResponse response)
+        {
+            // ResponseStatus is also Error when only deserializing the body failed, a request
+            // that never got an answer has no status code
+            if (response.ResponseStatus == ResponseStatus.TimedOut || response.StatusCode == 0)
+            {
+                return true;
+            }
+            int status = (int)response.StatusCode;
+            return status == 429 || status >= 500;
+        }
+
+        // Whether a transient failure is sent again
+        private bool IsRetriable(IRestResponse response)
+        {
+            // 429 is answered before the store does anything with the request
+            return IdempotentStore || IsConnectFailure(response) || (int)response.StatusCode == 429;
+        }
+
+        // The request never reached the store, so sending it again can not duplicate a scan
+        public static bool IsConnectFailure(IRestResponse response)
+        {
+            for (Exception ex = response.ErrorException; ex != null; ex = ex.InnerException)
+            {
+                var web = ex as WebException;
+                if (web != null && (web.Status == WebExceptionStatus.ConnectFailure
+                    || web.Status == WebExceptionStatus.NameResolutionFailure
+                    || web.Status == WebExceptionStatus.ProxyNameResolutionFailure))
+                {
+                    return true;
+                }
+                var socket = ex as SocketException;
+                if (socket != null)
+                {
+                    return socket.SocketErrorCode == SocketError.ConnectionRefused
+                        || socket.SocketErrorCode == SocketError.HostNotFound
+                        || socket.SocketErrorCode == SocketError.HostUnreachable
+                        || socket.SocketErrorCode == SocketError.NetworkUnreachable;
+                }
+            }
+            return false;
+        }
+
+        // Exponential backoff with equal jitter, as for reader recovery
+        private long NextBackoff(int retries)
+        {
+            if (jitter == null)
+            {
+                jitter = new Random(Thread.CurrentThread.ManagedThreadId ^ Environment.TickCount);
+            }
+            long initialMs = Math.Max(1L, (long)InitialBackoff.TotalMilliseconds);
+            long delay = Math.Min(initialMs << Math.Min(retries, 16), Math.Max(initialMs, (long)MaxBackoff.TotalMilliseconds));
+            return delay / 2 + (long)(jitter.NextDouble() * (delay / 2));
+        }
+
+        private static String Describe(IRestResponse response)
+        {
+            return String.Format("{0} {1} {2}", response.ResponseStatus, (int)response.StatusCode, response.ErrorMessage);
+        }
+
+        public override string ToString()
+        {
+            return String.Format("DeliveryPolicy Deadline [{0}ms] AttemptTimeout [{1}ms] MaxRetries [{2}] HedgeAfter [{3}ms] IdempotentStore [{4}]",
+                (long)Deadline.TotalMilliseconds, (long)AttemptTimeout.TotalMilliseconds, MaxRetries, (long)HedgeAfter.TotalMilliseconds, IdempotentStore);
+        }
+    }
+}
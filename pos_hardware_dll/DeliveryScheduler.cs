@@ -0,0 +1,263 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum DeliveryLane
+    {
+        LIVE,
+        BACKLOG
+    }
+
+    // Runs scan deliveries on a fixed set of delivery threads fed from one queue per lane. A
+    // waiting live scan is picked before a backlog scan, and backlog scans may only occupy
+    // MaxBacklogConcurrent of the threads, so a live scan never waits behind a backlog replay
+    // that is already on the wire. So that a steady stream of live scans does not starve the
+    // backlog, a backlog scan that can be picked is picked after at most MaxLiveInARow live
+    // scans. Each lane records how long its scans waited for a thread and how long they took
+    // from enqueue to completion.
+    public class DeliveryScheduler : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<DeliveryScheduler>();
+        // of all schedulers
+        private static readonly LaneMetrics[] laneMetrics = Enum.GetValues(typeof(DeliveryLane)).Cast<DeliveryLane>()
+            .Select(lane => new LaneMetrics(lane, MetricsRegistry.Default)).ToArray();
+        public const int DefaultWorkers = 4;
+        public const int DefaultMaxBacklogConcurrent = 2;
+        public const int DefaultMaxLiveInARow = 8;
+
+        private readonly Queue<WorkItem>[] _lanes;
+        private readonly Thread[] _workers;
+        private readonly int _maxBacklogConcurrent;
+        private readonly int _maxLiveInARow;
+        private readonly object _lock = new object();
+        private int _backlogInFlight = 0;
+        // live scans picked while a backlog scan could have been
+        private int _liveInARow = 0;
+        private bool _disposed = false;
+
+        public DeliveryScheduler()
+            : this(DefaultWorkers, DefaultMaxBacklogConcurrent, DefaultMaxLiveInARow)
+        {
+        }
+
+        public DeliveryScheduler(int workers, int maxBacklogConcurrent)
+            : this(workers, maxBacklogConcurrent, DefaultMaxLiveInARow)
+        {
+        }
+
+        public DeliveryScheduler(int workers, int maxBacklogConcurrent, int maxLiveInARow)
+        {
+            workers = Math.Max(1, workers);
+            // with one thread backlog can not be kept off it, at least it is never picked first
+            _maxBacklogConcurrent = Math.Max(1, Math.Min(maxBacklogConcurrent, workers - 1));
+            _maxLiveInARow = Math.Max(1, maxLiveInARow);
+
+            int laneCount = Enum.GetValues(typeof(DeliveryLane)).Length;
+            _lanes = new Queue<WorkItem>[laneCount];
+            for (int i = 0; i < laneCount; i++)
+            {
+                _lanes[i] = new Queue<WorkItem>();
+            }
+
+            _workers = new Thread[workers];
+            for (int i = 0; i < workers; i++)
+            {
+                _workers[i] = new Thread(Work);
+                _workers[i].Name = "ScanDelivery" + i;
+                _workers[i].IsBackground = true;
+                _workers[i].Start();
+            }
+        }
+
+        public LaneMetrics Metrics(DeliveryLane lane)
+        {
+            return laneMetrics[(int)lane];
+        }
+
+        public int Pending(DeliveryLane lane)
+        {
+            lock (_lock)
+            {
+                return _lanes[(int)lane].Count;
+            }
+        }
+
+        public Task<T> Enqueue<T>(DeliveryLane lane, Func<T> work)
+        {
+            var completion = new TaskCompletionSource<T>();
+            var item = new WorkItem(lane, () =>
+            {
+                try
+                {
+                    completion.SetResult(work());
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("Scan delivery in lane [{0}] failed [{1}]", lane, ex.Message);
+                    completion.SetException(ex);
+                    // callers usually fire and forget, do not let the exception go unobserved
+                    var observed = completion.Task.Exception;
+                }
+            }, () => completion.TrySetCanceled());
+            lock (_lock)
+            {
+                if (_disposed)
+                {
+                    throw new ObjectDisposedException("DeliveryScheduler");
+                }
+                _lanes[(int)lane].Enqueue(item);
+                laneMetrics[(int)lane].QueueDepth.Increment();
+                Monitor.PulseAll(_lock);
+            }
+            return completion.Task;
+        }
+
+        private void Work()
+        {
+            while (true)
+            {
+                WorkItem item;
+                lock (_lock)
+                {
+                    while ((item = Next()) == null)
+                    {
+                        if (_disposed)
+                        {
+                            return;
+                        }
+                        Monitor.Wait(_lock);
+                    }
+                }
+
+                LaneMetrics metrics = laneMetrics[(int)item.Lane];
+                metrics.QueueDepth.Decrement();
+                metrics.QueueTime.Record(item.ElapsedTicks);
+                item.Run();
+                metrics.DeliveryTime.Record(item.ElapsedTicks);
+
+                if (item.Lane == DeliveryLane.BACKLOG)
+                {
+                    lock (_lock)
+                    {
+                        _backlogInFlight--;
+                        Monitor.PulseAll(_lock);
+                    }
+                }
+            }
+        }
+
+        private WorkItem Next()
+        {
+            bool backlogReady = _lanes[(int)DeliveryLane.BACKLOG].Count > 0 && _backlogInFlight < _maxBacklogConcurrent && !_disposed;
+            if (_lanes[(int)DeliveryLane.LIVE].Count > 0 && !(backlogReady && _liveInARow >= _maxLiveInARow))
+            {
+                _liveInARow = backlogReady ? _liveInARow + 1 : 0;
+                return _lanes[(int)DeliveryLane.LIVE].Dequeue();
+            }
+            if (backlogReady)
+            {
+                _liveInARow = 0;
+                _backlogInFlight++;
+                return _lanes[(int)DeliveryLane.BACKLOG].Dequeue();
+            }
+            return null;
+        }
+
+        public void Dispose()
+        {
+            log.Debug("Disposing of DeliveryScheduler");
+            List<WorkItem> abandoned;
+            lock (_lock)
+            {
+                _disposed = true;
+                // live scans still go out, replaying backlog can wait for the next start
+                abandoned = _lanes[(int)DeliveryLane.BACKLOG].ToList();
+                _lanes[(int)DeliveryLane.BACKLOG].Clear();
+                laneMetrics[(int)DeliveryLane.BACKLOG].QueueDepth.Add(-abandoned.Count);
+                Monitor.PulseAll(_lock);
+            }
+            foreach (var item in abandoned)
+            {
+                item.Cancel();
+            }
+        }
+
+        public override string ToString()
+        {
+            lock (_lock)
+            {
+                return String.Format("DeliveryScheduler Workers [{0}] LivePending [{1}] BacklogPending [{2}] BacklogInFlight [{3}/{4}] MaxLiveInARow [{5}]",
+                    _workers.Length, _lanes[(int)DeliveryLane.LIVE].Count, _lanes[(int)DeliveryLane.BACKLOG].Count, _backlogInFlight, _maxBacklogConcurrent, _maxLiveInARow);
+            }
+        }
+
+        private class WorkItem
+        {
+            private readonly Stopwatch _clock = Stopwatch.StartNew();
+            private readonly Action _run;
+            private readonly Action _cancel;
+
+            public DeliveryLane Lane { get; private set; }
+
+            public WorkItem(DeliveryLane lane, Action run, Action cancel)
+            {
+                Lane = lane;
+                _run = run;
+                _cancel = cancel;
+            }
+
+            public long ElapsedTicks
+            {
+                get { return _clock.ElapsedTicks; }
+            }
+
+            public void Run()
+            {
+                _run();
+            }
+
+            public void Cancel()
+            {
+                _cancel();
+            }
+        }
+    }
+
+    // The registered metrics of a lane, labelled with it
+    public class LaneMetrics
+    {
+        public DeliveryLane Lane { get; private set; }
+
+        // scans waiting for a delivery thread
+        public MetricGauge QueueDepth { get; private set; }
+
+        // enqueue until a delivery thread picked the scan up
+        public MetricHistogram QueueTime { get; private set; }
+
+        // enqueue until the delivery finished
+        public MetricHistogram DeliveryTime { get; private set; }
+
+        internal LaneMetrics(DeliveryLane lane, MetricsRegistry registry)
+        {
+            Lane = lane;
+            String label = "lane=\"" + lane + "\"";
+            QueueDepth = registry.Gauge("alika_delivery_queue_depth", "Scans waiting for a delivery thread", label, null);
+            QueueTime = registry.Histogram("alika_delivery_queue_seconds", "Time a scan waited for a delivery thread",
+                label, MetricHistogram.SlowBucketsSeconds);
+            DeliveryTime = registry.Histogram("alika_delivery_seconds", "Time from queueing a scan until its delivery finished",
+                label, MetricHistogram.SlowBucketsSeconds);
+        }
+
+        public override string ToString()
+        {
+            return String.Format("LaneMetrics Lane [{0}] Queue [{1}] Delivery [{2}]", Lane, QueueTime, DeliveryTime);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Checks the scanner window for dirt over a window of live scans. The SDK finds dirt in the
+    // characters it reads off documents, so nothing is found while the reader is idle. Run, from
+    // the maintenance scheduler while the reader is idle, only enables the SDK dirt detection;
+    // it stays enabled for the next Scans documents read, HandleScanSourceEvent counts them, or
+    // at most MaxDuration, then it is disabled again until the next run. Dirt found is reported
+    // by the SDK as DIRT_DETECTED_ON_SCANNER_WINDOW, which is logged as a warning and counted.
+    // The detection costs the scans of the window, not the idle reader, so the scheduler's added
+    // latency does not show it: the time from the start to the end of each scan's data is
+    // recorded labelled by whether detection was on, to compare the two. The .NET wrapper does
+    // not expose MMMReader_EnableDisableDirtDetection, so it is called on
+    // MMMReaderLowLevelAPI.dll directly.
+    public class DirtDetectionMaintenanceTask : IReaderMaintenanceTask, IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<DirtDetectionMaintenanceTask>();
+        // of all tasks, off and on
+        private static readonly MetricHistogram[] scanReadTime = new[] { "off", "on" }
+            .Select(state => MetricsRegistry.Default.Histogram("alika_scan_read_seconds",
+                "Time from the start to the end of a scan's data, by whether dirt detection was on",
+                "dirt_detection=\"" + state + "\"", MetricHistogram.SlowBucketsSeconds))
+            .ToArray();
+        private static readonly TimeSpan DISABLE_RETRY = TimeSpan.FromMinutes(1);
+
+        private readonly object _lock = new object();
+        private DirtDetectSet _settings;
+        private readonly Timer _expiry;
+        private bool _enabled;
+        private int _scansLeft;
+        // Stopwatch timestamp the scan being read started at, 0 when none is
+        private long _scanStarted;
+        private bool _scanInWindow;
+        private long _windows;
+        private long _dirtDetected;
+
+        // scans as many documents as the SDK needs for its history
+        public DirtDetectionMaintenanceTask(TimeSpan maxDuration)
+            : this(5, maxDuration)
+        {
+        }
+
+        public DirtDetectionMaintenanceTask(int scans, TimeSpan maxDuration)
+        {
+            // SDK defaults, see DIRTDETECTSET in MMMReaderSettings.h
+            _settings = new DirtDetectSet
+            {
+                windowx = 15,
+                windowy = 10,
+                history = Math.Max(1, scans),
+                minbadcharcount = 5,
+                dirtthresh = 0.1f
+            };
+            Scans = Math.Max(1, scans);
+            MaxDuration = maxDuration;
+            _expiry = new Timer(state => Disable("after " + MaxDuration), null, Timeout.Infinite, Timeout.Infinite);
+        }
+
+        public String Name
+        {
+            get { return "DirtDetection"; }
+        }
+
+        public int Scans { get; private set; }
+        public TimeSpan MaxDuration { get; private set; }
+
+        public bool IsEnabled
+        {
+            get { lock (_lock) { return _enabled; } }
+        }
+
+        // Windows of live scans dirt detection was enabled for
+        public long Windows
+        {
+            get { return Interlocked.Read(ref _windows); }
+        }
+
+        public long DirtDetected
+        {
+            get { return Interlocked.Read(ref _dirtDetected); }
+        }
+
+        // Returns at once, the scans to check are still to come
+        public void Run(CancellationToken cancellationToken)
+        {
+            lock (_lock)
+            {
+                if (_enabled || cancellationToken.IsCancellationRequested)
+                {
+                    return;
+                }
+                EnableDisable(true);
+                _enabled = true;
+                _scansLeft = Scans;
+                _expiry.Change((long)MaxDuration.TotalMilliseconds, Timeout.Infinite);
+            }
+            Interlocked.Increment(ref _windows);
+            log.InfoFormat("Dirt detection enabled for the next [{0}] scans", Scans);
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            if (!e.IsDeviceEvent)
+            {
+                return;
+            }
+            switch (e.EventCode)
+            {
+                case MMM.Readers.FullPage.EventCode.DIRT_DETECTED_ON_SCANNER_WINDOW:
+                    Interlocked.Increment(ref _dirtDetected);
+                    log.Warn("Dirt detected on the scanner window, the window needs cleaning");
+                    break;
+                case MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA:
+                case MMM.Readers.FullPage.EventCode.START_OF_DOCUMENT_DATA:
+                    lock (_lock)
+                    {
+                        _scanStarted = Stopwatch.GetTimestamp();
+                        _scanInWindow = _enabled;
+                    }
+                    break;
+                case MMM.Readers.FullPage.EventCode.END_OF_SWIPE_DATA:
+                case MMM.Readers.FullPage.EventCode.END_OF_DOCUMENT_DATA:
+                    bool windowDone;
+                    long started;
+                    bool inWindow;
+                    lock (_lock)
+                    {
+                        started = _scanStarted;
+                        inWindow = _scanInWindow;
+                        _scanStarted = 0;
+                        windowDone = _enabled && --_scansLeft <= 0;
+                    }
+                    if (started != 0)
+                    {
+                        scanReadTime[inWindow ? 1 : 0].RecordSince(started);
+                    }
+                    if (windowDone)
+                    {
+                        Disable("after " + Scans + " scans");
+                    }
+                    break;
+            }
+        }
+
+        private void Disable(String reason)
+        {
+            lock (_lock)
+            {
+                if (!_enabled)
+                {
+                    return;
+                }
+                try
+                {
+                    EnableDisable(false);
+                }
+                catch (Exception ex)
+                {
+                    // still enabled, tried again by the next scan or the expiry
+                    log.WarnFormat("Unable to disable dirt detection [{0}]", ex.Message);
+                    _expiry.Change((long)DISABLE_RETRY.TotalMilliseconds, Timeout.Infinite);
+                    return;
+                }
+                _enabled = false;
+                _expiry.Change(Timeout.Infinite, Timeout.Infinite);
+            }
+            log.InfoFormat("Dirt detection disabled {0}", reason);
+        }
+
+        private void EnableDisable(bool enable)
+        {
+            _settings.status = (byte)(enable ? 1 : 0);
+            MMM.Readers.ErrorCode lErrorCode = (MMM.Readers.ErrorCode)MMMReader_EnableDisableDirtDetection(ref _settings);
+            if (lErrorCode != MMM.Readers.ErrorCode.NO_ERROR_OCCURRED)
+            {
+                String message = String.Format("Failed to {0} dirt detection {1} {2}", enable ? "enable" : "disable", (int)lErrorCode, lErrorCode.ToString());
+                throw new PosHardwareException(message);
+            }
+        }
+
+        [StructLayout(LayoutKind.Sequential)]
+        private struct DirtDetectSet
+        {
+            public int windowx;
+            public int windowy;
+            public int history;
+            public int minbadcharcount;
+            public float dirtthresh;
+            public byte status;
+        }
+
+        [DllImport("MMMReaderLowLevelAPI.dll", CallingConvention = CallingConvention.Cdecl)]
+        private static extern int MMMReader_EnableDisableDirtDetection(ref DirtDetectSet aDirtDetectSettings);
+
+        public void Dispose()
+        {
+            Disable("on dispose");
+            _expiry.Dispose();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("DirtDetectionMaintenanceTask Scans [{0}] MaxDuration [{1}] Enabled [{2}] Windows [{3}] DirtDetected [{4}]",
+                Scans, MaxDuration, IsEnabled, Windows, DirtDetected);
+        }
+    }
+}
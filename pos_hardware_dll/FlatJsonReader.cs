@@ -0,0 +1,178 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Reads a JSON object whose members are all strings, numbers, booleans or null into a
+    // case-insensitive name/value map without the reflection cost of Newtonsoft. Anything else
+    // (nested values, trailing garbage) returns false so the caller can fall back to Newtonsoft.
+    internal static class FlatJsonReader
+    {
+        public static bool TryRead(String json, out Dictionary<String, String> members)
+        {
+            members = new Dictionary<String, String>(StringComparer.OrdinalIgnoreCase);
+            if (json == null)
+            {
+                return false;
+            }
+            int i = SkipWhitespace(json, 0);
+            if (i >= json.Length || json[i] != '{')
+            {
+                return false;
+            }
+            i = SkipWhitespace(json, i + 1);
+            if (i < json.Length && json[i] == '}')
+            {
+                return SkipWhitespace(json, i + 1) == json.Length;
+            }
+            while (i < json.Length)
+            {
+                String name;
+                if (!TryReadString(json, ref i, out name))
+                {
+                    return false;
+                }
+                i = SkipWhitespace(json, i);
+                if (i >= json.Length || json[i] != ':')
+                {
+                    return false;
+                }
+                i = SkipWhitespace(json, i + 1);
+                String value;
+                if (!TryReadValue(json, ref i, out value))
+                {
+                    return false;
+                }
+                members[name] = value;
+                i = SkipWhitespace(json, i);
+                if (i < json.Length && json[i] == ',')
+                {
+                    i = SkipWhitespace(json, i + 1);
+                    continue;
+                }
+                if (i < json.Length && json[i] == '}')
+                {
+                    return SkipWhitespace(json, i + 1) == json.Length;
+                }
+                return false;
+            }
+            return false;
+        }
+
+        private static bool TryReadValue(String json, ref int i, out String value)
+        {
+            value = null;
+            if (i >= json.Length)
+            {
+                return false;
+            }
+            if (json[i] == '"')
+            {
+                return TryReadString(json, ref i, out value);
+            }
+            int start = i;
+            while (i < json.Length && (Char.IsLetterOrDigit(json[i]) || json[i] == '-' || json[i] == '+' || json[i] == '.'))
+            {
+                i++;
+            }
+            String literal = json.Substring(start, i - start);
+            if (literal == "null")
+            {
+                return true;
+            }
+            if (literal == "true" || literal == "false")
+            {
+                value = literal;
+                return true;
+            }
+            double number;
+            if (Double.TryParse(literal, NumberStyles.Float, CultureInfo.InvariantCulture, out number))
+            {
+                value = literal;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool TryReadString(String json, ref int i, out String value)
+        {
+            value = null;
+            if (i >= json.Length || json[i] != '"')
+            {
+                return false;
+            }
+            i++;
+            int runStart = i;
+            StringBuilder unescaped = null;
+            while (i < json.Length)
+            {
+                char c = json[i];
+                if (c == '"')
+                {
+                    if (unescaped == null)
+                    {
+                        value = json.Substring(runStart, i - runStart);
+                    }
+                    else
+                    {
+                        value = unescaped.Append(json, runStart, i - runStart).ToString();
+                    }
+                    i++;
+                    return true;
+                }
+                if (c != '\\')
+                {
+                    i++;
+                    continue;
+                }
+                if (unescaped == null)
+                {
+                    unescaped = new StringBuilder();
+                }
+                unescaped.Append(json, runStart, i - runStart);
+                if (i + 1 >= json.Length)
+                {
+                    return false;
+                }
+                char escaped = json[i + 1];
+                i += 2;
+                switch (escaped)
+                {
+                    case '"': unescaped.Append('"'); break;
+                    case '\\': unescaped.Append('\\'); break;
+                    case '/': unescaped.Append('/'); break;
+                    case 'b': unescaped.Append('\b'); break;
+                    case 'f': unescaped.Append('\f'); break;
+                    case 'n': unescaped.Append('\n'); break;
+                    case 'r': unescaped.Append('\r'); break;
+                    case 't': unescaped.Append('\t'); break;
+                    case 'u':
+                        int code;
+                        if (i + 4 > json.Length || !Int32.TryParse(json.Substring(i, 4), NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out code))
+                        {
+                            return false;
+                        }
+                        unescaped.Append((char)code);
+                        i += 4;
+                        break;
+                    default:
+                        return false;
+                }
+                runStart = i;
+            }
+            return false;
+        }
+
+        private static int SkipWhitespace(String json, int i)
+        {
+            while (i < json.Length && Char.IsWhiteSpace(json[i]))
+            {
+                i++;
+            }
+            return i;
+        }
+    }
+}
@@ -0,0 +1,17 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Hardware
+{
+    public interface IReaderMaintenanceTask
+    {
+        String Name { get; }
+
+        // Runs the housekeeping work. Implementations must poll the token and return promptly,
+        // leaving the reader ready for the next swipe, once cancellation is requested.
+        void Run(CancellationToken cancellationToken);
+    }
+}
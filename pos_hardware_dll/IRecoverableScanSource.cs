@@ -0,0 +1,14 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // A scan source that can re-establish its connection to the device without being activated
+    // again from scratch
+    public interface IRecoverableScanSource : IScanSource
+    {
+        void Reconnect();
+    }
+}
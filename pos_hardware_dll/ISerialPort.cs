@@ -0,0 +1,16 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Byte transport used by RteProtocolEngine. Read returns 0 when nothing arrived within the
+    // read timeout instead of throwing, so the engine can check command deadlines in between.
+    public interface ISerialPort : IDisposable
+    {
+        void Open();
+        int Read(byte[] buffer, int offset, int count);
+        void Write(byte[] buffer, int offset, int count);
+    }
+}
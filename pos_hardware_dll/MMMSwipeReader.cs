@@ -4,23 +4,45 @@ using System.Linq;
 using System.Text;
 using System.Text.RegularExpressions;
 using System.Media;
+using System.Diagnostics;
 using CH.Alika.POS.Hardware.Logging;
 
 namespace CH.Alika.POS.Hardware
 {
 
-    public class MMMSwipeReader : IScanSource
+    public class MMMSwipeReader : IRecoverableScanSource
     {
         private static readonly ILog log = LogProvider.For<MMMSwipeReader>();
 
         private MMM.Readers.Modules.Swipe.SwipeSettings swipeSettings;
-        public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent;
-        public event EventHandler<ScanSourceEvent> OnScanSourceEvent;
+        private readonly ScanSourceEventDispatcher dispatcher;
+
+        public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent
+        {
+            add { dispatcher.OnCodeLineScanEvent += value; }
+            remove { dispatcher.OnCodeLineScanEvent -= value; }
+        }
+
+        public event EventHandler<ScanSourceEvent> OnScanSourceEvent
+        {
+            add { dispatcher.OnScanSourceEvent += value; }
+            remove { dispatcher.OnScanSourceEvent -= value; }
+        }
+
+        // Kept for the lifetime of the reader so that the callbacks handed to the SDK are not
+        // collected, and so that a reconnect can reuse them
+        private readonly MMM.Readers.ErrorDelegate errorDelegate;
+        private readonly MMM.Readers.Modules.Swipe.DataDelegate dataDelegate;
+        private readonly MMM.Readers.FullPage.EventDelegate eventDelegate;
+        private bool loggingInitialized = false;
+        private bool swipeSettingsLoaded = false;
 
         public MMMSwipeReader()
         {
-            OnCodeLineScanEvent += delegate(Object sender, CodeLineScanEvent e) { };
-            OnScanSourceEvent += delegate(Object sender, ScanSourceEvent e) { };
+            dispatcher = new ScanSourceEventDispatcher(this);
+            errorDelegate = new MMM.Readers.ErrorDelegate(dispatcher.ErrorReceived);
+            dataDelegate = new MMM.Readers.Modules.Swipe.DataDelegate(dispatcher.DataReceived);
+            eventDelegate = new MMM.Readers.FullPage.EventDelegate(dispatcher.EventReceived);
         }
 
         public void Activate()
@@ -29,21 +51,51 @@ namespace CH.Alika.POS.Hardware
             // Initialise logging and error handling first. The error handler callback
             // will receive all error messages generated by the 3M Page Reader SDK
             MMM.Readers.Modules.Reader.SetErrorHandler(
-                new MMM.Readers.ErrorDelegate(DeviceErrorHandler),
+                errorDelegate,
                 IntPtr.Zero
             );
 
-            InitalizeLogging();
-            LoadSwipeSettings(ref swipeSettings);
+            // Logging and settings survive a reconnect, only load them the first time
+            if (!loggingInitialized)
+            {
+                InitalizeLogging();
+                loggingInitialized = true;
+            }
+            if (!swipeSettingsLoaded)
+            {
+                LoadSwipeSettings(ref swipeSettings);
+                swipeSettingsLoaded = true;
+            }
             InitializeSwipeReader(
                 swipeSettings,
-                new MMM.Readers.Modules.Swipe.DataDelegate(DeviceDataHandler),
-                new MMM.Readers.FullPage.EventDelegate(DeviceEventHandler));
+                dataDelegate,
+                eventDelegate);
 
             log.Debug("End Swipe Reader Activation");
             log.Info("Swipe Reader Acquired");
         }
 
+        // Warm restart after the reader dropped: the settings already in memory are pushed back
+        // to the SDK, which reopens the connection, instead of going through a full Activate
+        public void Reconnect()
+        {
+            log.Debug("Begin Swipe Reader reconnect");
+            if (!swipeSettingsLoaded || !MMM.Readers.Modules.Swipe.IsInitialised())
+            {
+                Activate();
+                return;
+            }
+
+            MMM.Readers.ErrorCode lErrorCode = MMM.Readers.Modules.Swipe.UpdateSettings(swipeSettings);
+            if (lErrorCode != MMM.Readers.ErrorCode.NO_ERROR_OCCURRED)
+            {
+                String message = String.Format("Failed SwipeReader Reconnect {0} {1}", (int)lErrorCode, lErrorCode.ToString());
+                throw new PosHardwareException(message);
+            }
+            log.Debug("End Swipe Reader reconnect");
+            log.Info("Swipe Reader Reacquired");
+        }
+
         public override String ToString()
         {
             // Display the hardware device and protocol in use
@@ -106,8 +158,17 @@ namespace CH.Alika.POS.Hardware
             }
         }
 
-        private void LoadSwipeSettings(ref MMM.Readers.Modules.Swipe.SwipeSettings swipeSettings)
+        // From the snapshot when the INI files did not change since it was saved, see RteSwipeReader
+        internal static void LoadSwipeSettings(ref MMM.Readers.Modules.Swipe.SwipeSettings swipeSettings)
         {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            String configDir = MMM.Readers.Modules.Reader.GetConfigDir();
+            if (SwipeSettingsSnapshot.TryLoad(SwipeSettingsSnapshot.DefaultPath, configDir, out swipeSettings))
+            {
+                log.InfoFormat("Loaded Swipe Settings from snapshot in [{0}ms]", stopwatch.ElapsedMilliseconds);
+                return;
+            }
+
             MMM.Readers.ErrorCode lErrorCode = MMM.Readers.Modules.Reader.LoadSwipeSettings(
                     ref swipeSettings
                 );
@@ -119,8 +180,16 @@ namespace CH.Alika.POS.Hardware
                 log.Warn(message);
                 throw new PosHardwareException(message);
             }
+            log.InfoFormat("Loaded Swipe Settings from INI files in [{0}ms]", stopwatch.ElapsedMilliseconds);
 
-
+            try
+            {
+                SwipeSettingsSnapshot.Save(SwipeSettingsSnapshot.DefaultPath, configDir, swipeSettings);
+            }
+            catch (Exception ex)
+            {
+                log.WarnFormat("Unable to save swipe settings snapshot [{0}]", ex.Message);
+            }
         }
 
         private void InitalizeLogging()
@@ -141,48 +210,6 @@ namespace CH.Alika.POS.Hardware
         }
 
 
-        private void DeviceDataHandler(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData)
-        {
-            log.DebugFormat("Device data: swipe item [{0}], swipe data [{1}]", swipeItem, swipeData);
-            NotifyListeners(new ScanSourceEvent(swipeItem, swipeData));
-
-            if (swipeItem == MMM.Readers.Modules.Swipe.SwipeItem.OCR_CODELINE)
-            {
-                
-                MMM.Readers.CodelineData codeLineData = (MMM.Readers.CodelineData)swipeData;
-                using (LogProvider.OpenNestedContext(codeLineData.Surname)) {
-                    log.InfoFormat("CodeLineData ValidationResult [{0}]", codeLineData.CodelineValidationResult);
-                    NotifyListeners(codeLineData);
-                }
-            }
-        }
-
-        private void NotifyListeners(MMM.Readers.CodelineData codeLineData)
-        {
-            log.Info("Notifying listeners of document scan");
-            log.DebugFormat("Begin notification of CodeLineScanEvent listeners [{0}]", codeLineData);
-            try { OnCodeLineScanEvent(this, new CodeLineScanEvent(codeLineData)); }
-            catch { };
-            log.DebugFormat("End notification of CodeLineScanEvent listeners [{0}]", codeLineData);
-        }
-
-        private void NotifyListeners(ScanSourceEvent e) {
-            log.DebugFormat("Begin notifying ScanSourceEvent listeners [{0}]", e);
-            try { OnScanSourceEvent(this, e); }
-            catch { };
-            log.DebugFormat("End notifying ScanSourceEvent listeners");
-        }
-
-        private void DeviceErrorHandler(MMM.Readers.ErrorCode errorCode, string errorMessage)
-        {
-            NotifyListeners(new ScanSourceEvent(errorCode,errorMessage));
-        }
-
-        private void DeviceEventHandler(MMM.Readers.FullPage.EventCode eventCode)
-        {
-            NotifyListeners(new ScanSourceEvent(eventCode));
-        }
-
         public void Dispose()
         {
             log.Debug("Begin disposing of SwipeReader");
@@ -0,0 +1,57 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Monotonic count of events, see MetricsRegistry
+    public class MetricCounter : IMetric
+    {
+        private long _value;
+
+        public String Name { get; private set; }
+        public String Labels { get; private set; }
+        public String Help { get; private set; }
+
+        internal MetricCounter(String name, String help, String labels)
+        {
+            Name = name;
+            Help = help;
+            Labels = labels;
+        }
+
+        public MetricType Type
+        {
+            get { return MetricType.COUNTER; }
+        }
+
+        public long Value
+        {
+            get { return Interlocked.Read(ref _value); }
+        }
+
+        public void Increment()
+        {
+            Interlocked.Increment(ref _value);
+        }
+
+        public void Add(long count)
+        {
+            Interlocked.Add(ref _value, count);
+        }
+
+        public void WriteSamples(TextWriter writer)
+        {
+            MetricsRegistry.WriteSample(writer, Name, Labels, null, Value.ToString(CultureInfo.InvariantCulture));
+        }
+
+        public override string ToString()
+        {
+            return String.Format("MetricCounter Name [{0}] Labels [{1}] Value [{2}]", Name, Labels, Value);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Value that goes up and down, either set by the code it describes or read from it when the
+    // metrics are exported, see MetricsRegistry
+    public class MetricGauge : IMetric
+    {
+        private readonly Func<long> _read;
+        private long _value;
+
+        public String Name { get; private set; }
+        public String Labels { get; private set; }
+        public String Help { get; private set; }
+
+        internal MetricGauge(String name, String help, String labels, Func<long> read)
+        {
+            Name = name;
+            Help = help;
+            Labels = labels;
+            _read = read;
+        }
+
+        public MetricType Type
+        {
+            get { return MetricType.GAUGE; }
+        }
+
+        public long Value
+        {
+            get
+            {
+                if (_read == null)
+                {
+                    return Interlocked.Read(ref _value);
+                }
+                try { return _read(); }
+                catch { return 0; }
+            }
+        }
+
+        public void Set(long value)
+        {
+            Interlocked.Exchange(ref _value, value);
+        }
+
+        public void Increment()
+        {
+            Interlocked.Increment(ref _value);
+        }
+
+        public void Decrement()
+        {
+            Interlocked.Decrement(ref _value);
+        }
+
+        public void Add(long amount)
+        {
+            Interlocked.Add(ref _value, amount);
+        }
+
+        public void WriteSamples(TextWriter writer)
+        {
+            MetricsRegistry.WriteSample(writer, Name, Labels, null, Value.ToString(CultureInfo.InvariantCulture));
+        }
+
+        public override string ToString()
+        {
+            return String.Format("MetricGauge Name [{0}] Labels [{1}] Value [{2}]", Name, Labels, Value);
+        }
+    }
+}
@@ -0,0 +1,114 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Distribution of durations over fixed buckets, see MetricsRegistry. Durations are recorded
+    // in Stopwatch ticks, so timing an operation takes two Stopwatch.GetTimestamp calls and two
+    // interlocked adds; they are converted to seconds only when exported. The count is not kept
+    // apart, it is the sum of the buckets.
+    public class MetricHistogram : IMetric
+    {
+        // in process work, e.g. decoding a codeline
+        public static readonly double[] FastBucketsSeconds = new double[]
+        {
+            0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01
+        };
+
+        // work that waits on a device or the network
+        public static readonly double[] SlowBucketsSeconds = new double[]
+        {
+            0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+        };
+
+        private readonly double[] _upperBoundsSeconds;
+        private readonly long[] _upperBoundsTicks;
+        // the last bucket, past the final bound, counts everything slower
+        private readonly long[] _buckets;
+        private long _sumTicks;
+
+        public String Name { get; private set; }
+        public String Labels { get; private set; }
+        public String Help { get; private set; }
+
+        internal MetricHistogram(String name, String help, String labels, double[] upperBoundsSeconds)
+        {
+            Name = name;
+            Help = help;
+            Labels = labels;
+            _upperBoundsSeconds = (double[])upperBoundsSeconds.Clone();
+            _upperBoundsTicks = _upperBoundsSeconds.Select(s => (long)(s * Stopwatch.Frequency)).ToArray();
+            _buckets = new long[_upperBoundsTicks.Length + 1];
+        }
+
+        public MetricType Type
+        {
+            get { return MetricType.HISTOGRAM; }
+        }
+
+        public long Value
+        {
+            get
+            {
+                long count = 0;
+                for (int i = 0; i < _buckets.Length; i++)
+                {
+                    count += Interlocked.Read(ref _buckets[i]);
+                }
+                return count;
+            }
+        }
+
+        public long SumTicks
+        {
+            get { return Interlocked.Read(ref _sumTicks); }
+        }
+
+        public void Record(long stopwatchTicks)
+        {
+            stopwatchTicks = Math.Max(0L, stopwatchTicks);
+            int bucket = 0;
+            while (bucket < _upperBoundsTicks.Length && stopwatchTicks > _upperBoundsTicks[bucket])
+            {
+                bucket++;
+            }
+            Interlocked.Increment(ref _buckets[bucket]);
+            Interlocked.Add(ref _sumTicks, stopwatchTicks);
+        }
+
+        // started is a Stopwatch.GetTimestamp taken when the operation began
+        public void RecordSince(long started)
+        {
+            Record(Stopwatch.GetTimestamp() - started);
+        }
+
+        public void WriteSamples(TextWriter writer)
+        {
+            long cumulative = 0;
+            for (int i = 0; i < _upperBoundsSeconds.Length; i++)
+            {
+                cumulative += Interlocked.Read(ref _buckets[i]);
+                MetricsRegistry.WriteSample(writer, Name + "_bucket", Labels,
+                    "le=\"" + MetricsRegistry.Format(_upperBoundsSeconds[i]) + "\"", cumulative.ToString(CultureInfo.InvariantCulture));
+            }
+            double sumSeconds = (double)SumTicks / Stopwatch.Frequency;
+            long count = cumulative + Interlocked.Read(ref _buckets[_upperBoundsSeconds.Length]);
+            MetricsRegistry.WriteSample(writer, Name + "_bucket", Labels, "le=\"+Inf\"", count.ToString(CultureInfo.InvariantCulture));
+            MetricsRegistry.WriteSample(writer, Name + "_sum", Labels, null, MetricsRegistry.Format(sumSeconds));
+            MetricsRegistry.WriteSample(writer, Name + "_count", Labels, null, count.ToString(CultureInfo.InvariantCulture));
+        }
+
+        public override string ToString()
+        {
+            long count = Value;
+            return String.Format("MetricHistogram Name [{0}] Labels [{1}] Count [{2}] MeanUs [{3:F1}]", Name, Labels, count,
+                count == 0 ? 0 : SumTicks * 1000000.0 / Stopwatch.Frequency / count);
+        }
+    }
+}
@@ -0,0 +1,149 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum MetricType
+    {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    }
+
+    public interface IMetric
+    {
+        // metric family, metrics of one family differ in their labels
+        String Name { get; }
+        // Prometheus label pairs without braces, e.g. lane="LIVE", or null
+        String Labels { get; }
+        String Help { get; }
+        MetricType Type { get; }
+        // total of a counter, value of a gauge, number of recordings of a histogram
+        long Value { get; }
+
+        // Sample lines in the Prometheus text format
+        void WriteSamples(TextWriter writer);
+    }
+
+    // Metrics of the process, exported by the service. Metrics are looked up once, typically into
+    // a static field, and recording into them takes no lock; the registry itself is only locked
+    // to add a metric. Asking again for a metric of the same name and labels gives the one
+    // already registered, so the metrics of objects that are created more than once, like the
+    // reader after a reconnect, add up.
+    public class MetricsRegistry
+    {
+        public static readonly MetricsRegistry Default = new MetricsRegistry();
+
+        private readonly object _lock = new object();
+        // replaced rather than changed, so exporters read it without the lock
+        private IMetric[] _metrics = new IMetric[0];
+
+        public IList<IMetric> Metrics
+        {
+            get { return _metrics; }
+        }
+
+        public MetricCounter Counter(String name, String help)
+        {
+            return Counter(name, help, null);
+        }
+
+        public MetricCounter Counter(String name, String help, String labels)
+        {
+            return GetOrAdd(new MetricCounter(name, help, labels));
+        }
+
+        public MetricGauge Gauge(String name, String help)
+        {
+            return GetOrAdd(new MetricGauge(name, help, null, null));
+        }
+
+        // Gauge read when exported, e.g. a queue length
+        public MetricGauge Gauge(String name, String help, String labels, Func<long> read)
+        {
+            return GetOrAdd(new MetricGauge(name, help, labels, read));
+        }
+
+        public MetricHistogram Histogram(String name, String help, double[] upperBoundsSeconds)
+        {
+            return Histogram(name, help, null, upperBoundsSeconds);
+        }
+
+        public MetricHistogram Histogram(String name, String help, String labels, double[] upperBoundsSeconds)
+        {
+            return GetOrAdd(new MetricHistogram(name, help, labels, upperBoundsSeconds));
+        }
+
+        private T GetOrAdd<T>(T metric) where T : class, IMetric
+        {
+            lock (_lock)
+            {
+                IMetric existing = _metrics.FirstOrDefault(m => m.Name == metric.Name && m.Labels == metric.Labels);
+                if (existing != null)
+                {
+                    var same = existing as T;
+                    if (same == null)
+                    {
+                        throw new PosHardwareException(String.Format("Metric [{0}] is already registered as [{1}]", metric.Name, existing.Type));
+                    }
+                    return same;
+                }
+                // families stay together, as the text format wants them
+                var metrics = _metrics.ToList();
+                int family = metrics.FindLastIndex(m => m.Name == metric.Name);
+                metrics.Insert(family < 0 ? metrics.Count : family + 1, metric);
+                _metrics = metrics.ToArray();
+                return metric;
+            }
+        }
+
+        // Prometheus text exposition format, version 0.0.4
+        public void WritePrometheus(TextWriter writer)
+        {
+            String family = null;
+            foreach (IMetric metric in _metrics)
+            {
+                if (metric.Name != family)
+                {
+                    family = metric.Name;
+                    writer.Write("# HELP {0} {1}\n", metric.Name, metric.Help.Replace("\\", "\\\\").Replace("\n", "\\n"));
+                    writer.Write("# TYPE {0} {1}\n", metric.Name, metric.Type.ToString().ToLowerInvariant());
+                }
+                metric.WriteSamples(writer);
+            }
+        }
+
+        internal static void WriteSample(TextWriter writer, String name, String labels, String extraLabel, String value)
+        {
+            writer.Write(name);
+            if (labels != null || extraLabel != null)
+            {
+                writer.Write('{');
+                writer.Write(labels);
+                if (labels != null && extraLabel != null)
+                {
+                    writer.Write(',');
+                }
+                writer.Write(extraLabel);
+                writer.Write('}');
+            }
+            writer.Write(' ');
+            writer.Write(value);
+            writer.Write('\n');
+        }
+
+        internal static String Format(double value)
+        {
+            return value.ToString("R", CultureInfo.InvariantCulture);
+        }
+
+        public override string ToString()
+        {
+            return String.Format("MetricsRegistry Metrics [{0}]", _metrics.Length);
+        }
+    }
+}
@@ -0,0 +1,188 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Parses the ICAO 9303 machine readable zone of a passport (TD3, 2 lines of 44), an identity
+    // card (TD1, 3 lines of 30) or a TD2 document (2 lines of 36) into the codeline the SDK
+    // delivers for it, for the readers driven without the SDK, see RteSwipeReader. Every check
+    // digit is validated; text of another shape keeps its lines only and is not validated.
+    public static class MrzCodelineParser
+    {
+        private static readonly char[] lineBreaks = new char[] { '\r', '\n' };
+
+        public static MMM.Readers.CodelineData Parse(String text)
+        {
+            String[] lines = text.Split(lineBreaks, StringSplitOptions.RemoveEmptyEntries);
+            var data = new MMM.Readers.CodelineData();
+            data.Data = String.Join("\r", lines);
+            data.LineCount = lines.Length;
+            data.Line1 = lines.Length > 0 ? lines[0] : String.Empty;
+            data.Line2 = lines.Length > 1 ? lines[1] : String.Empty;
+            data.Line3 = lines.Length > 2 ? lines[2] : String.Empty;
+            data.CodelineValidationResult = MMM.Readers.CheckDigitResult.CDR_NotValidated;
+            var checkDigits = new List<MMM.Readers.CodelineCheckDigitData>();
+
+            if (lines.Length == 2 && lines[0].Length == 44 && lines[1].Length == 44)
+            {
+                ParseTd2Or3(lines[0], lines[1], ref data, checkDigits);
+            }
+            else if (lines.Length == 2 && lines[0].Length == 36 && lines[1].Length == 36)
+            {
+                ParseTd2Or3(lines[0], lines[1], ref data, checkDigits);
+            }
+            else if (lines.Length == 3 && lines.All(line => line.Length == 30))
+            {
+                ParseTd1(lines[0], lines[1], lines[2], ref data, checkDigits);
+            }
+            else
+            {
+                return data;
+            }
+
+            data.CheckDigitDataList = checkDigits.ToArray();
+            data.CheckDigitDataListCount = checkDigits.Count;
+            data.CodelineValidationResult = checkDigits.All(c => c.puResult == MMM.Readers.CheckDigitResult.CDR_Valid)
+                ? MMM.Readers.CheckDigitResult.CDR_Valid
+                : MMM.Readers.CheckDigitResult.CDR_Invalid;
+            return data;
+        }
+
+        // TD3 and TD2 differ in the length of the names and optional data only
+        private static void ParseTd2Or3(String line1, String line2, ref MMM.Readers.CodelineData data, List<MMM.Readers.CodelineCheckDigitData> checkDigits)
+        {
+            int length = line2.Length;
+            ParseDocument(line1, ref data);
+            ParseNames(line1.Substring(5), ref data);
+            data.DocNumber = Field(line2, 0, 9);
+            data.DocId = data.DocNumber;
+            data.Nationality = Field(line2, 10, 3);
+            data.DateOfBirth = ParseDate(line2, 13, false);
+            ParseSex(line2[20], ref data);
+            data.ExpiryDate = ParseDate(line2, 21, true);
+            data.OptionalData1 = Field(line2, 28, length - 29 - (length == 44 ? 1 : 0));
+            data.OptionalData2 = String.Empty;
+
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_DocID, 2, line2, 9, line2.Substring(0, 9)));
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_DOB, 2, line2, 19, line2.Substring(13, 6)));
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_Expiry, 2, line2, 27, line2.Substring(21, 6)));
+            if (length == 44)
+            {
+                checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_OptionalData, 2, line2, 42, line2.Substring(28, 14)));
+            }
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_Overall, 2, line2, length - 1,
+                line2.Substring(0, 10) + line2.Substring(13, 7) + line2.Substring(21, length - 22)));
+        }
+
+        private static void ParseTd1(String line1, String line2, String line3, ref MMM.Readers.CodelineData data, List<MMM.Readers.CodelineCheckDigitData> checkDigits)
+        {
+            ParseDocument(line1, ref data);
+            data.DocNumber = Field(line1, 5, 9);
+            data.DocId = data.DocNumber;
+            data.OptionalData1 = Field(line1, 15, 15);
+            data.DateOfBirth = ParseDate(line2, 0, false);
+            ParseSex(line2[7], ref data);
+            data.ExpiryDate = ParseDate(line2, 8, true);
+            data.Nationality = Field(line2, 15, 3);
+            data.OptionalData2 = Field(line2, 18, 11);
+            ParseNames(line3, ref data);
+
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_DocID, 1, line1, 14, line1.Substring(5, 9)));
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_DOB, 2, line2, 6, line2.Substring(0, 6)));
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_Expiry, 2, line2, 14, line2.Substring(8, 6)));
+            checkDigits.Add(Check(MMM.Readers.CheckDigitType.CDT_Overall, 2, line2, 29,
+                line1.Substring(5) + line2.Substring(0, 7) + line2.Substring(8, 7) + line2.Substring(18, 11)));
+        }
+
+        private static void ParseDocument(String line1, ref MMM.Readers.CodelineData data)
+        {
+            switch (line1[0])
+            {
+                case 'P': data.DocType = "PASSPORT"; break;
+                case 'V': data.DocType = "VISA"; break;
+                case 'I':
+                case 'A':
+                case 'C': data.DocType = "IDENTITY CARD"; break;
+                default: data.DocType = "UNKNOWN DOCUMENT"; break;
+            }
+            data.IssuingState = Field(line1, 2, 3);
+        }
+
+        // SURNAME<<FIRST<SECOND<<<
+        private static void ParseNames(String field, ref MMM.Readers.CodelineData data)
+        {
+            int separator = field.IndexOf("<<", StringComparison.Ordinal);
+            String surname = separator < 0 ? field : field.Substring(0, separator);
+            String[] forenames = separator < 0
+                ? new String[0]
+                : field.Substring(separator + 2).Split(new[] { '<' }, StringSplitOptions.RemoveEmptyEntries);
+            data.Surname = surname.Replace('<', ' ').Trim();
+            data.Forenames = String.Join(" ", forenames);
+            data.Forename = forenames.Length > 0 ? forenames[0] : String.Empty;
+            data.SecondName = forenames.Length > 1 ? forenames[1] : String.Empty;
+        }
+
+        private static void ParseSex(char sex, ref MMM.Readers.CodelineData data)
+        {
+            switch (sex)
+            {
+                case 'M': data.Sex = "Male"; data.ShortSex = (byte)'M'; break;
+                case 'F': data.Sex = "Female"; data.ShortSex = (byte)'F'; break;
+                default: data.Sex = "Unknown"; data.ShortSex = (byte)'U'; break;
+            }
+        }
+
+        // YYMMDD; a birth year is never in the future, an expiry year always in this century
+        private static MMM.Readers.Date ParseDate(String line, int start, bool isExpiry)
+        {
+            var date = new MMM.Readers.Date();
+            int year, month, day;
+            if (!Int32.TryParse(line.Substring(start, 2), out year)
+                || !Int32.TryParse(line.Substring(start + 2, 2), out month)
+                || !Int32.TryParse(line.Substring(start + 4, 2), out day))
+            {
+                return date;
+            }
+            int century = isExpiry || year <= DateTime.UtcNow.Year % 100 ? 2000 : 1900;
+            date.Year = century + year;
+            date.Month = month;
+            date.Day = day;
+            return date;
+        }
+
+        private static String Field(String line, int start, int length)
+        {
+            return line.Substring(start, length).Replace('<', ' ').Trim();
+        }
+
+        private static MMM.Readers.CodelineCheckDigitData Check(MMM.Readers.CheckDigitType type, int lineNumber, String line, int position, String value)
+        {
+            char expected = CheckDigit(value);
+            // a filler stands for 0, e.g. for empty optional data
+            char read = line[position] == '<' ? '0' : line[position];
+            var checkDigit = new MMM.Readers.CodelineCheckDigitData();
+            checkDigit.puCheckDigitType = type;
+            checkDigit.puCodelineNumber = lineNumber;
+            checkDigit.puCodelinePos = position;
+            checkDigit.puValueExpected = expected;
+            checkDigit.puValueRead = line[position];
+            checkDigit.puResult = read == expected ? MMM.Readers.CheckDigitResult.CDR_Valid : MMM.Readers.CheckDigitResult.CDR_Invalid;
+            return checkDigit;
+        }
+
+        // Weights 7, 3, 1 over digits, letters as 10 to 35 and fillers as 0, modulo 10
+        internal static char CheckDigit(String value)
+        {
+            int sum = 0;
+            for (int i = 0; i < value.Length; i++)
+            {
+                char c = value[i];
+                int v = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'Z' ? c - 'A' + 10 : 0;
+                sum += v * (i % 3 == 0 ? 7 : i % 3 == 1 ? 3 : 1);
+            }
+            return (char)('0' + sum % 10);
+        }
+    }
+}
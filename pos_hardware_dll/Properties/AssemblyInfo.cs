@@ -34,3 +34,6 @@ using System.Runtime.InteropServices;
 // [assembly: AssemblyVersion("1.0.*")]
 [assembly: AssemblyVersion("1.0.0.0")]
 [assembly: AssemblyFileVersion("1.0.0.0")]
+
+// The benchmark times and checks the codecs and the cipher below their public entry points
+[assembly: InternalsVisibleTo("AlikaPosBenchmark")]
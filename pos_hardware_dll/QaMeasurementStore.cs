@@ -0,0 +1,184 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Fixed schema, columnar ring buffer of the RTE QA measurements the swipe reader reports for
+    // every scan.
+    // All columns are allocated up front so recording a scan only copies a handful of numbers.
+    // Line columns are indexed by (row * MaxLines + line).
+    public class QaMeasurementStore
+    {
+        private static readonly ILog log = LogProvider.For<QaMeasurementStore>();
+        public const int MaxLines = 3;
+        public const int DefaultCapacity = 4096;
+
+        private readonly object _lock = new object();
+        private readonly int _capacity;
+        private long _count = 0;
+
+        // scan columns
+        private readonly long[] _timestamp;
+        private readonly byte[] _lineCount;
+        private readonly int[] _spotCount;
+
+        // line columns
+        private readonly int[] _charCount;
+        private readonly int[] _badCharCount;
+        private readonly int[] _brokenCharCount;
+        private readonly float[] _strokeWidth;
+
+        public event EventHandler<QaMeasurementEvent> OnQaMeasurementEvent;
+
+        public QaMeasurementStore()
+            : this(DefaultCapacity)
+        {
+        }
+
+        public QaMeasurementStore(int capacity)
+        {
+            if (capacity <= 0)
+            {
+                throw new ArgumentOutOfRangeException("capacity");
+            }
+            _capacity = capacity;
+            _timestamp = new long[capacity];
+            _lineCount = new byte[capacity];
+            _spotCount = new int[capacity];
+            _charCount = new int[capacity * MaxLines];
+            _badCharCount = new int[capacity * MaxLines];
+            _brokenCharCount = new int[capacity * MaxLines];
+            _strokeWidth = new float[capacity * MaxLines];
+            OnQaMeasurementEvent += delegate(Object sender, QaMeasurementEvent e) { };
+        }
+
+        public int Capacity
+        {
+            get { return _capacity; }
+        }
+
+        // Total number of scans recorded since creation, including those already overwritten
+        public long Count
+        {
+            get { lock (_lock) { return _count; } }
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            if (e.IsDataEvent && e.SwipeItem == MMM.Readers.Modules.Swipe.SwipeItem.RTE_QA_DATA)
+            {
+                Record((MMM.Readers.Modules.Swipe.RTEQAData)e.SwipeData);
+            }
+        }
+
+        public void Record(MMM.Readers.Modules.Swipe.RTEQAData qaData)
+        {
+            long row;
+            lock (_lock)
+            {
+                row = _count;
+                int scan = BeginRow(qaData.CodelineCount, qaData.SpotCount);
+                SetLine(scan, 0, qaData.Line1);
+                SetLine(scan, 1, qaData.Line2);
+                SetLine(scan, 2, qaData.Line3);
+                _count++;
+            }
+            OnQaMeasurementEvent(this, new QaMeasurementEvent(this, row));
+        }
+
+        // Copies a recorded row into a summary. Returns false when the row has been overwritten.
+        public bool TryRead(long row, out QaScanSummary summary)
+        {
+            summary = new QaScanSummary();
+            lock (_lock)
+            {
+                if (row < 0 || row >= _count || row < _count - _capacity)
+                {
+                    return false;
+                }
+                int scan = (int)(row % _capacity);
+                summary.Row = row;
+                summary.Timestamp = new DateTime(_timestamp[scan], DateTimeKind.Utc);
+                summary.LineCount = _lineCount[scan];
+                summary.SpotCount = _spotCount[scan];
+                float strokeSum = 0;
+                int strokeLines = 0;
+                for (int line = 0; line < MaxLines; line++)
+                {
+                    int i = scan * MaxLines + line;
+                    summary.CharCount += _charCount[i];
+                    summary.BadCharCount += _badCharCount[i];
+                    summary.BrokenCharCount += _brokenCharCount[i];
+                    if (_charCount[i] > 0 && !float.IsNaN(_strokeWidth[i]))
+                    {
+                        strokeSum += _strokeWidth[i];
+                        strokeLines++;
+                    }
+                }
+                summary.StrokeWidth = strokeLines > 0 ? strokeSum / strokeLines : float.NaN;
+            }
+            return true;
+        }
+
+        private int BeginRow(int lineCount, int spotCount)
+        {
+            int scan = (int)(_count % _capacity);
+            _timestamp[scan] = DateTime.UtcNow.Ticks;
+            _lineCount[scan] = (byte)Math.Min(Math.Max(lineCount, 0), MaxLines);
+            _spotCount[scan] = spotCount;
+            return scan;
+        }
+
+        private void SetLine(int scan, int line, MMM.Readers.Modules.Swipe.RTEQALineData lineData)
+        {
+            int i = scan * MaxLines + line;
+            bool hasData = lineData.HasData != 0;
+            _charCount[i] = hasData ? lineData.CharCount : 0;
+            _badCharCount[i] = hasData ? Math.Max(lineData.CharCount - lineData.RecognisedCount, 0) : 0;
+            _brokenCharCount[i] = hasData ? lineData.NonContinuousCount : 0;
+            _strokeWidth[i] = hasData ? lineData.AverageStrokeWidth : float.NaN;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("QaMeasurementStore Capacity [{0}] Count [{1}]", _capacity, Count);
+        }
+    }
+
+    public struct QaScanSummary
+    {
+        public long Row;
+        public DateTime Timestamp;
+        public int LineCount;
+        public int SpotCount;
+        public int CharCount;
+        public int BadCharCount;
+        public int BrokenCharCount;
+        public float StrokeWidth;
+
+        public float BadCharRatio
+        {
+            get { return CharCount > 0 ? (float)BadCharCount / CharCount : 0f; }
+        }
+
+        public float BrokenCharRatio
+        {
+            get { return CharCount > 0 ? (float)BrokenCharCount / CharCount : 0f; }
+        }
+    }
+
+    public class QaMeasurementEvent : EventArgs
+    {
+        public QaMeasurementStore Store { get; private set; }
+        public long Row { get; private set; }
+
+        public QaMeasurementEvent(QaMeasurementStore store, long row)
+        {
+            Store = store;
+            Row = row;
+        }
+    }
+}
@@ -0,0 +1,341 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum ReaderHealthStatus
+    {
+        HEALTHY,
+        DEGRADED
+    }
+
+    public class ReaderHealthEvent : EventArgs
+    {
+        public ReaderHealthStatus Status { get; private set; }
+        public String Reason { get; private set; }
+        public long ScanCount { get; private set; }
+
+        public ReaderHealthEvent(ReaderHealthStatus status, String reason, long scanCount)
+        {
+            Status = status;
+            Reason = reason;
+            ScanCount = scanCount;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ReaderHealthEvent Status [{0}] Reason [{1}] ScanCount [{2}]", Status, Reason, ScanCount);
+        }
+    }
+
+    // Incrementally aggregates the QA measurements of a QaMeasurementStore. The first scans of a
+    // reader establish a baseline, after which exponentially weighted moving averages of the
+    // bad character ratio, broken stroke ratio, dirt spot count and stroke width are compared
+    // against it. Drifting away from the baseline is reported as DEGRADED so that the reader can
+    // be cleaned before cashiers start having to re-swipe documents. Given a baseline path, the
+    // baseline is saved once collected and loaded again on the next start, so a reader that got
+    // dirty while the service was down is not taken as its own baseline. Delete the file after
+    // replacing the reader.
+    public class ReaderHealthMonitor
+    {
+        private static readonly ILog log = LogProvider.For<ReaderHealthMonitor>();
+        private const uint MAGIC = 0x42485241; // "ARHB"
+        private const int FORMAT_VERSION = 1;
+
+        public const int DefaultBaselineScans = 50;
+        public const int DefaultWindowScans = 20;
+
+        private readonly object _lock = new object();
+        private readonly int _baselineScans;
+        private readonly double _alpha;
+        private readonly String _baselinePath;
+
+        private long _scans = 0;
+        private RollingQa _baseline = new RollingQa();
+        private RollingQa _recent = new RollingQa();
+        private ReaderHealthStatus _status = ReaderHealthStatus.HEALTHY;
+
+        public event EventHandler<ReaderHealthEvent> OnReaderHealthEvent;
+
+        public ReaderHealthMonitor()
+            : this(DefaultBaselineScans, DefaultWindowScans, null)
+        {
+        }
+
+        public ReaderHealthMonitor(String baselinePath)
+            : this(DefaultBaselineScans, DefaultWindowScans, baselinePath)
+        {
+        }
+
+        public ReaderHealthMonitor(int baselineScans, int windowScans)
+            : this(baselineScans, windowScans, null)
+        {
+        }
+
+        public ReaderHealthMonitor(int baselineScans, int windowScans, String baselinePath)
+        {
+            _baselineScans = Math.Max(1, baselineScans);
+            _alpha = 2.0 / (Math.Max(1, windowScans) + 1);
+            _baselinePath = baselinePath;
+            // Absolute limits, lower bounds for the baseline-relative limits
+            BadCharRatioLimit = 0.05;
+            BrokenCharRatioLimit = 0.10;
+            SpotCountIncreaseLimit = 3;
+            StrokeWidthDriftLimit = 0.25;
+            OnReaderHealthEvent += delegate(Object sender, ReaderHealthEvent e) { };
+            if (_baselinePath != null && TryLoadBaseline(_baselinePath, out _baseline))
+            {
+                _scans = _baselineScans;
+                _recent = _baseline;
+            }
+        }
+
+        public static String DefaultBaselinePath
+        {
+            get
+            {
+                return Path.Combine(
+                    Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.CommonApplicationData), "AlikaPos"),
+                    "ReaderHealth.baseline");
+            }
+        }
+
+        public double BadCharRatioLimit { get; set; }
+        public double BrokenCharRatioLimit { get; set; }
+        public double SpotCountIncreaseLimit { get; set; }
+        public double StrokeWidthDriftLimit { get; set; }
+
+        public ReaderHealthStatus Status
+        {
+            get { lock (_lock) { return _status; } }
+        }
+
+        public void Attach(QaMeasurementStore store)
+        {
+            store.OnQaMeasurementEvent += HandleQaMeasurementEvent;
+        }
+
+        public void Detach(QaMeasurementStore store)
+        {
+            store.OnQaMeasurementEvent -= HandleQaMeasurementEvent;
+        }
+
+        private void HandleQaMeasurementEvent(object sender, QaMeasurementEvent e)
+        {
+            QaScanSummary summary;
+            if (e.Store.TryRead(e.Row, out summary))
+            {
+                Update(summary);
+            }
+        }
+
+        public void Update(QaScanSummary summary)
+        {
+            if (summary.CharCount == 0)
+            {
+                // nothing was read, e.g. a document swiped upside down
+                return;
+            }
+
+            ReaderHealthEvent healthEvent = null;
+            RollingQa? collectedBaseline = null;
+            lock (_lock)
+            {
+                _scans++;
+                if (_scans <= _baselineScans)
+                {
+                    _baseline.AddToMean(summary, _scans);
+                    _recent = _baseline;
+                    if (_scans == _baselineScans)
+                    {
+                        collectedBaseline = _baseline;
+                    }
+                }
+                else
+                {
+                    healthEvent = Compare(summary);
+                }
+            }
+
+            if (collectedBaseline.HasValue && _baselinePath != null)
+            {
+                SaveBaseline(_baselinePath, collectedBaseline.Value);
+            }
+            if (healthEvent != null)
+            {
+                log.WarnFormat("Reader health changed [{0}]", healthEvent);
+                try { OnReaderHealthEvent(this, healthEvent); }
+                catch { }
+            }
+        }
+
+        // Folds the scan into the recent averages, returns the status change it causes if any
+        private ReaderHealthEvent Compare(QaScanSummary summary)
+        {
+            _recent.AddToEwma(summary, _alpha);
+
+            String reason = DegradationReason();
+            if (reason != null && _status == ReaderHealthStatus.HEALTHY)
+            {
+                _status = ReaderHealthStatus.DEGRADED;
+                return new ReaderHealthEvent(_status, reason, _scans);
+            }
+            if (reason == null && _status == ReaderHealthStatus.DEGRADED && IsBackNearBaseline())
+            {
+                _status = ReaderHealthStatus.HEALTHY;
+                return new ReaderHealthEvent(_status, "QA measurements back near baseline", _scans);
+            }
+            return null;
+        }
+
+        private String DegradationReason()
+        {
+            if (_recent.BadCharRatio > Math.Max(BadCharRatioLimit, 2 * _baseline.BadCharRatio))
+            {
+                return String.Format("bad character ratio {0:0.000} above baseline {1:0.000}", _recent.BadCharRatio, _baseline.BadCharRatio);
+            }
+            if (_recent.BrokenCharRatio > Math.Max(BrokenCharRatioLimit, 2 * _baseline.BrokenCharRatio))
+            {
+                return String.Format("broken character ratio {0:0.000} above baseline {1:0.000}", _recent.BrokenCharRatio, _baseline.BrokenCharRatio);
+            }
+            if (_recent.SpotCount > _baseline.SpotCount + SpotCountIncreaseLimit)
+            {
+                return String.Format("spot count {0:0.0} above baseline {1:0.0}, optics may be dirty", _recent.SpotCount, _baseline.SpotCount);
+            }
+            if (_baseline.StrokeWidth > 0 && Math.Abs(_recent.StrokeWidth - _baseline.StrokeWidth) > StrokeWidthDriftLimit * _baseline.StrokeWidth)
+            {
+                return String.Format("stroke width {0:0.00} drifted from baseline {1:0.00}", _recent.StrokeWidth, _baseline.StrokeWidth);
+            }
+            return null;
+        }
+
+        // Hysteresis so a reader hovering around a limit does not flap between states
+        private bool IsBackNearBaseline()
+        {
+            return _recent.BadCharRatio <= Math.Max(BadCharRatioLimit, 2 * _baseline.BadCharRatio) / 2
+                && _recent.BrokenCharRatio <= Math.Max(BrokenCharRatioLimit, 2 * _baseline.BrokenCharRatio) / 2;
+        }
+
+        private static bool TryLoadBaseline(String baselinePath, out RollingQa baseline)
+        {
+            baseline = new RollingQa();
+            if (!File.Exists(baselinePath))
+            {
+                log.DebugFormat("No reader health baseline at [{0}], collecting one", baselinePath);
+                return false;
+            }
+
+            try
+            {
+                using (var reader = new BinaryReader(File.OpenRead(baselinePath)))
+                {
+                    if (reader.ReadUInt32() != MAGIC || reader.ReadInt32() != FORMAT_VERSION)
+                    {
+                        log.Info("Reader health baseline has an unknown format, collecting a new one");
+                        return false;
+                    }
+                    var collected = new DateTime(reader.ReadInt64(), DateTimeKind.Utc);
+                    var loaded = new RollingQa();
+                    loaded.BadCharRatio = reader.ReadDouble();
+                    loaded.BrokenCharRatio = reader.ReadDouble();
+                    loaded.SpotCount = reader.ReadDouble();
+                    loaded.StrokeWidth = reader.ReadDouble();
+                    if (reader.ReadUInt32() != MAGIC)
+                    {
+                        log.Info("Reader health baseline is truncated, collecting a new one");
+                        return false;
+                    }
+                    baseline = loaded;
+                    log.InfoFormat("Loaded reader health baseline [{0}] collected [{1:u}]", baseline, collected);
+                    return true;
+                }
+            }
+            catch (Exception ex)
+            {
+                log.WarnFormat("Unable to read reader health baseline [{0}] [{1}]", baselinePath, ex.Message);
+                return false;
+            }
+        }
+
+        private static void SaveBaseline(String baselinePath, RollingQa baseline)
+        {
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(baselinePath));
+                String tempPath = baselinePath + ".tmp";
+                using (var writer = new BinaryWriter(File.Create(tempPath)))
+                {
+                    writer.Write(MAGIC);
+                    writer.Write(FORMAT_VERSION);
+                    writer.Write(DateTime.UtcNow.Ticks);
+                    writer.Write(baseline.BadCharRatio);
+                    writer.Write(baseline.BrokenCharRatio);
+                    writer.Write(baseline.SpotCount);
+                    writer.Write(baseline.StrokeWidth);
+                    writer.Write(MAGIC);
+                }
+                if (File.Exists(baselinePath))
+                {
+                    File.Delete(baselinePath);
+                }
+                File.Move(tempPath, baselinePath);
+                log.InfoFormat("Saved reader health baseline [{0}] to [{1}]", baseline, baselinePath);
+            }
+            catch (Exception ex)
+            {
+                // the baseline is collected again on the next start
+                log.WarnFormat("Unable to save reader health baseline [{0}] [{1}]", baselinePath, ex.Message);
+            }
+        }
+
+        public override string ToString()
+        {
+            lock (_lock)
+            {
+                return String.Format("ReaderHealthMonitor Status [{0}] Scans [{1}] Recent [{2}] Baseline [{3}]", _status, _scans, _recent, _baseline);
+            }
+        }
+
+        private struct RollingQa
+        {
+            public double BadCharRatio;
+            public double BrokenCharRatio;
+            public double SpotCount;
+            public double StrokeWidth;
+            // scans that reported a stroke width, not every scan does
+            public long StrokeWidthScans;
+
+            public void AddToMean(QaScanSummary summary, long n)
+            {
+                BadCharRatio += (summary.BadCharRatio - BadCharRatio) / n;
+                BrokenCharRatio += (summary.BrokenCharRatio - BrokenCharRatio) / n;
+                SpotCount += (summary.SpotCount - SpotCount) / n;
+                if (!float.IsNaN(summary.StrokeWidth))
+                {
+                    StrokeWidthScans++;
+                    StrokeWidth += (summary.StrokeWidth - StrokeWidth) / StrokeWidthScans;
+                }
+            }
+
+            public void AddToEwma(QaScanSummary summary, double alpha)
+            {
+                BadCharRatio += alpha * (summary.BadCharRatio - BadCharRatio);
+                BrokenCharRatio += alpha * (summary.BrokenCharRatio - BrokenCharRatio);
+                SpotCount += alpha * (summary.SpotCount - SpotCount);
+                if (!float.IsNaN(summary.StrokeWidth))
+                {
+                    StrokeWidth += alpha * (summary.StrokeWidth - StrokeWidth);
+                }
+            }
+
+            public override string ToString()
+            {
+                return String.Format("bad {0:0.000} broken {1:0.000} spots {2:0.0} stroke {3:0.00}", BadCharRatio, BrokenCharRatio, SpotCount, StrokeWidth);
+            }
+        }
+    }
+}
@@ -0,0 +1,219 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Runs reader housekeeping (such as dirt detection) only once the reader has been idle for
+    // IdlePeriod, and aborts it as soon as the scan source reports that a document is arriving,
+    // so that maintenance never runs while a cashier is waiting on a swipe.
+    public class ReaderMaintenanceScheduler : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<ReaderMaintenanceScheduler>();
+        public static readonly TimeSpan DefaultIdlePeriod = TimeSpan.FromMinutes(5);
+        public static readonly TimeSpan DefaultRunInterval = TimeSpan.FromHours(1);
+        // of all schedulers, runs by whether they completed or were aborted by a scan
+        private static readonly MetricCounter runsCompleted = MetricsRegistry.Default.Counter(
+            "alika_maintenance_runs_total", "Reader maintenance runs, by whether a scan aborted them", "outcome=\"completed\"");
+        private static readonly MetricCounter runsAborted = MetricsRegistry.Default.Counter(
+            "alika_maintenance_runs_total", "Reader maintenance runs, by whether a scan aborted them", "outcome=\"aborted\"");
+        private static readonly MetricCounter scansDuringMaintenance = MetricsRegistry.Default.Counter(
+            "alika_maintenance_scans_total", "Scans that arrived while reader maintenance ran");
+        private static readonly MetricHistogram maintenanceTime = MetricsRegistry.Default.Histogram(
+            "alika_maintenance_seconds", "Time a reader maintenance run took", MetricHistogram.SlowBucketsSeconds);
+        private static readonly MetricHistogram addedLatency = MetricsRegistry.Default.Histogram(
+            "alika_maintenance_added_latency_seconds", "Time a scan waited for an aborted maintenance run to stop", MetricHistogram.SlowBucketsSeconds);
+
+        private readonly object _lock = new object();
+        private readonly List<IReaderMaintenanceTask> _tasks = new List<IReaderMaintenanceTask>();
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private Timer _timer;
+        private long _lastActivityMs = 0;
+        private long _lastRunMs = -1;
+        private CancellationTokenSource _running = null;
+        private long _abortRequestedMs = -1;
+
+        public ReaderMaintenanceScheduler()
+            : this(DefaultIdlePeriod, DefaultRunInterval)
+        {
+        }
+
+        public ReaderMaintenanceScheduler(TimeSpan idlePeriod, TimeSpan runInterval)
+        {
+            IdlePeriod = idlePeriod;
+            RunInterval = runInterval;
+        }
+
+        public TimeSpan IdlePeriod { get; private set; }
+        public TimeSpan RunInterval { get; private set; }
+
+        public bool IsRunning
+        {
+            get { lock (_lock) { return _running != null; } }
+        }
+
+        public void Add(IReaderMaintenanceTask task)
+        {
+            lock (_lock)
+            {
+                _tasks.Add(task);
+            }
+        }
+
+        public void Start()
+        {
+            log.InfoFormat("Starting reader maintenance scheduler, idle period [{0}] run interval [{1}]", IdlePeriod, RunInterval);
+            long checkInterval = Math.Max(1000L, (long)IdlePeriod.TotalMilliseconds / 4);
+            _timer = new Timer(CheckIdle, null, checkInterval, checkInterval);
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            if (IsScanActivity(e))
+            {
+                NotifyActivity();
+            }
+        }
+
+        private static bool IsScanActivity(ScanSourceEvent e)
+        {
+            if (e.IsDataEvent)
+            {
+                return true;
+            }
+            if (e.IsDeviceEvent)
+            {
+                switch (e.EventCode)
+                {
+                    case MMM.Readers.FullPage.EventCode.DOC_ON_WINDOW:
+                    case MMM.Readers.FullPage.EventCode.START_OF_DOCUMENT_DATA:
+                    case MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA:
+                    case MMM.Readers.FullPage.EventCode.READING_DATA:
+                    case MMM.Readers.FullPage.EventCode.SWIPE_REQUESTED:
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        public void NotifyActivity()
+        {
+            long now = _clock.ElapsedMilliseconds;
+            Interlocked.Exchange(ref _lastActivityMs, now);
+            lock (_lock)
+            {
+                if (_running != null && !_running.IsCancellationRequested)
+                {
+                    log.Info("Scan activity during reader maintenance, aborting maintenance");
+                    scansDuringMaintenance.Increment();
+                    _abortRequestedMs = now;
+                    _running.Cancel();
+                }
+            }
+        }
+
+        private void CheckIdle(object state)
+        {
+            long now = _clock.ElapsedMilliseconds;
+            long idleMs = now - Interlocked.Read(ref _lastActivityMs);
+            CancellationTokenSource running;
+            List<IReaderMaintenanceTask> tasks;
+            lock (_lock)
+            {
+                if (_running != null || _tasks.Count == 0 || idleMs < (long)IdlePeriod.TotalMilliseconds)
+                {
+                    return;
+                }
+                if (_lastRunMs >= 0 && now - _lastRunMs < (long)RunInterval.TotalMilliseconds)
+                {
+                    return;
+                }
+                _running = running = new CancellationTokenSource();
+                _abortRequestedMs = -1;
+                _lastRunMs = now;
+                tasks = new List<IReaderMaintenanceTask>(_tasks);
+            }
+
+            log.InfoFormat("Reader idle for [{0}ms], starting maintenance", idleMs);
+            Task.Factory.StartNew(() => RunMaintenance(tasks, running), TaskCreationOptions.LongRunning);
+        }
+
+        private void RunMaintenance(List<IReaderMaintenanceTask> tasks, CancellationTokenSource running)
+        {
+            long started = _clock.ElapsedMilliseconds;
+            foreach (var task in tasks)
+            {
+                if (running.IsCancellationRequested)
+                {
+                    break;
+                }
+                using (LogProvider.OpenNestedContext("Maintenance_" + task.Name))
+                {
+                    try
+                    {
+                        log.DebugFormat("Begin reader maintenance task [{0}]", task.Name);
+                        task.Run(running.Token);
+                        log.DebugFormat("End reader maintenance task [{0}]", task.Name);
+                    }
+                    catch (Exception ex)
+                    {
+                        log.WarnFormat("Reader maintenance task [{0}] failed [{1}]", task.Name, ex.Message);
+                    }
+                }
+            }
+
+            long finished = _clock.ElapsedMilliseconds;
+            bool aborted;
+            lock (_lock)
+            {
+                aborted = running.IsCancellationRequested && _abortRequestedMs >= 0;
+                if (aborted)
+                {
+                    // time the arriving scan had to wait for maintenance to get out of the way
+                    addedLatency.Record(Ticks(finished - _abortRequestedMs));
+                    runsAborted.Increment();
+                }
+                else
+                {
+                    runsCompleted.Increment();
+                }
+                maintenanceTime.Record(Ticks(finished - started));
+                _running = null;
+            }
+            running.Dispose();
+            log.InfoFormat("Reader maintenance finished after [{0}ms] Aborted [{1}]", finished - started, aborted);
+        }
+
+        private static long Ticks(long milliseconds)
+        {
+            return milliseconds * Stopwatch.Frequency / 1000;
+        }
+
+        public void Dispose()
+        {
+            log.Debug("Disposing of ReaderMaintenanceScheduler");
+            if (_timer != null)
+            {
+                _timer.Dispose();
+                _timer = null;
+            }
+            lock (_lock)
+            {
+                if (_running != null)
+                {
+                    _running.Cancel();
+                }
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ReaderMaintenanceScheduler IdlePeriod [{0}] RunInterval [{1}] Running [{2}]", IdlePeriod, RunInterval, IsRunning);
+        }
+    }
+}
@@ -0,0 +1,363 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum ReaderConnectionState
+    {
+        CONNECTED,
+        RECOVERING,
+        FAILED
+    }
+
+    public class ReaderRecoveryEvent : EventArgs
+    {
+        public ReaderConnectionState State { get; private set; }
+        public int Attempts { get; private set; }
+        public TimeSpan Downtime { get; private set; }
+
+        public ReaderRecoveryEvent(ReaderConnectionState state, int attempts, TimeSpan downtime)
+        {
+            State = state;
+            Attempts = attempts;
+            Downtime = downtime;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ReaderRecoveryEvent State [{0}] Attempts [{1}] Downtime [{2}ms]", State, Attempts, (long)Downtime.TotalMilliseconds);
+        }
+    }
+
+    // Reconnects the reader as soon as the scan source reports that it dropped, rather than
+    // waiting on the SDK's own RebootOnFailedConnection / RecoverWaitTimeout cycle. Attempts are
+    // retried with jittered exponential backoff, so a USB re-enumeration is usually recovered on
+    // the first or second attempt while a reader that is unplugged does not get hammered. A
+    // reconnect that returns is not yet a recovery: the monitor stays RECOVERING until the
+    // source raises DEVICE_CONNECTED or SWIPE_READER_CONNECTED, and only takes the reader as
+    // connected without it once ConnectedTimeout passed without the reader dropping again.
+    public class ReaderRecoveryMonitor : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<ReaderRecoveryMonitor>();
+        public static readonly TimeSpan DefaultInitialDelay = TimeSpan.FromMilliseconds(100);
+        public static readonly TimeSpan DefaultMaxDelay = TimeSpan.FromSeconds(10);
+        public const int DefaultMaxAttempts = 30;
+        public static readonly TimeSpan DefaultConnectedTimeout = TimeSpan.FromSeconds(5);
+
+        private readonly IRecoverableScanSource _source;
+        private readonly long _initialDelayMs;
+        private readonly long _maxDelayMs;
+        private readonly int _maxAttempts;
+        private readonly long _connectedTimeoutMs;
+        private readonly object _lock = new object();
+        private readonly Random _jitter = new Random();
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private readonly RecoveryMetrics _metrics = new RecoveryMetrics();
+        private readonly Timer _timer;
+
+        private ReaderConnectionState _state = ReaderConnectionState.CONNECTED;
+        private long _droppedAtMs = 0;
+        private int _attempts = 0;
+        // a reconnect returned and the timer waits for the connected event
+        private bool _awaitingConnected = false;
+        private bool _disposed = false;
+
+        public event EventHandler<ReaderRecoveryEvent> OnReaderRecoveryEvent;
+
+        public ReaderRecoveryMonitor(IRecoverableScanSource source)
+            : this(source, DefaultInitialDelay, DefaultMaxDelay, DefaultMaxAttempts)
+        {
+        }
+
+        public ReaderRecoveryMonitor(IRecoverableScanSource source, TimeSpan initialDelay, TimeSpan maxDelay, int maxAttempts)
+            : this(source, initialDelay, maxDelay, maxAttempts, DefaultConnectedTimeout)
+        {
+        }
+
+        public ReaderRecoveryMonitor(IRecoverableScanSource source, TimeSpan initialDelay, TimeSpan maxDelay, int maxAttempts, TimeSpan connectedTimeout)
+        {
+            _source = source;
+            _initialDelayMs = Math.Max(1L, (long)initialDelay.TotalMilliseconds);
+            _maxDelayMs = Math.Max(_initialDelayMs, (long)maxDelay.TotalMilliseconds);
+            _maxAttempts = Math.Max(1, maxAttempts);
+            _connectedTimeoutMs = Math.Max(1L, (long)connectedTimeout.TotalMilliseconds);
+            _timer = new Timer(Attempt, null, Timeout.Infinite, Timeout.Infinite);
+            OnReaderRecoveryEvent += delegate(Object sender, ReaderRecoveryEvent e) { };
+        }
+
+        public ReaderConnectionState State
+        {
+            get { lock (_lock) { return _state; } }
+        }
+
+        public RecoveryMetrics Metrics
+        {
+            get { return _metrics; }
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            if (e.IsDeviceEvent)
+            {
+                switch (e.EventCode)
+                {
+                    case MMM.Readers.FullPage.EventCode.DEVICE_DISCONNECTED:
+                    case MMM.Readers.FullPage.EventCode.SWIPE_READER_DISCONNECTED:
+                        ConnectionLost(e.ToString());
+                        break;
+                    case MMM.Readers.FullPage.EventCode.DEVICE_CONNECTED:
+                    case MMM.Readers.FullPage.EventCode.SWIPE_READER_CONNECTED:
+                        ConnectionRestored();
+                        break;
+                }
+            }
+            else if (e.IsError && IsConnectionError(e.ErrorCode))
+            {
+                ConnectionLost(e.ToString());
+            }
+        }
+
+        private static bool IsConnectionError(MMM.Readers.ErrorCode errorCode)
+        {
+            switch (errorCode)
+            {
+                case MMM.Readers.ErrorCode.ERROR_SWIPE_READER_NOT_CONNECTED:
+                case MMM.Readers.ErrorCode.ERROR_DEVICE_NOT_PRESENT:
+                case MMM.Readers.ErrorCode.ERROR_OPENING_COM_PORT:
+                case MMM.Readers.ErrorCode.ERROR_READING_COM_PORT:
+                case MMM.Readers.ErrorCode.ERROR_WRITING_COM_PORT:
+                case MMM.Readers.ErrorCode.ERROR_CONNECTING_DEVICE:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        public void ConnectionLost(String reason)
+        {
+            lock (_lock)
+            {
+                if (_disposed)
+                {
+                    return;
+                }
+                if (_state == ReaderConnectionState.RECOVERING)
+                {
+                    if (_awaitingConnected)
+                    {
+                        // the reconnect did not hold, try again rather than wait for the fallback
+                        log.InfoFormat("Reader dropped again after reconnecting [{0}]", reason);
+                        _awaitingConnected = false;
+                        _timer.Change(NextDelay(), Timeout.Infinite);
+                    }
+                    return;
+                }
+                log.WarnFormat("Reader connection lost [{0}], starting recovery", reason);
+                _state = ReaderConnectionState.RECOVERING;
+                _droppedAtMs = _clock.ElapsedMilliseconds;
+                _attempts = 0;
+                _metrics.RecordConnectionLost();
+                _timer.Change(NextDelay(), Timeout.Infinite);
+            }
+        }
+
+        private void ConnectionRestored()
+        {
+            ReaderRecoveryEvent recoveryEvent;
+            lock (_lock)
+            {
+                if (_state == ReaderConnectionState.CONNECTED)
+                {
+                    return;
+                }
+                _timer.Change(Timeout.Infinite, Timeout.Infinite);
+                _awaitingConnected = false;
+                TimeSpan downtime = TimeSpan.FromMilliseconds(_clock.ElapsedMilliseconds - _droppedAtMs);
+                _state = ReaderConnectionState.CONNECTED;
+                _metrics.RecordRecovered((long)downtime.TotalMilliseconds);
+                recoveryEvent = new ReaderRecoveryEvent(_state, _attempts, downtime);
+            }
+            log.InfoFormat("Reader connection recovered [{0}]", recoveryEvent);
+            NotifyListeners(recoveryEvent);
+        }
+
+        private void Attempt(object state)
+        {
+            int attempt;
+            bool fallback;
+            lock (_lock)
+            {
+                if (_disposed || _state != ReaderConnectionState.RECOVERING)
+                {
+                    return;
+                }
+                fallback = _awaitingConnected;
+                _awaitingConnected = false;
+                attempt = fallback ? _attempts : ++_attempts;
+            }
+            if (fallback)
+            {
+                log.InfoFormat("No connected event within [{0}ms] of reconnect attempt [{1}], taking the reader as connected", _connectedTimeoutMs, attempt);
+                ConnectionRestored();
+                return;
+            }
+
+            try
+            {
+                log.DebugFormat("Reconnect attempt [{0}]", attempt);
+                _metrics.RecordAttempt();
+                // not under the lock, the SDK raises connection events from within the call
+                _source.Reconnect();
+                lock (_lock)
+                {
+                    // unless the connected event already came
+                    if (!_disposed && _state == ReaderConnectionState.RECOVERING)
+                    {
+                        _awaitingConnected = true;
+                        _timer.Change(_connectedTimeoutMs, Timeout.Infinite);
+                    }
+                }
+                return;
+            }
+            catch (Exception ex)
+            {
+                log.InfoFormat("Reconnect attempt [{0}] failed [{1}]", attempt, ex.Message);
+            }
+
+            ReaderRecoveryEvent failedEvent = null;
+            lock (_lock)
+            {
+                if (_disposed || _state != ReaderConnectionState.RECOVERING)
+                {
+                    return;
+                }
+                if (_attempts >= _maxAttempts)
+                {
+                    _state = ReaderConnectionState.FAILED;
+                    _metrics.RecordFailed();
+                    failedEvent = new ReaderRecoveryEvent(_state, _attempts,
+                        TimeSpan.FromMilliseconds(_clock.ElapsedMilliseconds - _droppedAtMs));
+                }
+                else
+                {
+                    _timer.Change(NextDelay(), Timeout.Infinite);
+                }
+            }
+            if (failedEvent != null)
+            {
+                log.ErrorFormat("Giving up reconnecting to reader [{0}]", failedEvent);
+                NotifyListeners(failedEvent);
+            }
+        }
+
+        // Exponential backoff with equal jitter: half the delay is fixed and half is random so
+        // several tills recovering from the same outage do not retry in lock step
+        private long NextDelay()
+        {
+            long delay = _initialDelayMs << Math.Min(_attempts, 16);
+            delay = Math.Min(delay, _maxDelayMs);
+            return delay / 2 + (long)(_jitter.NextDouble() * (delay / 2));
+        }
+
+        private void NotifyListeners(ReaderRecoveryEvent e)
+        {
+            try { OnReaderRecoveryEvent(this, e); }
+            catch { }
+        }
+
+        public void Dispose()
+        {
+            log.Debug("Disposing of ReaderRecoveryMonitor");
+            lock (_lock)
+            {
+                _disposed = true;
+                _timer.Dispose();
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ReaderRecoveryMonitor State [{0}] [{1}]", State, _metrics);
+        }
+    }
+
+    public class RecoveryMetrics
+    {
+        // of all monitors
+        private static readonly MetricCounter connectionsLostTotal = MetricsRegistry.Default.Counter(
+            "alika_reader_connections_lost_total", "Times the reader dropped its connection");
+        private static readonly MetricCounter reconnectAttemptsTotal = MetricsRegistry.Default.Counter(
+            "alika_reader_reconnect_attempts_total", "Attempts to reconnect the reader");
+        private static readonly MetricCounter reconnectsTotal = MetricsRegistry.Default.Counter(
+            "alika_reader_reconnects_total", "Times the reader was reconnected");
+        private static readonly MetricCounter recoveryFailuresTotal = MetricsRegistry.Default.Counter(
+            "alika_reader_recovery_failures_total", "Times reconnecting the reader was given up");
+
+        private long _connectionsLost;
+        private long _recoveries;
+        private long _failures;
+        private long _attempts;
+        private long _lastTimeToRecoverMs;
+        private long _totalTimeToRecoverMs;
+        private long _maxTimeToRecoverMs;
+
+        public long ConnectionsLost { get { return Interlocked.Read(ref _connectionsLost); } }
+        public long Recoveries { get { return Interlocked.Read(ref _recoveries); } }
+        public long Failures { get { return Interlocked.Read(ref _failures); } }
+        public long Attempts { get { return Interlocked.Read(ref _attempts); } }
+        public long LastTimeToRecoverMs { get { return Interlocked.Read(ref _lastTimeToRecoverMs); } }
+        public long TotalTimeToRecoverMs { get { return Interlocked.Read(ref _totalTimeToRecoverMs); } }
+        public long MaxTimeToRecoverMs { get { return Interlocked.Read(ref _maxTimeToRecoverMs); } }
+
+        public long MeanTimeToRecoverMs
+        {
+            get
+            {
+                long recoveries = Recoveries;
+                return recoveries == 0 ? 0 : TotalTimeToRecoverMs / recoveries;
+            }
+        }
+
+        internal void RecordConnectionLost()
+        {
+            Interlocked.Increment(ref _connectionsLost);
+            connectionsLostTotal.Increment();
+        }
+
+        internal void RecordAttempt()
+        {
+            Interlocked.Increment(ref _attempts);
+            reconnectAttemptsTotal.Increment();
+        }
+
+        internal void RecordFailed()
+        {
+            Interlocked.Increment(ref _failures);
+            recoveryFailuresTotal.Increment();
+        }
+
+        internal void RecordRecovered(long timeToRecoverMs)
+        {
+            Interlocked.Increment(ref _recoveries);
+            reconnectsTotal.Increment();
+            Interlocked.Exchange(ref _lastTimeToRecoverMs, timeToRecoverMs);
+            Interlocked.Add(ref _totalTimeToRecoverMs, timeToRecoverMs);
+            long max;
+            while (timeToRecoverMs > (max = Interlocked.Read(ref _maxTimeToRecoverMs)))
+            {
+                Interlocked.CompareExchange(ref _maxTimeToRecoverMs, timeToRecoverMs, max);
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("RecoveryMetrics ConnectionsLost [{0}] Recoveries [{1}] Failures [{2}] Attempts [{3}] LastTimeToRecoverMs [{4}] MeanTimeToRecoverMs [{5}] MaxTimeToRecoverMs [{6}]",
+                ConnectionsLost, Recoveries, Failures, Attempts, LastTimeToRecoverMs, MeanTimeToRecoverMs, MaxTimeToRecoverMs);
+        }
+    }
+}
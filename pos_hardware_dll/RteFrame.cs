@@ -0,0 +1,264 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum RteFrameKind
+    {
+        MESSAGE,
+        ACK,
+        NAK,
+        BAD_CHECKSUM,
+        BAD_FRAME
+    }
+
+    // One block received from an RTE reader:
+    //   <SOH>[length lo][length hi][device][type]<STX>[text]<ETX>[BCC]
+    // or a single <ACK>/<NAK>. The frame does not copy the bytes it was parsed from, Text points
+    // into the parser's receive buffer and is only valid until the parser is next written to.
+    public struct RteFrame
+    {
+        public RteFrameKind Kind;
+        public byte Device;
+        public byte Type;
+        public ArraySegment<byte> Text;
+
+        public bool IsMessage
+        {
+            get { return Kind == RteFrameKind.MESSAGE; }
+        }
+
+        public String TextAsString()
+        {
+            return Text.Array == null ? String.Empty : Encoding.ASCII.GetString(Text.Array, Text.Offset, Text.Count);
+        }
+
+        public override string ToString()
+        {
+            return String.Format("RteFrame Kind [{0}] Device [{1}] Type [{2}] TextLength [{3}]",
+                Kind, (char)Device, (char)Type, Text.Count);
+        }
+    }
+
+    // Longitudinal parity check of an RTE block: the XOR of every byte after <SOH>, including
+    // the BCC itself when checking. Bytes are folded eight at a time.
+    public static class RteBcc
+    {
+        public static byte Compute(byte[] buffer, int offset, int count)
+        {
+            ulong word = 0;
+            int end = offset + count;
+            int i = offset;
+            for (; i + 8 <= end; i += 8)
+            {
+                word ^= BitConverter.ToUInt64(buffer, i);
+            }
+            word ^= word >> 32;
+            word ^= word >> 16;
+            word ^= word >> 8;
+            byte bcc = (byte)word;
+            for (; i < end; i++)
+            {
+                bcc ^= buffer[i];
+            }
+            return bcc;
+        }
+    }
+
+    // Incremental RTE block parser. The serial port reads straight into GetWriteSegment(), so a
+    // message is never copied between the port and the frame handed to the caller. Garbage
+    // between blocks is skipped and a corrupt block resynchronises on the next <SOH>, skipping
+    // any <ACK>/<NAK> byte on the way, which would be one of the block's own bytes. A header is
+    // checked as soon as it is in, so a stray <SOH> with a length longer than any block or
+    // without <STX> where it belongs is dropped at once rather than waited on.
+    public class RteFrameParser
+    {
+        public const byte SOH = 0x01;
+        public const byte STX = 0x02;
+        public const byte ETX = 0x03;
+        public const byte ACK = 0x06;
+        public const byte NAK = 0x15;
+
+        // The length word has 14 bits, but no reader sends more text than this: three MRZ lines
+        // or three magnetic tracks are a few hundred bytes
+        public const int MaxTextLength = 1024;
+        // device, type, <STX>, text, <ETX> and BCC
+        public const int MaxMessageLength = 3 + MaxTextLength + 2;
+        private const int HEADER_LENGTH = 3;
+
+        private readonly bool _useBcc;
+        private byte[] _buffer;
+        private int _start = 0;
+        private int _end = 0;
+        private long _discardedBytes = 0;
+        // a block was dropped, everything up to the next <SOH> is part of it
+        private bool _resyncing = false;
+
+        public RteFrameParser(bool useBcc)
+            : this(useBcc, 1024)
+        {
+        }
+
+        public RteFrameParser(bool useBcc, int initialCapacity)
+        {
+            _useBcc = useBcc;
+            _buffer = new byte[Math.Max(16, initialCapacity)];
+        }
+
+        public bool UseBcc
+        {
+            get { return _useBcc; }
+        }
+
+        public long DiscardedBytes
+        {
+            get { return _discardedBytes; }
+        }
+
+        // Free space at the end of the receive buffer, compacting (and growing) it if needed.
+        // Frames returned earlier are invalidated by this call.
+        public ArraySegment<byte> GetWriteSegment()
+        {
+            if (_start == _end)
+            {
+                _start = _end = 0;
+            }
+            if (_buffer.Length - _end < 256)
+            {
+                int pending = _end - _start;
+                byte[] target = _buffer;
+                if (pending > _buffer.Length / 2)
+                {
+                    target = new byte[Math.Min(_buffer.Length * 2, Math.Max(_buffer.Length, MaxMessageLength + 256))];
+                }
+                Buffer.BlockCopy(_buffer, _start, target, 0, pending);
+                _buffer = target;
+                _start = 0;
+                _end = pending;
+            }
+            return new ArraySegment<byte>(_buffer, _end, _buffer.Length - _end);
+        }
+
+        public void Commit(int count)
+        {
+            if (count < 0 || _end + count > _buffer.Length)
+            {
+                throw new ArgumentOutOfRangeException("count");
+            }
+            _end += count;
+        }
+
+        public void Append(byte[] data, int offset, int count)
+        {
+            while (count > 0)
+            {
+                ArraySegment<byte> segment = GetWriteSegment();
+                int n = Math.Min(count, segment.Count);
+                Buffer.BlockCopy(data, offset, segment.Array, segment.Offset, n);
+                Commit(n);
+                offset += n;
+                count -= n;
+            }
+        }
+
+        public bool TryParse(out RteFrame frame)
+        {
+            frame = new RteFrame();
+            while (_start < _end)
+            {
+                byte b = _buffer[_start];
+                if ((b == ACK || b == NAK) && !_resyncing)
+                {
+                    _start++;
+                    frame.Kind = b == ACK ? RteFrameKind.ACK : RteFrameKind.NAK;
+                    return true;
+                }
+                if (b == SOH)
+                {
+                    _resyncing = false;
+                    break;
+                }
+                _start++;
+                _discardedBytes++;
+            }
+
+            int available = _end - _start;
+            if (available < HEADER_LENGTH)
+            {
+                return false;
+            }
+
+            int length = (_buffer[_start + 2] & 0x7F) * 128 + (_buffer[_start + 1] & 0x7F);
+            int trailer = _useBcc ? 2 : 1;
+            if (length < 3 + trailer || length > MaxMessageLength)
+            {
+                return Resync(ref frame);
+            }
+            int device = _start + HEADER_LENGTH;
+            if (available >= HEADER_LENGTH + 3 && _buffer[device + 2] != STX)
+            {
+                return Resync(ref frame);
+            }
+            if (available < HEADER_LENGTH + length)
+            {
+                return false;
+            }
+
+            int text = device + 3;
+            int etx = _start + HEADER_LENGTH + length - trailer;
+            if (_buffer[etx] != ETX)
+            {
+                return Resync(ref frame);
+            }
+
+            if (_useBcc && RteBcc.Compute(_buffer, _start + 1, HEADER_LENGTH - 1 + length) != 0)
+            {
+                frame.Kind = RteFrameKind.BAD_CHECKSUM;
+                frame.Device = _buffer[device];
+                frame.Type = _buffer[device + 1];
+                _start += HEADER_LENGTH + length;
+                return true;
+            }
+
+            frame.Kind = RteFrameKind.MESSAGE;
+            frame.Device = _buffer[device];
+            frame.Type = _buffer[device + 1];
+            frame.Text = new ArraySegment<byte>(_buffer, text, etx - text);
+            _start += HEADER_LENGTH + length;
+            return true;
+        }
+
+        // Drops the <SOH> of a block that does not hold together so the next one can be found
+        private bool Resync(ref RteFrame frame)
+        {
+            _start++;
+            _discardedBytes++;
+            _resyncing = true;
+            frame.Kind = RteFrameKind.BAD_FRAME;
+            return true;
+        }
+
+        // Encodes a command block, appending the BCC when the reader is configured to use one
+        public static byte[] Encode(byte device, byte type, byte[] text, bool useBcc)
+        {
+            int trailer = useBcc ? 2 : 1;
+            int length = 3 + text.Length + trailer;
+            var block = new byte[HEADER_LENGTH + length];
+            block[0] = SOH;
+            block[1] = (byte)(length & 0x7F);
+            block[2] = (byte)((length >> 7) & 0x7F);
+            block[3] = device;
+            block[4] = type;
+            block[5] = STX;
+            Buffer.BlockCopy(text, 0, block, 6, text.Length);
+            block[6 + text.Length] = ETX;
+            if (useBcc)
+            {
+                block[block.Length - 1] = RteBcc.Compute(block, 1, block.Length - 2);
+            }
+            return block;
+        }
+    }
+}
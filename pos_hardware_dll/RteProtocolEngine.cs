@@ -0,0 +1,491 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Hardware
+{
+    public class RteResponse
+    {
+        public RteFrameKind Kind { get; private set; }
+        public Swipe.RTEProtocolDevice Device { get; private set; }
+        public Swipe.RTEProtocolMessageType MessageType { get; private set; }
+        public String Text { get; private set; }
+
+        public RteResponse(RteFrameKind kind, Swipe.RTEProtocolDevice device, Swipe.RTEProtocolMessageType messageType, String text)
+        {
+            Kind = kind;
+            Device = device;
+            MessageType = messageType;
+            Text = text;
+        }
+
+        public bool IsSuccess
+        {
+            get { return Kind == RteFrameKind.ACK || (Kind == RteFrameKind.MESSAGE && MessageType == Swipe.RTEProtocolMessageType.DATA); }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("RteResponse Kind [{0}] Device [{1}] MessageType [{2}] Text [{3}]", Kind, Device, MessageType, Text);
+        }
+    }
+
+    public class RteMessageEvent : EventArgs
+    {
+        public Swipe.RTEProtocolDevice Device { get; private set; }
+        public String Text { get; private set; }
+
+        public RteMessageEvent(Swipe.RTEProtocolDevice device, String text)
+        {
+            Device = device;
+            Text = text;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("RteMessageEvent Device [{0}] TextLength [{1}]", Device, Text.Length);
+        }
+    }
+
+    // Speaks the RTE interrupt/polled protocol to a swipe reader directly instead of through the
+    // SDK's blocking MMMReader_SwipeRTE_* calls. Commands are pipelined: up to MaxInFlight blocks
+    // are written without waiting for the previous <ACK>. RTE responses carry no command
+    // identifier, so at most one command per device and command code is outstanding: a message
+    // answers the outstanding command of its device and of the code its text starts with, and an
+    // <ACK>/<NAK>, which the link returns in order, the oldest outstanding command answered that
+    // way. A command that timed out
+    // stays outstanding as a tombstone for another command timeout, so that its late answer is
+    // dropped rather than taken for the answer of the next command. A block failing its BCC is
+    // answered with <NAK> for the reader to send it again. Enable Device commands overtake
+    // queued LED/buzzer commands so cashier feedback never delays re-arming the reader for the
+    // next swipe.
+    public class RteProtocolEngine : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<RteProtocolEngine>();
+        public const int DefaultMaxInFlight = 4;
+        public static readonly TimeSpan DefaultCommandTimeout = TimeSpan.FromSeconds(2);
+
+        private readonly ISerialPort _port;
+        private readonly RteFrameParser _parser;
+        private readonly bool _autoSendEnableDevice;
+        private readonly long _commandTimeoutMs;
+        private readonly int _maxInFlight;
+        private readonly object _lock = new object();
+        private readonly LinkedList<RteCommand> _pending = new LinkedList<RteCommand>();
+        // outstanding commands and tombstones, in the order they were written
+        private readonly List<RteCommand> _inFlight = new List<RteCommand>();
+        private static readonly byte[] nak = new byte[] { RteFrameParser.NAK };
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private volatile bool _running = false;
+        private Task _reader;
+
+        private long _messagesReceived = 0;
+        private long _checksumErrors = 0;
+        private long _framingErrors = 0;
+        private long _commandTimeouts = 0;
+        private long _lateResponses = 0;
+
+        public event EventHandler<RteMessageEvent> OnRteMessageEvent;
+
+        public RteProtocolEngine(ISerialPort port, bool useBcc, bool autoSendEnableDevice, TimeSpan commandTimeout, int maxInFlight)
+        {
+            _port = port;
+            _parser = new RteFrameParser(useBcc);
+            _autoSendEnableDevice = autoSendEnableDevice;
+            _commandTimeoutMs = (long)commandTimeout.TotalMilliseconds;
+            _maxInFlight = Math.Max(1, maxInFlight);
+            OnRteMessageEvent += delegate(Object sender, RteMessageEvent e) { };
+        }
+
+        // Uses the RTE options configured for the SDK (UseBCC, AutoSendEnableDevice, CommandTimeout)
+        public static RteProtocolEngine FromSwipeSettings(ISerialPort port, Swipe.SwipeSettings settings)
+        {
+            TimeSpan commandTimeout = settings.Protocol.CommandTimeout > 0
+                ? TimeSpan.FromMilliseconds(settings.Protocol.CommandTimeout)
+                : DefaultCommandTimeout;
+            return new RteProtocolEngine(
+                port,
+                settings.Protocol.RTE.UseBCC > 0,
+                settings.Protocol.RTE.AutoSendEnableDevice > 0,
+                commandTimeout,
+                DefaultMaxInFlight);
+        }
+
+        public long MessagesReceived { get { return Interlocked.Read(ref _messagesReceived); } }
+        public long ChecksumErrors { get { return Interlocked.Read(ref _checksumErrors); } }
+        public long FramingErrors { get { return Interlocked.Read(ref _framingErrors); } }
+        public long CommandTimeouts { get { return Interlocked.Read(ref _commandTimeouts); } }
+        // answers to commands that had already timed out
+        public long LateResponses { get { return Interlocked.Read(ref _lateResponses); } }
+
+        public void Start()
+        {
+            log.InfoFormat("Starting RTE protocol engine on [{0}] BCC [{1}]", _port, _parser.UseBcc);
+            _port.Open();
+            _running = true;
+            _reader = Task.Factory.StartNew(ReadLoop, TaskCreationOptions.LongRunning);
+        }
+
+        public Task<RteResponse> EnableDevice(Swipe.RTEProtocolDevice device)
+        {
+            return Send(device, new byte[] { (byte)'E' }, true);
+        }
+
+        public Task<RteResponse> DisableDevice(Swipe.RTEProtocolDevice device)
+        {
+            return Send(device, new byte[] { (byte)'D' }, false);
+        }
+
+        public Task<RteResponse> Inquire(Swipe.RTEProtocolDevice device, Swipe.RTEProtocolTrackValue tracks)
+        {
+            byte modifier = ToByte(tracks);
+            return Send(device, modifier == 0 ? new byte[] { (byte)'I' } : new byte[] { (byte)'I', modifier }, false);
+        }
+
+        public Task<RteResponse> OperateLED(Swipe.RTEProtocolDevice device, Swipe.RTEProtocolLEDStatus status, Swipe.RTEProtocolLEDOperation operation)
+        {
+            byte statusByte = ToByte(status);
+            // the operation is not sent when switching the LED off
+            return Send(device, statusByte == (byte)'0' || operation == Swipe.RTEProtocolLEDOperation.NONE
+                ? new byte[] { (byte)'L', statusByte }
+                : new byte[] { (byte)'L', statusByte, ToByte(operation) }, false);
+        }
+
+        // Duration in seconds, as for MMMReader_SwipeRTE_OperateBuzzer
+        public Task<RteResponse> OperateBuzzer(Swipe.RTEProtocolBuzzerTone tone, uint time)
+        {
+            byte toneByte = tone == Swipe.RTEProtocolBuzzerTone.WARBLE ? (byte)'W' : (byte)'O';
+            byte seconds = (byte)('0' + Math.Min(9u, time));
+            return Send(Swipe.RTEProtocolDevice.DEVICE, new byte[] { (byte)'B', toneByte, seconds }, false);
+        }
+
+        public Task<RteResponse> ResetDevice(Swipe.RTEProtocolDevice device)
+        {
+            return Send(device, new byte[] { (byte)'R' }, false);
+        }
+
+        private Task<RteResponse> Send(Swipe.RTEProtocolDevice device, byte[] text, bool priority)
+        {
+            var command = new RteCommand(device, ToByte(device), text[0], RteFrameParser.Encode(ToByte(device), (byte)'C', text, _parser.UseBcc));
+            lock (_lock)
+            {
+                if (priority)
+                {
+                    _pending.AddFirst(command);
+                }
+                else
+                {
+                    _pending.AddLast(command);
+                }
+            }
+            Pump();
+            return command.Completion.Task;
+        }
+
+        // Writes queued commands while the pipeline has room, skipping those whose device and
+        // command code are still outstanding
+        private void Pump()
+        {
+            lock (_lock)
+            {
+                LinkedListNode<RteCommand> node = _pending.First;
+                while (_running && node != null && _inFlight.Count(c => !c.TimedOut) < _maxInFlight)
+                {
+                    RteCommand command = node.Value;
+                    node = node.Next;
+                    if (_inFlight.Any(c => c.Device == command.Device && c.Code == command.Code))
+                    {
+                        continue;
+                    }
+                    _pending.Remove(command);
+                    try
+                    {
+                        _port.Write(command.Block, 0, command.Block.Length);
+                    }
+                    catch (Exception ex)
+                    {
+                        command.Completion.TrySetException(new PosHardwareException(String.Format("Failed to send RTE command {0}", ex.Message)));
+                        continue;
+                    }
+                    command.DeadlineMs = _clock.ElapsedMilliseconds + _commandTimeoutMs;
+                    _inFlight.Add(command);
+                }
+            }
+        }
+
+        private void ReadLoop()
+        {
+            while (_running)
+            {
+                int n;
+                try
+                {
+                    ArraySegment<byte> segment = _parser.GetWriteSegment();
+                    n = _port.Read(segment.Array, segment.Offset, segment.Count);
+                }
+                catch (Exception ex)
+                {
+                    if (_running)
+                    {
+                        log.WarnFormat("RTE serial read failed [{0}]", ex.Message);
+                        Thread.Sleep(100);
+                    }
+                    continue;
+                }
+
+                if (n > 0)
+                {
+                    _parser.Commit(n);
+                    RteFrame frame;
+                    while (_parser.TryParse(out frame))
+                    {
+                        Dispatch(frame);
+                    }
+                }
+                ExpireCommands();
+                Pump();
+            }
+        }
+
+        private void Dispatch(RteFrame frame)
+        {
+            switch (frame.Kind)
+            {
+                case RteFrameKind.BAD_CHECKSUM:
+                    Interlocked.Increment(ref _checksumErrors);
+                    log.WarnFormat("RTE block with bad checksum, asking for it again [{0}]", frame);
+                    SendNak();
+                    return;
+                case RteFrameKind.BAD_FRAME:
+                    Interlocked.Increment(ref _framingErrors);
+                    return;
+                case RteFrameKind.ACK:
+                case RteFrameKind.NAK:
+                    Complete(null, new RteResponse(frame.Kind, Swipe.RTEProtocolDevice.UNKNOWN, Swipe.RTEProtocolMessageType.COMMAND, null));
+                    return;
+            }
+
+            Interlocked.Increment(ref _messagesReceived);
+            Swipe.RTEProtocolDevice device = ToDevice(frame.Device);
+            if (frame.Type == (byte)'U')
+            {
+                // re-arm the reader before anybody gets to react to the swipe
+                if (_autoSendEnableDevice && device != Swipe.RTEProtocolDevice.DEVICE)
+                {
+                    EnableDevice(device);
+                }
+                var e = new RteMessageEvent(device, frame.TextAsString());
+                log.DebugFormat("Unsolicited RTE message [{0}]", e);
+                try { OnRteMessageEvent(this, e); }
+                catch { }
+                return;
+            }
+
+            Complete(frame, new RteResponse(frame.Kind, device,
+                frame.Type == (byte)'E' ? Swipe.RTEProtocolMessageType.ERROR_RESPONSE : Swipe.RTEProtocolMessageType.DATA,
+                frame.TextAsString()));
+        }
+
+        // A message answers the outstanding command of its device and the code it starts with,
+        // never one of another code waiting for its <ACK>; an <ACK>/<NAK> (frame null) the oldest
+        // command answered so
+        private void Complete(RteFrame? frame, RteResponse response)
+        {
+            RteCommand command;
+            lock (_lock)
+            {
+                if (frame.HasValue)
+                {
+                    byte device = frame.Value.Device;
+                    byte code = frame.Value.Text.Count > 0 ? frame.Value.Text.Array[frame.Value.Text.Offset] : (byte)0;
+                    command = _inFlight.FirstOrDefault(c => c.DeviceByte == device && c.Code == code);
+                }
+                else
+                {
+                    command = _inFlight.FirstOrDefault(c => !c.AnsweredByMessage);
+                }
+                if (command != null)
+                {
+                    _inFlight.Remove(command);
+                }
+            }
+            if (command == null)
+            {
+                log.DebugFormat("RTE response without outstanding command [{0}]", response);
+                return;
+            }
+            if (command.TimedOut)
+            {
+                Interlocked.Increment(ref _lateResponses);
+                log.InfoFormat("Dropped RTE response to a command to [{0}] that timed out [{1}]", command.Device, response);
+                return;
+            }
+            command.Completion.TrySetResult(response);
+        }
+
+        private void SendNak()
+        {
+            lock (_lock)
+            {
+                try
+                {
+                    _port.Write(nak, 0, nak.Length);
+                }
+                catch (Exception ex)
+                {
+                    log.WarnFormat("Failed to send RTE NAK [{0}]", ex.Message);
+                }
+            }
+        }
+
+        // Fails the commands past their deadline, leaving them outstanding as tombstones, and
+        // forgets the tombstones past theirs
+        private void ExpireCommands()
+        {
+            long now = _clock.ElapsedMilliseconds;
+            List<RteCommand> expired = null;
+            lock (_lock)
+            {
+                _inFlight.RemoveAll(c => c.TimedOut && c.DeadlineMs <= now);
+                foreach (RteCommand command in _inFlight.Where(c => c.DeadlineMs <= now))
+                {
+                    command.TimedOut = true;
+                    command.DeadlineMs = now + _commandTimeoutMs;
+                    if (expired == null)
+                    {
+                        expired = new List<RteCommand>();
+                    }
+                    expired.Add(command);
+                }
+            }
+            if (expired != null)
+            {
+                foreach (var command in expired)
+                {
+                    Interlocked.Increment(ref _commandTimeouts);
+                    log.WarnFormat("RTE command to [{0}] timed out after [{1}ms]", command.Device, _commandTimeoutMs);
+                    command.Completion.TrySetException(new TimeoutException(String.Format("RTE command to {0} timed out", command.Device)));
+                }
+            }
+        }
+
+        private static byte ToByte(Swipe.RTEProtocolDevice device)
+        {
+            switch (device)
+            {
+                case Swipe.RTEProtocolDevice.DEVICE: return (byte)'0';
+                case Swipe.RTEProtocolDevice.ATB: return (byte)'A';
+                case Swipe.RTEProtocolDevice.MSR: return (byte)'C';
+                case Swipe.RTEProtocolDevice.OCR: return (byte)'O';
+                case Swipe.RTEProtocolDevice.SERIAL: return (byte)'1';
+                case Swipe.RTEProtocolDevice.SMARTCARD: return (byte)'S';
+                default: throw new PosHardwareException(String.Format("Unable to send RTE command to device {0}", device));
+            }
+        }
+
+        private static Swipe.RTEProtocolDevice ToDevice(byte device)
+        {
+            switch (device)
+            {
+                case (byte)'0': return Swipe.RTEProtocolDevice.DEVICE;
+                case (byte)'A': return Swipe.RTEProtocolDevice.ATB;
+                case (byte)'C': return Swipe.RTEProtocolDevice.MSR;
+                case (byte)'O': return Swipe.RTEProtocolDevice.OCR;
+                case (byte)'1': return Swipe.RTEProtocolDevice.SERIAL;
+                case (byte)'S': return Swipe.RTEProtocolDevice.SMARTCARD;
+                case (byte)'!': return Swipe.RTEProtocolDevice.RESERVED;
+                default: return Swipe.RTEProtocolDevice.UNKNOWN;
+            }
+        }
+
+        private static byte ToByte(Swipe.RTEProtocolTrackValue tracks)
+        {
+            switch (tracks)
+            {
+                case Swipe.RTEProtocolTrackValue.DEVICE_DEFAULT: return (byte)'0';
+                case Swipe.RTEProtocolTrackValue.TRACK_ONE: return (byte)'1';
+                case Swipe.RTEProtocolTrackValue.TRACK_TWO: return (byte)'2';
+                case Swipe.RTEProtocolTrackValue.TRACK_THREE: return (byte)'3';
+                case Swipe.RTEProtocolTrackValue.TRACK_FOUR: return (byte)'4';
+                case Swipe.RTEProtocolTrackValue.ALL_TRACKS: return (byte)'A';
+                default: return 0;
+            }
+        }
+
+        private static byte ToByte(Swipe.RTEProtocolLEDStatus status)
+        {
+            switch (status)
+            {
+                case Swipe.RTEProtocolLEDStatus.RED: return (byte)'R';
+                case Swipe.RTEProtocolLEDStatus.AMBER: return (byte)'A';
+                case Swipe.RTEProtocolLEDStatus.GREEN: return (byte)'G';
+                default: return (byte)'0';
+            }
+        }
+
+        private static byte ToByte(Swipe.RTEProtocolLEDOperation operation)
+        {
+            return operation == Swipe.RTEProtocolLEDOperation.BLINK ? (byte)'B' : (byte)'O';
+        }
+
+        public void Dispose()
+        {
+            log.Debug("Disposing of RteProtocolEngine");
+            _running = false;
+            List<RteCommand> abandoned;
+            lock (_lock)
+            {
+                abandoned = new List<RteCommand>(_inFlight.Concat(_pending));
+                _inFlight.Clear();
+                _pending.Clear();
+            }
+            foreach (var command in abandoned)
+            {
+                command.Completion.TrySetCanceled();
+            }
+            if (_reader != null)
+            {
+                _reader.Wait(TimeSpan.FromSeconds(1));
+            }
+            _port.Dispose();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("RteProtocolEngine Messages [{0}] ChecksumErrors [{1}] FramingErrors [{2}] CommandTimeouts [{3}] LateResponses [{4}]",
+                MessagesReceived, ChecksumErrors, FramingErrors, CommandTimeouts, LateResponses);
+        }
+
+        private class RteCommand
+        {
+            public readonly Swipe.RTEProtocolDevice Device;
+            public readonly byte DeviceByte;
+            public readonly byte Code;
+            public readonly byte[] Block;
+            public readonly TaskCompletionSource<RteResponse> Completion = new TaskCompletionSource<RteResponse>();
+            // of the answer, or of the tombstone once timed out
+            public long DeadlineMs;
+            public bool TimedOut;
+
+            public RteCommand(Swipe.RTEProtocolDevice device, byte deviceByte, byte code, byte[] block)
+            {
+                Device = device;
+                DeviceByte = deviceByte;
+                Code = code;
+                Block = block;
+            }
+
+            // Inquire is answered with the data, the other commands with <ACK>/<NAK>
+            public bool AnsweredByMessage
+            {
+                get { return Code == (byte)'I'; }
+            }
+        }
+    }
+}
@@ -0,0 +1,155 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Swipe reader on the RTE interrupt or polled protocol driven by RteProtocolEngine on its
+    // serial port, in place of the SDK's swipe module. An unsolicited OCR message is parsed by
+    // MrzCodelineParser and raised between START_OF_SWIPE_DATA and END_OF_SWIPE_DATA like a
+    // codeline of the SDK, the messages of other devices as MESSAGE_CONTENT. The reader counts as
+    // connected, SWIPE_READER_CONNECTED, once it acknowledged enabling its OCR.
+    public class RteSwipeReader : IRecoverableScanSource
+    {
+        private static readonly ILog log = LogProvider.For<RteSwipeReader>();
+
+        private readonly Func<ISerialPort> _openPort;
+        private readonly bool _useBcc;
+        private readonly bool _autoSendEnableDevice;
+        private readonly TimeSpan _commandTimeout;
+        private readonly ScanSourceEventDispatcher _dispatcher;
+        private readonly object _lock = new object();
+        private RteProtocolEngine _engine;
+
+        public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent
+        {
+            add { _dispatcher.OnCodeLineScanEvent += value; }
+            remove { _dispatcher.OnCodeLineScanEvent -= value; }
+        }
+
+        public event EventHandler<ScanSourceEvent> OnScanSourceEvent
+        {
+            add { _dispatcher.OnScanSourceEvent += value; }
+            remove { _dispatcher.OnScanSourceEvent -= value; }
+        }
+
+        // openPort is called on every (re)connect, the engine closes the port it was given
+        public RteSwipeReader(Func<ISerialPort> openPort, bool useBcc, bool autoSendEnableDevice, TimeSpan commandTimeout)
+        {
+            _openPort = openPort;
+            _useBcc = useBcc;
+            _autoSendEnableDevice = autoSendEnableDevice;
+            _commandTimeout = commandTimeout;
+            _dispatcher = new ScanSourceEventDispatcher(this);
+        }
+
+        // The port and RTE options configured for the SDK
+        public static RteSwipeReader FromSwipeSettings(Swipe.SwipeSettings settings)
+        {
+            String protocolName = new String(settings.Protocol.ProtocolName).Replace("\0", "");
+            if (protocolName != "RTE_INTERRUPT" && protocolName != "RTE_POLLED")
+            {
+                throw new PosHardwareException(String.Format("Swipe reader protocol {0} is not driven by the RTE protocol engine", protocolName));
+            }
+            TimeSpan commandTimeout = settings.Protocol.CommandTimeout > 0
+                ? TimeSpan.FromMilliseconds(settings.Protocol.CommandTimeout)
+                : RteProtocolEngine.DefaultCommandTimeout;
+            Swipe.ConnectionSettings connection = settings.Connection;
+            return new RteSwipeReader(() => new SerialPortAdapter(connection),
+                settings.Protocol.RTE.UseBCC > 0, settings.Protocol.RTE.AutoSendEnableDevice > 0, commandTimeout);
+        }
+
+        // Reads the SDK's swipe settings, as MMMSwipeReader does
+        public static RteSwipeReader FromSdkSettings()
+        {
+            MMM.Readers.Modules.Swipe.SwipeSettings settings = new MMM.Readers.Modules.Swipe.SwipeSettings();
+            MMMSwipeReader.LoadSwipeSettings(ref settings);
+            return FromSwipeSettings(settings);
+        }
+
+        public void Activate()
+        {
+            log.Debug("Begin RTE Swipe Reader Activation");
+            var engine = new RteProtocolEngine(_openPort(), _useBcc, _autoSendEnableDevice, _commandTimeout, RteProtocolEngine.DefaultMaxInFlight);
+            engine.OnRteMessageEvent += HandleRteMessage;
+            RteProtocolEngine previous;
+            lock (_lock)
+            {
+                previous = _engine;
+                _engine = engine;
+            }
+            if (previous != null)
+            {
+                previous.OnRteMessageEvent -= HandleRteMessage;
+                previous.Dispose();
+            }
+
+            RteResponse response;
+            try
+            {
+                engine.Start();
+                Task<RteResponse> enabled = engine.EnableDevice(Swipe.RTEProtocolDevice.OCR);
+                enabled.Wait();
+                response = enabled.Result;
+            }
+            catch (Exception ex)
+            {
+                Exception cause = ex is AggregateException ? ex.InnerException : ex;
+                throw new PosHardwareException(String.Format("Failed RTE Swipe Reader Activation {0}", cause.Message), cause);
+            }
+            if (!response.IsSuccess)
+            {
+                throw new PosHardwareException(String.Format("Failed RTE Swipe Reader Activation, reader answered [{0}]", response));
+            }
+            log.Debug("End RTE Swipe Reader Activation");
+            log.Info("Swipe Reader Acquired");
+            _dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.SWIPE_READER_CONNECTED);
+        }
+
+        // The serial port is opened again from scratch, there is no SDK state to keep
+        public void Reconnect()
+        {
+            Activate();
+        }
+
+        private void HandleRteMessage(object sender, RteMessageEvent e)
+        {
+            if (e.Device != Swipe.RTEProtocolDevice.OCR)
+            {
+                _dispatcher.DataReceived(Swipe.SwipeItem.MESSAGE_CONTENT, e.Text);
+                return;
+            }
+            MMM.Readers.CodelineData codeline = MrzCodelineParser.Parse(e.Text);
+            _dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA);
+            _dispatcher.CodelineReceived(codeline);
+            _dispatcher.EventReceived(MMM.Readers.FullPage.EventCode.END_OF_SWIPE_DATA);
+        }
+
+        public void Dispose()
+        {
+            log.Debug("Begin disposing of RTE Swipe Reader");
+            RteProtocolEngine engine;
+            lock (_lock)
+            {
+                engine = _engine;
+                _engine = null;
+            }
+            if (engine != null)
+            {
+                engine.OnRteMessageEvent -= HandleRteMessage;
+                engine.Dispose();
+            }
+            log.Info("Swipe Reader Released");
+        }
+
+        public override String ToString()
+        {
+            RteProtocolEngine engine = _engine;
+            return String.Format("RteSwipeReader UseBcc [{0}] AutoSendEnableDevice [{1}] Engine [{2}]", _useBcc, _autoSendEnableDevice, engine);
+        }
+    }
+}
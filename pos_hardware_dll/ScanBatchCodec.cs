@@ -0,0 +1,153 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Compression;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Several scans in one upload. The client id and access key are written once for the batch
+    // and the records (see ScanRecordCodec) are deflated together, so the field values repeated
+    // between scans (issuing state, nationality, document type, codeline fillers) are encoded as
+    // back references to the previous records.
+    //
+    //   batch : 'A' 'B' [schema version] [flags] [clientId] [accessKey] [record count] body
+    //   body  : ([record length] record)*, deflated when FLAG_DEFLATED is set
+    //
+    // The body is stored uncompressed when deflating does not make it smaller; .NET 4.0's
+    // DeflateStream can grow incompressible input. A deflated body is inflated to at most
+    // MaxRecordBytes per declared record, so a small batch can not inflate to gigabytes.
+    public static class ScanBatchCodec
+    {
+        public const String ContentType = "application/vnd.alika.scan-batch";
+        public const byte SchemaVersion = 1;
+        public const int MaxBatchSize = 1000;
+        // a record with every string field at the SDK's longest is far below this
+        public const int MaxRecordBytes = 4096;
+
+        private const byte FLAG_DEFLATED = 0x01;
+
+        public static byte[] EncodeBatch(String clientId, String accessKey, IList<MMM.Readers.CodelineData> codeLineData)
+        {
+            if (codeLineData.Count > MaxBatchSize)
+            {
+                throw new ArgumentException(String.Format("A batch holds at most {0} scans", MaxBatchSize));
+            }
+
+            var body = new CompactWriter(256 * codeLineData.Count);
+            var record = new CompactWriter(256);
+            foreach (var data in codeLineData)
+            {
+                record.Reset();
+                ScanRecordCodec.WriteRecord(ref record, data);
+                if (record.Length > MaxRecordBytes)
+                {
+                    throw new ArgumentException(String.Format("A scan record is at most {0} bytes", MaxRecordBytes));
+                }
+                body.WriteVarint((uint)record.Length);
+                body.WriteBytes(record.GetBuffer(), 0, record.Length);
+            }
+            byte[] deflated = Deflate(body.GetBuffer(), body.Length);
+            bool useDeflated = deflated.Length < body.Length;
+
+            var writer = new CompactWriter(64 + (useDeflated ? deflated.Length : body.Length));
+            writer.WriteByte((byte)'A');
+            writer.WriteByte((byte)'B');
+            writer.WriteByte(SchemaVersion);
+            writer.WriteByte(useDeflated ? FLAG_DEFLATED : (byte)0);
+            writer.WriteString(clientId);
+            writer.WriteString(accessKey);
+            writer.WriteVarint((uint)codeLineData.Count);
+            if (useDeflated)
+            {
+                writer.WriteBytes(deflated, 0, deflated.Length);
+            }
+            else
+            {
+                writer.WriteBytes(body.GetBuffer(), 0, body.Length);
+            }
+            return writer.ToArray();
+        }
+
+        public static List<MMM.Readers.CodelineData> DecodeBatch(byte[] batch, out String clientId, out String accessKey)
+        {
+            var reader = new CompactReader(batch, 0, batch.Length);
+            if (reader.ReadByte() != (byte)'A' || reader.ReadByte() != (byte)'B')
+            {
+                throw new FormatException("Not a scan batch");
+            }
+            byte version = reader.ReadByte();
+            if (version != SchemaVersion)
+            {
+                throw new FormatException(String.Format("Unsupported scan batch schema version {0}", version));
+            }
+            byte flags = reader.ReadByte();
+            clientId = reader.ReadString();
+            accessKey = reader.ReadString();
+            int count = (int)reader.ReadVarint();
+            if (count > MaxBatchSize)
+            {
+                throw new FormatException(String.Format("Scan batch holds too many scans {0}", count));
+            }
+
+            byte[] body;
+            if ((flags & FLAG_DEFLATED) != 0)
+            {
+                // a record and the varint of its length
+                body = Inflate(batch, reader.Position, batch.Length - reader.Position, Math.Max(1, count) * (MaxRecordBytes + 5));
+            }
+            else
+            {
+                body = new byte[batch.Length - reader.Position];
+                reader.ReadBytes(body, 0, body.Length);
+            }
+
+            var bodyReader = new CompactReader(body, 0, body.Length);
+            var result = new List<MMM.Readers.CodelineData>(count);
+            for (int i = 0; i < count; i++)
+            {
+                int length = (int)bodyReader.ReadVarint();
+                if (length > body.Length - bodyReader.Position)
+                {
+                    throw new FormatException("Scan batch is truncated");
+                }
+                var recordReader = new CompactReader(body, bodyReader.Position, length);
+                result.Add(ScanRecordCodec.ReadRecord(ref recordReader));
+                bodyReader.Skip(length);
+            }
+            return result;
+        }
+
+        private static byte[] Deflate(byte[] buffer, int count)
+        {
+            using (var compressed = new MemoryStream(count / 2 + 64))
+            {
+                using (var deflate = new DeflateStream(compressed, CompressionMode.Compress, true))
+                {
+                    deflate.Write(buffer, 0, count);
+                }
+                return compressed.ToArray();
+            }
+        }
+
+        private static byte[] Inflate(byte[] buffer, int offset, int count, int maxLength)
+        {
+            using (var deflate = new DeflateStream(new MemoryStream(buffer, offset, count, false), CompressionMode.Decompress))
+            using (var inflated = new MemoryStream(Math.Min(count * 4, maxLength)))
+            {
+                byte[] chunk = new byte[4096];
+                int read;
+                while ((read = deflate.Read(chunk, 0, chunk.Length)) > 0)
+                {
+                    if (inflated.Length + read > maxLength)
+                    {
+                        throw new PosHardwareException(String.Format("Scan batch inflates to more than [{0}] bytes", maxLength));
+                    }
+                    inflated.Write(chunk, 0, read);
+                }
+                return inflated.ToArray();
+            }
+        }
+    }
+}
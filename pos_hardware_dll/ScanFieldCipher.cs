@@ -0,0 +1,263 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Security.Cryptography;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Authenticated encryption of the personal fields of a scan for local persistence: the MRZ
+    // lines, names, document id and number, optional data and date of birth. Document type,
+    // issuing state, nationality, sex, expiry and validation stay in the clear so that scans can
+    // still be routed and counted without the key.
+    //
+    //   sealed : [length] [random block] [AES-256-CBC of the personal fields, padded] [tag]
+    //
+    // The tag is the first 16 bytes of HMAC-SHA256 over the caller's context and the ciphertext
+    // (encrypt then MAC). Instead of a new IV per scan the first plaintext block is random, which
+    // makes the chaining state carried over from the previous scan irrelevant, so the cipher
+    // transforms are created once and reused along with all buffers. Not thread safe, an
+    // instance belongs to one owner that serializes its use.
+    public class ScanFieldCipher : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<ScanFieldCipher>();
+        public const int KeyLength = 64;
+        private const int BLOCK_LENGTH = 16;
+        private const int TAG_LENGTH = 16;
+        private static readonly byte[] empty = new byte[0];
+        private static readonly byte[] keyFileEntropy = Encoding.ASCII.GetBytes("CH.Alika.POS.ScanFieldCipher");
+
+        private readonly Aes _aes;
+        private readonly ICryptoTransform _encryptor;
+        private readonly ICryptoTransform _decryptor;
+        private readonly Mac _hmac;
+        private readonly RandomNumberGenerator _random;
+        private readonly byte[] _context = new byte[8];
+        private readonly byte[] _firstBlock = new byte[BLOCK_LENGTH];
+        private CompactWriter _plain = new CompactWriter(512);
+        private byte[] _sealed = new byte[512];
+        private byte[] _opened = new byte[512];
+
+        // 32 bytes AES key followed by 32 bytes HMAC key
+        public ScanFieldCipher(byte[] key)
+        {
+            if (key == null || key.Length != KeyLength)
+            {
+                throw new PosHardwareException(String.Format("Scan field key must be {0} bytes", KeyLength));
+            }
+            byte[] aesKey = new byte[32];
+            byte[] macKey = new byte[32];
+            Buffer.BlockCopy(key, 0, aesKey, 0, 32);
+            Buffer.BlockCopy(key, 32, macKey, 0, 32);
+            _aes = Aes.Create();
+            _aes.Mode = CipherMode.CBC;
+            _aes.Padding = PaddingMode.None;
+            _encryptor = _aes.CreateEncryptor(aesKey, new byte[BLOCK_LENGTH]);
+            _decryptor = _aes.CreateDecryptor(aesKey, new byte[BLOCK_LENGTH]);
+            _hmac = new Mac(macKey);
+            _random = RandomNumberGenerator.Create();
+        }
+
+        // Key kept next to the data, protected with DPAPI for the machine so that only this
+        // machine can use it; created on first use
+        public static ScanFieldCipher ForKeyFile(String keyFileName)
+        {
+            byte[] key;
+            Directory.CreateDirectory(Path.GetDirectoryName(Path.GetFullPath(keyFileName)));
+            if (File.Exists(keyFileName))
+            {
+                key = ProtectedData.Unprotect(File.ReadAllBytes(keyFileName), keyFileEntropy, DataProtectionScope.LocalMachine);
+            }
+            else
+            {
+                log.InfoFormat("Creating scan field key [{0}]", keyFileName);
+                key = new byte[KeyLength];
+                using (var random = RandomNumberGenerator.Create())
+                {
+                    random.GetBytes(key);
+                }
+                String created = keyFileName + ".tmp";
+                File.WriteAllBytes(created, ProtectedData.Protect(key, keyFileEntropy, DataProtectionScope.LocalMachine));
+                File.Move(created, keyFileName);
+            }
+            return new ScanFieldCipher(key);
+        }
+
+        // Writes the record with the personal fields left out followed by them sealed. The same
+        // context must be given to ReadRecord, it keeps a sealed blob from being moved to
+        // another record.
+        internal void WriteRecord(ref CompactWriter writer, MMM.Readers.CodelineData data, long context)
+        {
+            ScanRecordCodec.WriteRecord(ref writer, WithoutPersonalFields(data));
+
+            _plain.Reset();
+            _plain.WriteString(data.Data);
+            _plain.WriteString(data.Line1);
+            _plain.WriteString(data.Line2);
+            _plain.WriteString(data.Line3);
+            _plain.WriteString(data.DocId);
+            _plain.WriteString(data.Surname);
+            _plain.WriteString(data.Forename);
+            _plain.WriteString(data.SecondName);
+            _plain.WriteString(data.Forenames);
+            _plain.WriteString(data.DocNumber);
+            _plain.WriteString(data.OptionalData1);
+            _plain.WriteString(data.OptionalData2);
+            _plain.WriteVarint((uint)data.DateOfBirth.Year);
+            _plain.WriteVarint((uint)data.DateOfBirth.Month);
+            _plain.WriteVarint((uint)data.DateOfBirth.Day);
+            // PKCS7
+            byte padding = (byte)(BLOCK_LENGTH - _plain.Length % BLOCK_LENGTH);
+            for (int i = 0; i < padding; i++)
+            {
+                _plain.WriteByte(padding);
+            }
+
+            int cipherLength = BLOCK_LENGTH + _plain.Length;
+            if (_sealed.Length < cipherLength)
+            {
+                _sealed = new byte[Math.Max(cipherLength, _sealed.Length * 2)];
+            }
+            _random.GetBytes(_firstBlock);
+            _encryptor.TransformBlock(_firstBlock, 0, BLOCK_LENGTH, _sealed, 0);
+            _encryptor.TransformBlock(_plain.GetBuffer(), 0, _plain.Length, _sealed, BLOCK_LENGTH);
+            byte[] tag = Tag(_sealed, 0, cipherLength, context);
+
+            writer.WriteVarint((uint)(cipherLength + TAG_LENGTH));
+            writer.WriteBytes(_sealed, 0, cipherLength);
+            writer.WriteBytes(tag, 0, TAG_LENGTH);
+        }
+
+        // The fields that stay in the clear, the personal ones left out
+        internal static MMM.Readers.CodelineData WithoutPersonalFields(MMM.Readers.CodelineData data)
+        {
+            MMM.Readers.CodelineData clear = data;
+            clear.Data = null;
+            clear.Line1 = null;
+            clear.Line2 = null;
+            clear.Line3 = null;
+            clear.DocId = null;
+            clear.Surname = null;
+            clear.Forename = null;
+            clear.SecondName = null;
+            clear.Forenames = null;
+            clear.DocNumber = null;
+            clear.OptionalData1 = null;
+            clear.OptionalData2 = null;
+            clear.DateOfBirth = new MMM.Readers.Date();
+            return clear;
+        }
+
+        internal MMM.Readers.CodelineData ReadRecord(ref CompactReader reader, long context)
+        {
+            MMM.Readers.CodelineData data = ScanRecordCodec.ReadRecord(ref reader);
+            int sealedLength = (int)reader.ReadVarint();
+            int cipherLength = sealedLength - TAG_LENGTH;
+            if (cipherLength < 2 * BLOCK_LENGTH || cipherLength % BLOCK_LENGTH != 0)
+            {
+                throw new FormatException("Sealed scan fields have an invalid length");
+            }
+            if (_sealed.Length < sealedLength)
+            {
+                _sealed = new byte[Math.Max(sealedLength, _sealed.Length * 2)];
+            }
+            reader.ReadBytes(_sealed, 0, sealedLength);
+
+            byte[] tag = Tag(_sealed, 0, cipherLength, context);
+            int difference = 0;
+            for (int i = 0; i < TAG_LENGTH; i++)
+            {
+                difference |= tag[i] ^ _sealed[cipherLength + i];
+            }
+            if (difference != 0)
+            {
+                throw new CryptographicException("Sealed scan fields failed authentication");
+            }
+
+            if (_opened.Length < cipherLength)
+            {
+                _opened = new byte[Math.Max(cipherLength, _opened.Length * 2)];
+            }
+            // the first block only ever decrypts the random block
+            _decryptor.TransformBlock(_sealed, 0, cipherLength, _opened, 0);
+            int padding = _opened[cipherLength - 1];
+            if (padding < 1 || padding > BLOCK_LENGTH)
+            {
+                throw new CryptographicException("Sealed scan fields have invalid padding");
+            }
+
+            var plain = new CompactReader(_opened, BLOCK_LENGTH, cipherLength - BLOCK_LENGTH - padding);
+            data.Data = plain.ReadString();
+            data.Line1 = plain.ReadString();
+            data.Line2 = plain.ReadString();
+            data.Line3 = plain.ReadString();
+            data.DocId = plain.ReadString();
+            data.Surname = plain.ReadString();
+            data.Forename = plain.ReadString();
+            data.SecondName = plain.ReadString();
+            data.Forenames = plain.ReadString();
+            data.DocNumber = plain.ReadString();
+            data.OptionalData1 = plain.ReadString();
+            data.OptionalData2 = plain.ReadString();
+            var dateOfBirth = new MMM.Readers.Date();
+            dateOfBirth.Year = (int)plain.ReadVarint();
+            dateOfBirth.Month = (int)plain.ReadVarint();
+            dateOfBirth.Day = (int)plain.ReadVarint();
+            data.DateOfBirth = dateOfBirth;
+            return data;
+        }
+
+        // Keyed hash of a value for looking it up without storing it, case insensitive
+        internal uint Fingerprint(String value)
+        {
+            _plain.Reset();
+            foreach (char c in value)
+            {
+                _plain.WriteVarint(Char.ToUpperInvariant(c));
+            }
+            // no sequence is negative, so a fingerprint never equals a record tag
+            byte[] tag = Tag(_plain.GetBuffer(), 0, _plain.Length, -1);
+            return (uint)(tag[0] | tag[1] << 8 | tag[2] << 16 | tag[3] << 24);
+        }
+
+        private byte[] Tag(byte[] cipher, int offset, int count, long context)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                _context[i] = (byte)(context >> (8 * i));
+            }
+            // every tag starts from the key alone, also after a tag that failed half way
+            _hmac.Initialize();
+            _hmac.TransformBlock(_context, 0, _context.Length, null, 0);
+            _hmac.TransformBlock(cipher, offset, count, null, 0);
+            // a final block with data would be copied to a new array
+            _hmac.TransformFinalBlock(empty, 0, 0);
+            return _hmac.LastHash;
+        }
+
+        // Hash hands out a copy, the tag is only read before the next one is computed
+        private class Mac : HMACSHA256
+        {
+            public Mac(byte[] key)
+                : base(key)
+            {
+            }
+
+            public byte[] LastHash
+            {
+                get { return HashValue; }
+            }
+        }
+
+        public void Dispose()
+        {
+            _encryptor.Dispose();
+            _decryptor.Dispose();
+            _hmac.Clear();
+            _aes.Clear();
+            _random.Dispose();
+        }
+    }
+}
@@ -0,0 +1,1125 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Embedded log structured store of scans. Scans are appended to the active segment file and
+    // never rewritten in place; a segment that reaches MaxSegmentBytes is sealed and the next one
+    // started. Marking scans synced appends a marker record instead of touching the scans.
+    // Compaction rewrites sealed segments, folding markers into the scan records and dropping
+    // synced scans once the whole segment is older than RetainSynced.
+    //
+    //   segment : 'A' 'L' [version] [next sequence, fixed64] record...
+    //   record  : [body length, fixed32] [CRC-32 of body, fixed32] body
+    //   scan    : 1 [sequence, fixed64] [stored at, UTC ticks fixed64] [flags]
+    //             [doc number hash, fixed32] [trace id, fixed64] [codeline, see ScanRecordCodec]
+    //             or with FLAG_SEALED [codeline, see ScanFieldCipher]
+    //   synced  : 2 [run count] ([first sequence, fixed64] [count])...
+    //
+    // The index lives in memory and is rebuilt on open by reading the segments record by record,
+    // each checked against its CRC but no codeline decoded. A scan is stored under the trace ID
+    // of its CodeLineScanEvent, see ScanTrace, which the index maps to the scan's sequence, and
+    // finding a scan by sequence is an array lookup; scans of one document number are chained
+    // through the index.
+    // With a ScanFieldCipher the personal fields are sealed and the doc number hash is keyed.
+    // Every append is written through to the operating system, so a service crash loses nothing,
+    // and flushed to disk at most FlushInterval later.
+    public class ScanLog : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<ScanLog>();
+        public const int DefaultMaxSegmentBytes = 8 * 1024 * 1024;
+        public static readonly TimeSpan DefaultRetainSynced = TimeSpan.FromDays(30);
+        public static readonly TimeSpan FlushInterval = TimeSpan.FromSeconds(1);
+
+        private const byte SegmentVersion = 2;
+        private const int SEGMENT_HEADER_LENGTH = 11;
+        private const int RECORD_HEADER_LENGTH = 8;
+        private const int SCAN_FLAGS_OFFSET = RECORD_HEADER_LENGTH + 17;
+        private const byte RECORD_SCAN = 1;
+        private const byte RECORD_SYNCED = 2;
+        private const byte FLAG_SYNCED = 0x01;
+        // scan record only
+        private const byte FLAG_SEALED = 0x02;
+        // index only
+        private const byte FLAG_SYNCED_IN_RECORD = 0x10;
+        private const byte FLAG_REMOVED = 0x20;
+
+        private readonly String _directory;
+        private readonly object _lock = new object();
+        private readonly object _compactLock = new object();
+        private readonly List<IndexEntry> _entries = new List<IndexEntry>();
+        private readonly Dictionary<uint, long> _latestByDocNumber = new Dictionary<uint, long>();
+        private readonly Dictionary<long, long> _sequenceByTraceId = new Dictionary<long, long>();
+        private readonly SortedDictionary<int, Segment> _segments = new SortedDictionary<int, Segment>();
+        private readonly Dictionary<int, FileStream> _readers = new Dictionary<int, FileStream>();
+        private readonly Timer _flushTimer;
+        private readonly ScanFieldCipher _cipher;
+        private CompactWriter _writer = new CompactWriter(512);
+        private byte[] _readBuffer = new byte[512];
+        // sequence of _entries[0]
+        private long _baseSequence = 1;
+        private long _nextSequence = 1;
+        // no entry before it is unsynced
+        private int _firstUnsynced = 0;
+        private long _count;
+        private long _unsyncedCount;
+        private Segment _active;
+        private FileStream _activeStream;
+        private bool _dirty = false;
+        private bool _disposed = false;
+
+        public int MaxSegmentBytes { get; set; }
+        public TimeSpan RetainSynced { get; set; }
+
+        public ScanLog(String directory)
+            : this(directory, DefaultMaxSegmentBytes)
+        {
+        }
+
+        public ScanLog(String directory, int maxSegmentBytes)
+            : this(directory, maxSegmentBytes, null)
+        {
+        }
+
+        // The log owns the cipher and disposes of it
+        public ScanLog(String directory, int maxSegmentBytes, ScanFieldCipher cipher)
+        {
+            _directory = directory;
+            _cipher = cipher;
+            MaxSegmentBytes = Math.Max(4096, maxSegmentBytes);
+            RetainSynced = DefaultRetainSynced;
+            Directory.CreateDirectory(directory);
+            var clock = Stopwatch.StartNew();
+            Load();
+            log.InfoFormat("Opened [{0}] in [{1}] ms", this, clock.ElapsedMilliseconds);
+            _flushTimer = new Timer(state => FlushToDisk(), null, FlushInterval, FlushInterval);
+        }
+
+        public long Count
+        {
+            get { lock (_lock) { return _count; } }
+        }
+
+        public long UnsyncedCount
+        {
+            get { lock (_lock) { return _unsyncedCount; } }
+        }
+
+        public int SegmentCount
+        {
+            get { lock (_lock) { return _segments.Count; } }
+        }
+
+        public long Bytes
+        {
+            get { lock (_lock) { return _segments.Values.Sum(s => s.Length); } }
+        }
+
+        // traceId is the scan's id in ScanTrace, 0 when it was not traced
+        public StoredScan Append(long traceId, MMM.Readers.CodelineData codeLineData)
+        {
+            lock (_lock)
+            {
+                ThrowIfDisposed();
+                long sequence = _nextSequence;
+                DateTime storedUtc = DateTime.UtcNow;
+                uint docHash = DocNumberHash(NormalizeDocNumber(codeLineData.DocNumber));
+                _writer.Reset();
+                _writer.WriteFixed64(0);
+                _writer.WriteByte(RECORD_SCAN);
+                _writer.WriteFixed64((ulong)sequence);
+                _writer.WriteFixed64((ulong)storedUtc.Ticks);
+                _writer.WriteByte(_cipher == null ? (byte)0 : FLAG_SEALED);
+                _writer.WriteFixed32(docHash);
+                _writer.WriteFixed64((ulong)traceId);
+                if (_cipher == null)
+                {
+                    ScanRecordCodec.WriteRecord(ref _writer, codeLineData);
+                }
+                else
+                {
+                    _cipher.WriteRecord(ref _writer, codeLineData, sequence);
+                }
+                int offset = WriteRecord();
+
+                _nextSequence++;
+                AddEntry(sequence, _active.Id, offset, _writer.Length, 0, docHash, traceId);
+                _active.LiveBytes += _writer.Length;
+                _active.LastStoredTicks = storedUtc.Ticks;
+                return new StoredScan(traceId, sequence, storedUtc, false, codeLineData);
+            }
+        }
+
+        public StoredScan Get(long traceId)
+        {
+            lock (_lock)
+            {
+                ThrowIfDisposed();
+                long sequence;
+                int index;
+                if (traceId == 0 || !_sequenceByTraceId.TryGetValue(traceId, out sequence) || !TryGetIndex(sequence, out index))
+                {
+                    return null;
+                }
+                return ReadScan(sequence, _entries[index]);
+            }
+        }
+
+        // Newest first
+        public IList<StoredScan> FindByDocNumber(String docNumber)
+        {
+            var result = new List<StoredScan>();
+            String normalized = NormalizeDocNumber(docNumber);
+            uint docHash = DocNumberHash(normalized);
+            lock (_lock)
+            {
+                ThrowIfDisposed();
+                long sequence;
+                if (docHash == 0 || !_latestByDocNumber.TryGetValue(docHash, out sequence))
+                {
+                    return result;
+                }
+                // the chain runs through removed scans, it ends before the oldest one indexed
+                while (sequence != 0 && sequence >= _baseSequence)
+                {
+                    IndexEntry entry = _entries[(int)(sequence - _baseSequence)];
+                    if ((entry.Flags & FLAG_REMOVED) == 0 && entry.DocHash == docHash)
+                    {
+                        // the hash only narrows the search down
+                        StoredScan scan = ReadScan(sequence, entry);
+                        if (String.Equals(NormalizeDocNumber(scan.CodeLineData.DocNumber), normalized, StringComparison.OrdinalIgnoreCase))
+                        {
+                            result.Add(scan);
+                        }
+                    }
+                    sequence = entry.PreviousSameDoc;
+                }
+            }
+            return result;
+        }
+
+        // Oldest first
+        public IList<StoredScan> Unsynced(int max, ICollection<long> except)
+        {
+            var result = new List<StoredScan>();
+            lock (_lock)
+            {
+                ThrowIfDisposed();
+                AdvanceFirstUnsynced();
+                for (int i = _firstUnsynced; i < _entries.Count && result.Count < max; i++)
+                {
+                    IndexEntry entry = _entries[i];
+                    long sequence = _baseSequence + i;
+                    if ((entry.Flags & (FLAG_SYNCED | FLAG_REMOVED)) == 0 && (except == null || !except.Contains(sequence)))
+                    {
+                        result.Add(ReadScan(sequence, entry));
+                    }
+                }
+            }
+            return result;
+        }
+
+        // Returns how many of the scans were not marked synced before
+        public int MarkSynced(IEnumerable<long> sequences)
+        {
+            lock (_lock)
+            {
+                ThrowIfDisposed();
+                var marked = new List<long>();
+                int index;
+                foreach (long sequence in sequences.Distinct().OrderBy(s => s))
+                {
+                    if (TryGetIndex(sequence, out index) && (_entries[index].Flags & FLAG_SYNCED) == 0)
+                    {
+                        marked.Add(sequence);
+                    }
+                }
+                if (marked.Count == 0)
+                {
+                    return 0;
+                }
+
+                // the marker is written before the index changes, an index never claims more than the disk
+                _writer.Reset();
+                _writer.WriteFixed64(0);
+                WriteSyncedBody(ref _writer, marked);
+                WriteRecord();
+                foreach (long sequence in marked)
+                {
+                    MarkSyncedInIndex(sequence);
+                }
+                AdvanceFirstUnsynced();
+                return marked.Count;
+            }
+        }
+
+        // Rewrites the sealed segments where at least half the bytes can be reclaimed: sync markers,
+        // removed scans, and synced scans when the segment is past RetainSynced. Returns the number
+        // of bytes reclaimed.
+        public long Compact()
+        {
+            lock (_compactLock)
+            {
+                long reclaimed = 0;
+                foreach (int id in CompactionCandidates())
+                {
+                    reclaimed += CompactSegment(id);
+                }
+                return reclaimed;
+            }
+        }
+
+        private List<int> CompactionCandidates()
+        {
+            long cutoff = (DateTime.UtcNow - RetainSynced).Ticks;
+            lock (_lock)
+            {
+                var candidates = new List<int>();
+                foreach (var segment in _segments.Values)
+                {
+                    if (segment == _active)
+                    {
+                        continue;
+                    }
+                    long reclaimable = segment.Length - SEGMENT_HEADER_LENGTH - segment.LiveBytes;
+                    if (segment.LastStoredTicks < cutoff)
+                    {
+                        reclaimable += segment.SyncedBytes;
+                    }
+                    if (reclaimable > 0 && reclaimable * 2 >= segment.Length)
+                    {
+                        candidates.Add(segment.Id);
+                    }
+                }
+                return candidates;
+            }
+        }
+
+        private long CompactSegment(int id)
+        {
+            String path = SegmentPath(id);
+            Segment segment;
+            lock (_lock)
+            {
+                if (_disposed || !_segments.TryGetValue(id, out segment) || segment == _active)
+                {
+                    return 0;
+                }
+            }
+            // sealed, so it is never written again and can be read without holding up appends
+            byte[] bytes = File.ReadAllBytes(path);
+            long cutoff = (DateTime.UtcNow - RetainSynced).Ticks;
+
+            // what is kept is decided against the index under the lock, the new segment is written
+            // and flushed to disk without it
+            var output = new CompactWriter(bytes.Length);
+            var moved = new List<KeyValuePair<long, int>>();
+            var syncedInRecord = new HashSet<long>();
+            var removed = new List<long>();
+            long lastStoredTicks = 0;
+            lock (_lock)
+            {
+                if (_disposed)
+                {
+                    return 0;
+                }
+                bool expired = segment.LastStoredTicks < cutoff;
+                output.WriteBytes(bytes, 0, SEGMENT_HEADER_LENGTH);
+                var carried = new List<long>();
+
+                int offset = SEGMENT_HEADER_LENGTH;
+                int length;
+                while ((length = ValidRecordLength(bytes, offset, bytes.Length)) > 0)
+                {
+                    var body = new CompactReader(bytes, offset + RECORD_HEADER_LENGTH, length - RECORD_HEADER_LENGTH);
+                    byte type = body.ReadByte();
+                    if (type == RECORD_SCAN)
+                    {
+                        long sequence = (long)body.ReadFixed64();
+                        long storedTicks = (long)body.ReadFixed64();
+                        int index;
+                        if (TryGetIndex(sequence, out index) && _entries[index].Segment == id)
+                        {
+                            bool synced = (_entries[index].Flags & FLAG_SYNCED) != 0;
+                            if (synced && expired)
+                            {
+                                removed.Add(sequence);
+                            }
+                            else
+                            {
+                                int start = output.Length;
+                                output.WriteBytes(bytes, offset, length);
+                                if (synced)
+                                {
+                                    byte[] buffer = output.GetBuffer();
+                                    buffer[start + SCAN_FLAGS_OFFSET] |= FLAG_SYNCED;
+                                    WriteRecordHeader(buffer, start, length - RECORD_HEADER_LENGTH);
+                                    syncedInRecord.Add(sequence);
+                                }
+                                moved.Add(new KeyValuePair<long, int>(sequence, start));
+                                lastStoredTicks = Math.Max(lastStoredTicks, storedTicks);
+                            }
+                        }
+                    }
+                    else if (type == RECORD_SYNCED)
+                    {
+                        // only markers for scans whose own record does not say so yet are kept
+                        foreach (long sequence in ReadSyncedBody(ref body))
+                        {
+                            int index;
+                            if (TryGetIndex(sequence, out index) && _entries[index].Segment != id
+                                && (_entries[index].Flags & (FLAG_SYNCED | FLAG_SYNCED_IN_RECORD)) == FLAG_SYNCED)
+                            {
+                                carried.Add(sequence);
+                            }
+                        }
+                    }
+                    offset += length;
+                }
+                if (carried.Count > 0)
+                {
+                    int start = output.Length;
+                    output.WriteFixed64(0);
+                    WriteSyncedBody(ref output, carried);
+                    WriteRecordHeader(output.GetBuffer(), start, output.Length - start - RECORD_HEADER_LENGTH);
+                }
+            }
+
+            // a crash before the swap leaves the .compact file next to the segment, which Load
+            // deletes, and one in the middle of it the .compact file alone, which Load moves
+            bool empty = output.Length == SEGMENT_HEADER_LENGTH;
+            String compacted = path + ".compact";
+            if (!empty)
+            {
+                using (var file = new FileStream(compacted, FileMode.Create, FileAccess.Write, FileShare.None))
+                {
+                    file.Write(output.GetBuffer(), 0, output.Length);
+                    file.Flush(true);
+                }
+            }
+
+            lock (_lock)
+            {
+                if (_disposed)
+                {
+                    if (!empty)
+                    {
+                        File.Delete(compacted);
+                    }
+                    return 0;
+                }
+                CloseReader(id);
+                if (empty)
+                {
+                    File.Delete(path);
+                    _segments.Remove(id);
+                }
+                else
+                {
+                    File.Delete(path);
+                    File.Move(compacted, path);
+                }
+
+                // scans may have been marked synced while the segment was written
+                long liveBytes = 0;
+                long syncedBytes = 0;
+                foreach (var move in moved)
+                {
+                    int index;
+                    if (!TryGetIndex(move.Key, out index))
+                    {
+                        continue;
+                    }
+                    IndexEntry entry = _entries[index];
+                    entry.Offset = move.Value;
+                    if (syncedInRecord.Contains(move.Key))
+                    {
+                        entry.Flags |= FLAG_SYNCED_IN_RECORD;
+                    }
+                    _entries[index] = entry;
+                    liveBytes += entry.Length;
+                    syncedBytes += (entry.Flags & FLAG_SYNCED) != 0 ? entry.Length : 0;
+                }
+                segment.Length = output.Length;
+                segment.LiveBytes = liveBytes;
+                segment.SyncedBytes = syncedBytes;
+                segment.LastStoredTicks = lastStoredTicks;
+                foreach (long sequence in removed)
+                {
+                    Remove(sequence);
+                }
+                TrimRemoved();
+
+                long reclaimed = bytes.Length - output.Length;
+                log.InfoFormat("Compacted segment [{0}] removed [{1}] scans reclaimed [{2}] bytes", id, removed.Count, reclaimed);
+                return reclaimed;
+            }
+        }
+
+        private void Load()
+        {
+            RecoverCompaction();
+            List<int> ids = Directory.GetFiles(_directory, "scans-*.log").Select(SegmentId).Where(id => id > 0).OrderBy(id => id).ToList();
+            var syncedRuns = new List<long>();
+            for (int i = 0; i < ids.Count; i++)
+            {
+                LoadSegment(ids[i], i == ids.Count - 1, syncedRuns);
+            }
+            // markers may refer to scans in any segment, so they are applied once all are indexed
+            foreach (long sequence in syncedRuns)
+            {
+                MarkSyncedInIndex(sequence);
+            }
+            AdvanceFirstUnsynced();
+
+            if (_active == null)
+            {
+                CreateSegment(1);
+            }
+            else
+            {
+                _activeStream = new FileStream(SegmentPath(_active.Id), FileMode.Open, FileAccess.Write, FileShare.Read);
+                _activeStream.SetLength(_active.Length);
+                _activeStream.Seek(_active.Length, SeekOrigin.Begin);
+            }
+        }
+
+        private void LoadSegment(int id, bool last, List<long> syncedRuns)
+        {
+            String path = SegmentPath(id);
+            var segment = new Segment(id);
+            int offset = SEGMENT_HEADER_LENGTH;
+            long fileLength;
+            // a record at a time through _readBuffer, a segment is never read into memory whole
+            using (var file = new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.Read, 64 * 1024))
+            {
+                fileLength = file.Length;
+                if (ReadFully(file, _readBuffer, 0, SEGMENT_HEADER_LENGTH) < SEGMENT_HEADER_LENGTH
+                    || _readBuffer[0] != (byte)'A' || _readBuffer[1] != (byte)'L' || _readBuffer[2] != SegmentVersion)
+                {
+                    throw new PosHardwareException(String.Format("[{0}] is not a scan log segment", path));
+                }
+                var header = new CompactReader(_readBuffer, 3, 8);
+                _nextSequence = Math.Max(_nextSequence, (long)header.ReadFixed64());
+
+                int length;
+                while ((length = ReadRecord(file, fileLength - offset)) > 0)
+                {
+                    LoadRecord(segment, offset, length, syncedRuns);
+                    offset += length;
+                }
+            }
+
+            if (offset < fileLength)
+            {
+                if (last)
+                {
+                    // the tail of a write cut short, appends continue from the last whole record
+                    log.WarnFormat("Discarding [{0}] bytes of incomplete record at the end of [{1}]", fileLength - offset, path);
+                }
+                else
+                {
+                    log.ErrorFormat("Corrupt record at [{0}] in [{1}], the rest of the segment is ignored", offset, path);
+                }
+            }
+            segment.Length = last ? offset : fileLength;
+            _segments[id] = segment;
+            if (last)
+            {
+                _active = segment;
+            }
+        }
+
+        // Indexes the record in _readBuffer
+        private void LoadRecord(Segment segment, int offset, int length, List<long> syncedRuns)
+        {
+            var body = new CompactReader(_readBuffer, RECORD_HEADER_LENGTH, length - RECORD_HEADER_LENGTH);
+            byte type = body.ReadByte();
+            if (type == RECORD_SCAN)
+            {
+                long sequence = (long)body.ReadFixed64();
+                long storedTicks = (long)body.ReadFixed64();
+                bool synced = (body.ReadByte() & FLAG_SYNCED) != 0;
+                uint docHash = body.ReadFixed32();
+                long traceId = (long)body.ReadFixed64();
+                if (AddEntry(sequence, segment.Id, offset, length, synced ? (byte)(FLAG_SYNCED | FLAG_SYNCED_IN_RECORD) : (byte)0, docHash, traceId))
+                {
+                    segment.LiveBytes += length;
+                    segment.SyncedBytes += synced ? length : 0;
+                    segment.LastStoredTicks = Math.Max(segment.LastStoredTicks, storedTicks);
+                    _nextSequence = Math.Max(_nextSequence, sequence + 1);
+                }
+            }
+            else if (type == RECORD_SYNCED)
+            {
+                syncedRuns.AddRange(ReadSyncedBody(ref body));
+            }
+        }
+
+        // Reads the next record into _readBuffer, returns its length or 0 when there is no intact
+        // record in the remaining bytes
+        private int ReadRecord(FileStream file, long remaining)
+        {
+            if (remaining < RECORD_HEADER_LENGTH + 1 || ReadFully(file, _readBuffer, 0, RECORD_HEADER_LENGTH) < RECORD_HEADER_LENGTH)
+            {
+                return 0;
+            }
+            uint bodyLength = new CompactReader(_readBuffer, 0, 4).ReadFixed32();
+            if (bodyLength == 0 || bodyLength > remaining - RECORD_HEADER_LENGTH)
+            {
+                return 0;
+            }
+            int length = RECORD_HEADER_LENGTH + (int)bodyLength;
+            if (_readBuffer.Length < length)
+            {
+                byte[] grown = new byte[Math.Max(length, _readBuffer.Length * 2)];
+                Buffer.BlockCopy(_readBuffer, 0, grown, 0, RECORD_HEADER_LENGTH);
+                _readBuffer = grown;
+            }
+            int read = RECORD_HEADER_LENGTH + ReadFully(file, _readBuffer, RECORD_HEADER_LENGTH, (int)bodyLength);
+            return ValidRecordLength(_readBuffer, 0, read);
+        }
+
+        private static int ReadFully(Stream stream, byte[] buffer, int offset, int count)
+        {
+            int read = 0;
+            while (read < count)
+            {
+                int n = stream.Read(buffer, offset + read, count - read);
+                if (n == 0)
+                {
+                    break;
+                }
+                read += n;
+            }
+            return read;
+        }
+
+        // Finishes or undoes a compaction the service stopped in the middle of
+        private void RecoverCompaction()
+        {
+            foreach (String compacted in Directory.GetFiles(_directory, "scans-*.log.compact"))
+            {
+                String path = compacted.Substring(0, compacted.Length - ".compact".Length);
+                if (File.Exists(path))
+                {
+                    File.Delete(compacted);
+                }
+                else
+                {
+                    log.WarnFormat("Completing interrupted compaction of [{0}]", path);
+                    File.Move(compacted, path);
+                }
+            }
+            foreach (String created in Directory.GetFiles(_directory, "scans-*.log.tmp"))
+            {
+                File.Delete(created);
+            }
+        }
+
+        private void CreateSegment(int id)
+        {
+            var header = new CompactWriter(SEGMENT_HEADER_LENGTH);
+            header.WriteByte((byte)'A');
+            header.WriteByte((byte)'L');
+            header.WriteByte(SegmentVersion);
+            // keeps sequences unique when compaction has removed every scan before
+            header.WriteFixed64((ulong)_nextSequence);
+
+            // created under a temporary name so that a segment is never without its header
+            String path = SegmentPath(id);
+            String created = path + ".tmp";
+            using (var file = new FileStream(created, FileMode.Create, FileAccess.Write, FileShare.None))
+            {
+                file.Write(header.GetBuffer(), 0, header.Length);
+                file.Flush(true);
+            }
+            File.Move(created, path);
+
+            _activeStream = new FileStream(path, FileMode.Open, FileAccess.Write, FileShare.Read);
+            _activeStream.Seek(0, SeekOrigin.End);
+            _active = new Segment(id);
+            _active.Length = SEGMENT_HEADER_LENGTH;
+            _segments[id] = _active;
+        }
+
+        // Appends the record in _writer to the active segment, returns its offset
+        private int WriteRecord()
+        {
+            WriteRecordHeader(_writer.GetBuffer(), 0, _writer.Length - RECORD_HEADER_LENGTH);
+            if (_active.Length + _writer.Length > MaxSegmentBytes && _active.Length > SEGMENT_HEADER_LENGTH)
+            {
+                _activeStream.Flush(true);
+                _activeStream.Dispose();
+                _dirty = false;
+                CreateSegment(_active.Id + 1);
+            }
+            int offset = (int)_active.Length;
+            try
+            {
+                _activeStream.Write(_writer.GetBuffer(), 0, _writer.Length);
+                _activeStream.Flush();
+            }
+            catch
+            {
+                // a partial record would hide every record appended after it on the next open
+                try
+                {
+                    _activeStream.SetLength(offset);
+                    _activeStream.Seek(offset, SeekOrigin.Begin);
+                }
+                catch { }
+                throw;
+            }
+            _active.Length += _writer.Length;
+            _dirty = true;
+            return offset;
+        }
+
+        private void FlushToDisk()
+        {
+            lock (_lock)
+            {
+                if (_dirty && !_disposed)
+                {
+                    try
+                    {
+                        _activeStream.Flush(true);
+                        _dirty = false;
+                    }
+                    catch (Exception ex)
+                    {
+                        log.ErrorFormat("Failed to flush scan log [{0}]", ex.Message);
+                    }
+                }
+            }
+        }
+
+        private StoredScan ReadScan(long sequence, IndexEntry entry)
+        {
+            FileStream reader;
+            if (!_readers.TryGetValue(entry.Segment, out reader))
+            {
+                // unbuffered, the active segment is read while it grows
+                reader = new FileStream(SegmentPath(entry.Segment), FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete, 1);
+                _readers[entry.Segment] = reader;
+            }
+            if (_readBuffer.Length < entry.Length)
+            {
+                _readBuffer = new byte[Math.Max(entry.Length, _readBuffer.Length * 2)];
+            }
+            reader.Position = entry.Offset;
+            int read = ReadFully(reader, _readBuffer, 0, entry.Length);
+            if (ValidRecordLength(_readBuffer, 0, read) != entry.Length)
+            {
+                throw new PosHardwareException(String.Format("Scan [{0}] in segment [{1}] is corrupt", sequence, entry.Segment));
+            }
+
+            var body = new CompactReader(_readBuffer, RECORD_HEADER_LENGTH + 1, entry.Length - RECORD_HEADER_LENGTH - 1);
+            body.Skip(8);
+            var storedUtc = new DateTime((long)body.ReadFixed64(), DateTimeKind.Utc);
+            bool sealedFields = (body.ReadByte() & FLAG_SEALED) != 0;
+            body.Skip(12);
+            MMM.Readers.CodelineData data;
+            if (!sealedFields)
+            {
+                data = ScanRecordCodec.ReadRecord(ref body);
+            }
+            else if (_cipher != null)
+            {
+                data = _cipher.ReadRecord(ref body, sequence);
+            }
+            else
+            {
+                throw new PosHardwareException(String.Format("Scan [{0}] is sealed and the scan log has no key", sequence));
+            }
+            return new StoredScan(entry.TraceId, sequence, storedUtc, (entry.Flags & FLAG_SYNCED) != 0, data);
+        }
+
+        private void CloseReader(int id)
+        {
+            FileStream reader;
+            if (_readers.TryGetValue(id, out reader))
+            {
+                reader.Dispose();
+                _readers.Remove(id);
+            }
+        }
+
+        private bool AddEntry(long sequence, int segment, int offset, int length, byte flags, uint docHash, long traceId)
+        {
+            if (_entries.Count == 0)
+            {
+                _baseSequence = sequence;
+            }
+            long index = sequence - _baseSequence;
+            if (index < _entries.Count)
+            {
+                log.WarnFormat("Ignoring scan [{0}] in segment [{1}], it is out of sequence", sequence, segment);
+                return false;
+            }
+            // sequences of scans compaction removed
+            while (_entries.Count < index)
+            {
+                _entries.Add(new IndexEntry { Flags = FLAG_REMOVED });
+            }
+
+            var entry = new IndexEntry { Segment = segment, Offset = offset, Length = length, Flags = flags, DocHash = docHash, TraceId = traceId };
+            if (docHash != 0)
+            {
+                long previous;
+                _latestByDocNumber.TryGetValue(docHash, out previous);
+                entry.PreviousSameDoc = previous;
+                _latestByDocNumber[docHash] = sequence;
+            }
+            if (traceId != 0)
+            {
+                _sequenceByTraceId[traceId] = sequence;
+            }
+            _entries.Add(entry);
+            _count++;
+            if ((flags & FLAG_SYNCED) == 0)
+            {
+                _unsyncedCount++;
+            }
+            return true;
+        }
+
+        private void MarkSyncedInIndex(long sequence)
+        {
+            int index;
+            if (TryGetIndex(sequence, out index) && (_entries[index].Flags & FLAG_SYNCED) == 0)
+            {
+                IndexEntry entry = _entries[index];
+                entry.Flags |= FLAG_SYNCED;
+                _entries[index] = entry;
+                _segments[entry.Segment].SyncedBytes += entry.Length;
+                _unsyncedCount--;
+            }
+        }
+
+        private void Remove(long sequence)
+        {
+            int index;
+            if (!TryGetIndex(sequence, out index))
+            {
+                return;
+            }
+            IndexEntry entry = _entries[index];
+            entry.Flags |= FLAG_REMOVED;
+            _entries[index] = entry;
+            _count--;
+            if ((entry.Flags & FLAG_SYNCED) == 0)
+            {
+                _unsyncedCount--;
+            }
+
+            long traced;
+            if (entry.TraceId != 0 && _sequenceByTraceId.TryGetValue(entry.TraceId, out traced) && traced == sequence)
+            {
+                _sequenceByTraceId.Remove(entry.TraceId);
+            }
+            long latest;
+            if (entry.DocHash != 0 && _latestByDocNumber.TryGetValue(entry.DocHash, out latest) && latest == sequence)
+            {
+                // the newest scan of the document is gone, point at the newest one left
+                long previous = entry.PreviousSameDoc;
+                int previousIndex;
+                while (previous != 0 && previous >= _baseSequence && !TryGetIndex(previous, out previousIndex))
+                {
+                    previous = _entries[(int)(previous - _baseSequence)].PreviousSameDoc;
+                }
+                if (previous != 0 && previous >= _baseSequence)
+                {
+                    _latestByDocNumber[entry.DocHash] = previous;
+                }
+                else
+                {
+                    _latestByDocNumber.Remove(entry.DocHash);
+                }
+            }
+        }
+
+        private void TrimRemoved()
+        {
+            int count = 0;
+            while (count < _entries.Count && (_entries[count].Flags & FLAG_REMOVED) != 0)
+            {
+                count++;
+            }
+            if (count > 0)
+            {
+                _entries.RemoveRange(0, count);
+                _baseSequence += count;
+                _firstUnsynced = Math.Max(0, _firstUnsynced - count);
+            }
+        }
+
+        private void AdvanceFirstUnsynced()
+        {
+            while (_firstUnsynced < _entries.Count && (_entries[_firstUnsynced].Flags & (FLAG_SYNCED | FLAG_REMOVED)) != 0)
+            {
+                _firstUnsynced++;
+            }
+        }
+
+        // Index of a scan that is still stored
+        private bool TryGetIndex(long sequence, out int index)
+        {
+            long offset = sequence - _baseSequence;
+            if (offset < 0 || offset >= _entries.Count || (_entries[(int)offset].Flags & FLAG_REMOVED) != 0)
+            {
+                index = -1;
+                return false;
+            }
+            index = (int)offset;
+            return true;
+        }
+
+        private String SegmentPath(int id)
+        {
+            return Path.Combine(_directory, String.Format("scans-{0:D6}.log", id));
+        }
+
+        private static int SegmentId(String path)
+        {
+            String name = Path.GetFileNameWithoutExtension(path);
+            int id;
+            return name.StartsWith("scans-") && Int32.TryParse(name.Substring("scans-".Length), out id) ? id : 0;
+        }
+
+        // Length of the whole record at offset, or 0 when there is no intact record
+        private static int ValidRecordLength(byte[] bytes, int offset, int end)
+        {
+            if (end - offset < RECORD_HEADER_LENGTH + 1)
+            {
+                return 0;
+            }
+            var header = new CompactReader(bytes, offset, RECORD_HEADER_LENGTH);
+            uint bodyLength = header.ReadFixed32();
+            uint crc = header.ReadFixed32();
+            if (bodyLength == 0 || bodyLength > end - offset - RECORD_HEADER_LENGTH
+                || Crc32.Compute(bytes, offset + RECORD_HEADER_LENGTH, (int)bodyLength) != crc)
+            {
+                return 0;
+            }
+            return RECORD_HEADER_LENGTH + (int)bodyLength;
+        }
+
+        private static void WriteRecordHeader(byte[] buffer, int offset, int bodyLength)
+        {
+            uint crc = Crc32.Compute(buffer, offset + RECORD_HEADER_LENGTH, bodyLength);
+            for (int i = 0; i < 4; i++)
+            {
+                buffer[offset + i] = (byte)((uint)bodyLength >> (8 * i));
+                buffer[offset + 4 + i] = (byte)(crc >> (8 * i));
+            }
+        }
+
+        // Sequences must be ascending, consecutive ones are written as one run
+        private static void WriteSyncedBody(ref CompactWriter writer, IList<long> sequences)
+        {
+            int runs = 0;
+            for (int i = 0; i < sequences.Count; i++)
+            {
+                if (i == 0 || sequences[i] != sequences[i - 1] + 1)
+                {
+                    runs++;
+                }
+            }
+            writer.WriteByte(RECORD_SYNCED);
+            writer.WriteVarint((uint)runs);
+            int start = 0;
+            for (int i = 1; i <= sequences.Count; i++)
+            {
+                if (i == sequences.Count || sequences[i] != sequences[i - 1] + 1)
+                {
+                    writer.WriteFixed64((ulong)sequences[start]);
+                    writer.WriteVarint((uint)(i - start));
+                    start = i;
+                }
+            }
+        }
+
+        private static List<long> ReadSyncedBody(ref CompactReader body)
+        {
+            var sequences = new List<long>();
+            uint runs = body.ReadVarint();
+            for (uint run = 0; run < runs; run++)
+            {
+                long first = (long)body.ReadFixed64();
+                uint count = body.ReadVarint();
+                for (uint i = 0; i < count; i++)
+                {
+                    sequences.Add(first + i);
+                }
+            }
+            return sequences;
+        }
+
+        // Fixed length SDK buffers come back padded with NULs, MRZ fields with fillers
+        private static String NormalizeDocNumber(String docNumber)
+        {
+            return docNumber == null ? String.Empty : docNumber.TrimEnd('\0').Trim().TrimEnd('<');
+        }
+
+        // Stored in the scan records so it must not change; 0 means no doc number. Keyed when
+        // the fields are sealed, a plain hash of a document number is easily reversed.
+        private uint DocNumberHash(String normalized)
+        {
+            if (normalized.Length == 0)
+            {
+                return 0;
+            }
+            if (_cipher != null)
+            {
+                uint fingerprint = _cipher.Fingerprint(normalized);
+                return fingerprint == 0 ? 1 : fingerprint;
+            }
+            // FNV-1a
+            uint hash = 2166136261;
+            foreach (char c in normalized)
+            {
+                char upper = Char.ToUpperInvariant(c);
+                hash = (hash ^ (byte)upper) * 16777619;
+                hash = (hash ^ (byte)(upper >> 8)) * 16777619;
+            }
+            return hash == 0 ? 1 : hash;
+        }
+
+        private void ThrowIfDisposed()
+        {
+            if (_disposed)
+            {
+                throw new ObjectDisposedException("ScanLog");
+            }
+        }
+
+        public void Dispose()
+        {
+            _flushTimer.Dispose();
+            lock (_lock)
+            {
+                if (_disposed)
+                {
+                    return;
+                }
+                _disposed = true;
+                try
+                {
+                    _activeStream.Flush(true);
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("Failed to flush scan log [{0}]", ex.Message);
+                }
+                _activeStream.Dispose();
+                foreach (var reader in _readers.Values)
+                {
+                    reader.Dispose();
+                }
+                _readers.Clear();
+                if (_cipher != null)
+                {
+                    _cipher.Dispose();
+                }
+            }
+            log.DebugFormat("Disposed [{0}]", this);
+        }
+
+        public override string ToString()
+        {
+            lock (_lock)
+            {
+                return String.Format("ScanLog Directory [{0}] Scans [{1}] Unsynced [{2}] Segments [{3}] Bytes [{4}]",
+                    _directory, _count, _unsyncedCount, _segments.Count, _segments.Values.Sum(s => s.Length));
+            }
+        }
+
+        private struct IndexEntry
+        {
+            public int Segment;
+            public int Offset;
+            public int Length;
+            public uint DocHash;
+            // sequence of the previous scan with the same doc number hash, 0 for none
+            public long PreviousSameDoc;
+            public long TraceId;
+            public byte Flags;
+        }
+
+        private class Segment
+        {
+            public int Id { get; private set; }
+            public long Length { get; set; }
+            // scan records still indexed
+            public long LiveBytes { get; set; }
+            public long SyncedBytes { get; set; }
+            public long LastStoredTicks { get; set; }
+
+            public Segment(int id)
+            {
+                Id = id;
+            }
+        }
+
+        private static class Crc32
+        {
+            private static readonly uint[] table = CreateTable();
+
+            private static uint[] CreateTable()
+            {
+                var result = new uint[256];
+                for (uint i = 0; i < 256; i++)
+                {
+                    uint value = i;
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        value = (value & 1) != 0 ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+                    }
+                    result[i] = value;
+                }
+                return result;
+            }
+
+            public static uint Compute(byte[] buffer, int offset, int count)
+            {
+                uint crc = 0xFFFFFFFF;
+                for (int i = offset; i < offset + count; i++)
+                {
+                    crc = table[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+                }
+                return ~crc;
+            }
+        }
+    }
+
+    public class StoredScan
+    {
+        public long TraceId { get; private set; }
+        public long Sequence { get; private set; }
+        public DateTime StoredUtc { get; private set; }
+        public bool IsSynced { get; private set; }
+        public MMM.Readers.CodelineData CodeLineData { get; private set; }
+
+        public StoredScan(long traceId, long sequence, DateTime storedUtc, bool isSynced, MMM.Readers.CodelineData codeLineData)
+        {
+            TraceId = traceId;
+            Sequence = sequence;
+            StoredUtc = storedUtc;
+            IsSynced = isSynced;
+            CodeLineData = codeLineData;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("StoredScan TraceId [{0}] Sequence [{1}] StoredUtc [{2:o}] IsSynced [{3}]", TraceId, Sequence, StoredUtc, IsSynced);
+        }
+    }
+}
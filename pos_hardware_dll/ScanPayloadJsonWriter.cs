@@ -0,0 +1,255 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Writes the V1 (JSON-RPC) and V2 scan delivery bodies straight into UTF-8 without going
+    // through reflection. The output is byte for byte what RestSharp's AddJsonBody produced for
+    // the same payloads, including its quirks: public fields in declaration order, enums as
+    // numbers, char fields as {} and only " \ \b \f \n \r \t escaped in strings.
+    public static class ScanPayloadJsonWriter
+    {
+        public const String ContentType = "application/json";
+
+        [ThreadStatic]
+        private static Utf8JsonBuilder _pooled;
+
+        public static byte[] WriteV1(String method, String clientId, String accessKey, MMM.Readers.CodelineData codeLineData)
+        {
+            Utf8JsonBuilder json = Rent();
+            json.Raw("{\"Method\":");
+            json.String(method);
+            json.Raw(",\"Params\":");
+            WriteParams(json, clientId, accessKey, codeLineData);
+            json.Raw('}');
+            return json.ToArray();
+        }
+
+        public static byte[] WriteV2(String clientId, String accessKey, MMM.Readers.CodelineData codeLineData)
+        {
+            Utf8JsonBuilder json = Rent();
+            WriteParams(json, clientId, accessKey, codeLineData);
+            return json.ToArray();
+        }
+
+        // The codeline object alone, as it appears inside the V1 and V2 payloads
+        public static byte[] WriteCodeline(MMM.Readers.CodelineData codeLineData)
+        {
+            Utf8JsonBuilder json = Rent();
+            WriteCodeline(json, codeLineData);
+            return json.ToArray();
+        }
+
+        private static Utf8JsonBuilder Rent()
+        {
+            if (_pooled == null)
+            {
+                _pooled = new Utf8JsonBuilder(2048);
+            }
+            _pooled.Reset();
+            return _pooled;
+        }
+
+        private static void WriteParams(Utf8JsonBuilder json, String clientId, String accessKey, MMM.Readers.CodelineData codeLineData)
+        {
+            json.Raw("{\"clientId\":");
+            json.String(clientId);
+            json.Raw(",\"accessKey\":");
+            json.String(accessKey);
+            json.Raw(",\"codeLineData\":");
+            WriteCodeline(json, codeLineData);
+            json.Raw('}');
+        }
+
+        private static void WriteCodeline(Utf8JsonBuilder json, MMM.Readers.CodelineData data)
+        {
+            json.Raw("{\"Data\":"); json.String(data.Data);
+            json.Raw(",\"LineCount\":"); json.Number(data.LineCount);
+            json.Raw(",\"Line1\":"); json.String(data.Line1);
+            json.Raw(",\"Line2\":"); json.String(data.Line2);
+            json.Raw(",\"Line3\":"); json.String(data.Line3);
+            json.Raw(",\"DocId\":"); json.String(data.DocId);
+            json.Raw(",\"DocType\":"); json.String(data.DocType);
+            json.Raw(",\"Surname\":"); json.String(data.Surname);
+            json.Raw(",\"Forename\":"); json.String(data.Forename);
+            json.Raw(",\"SecondName\":"); json.String(data.SecondName);
+            json.Raw(",\"Forenames\":"); json.String(data.Forenames);
+            json.Raw(",\"DateOfBirth\":"); WriteDate(json, data.DateOfBirth);
+            json.Raw(",\"ExpiryDate\":"); WriteDate(json, data.ExpiryDate);
+            json.Raw(",\"IssuingState\":"); json.String(data.IssuingState);
+            json.Raw(",\"Nationality\":"); json.String(data.Nationality);
+            json.Raw(",\"DocNumber\":"); json.String(data.DocNumber);
+            json.Raw(",\"Sex\":"); json.String(data.Sex);
+            json.Raw(",\"ShortSex\":"); json.Number(data.ShortSex);
+            json.Raw(",\"OptionalData1\":"); json.String(data.OptionalData1);
+            json.Raw(",\"OptionalData2\":"); json.String(data.OptionalData2);
+            json.Raw(",\"CheckDigitDataList\":");
+            if (data.CheckDigitDataList == null)
+            {
+                json.Raw("null");
+            }
+            else
+            {
+                json.Raw('[');
+                for (int i = 0; i < data.CheckDigitDataList.Length; i++)
+                {
+                    if (i > 0)
+                    {
+                        json.Raw(',');
+                    }
+                    WriteCheckDigit(json, data.CheckDigitDataList[i]);
+                }
+                json.Raw(']');
+            }
+            json.Raw(",\"CheckDigitDataListCount\":"); json.Number(data.CheckDigitDataListCount);
+            json.Raw(",\"CodelineValidationResult\":"); json.Number((int)data.CodelineValidationResult);
+            json.Raw(",\"MrzOnRearSide\":"); json.Boolean(data.MrzOnRearSide);
+            json.Raw(",\"ExpiredDocumentFlag\":"); json.Boolean(data.ExpiredDocumentFlag);
+            json.Raw(",\"ImageSource\":"); json.Number(data.ImageSource);
+            json.Raw('}');
+        }
+
+        private static void WriteDate(Utf8JsonBuilder json, MMM.Readers.Date date)
+        {
+            json.Raw("{\"Day\":"); json.Number(date.Day);
+            json.Raw(",\"Month\":"); json.Number(date.Month);
+            json.Raw(",\"Year\":"); json.Number(date.Year);
+            json.Raw('}');
+        }
+
+        private static void WriteCheckDigit(Utf8JsonBuilder json, MMM.Readers.CodelineCheckDigitData checkDigit)
+        {
+            json.Raw("{\"puCheckDigitType\":"); json.Number((int)checkDigit.puCheckDigitType);
+            json.Raw(",\"puCodelineNumber\":"); json.Number(checkDigit.puCodelineNumber);
+            json.Raw(",\"puCodelinePos\":"); json.Number(checkDigit.puCodelinePos);
+            // RestSharp serializes a char as an object without members
+            json.Raw(",\"puValueExpected\":{}");
+            json.Raw(",\"puValueRead\":{}");
+            json.Raw(",\"puResult\":"); json.Number((int)checkDigit.puResult);
+            json.Raw('}');
+        }
+    }
+
+    internal class Utf8JsonBuilder
+    {
+        private byte[] _buffer;
+        private int _length;
+
+        public Utf8JsonBuilder(int capacity)
+        {
+            _buffer = new byte[capacity];
+        }
+
+        public void Reset()
+        {
+            _length = 0;
+        }
+
+        public byte[] ToArray()
+        {
+            var result = new byte[_length];
+            Buffer.BlockCopy(_buffer, 0, result, 0, _length);
+            return result;
+        }
+
+        // ASCII only
+        public void Raw(String value)
+        {
+            Reserve(value.Length);
+            for (int i = 0; i < value.Length; i++)
+            {
+                _buffer[_length++] = (byte)value[i];
+            }
+        }
+
+        public void Raw(char value)
+        {
+            Reserve(1);
+            _buffer[_length++] = (byte)value;
+        }
+
+        public void Boolean(bool value)
+        {
+            Raw(value ? "true" : "false");
+        }
+
+        public void Number(int value)
+        {
+            Reserve(11);
+            if (value < 0)
+            {
+                _buffer[_length++] = (byte)'-';
+            }
+            uint magnitude = value < 0 ? (uint)(-(long)value) : (uint)value;
+            int digits = 1;
+            for (uint rest = magnitude; rest >= 10; rest /= 10)
+            {
+                digits++;
+            }
+            for (int i = digits - 1; i >= 0; i--)
+            {
+                _buffer[_length + i] = (byte)('0' + magnitude % 10);
+                magnitude /= 10;
+            }
+            _length += digits;
+        }
+
+        public void String(String value)
+        {
+            if (value == null)
+            {
+                Raw("null");
+                return;
+            }
+            Raw('"');
+            int runStart = 0;
+            for (int i = 0; i < value.Length; i++)
+            {
+                String escape = Escape(value[i]);
+                if (escape != null)
+                {
+                    Utf8(value, runStart, i - runStart);
+                    Raw(escape);
+                    runStart = i + 1;
+                }
+            }
+            Utf8(value, runStart, value.Length - runStart);
+            Raw('"');
+        }
+
+        private static String Escape(char c)
+        {
+            switch (c)
+            {
+                case '"': return "\\\"";
+                case '\\': return "\\\\";
+                case '\b': return "\\b";
+                case '\f': return "\\f";
+                case '\n': return "\\n";
+                case '\r': return "\\r";
+                case '\t': return "\\t";
+                default: return null;
+            }
+        }
+
+        private void Utf8(String value, int start, int count)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+            Reserve(count * 3);
+            _length += Encoding.UTF8.GetBytes(value, start, count, _buffer, _length);
+        }
+
+        private void Reserve(int count)
+        {
+            if (_length + count > _buffer.Length)
+            {
+                Array.Resize(ref _buffer, Math.Max(_buffer.Length * 2, _length + count));
+            }
+        }
+    }
+}
@@ -0,0 +1,443 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Compact binary form of a scanned codeline, used instead of the JSON serialization of
+    // CodelineData when delivering to a store that accepts ContentType and for archival.
+    //
+    //   envelope : 'A' 'S' [schema version] [clientId] [accessKey] record
+    //   record   : [string presence bitmap] [strings...] [line count] [date of birth]
+    //              [expiry date] [short sex] [flags] [validation result] [image source]
+    //              [check digits]
+    //
+    // Integers are unsigned LEB128 varints, strings are a varint byte length followed by UTF-8,
+    // and a string that is null or empty is only a cleared bit in the presence bitmap. Dates are
+    // packed as year << 9 | month << 5 | day. Check digits are a bitmap of the CheckDigitTypes
+    // present followed by one entry per type, in type order, holding its result, position and
+    // characters.
+    public static class ScanRecordCodec
+    {
+        public const String ContentType = "application/vnd.alika.scan-record";
+        public const byte SchemaVersion = 1;
+        private const int MAX_CHECKDIGITDATA_COUNT = 5;
+
+        private const byte FLAG_MRZ_ON_REAR_SIDE = 0x01;
+        private const byte FLAG_EXPIRED_DOCUMENT = 0x02;
+
+        public static byte[] EncodeEnvelope(String clientId, String accessKey, MMM.Readers.CodelineData codeLineData)
+        {
+            var writer = new CompactWriter(256);
+            writer.WriteByte((byte)'A');
+            writer.WriteByte((byte)'S');
+            writer.WriteByte(SchemaVersion);
+            writer.WriteString(clientId);
+            writer.WriteString(accessKey);
+            WriteRecord(ref writer, codeLineData);
+            return writer.ToArray();
+        }
+
+        public static MMM.Readers.CodelineData DecodeEnvelope(byte[] envelope, out String clientId, out String accessKey)
+        {
+            var reader = new CompactReader(envelope, 0, envelope.Length);
+            if (reader.ReadByte() != (byte)'A' || reader.ReadByte() != (byte)'S')
+            {
+                throw new FormatException("Not a scan record");
+            }
+            byte version = reader.ReadByte();
+            if (version != SchemaVersion)
+            {
+                throw new FormatException(String.Format("Unsupported scan record schema version {0}", version));
+            }
+            clientId = reader.ReadString();
+            accessKey = reader.ReadString();
+            return ReadRecord(ref reader);
+        }
+
+        internal static void WriteRecord(ref CompactWriter writer, MMM.Readers.CodelineData data)
+        {
+            String[] strings = Strings(data);
+            uint present = 0;
+            for (int i = 0; i < strings.Length; i++)
+            {
+                strings[i] = Trim(strings[i]);
+                if (strings[i].Length > 0)
+                {
+                    present |= 1u << i;
+                }
+            }
+            writer.WriteVarint(present);
+            for (int i = 0; i < strings.Length; i++)
+            {
+                if (strings[i].Length > 0)
+                {
+                    writer.WriteString(strings[i]);
+                }
+            }
+
+            writer.WriteVarint((uint)data.LineCount);
+            writer.WriteVarint(PackDate(data.DateOfBirth));
+            writer.WriteVarint(PackDate(data.ExpiryDate));
+            writer.WriteByte(data.ShortSex);
+            writer.WriteByte((byte)((data.MrzOnRearSide ? FLAG_MRZ_ON_REAR_SIDE : 0) | (data.ExpiredDocumentFlag ? FLAG_EXPIRED_DOCUMENT : 0)));
+            writer.WriteByte((byte)data.CodelineValidationResult);
+            writer.WriteVarint((uint)data.ImageSource);
+
+            int count = data.CheckDigitDataList == null ? 0 : Math.Min(data.CheckDigitDataListCount, data.CheckDigitDataList.Length);
+            byte types = 0;
+            for (int i = 0; i < count; i++)
+            {
+                types |= (byte)(1 << (int)data.CheckDigitDataList[i].puCheckDigitType);
+            }
+            writer.WriteByte(types);
+            for (int type = 0; type < 8; type++)
+            {
+                if ((types & (1 << type)) != 0)
+                {
+                    // an MRZ holds at most one check digit of each type
+                    var checkDigit = data.CheckDigitDataList.Take(count).First(c => (int)c.puCheckDigitType == type);
+                    writer.WriteByte((byte)checkDigit.puResult);
+                    writer.WriteVarint((uint)checkDigit.puCodelineNumber);
+                    writer.WriteVarint((uint)checkDigit.puCodelinePos);
+                    writer.WriteByte((byte)checkDigit.puValueExpected);
+                    writer.WriteByte((byte)checkDigit.puValueRead);
+                }
+            }
+        }
+
+        internal static MMM.Readers.CodelineData ReadRecord(ref CompactReader reader)
+        {
+            var data = new MMM.Readers.CodelineData();
+            uint present = reader.ReadVarint();
+            var strings = new String[16];
+            for (int i = 0; i < strings.Length; i++)
+            {
+                strings[i] = (present & (1u << i)) != 0 ? reader.ReadString() : String.Empty;
+            }
+            data.Data = strings[0];
+            data.Line1 = strings[1];
+            data.Line2 = strings[2];
+            data.Line3 = strings[3];
+            data.DocId = strings[4];
+            data.DocType = strings[5];
+            data.Surname = strings[6];
+            data.Forename = strings[7];
+            data.SecondName = strings[8];
+            data.Forenames = strings[9];
+            data.IssuingState = strings[10];
+            data.Nationality = strings[11];
+            data.DocNumber = strings[12];
+            data.Sex = strings[13];
+            data.OptionalData1 = strings[14];
+            data.OptionalData2 = strings[15];
+
+            data.LineCount = (int)reader.ReadVarint();
+            data.DateOfBirth = UnpackDate(reader.ReadVarint());
+            data.ExpiryDate = UnpackDate(reader.ReadVarint());
+            data.ShortSex = reader.ReadByte();
+            byte flags = reader.ReadByte();
+            data.MrzOnRearSide = (flags & FLAG_MRZ_ON_REAR_SIDE) != 0;
+            data.ExpiredDocumentFlag = (flags & FLAG_EXPIRED_DOCUMENT) != 0;
+            data.CodelineValidationResult = (MMM.Readers.CheckDigitResult)reader.ReadByte();
+            data.ImageSource = (int)reader.ReadVarint();
+
+            byte types = reader.ReadByte();
+            data.CheckDigitDataList = new MMM.Readers.CodelineCheckDigitData[MAX_CHECKDIGITDATA_COUNT];
+            int count = 0;
+            for (int type = 0; type < 8; type++)
+            {
+                if ((types & (1 << type)) != 0)
+                {
+                    var checkDigit = new MMM.Readers.CodelineCheckDigitData();
+                    checkDigit.puCheckDigitType = (MMM.Readers.CheckDigitType)type;
+                    checkDigit.puResult = (MMM.Readers.CheckDigitResult)reader.ReadByte();
+                    checkDigit.puCodelineNumber = (int)reader.ReadVarint();
+                    checkDigit.puCodelinePos = (int)reader.ReadVarint();
+                    checkDigit.puValueExpected = (char)reader.ReadByte();
+                    checkDigit.puValueRead = (char)reader.ReadByte();
+                    if (count < MAX_CHECKDIGITDATA_COUNT)
+                    {
+                        data.CheckDigitDataList[count++] = checkDigit;
+                    }
+                }
+            }
+            data.CheckDigitDataListCount = count;
+            return data;
+        }
+
+        private static String[] Strings(MMM.Readers.CodelineData data)
+        {
+            var strings = new String[StringCount];
+            for (int i = 0; i < strings.Length; i++)
+            {
+                strings[i] = StringAt(ref data, i);
+            }
+            return strings;
+        }
+
+        // Order is part of the schema, append only
+        internal const int StringCount = 16;
+
+        internal static String StringAt(ref MMM.Readers.CodelineData data, int index)
+        {
+            switch (index)
+            {
+                case 0: return data.Data;
+                case 1: return data.Line1;
+                case 2: return data.Line2;
+                case 3: return data.Line3;
+                case 4: return data.DocId;
+                case 5: return data.DocType;
+                case 6: return data.Surname;
+                case 7: return data.Forename;
+                case 8: return data.SecondName;
+                case 9: return data.Forenames;
+                case 10: return data.IssuingState;
+                case 11: return data.Nationality;
+                case 12: return data.DocNumber;
+                case 13: return data.Sex;
+                case 14: return data.OptionalData1;
+                case 15: return data.OptionalData2;
+                default: throw new ArgumentOutOfRangeException("index");
+            }
+        }
+
+        // Fixed length SDK buffers come back padded with NULs
+        private static String Trim(String value)
+        {
+            return value == null ? String.Empty : value.TrimEnd('\0');
+        }
+
+        private static uint PackDate(MMM.Readers.Date date)
+        {
+            if (date.Year < 0 || date.Month < 0 || date.Month > 15 || date.Day < 0 || date.Day > 31)
+            {
+                return 0;
+            }
+            return (uint)date.Year << 9 | (uint)date.Month << 5 | (uint)date.Day;
+        }
+
+        private static MMM.Readers.Date UnpackDate(uint packed)
+        {
+            var date = new MMM.Readers.Date();
+            date.Year = (int)(packed >> 9);
+            date.Month = (int)(packed >> 5 & 0x0F);
+            date.Day = (int)(packed & 0x1F);
+            return date;
+        }
+    }
+
+    internal struct CompactWriter
+    {
+        private byte[] _buffer;
+        private int _length;
+
+        public CompactWriter(int capacity)
+        {
+            _buffer = new byte[Math.Max(16, capacity)];
+            _length = 0;
+        }
+
+        // Writes into the caller's buffer until it is outgrown, GetBuffer hands back the one in use
+        public CompactWriter(byte[] buffer)
+        {
+            _buffer = buffer;
+            _length = 0;
+        }
+
+        public int Length
+        {
+            get { return _length; }
+        }
+
+        public void Reset()
+        {
+            _length = 0;
+        }
+
+        // The first Length bytes are the written data
+        public byte[] GetBuffer()
+        {
+            return _buffer;
+        }
+
+        public void WriteByte(byte value)
+        {
+            Reserve(1);
+            _buffer[_length++] = value;
+        }
+
+        public void WriteVarint(uint value)
+        {
+            Reserve(5);
+            while (value >= 0x80)
+            {
+                _buffer[_length++] = (byte)(value | 0x80);
+                value >>= 7;
+            }
+            _buffer[_length++] = (byte)value;
+        }
+
+        // little endian, for fields that are patched or read at a known position
+        public void WriteFixed32(uint value)
+        {
+            Reserve(4);
+            for (int i = 0; i < 4; i++)
+            {
+                _buffer[_length++] = (byte)(value >> (8 * i));
+            }
+        }
+
+        public void WriteFixed64(ulong value)
+        {
+            Reserve(8);
+            for (int i = 0; i < 8; i++)
+            {
+                _buffer[_length++] = (byte)(value >> (8 * i));
+            }
+        }
+
+        public void WriteString(String value)
+        {
+            if (value == null)
+            {
+                WriteVarint(0);
+                return;
+            }
+            int byteCount = Encoding.UTF8.GetByteCount(value);
+            WriteVarint((uint)byteCount);
+            Reserve(byteCount);
+            _length += Encoding.UTF8.GetBytes(value, 0, value.Length, _buffer, _length);
+        }
+
+        // UTF-8 without a length, for callers that keep their own
+        public void WriteChars(String value, int index, int count)
+        {
+            Reserve(Encoding.UTF8.GetMaxByteCount(count));
+            _length += Encoding.UTF8.GetBytes(value, index, count, _buffer, _length);
+        }
+
+        public void WriteBytes(byte[] value, int offset, int count)
+        {
+            Reserve(count);
+            Buffer.BlockCopy(value, offset, _buffer, _length, count);
+            _length += count;
+        }
+
+        public byte[] ToArray()
+        {
+            var result = new byte[_length];
+            Buffer.BlockCopy(_buffer, 0, result, 0, _length);
+            return result;
+        }
+
+        private void Reserve(int count)
+        {
+            if (_length + count > _buffer.Length)
+            {
+                Array.Resize(ref _buffer, Math.Max(_buffer.Length * 2, _length + count));
+            }
+        }
+    }
+
+    internal struct CompactReader
+    {
+        private readonly byte[] _buffer;
+        private readonly int _end;
+        private int _position;
+
+        public CompactReader(byte[] buffer, int offset, int count)
+        {
+            _buffer = buffer;
+            _position = offset;
+            _end = offset + count;
+        }
+
+        public bool AtEnd
+        {
+            get { return _position >= _end; }
+        }
+
+        public int Position
+        {
+            get { return _position; }
+        }
+
+        public void Skip(int count)
+        {
+            if (count > _end - _position)
+            {
+                throw new FormatException("Scan record is truncated");
+            }
+            _position += count;
+        }
+
+        public byte ReadByte()
+        {
+            if (_position >= _end)
+            {
+                throw new FormatException("Scan record is truncated");
+            }
+            return _buffer[_position++];
+        }
+
+        public uint ReadVarint()
+        {
+            uint value = 0;
+            for (int shift = 0; shift < 35; shift += 7)
+            {
+                byte b = ReadByte();
+                value |= (uint)(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+            throw new FormatException("Scan record varint is too long");
+        }
+
+        public uint ReadFixed32()
+        {
+            uint value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                value |= (uint)ReadByte() << (8 * i);
+            }
+            return value;
+        }
+
+        public ulong ReadFixed64()
+        {
+            ulong value = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                value |= (ulong)ReadByte() << (8 * i);
+            }
+            return value;
+        }
+
+        public String ReadString()
+        {
+            int length = (int)ReadVarint();
+            if (length > _end - _position)
+            {
+                throw new FormatException("Scan record is truncated");
+            }
+            String value = Encoding.UTF8.GetString(_buffer, _position, length);
+            _position += length;
+            return value;
+        }
+
+        public void ReadBytes(byte[] target, int offset, int count)
+        {
+            if (count > _end - _position)
+            {
+                throw new FormatException("Scan record is truncated");
+            }
+            Buffer.BlockCopy(_buffer, _position, target, offset, count);
+            _position += count;
+        }
+    }
+}
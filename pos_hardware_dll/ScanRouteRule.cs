@@ -0,0 +1,99 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Which scans a route takes. Every criterion that is set must match, a criterion matches
+    // when the scan's value is one of those listed; a rule without criteria takes every scan.
+    // The criteria are turned into one predicate when the routes are loaded so that matching a
+    // scan is a few set lookups.
+    public class ScanRouteRule
+    {
+        public static readonly ScanRouteRule All = new ScanRouteRule(null, null, null);
+
+        private readonly Func<CompactCodeline, bool> _matches;
+        private readonly String _description;
+
+        public ScanRouteRule(IEnumerable<String> issuingStates, IEnumerable<String> docTypes, IEnumerable<String> validationResults)
+        {
+            var predicates = new List<Func<CompactCodeline, bool>>();
+            var description = new List<String>();
+            if (issuingStates != null)
+            {
+                var states = new HashSet<String>(issuingStates.Select(Normalize), StringComparer.OrdinalIgnoreCase);
+                predicates.Add(data => states.Contains(Normalize(data.IssuingState)));
+                description.Add("IssuingState in " + String.Join(",", states));
+            }
+            if (docTypes != null)
+            {
+                var types = new HashSet<String>(docTypes.Select(Normalize), StringComparer.OrdinalIgnoreCase);
+                predicates.Add(data => types.Contains(Normalize(data.DocType)));
+                description.Add("DocType in " + String.Join(",", types));
+            }
+            if (validationResults != null)
+            {
+                var results = new HashSet<MMM.Readers.CheckDigitResult>(validationResults.Select(ParseValidationResult));
+                predicates.Add(data => results.Contains(data.ValidationResult));
+                description.Add("ValidationResult in " + String.Join(",", results));
+            }
+
+            if (predicates.Count == 0)
+            {
+                _matches = data => true;
+            }
+            else if (predicates.Count == 1)
+            {
+                _matches = predicates[0];
+            }
+            else
+            {
+                Func<CompactCodeline, bool>[] all = predicates.ToArray();
+                _matches = data =>
+                {
+                    for (int i = 0; i < all.Length; i++)
+                    {
+                        if (!all[i](data))
+                        {
+                            return false;
+                        }
+                    }
+                    return true;
+                };
+            }
+            _description = description.Count == 0 ? "all scans" : String.Join(" and ", description);
+        }
+
+        public bool Matches(CompactCodeline data)
+        {
+            return _matches(data);
+        }
+
+        // Fixed length SDK buffers come back padded with NULs, MRZ fields with fillers
+        private static String Normalize(String value)
+        {
+            return value == null ? String.Empty : value.TrimEnd('\0').Trim().TrimEnd('<');
+        }
+
+        private static MMM.Readers.CheckDigitResult ParseValidationResult(String name)
+        {
+            foreach (MMM.Readers.CheckDigitResult result in Enum.GetValues(typeof(MMM.Readers.CheckDigitResult)))
+            {
+                // accept CDR_Valid as well as Valid
+                String resultName = result.ToString();
+                if (String.Equals(resultName, name, StringComparison.OrdinalIgnoreCase)
+                    || String.Equals(resultName, "CDR_" + name, StringComparison.OrdinalIgnoreCase))
+                {
+                    return result;
+                }
+            }
+            throw new PosHardwareException(String.Format("Unknown validation result [{0}] in scan route rule", name));
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ScanRouteRule [{0}]", _description);
+        }
+    }
+}
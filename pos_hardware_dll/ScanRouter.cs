@@ -0,0 +1,322 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Sends each scan to every store whose route rule matches it. Every route has its own
+    // bounded queue and limit on deliveries in flight, so a slow or failing store only backs up
+    // its own route; when a route's queue is full the scan is dropped for that route alone.
+    // Only the outcome on routes marked ReportsDelivery is raised as a ScanStoreEvent, which
+    // keeps the tray app to one notification per scan from the primary store: in a routes file
+    // that is the first cloud or local route unless set otherwise, any other route only when it
+    // sets ReportsDelivery. Configuration
+    // scans go to the cloud and local stores only, they carry the store credentials.
+    public class ScanRouter : IScanStore
+    {
+        private static readonly ILog log = LogProvider.For<ScanRouter>();
+
+        private readonly List<ScanRoute> _routes;
+
+        public event EventHandler<ScanStoreEvent> OnScanStoreEvent;
+
+        public ScanRouter(IEnumerable<ScanRoute> routes)
+        {
+            _routes = routes.ToList();
+            OnScanStoreEvent += delegate(Object sender, ScanStoreEvent e) { };
+            foreach (var route in _routes)
+            {
+                log.InfoFormat("Scan route [{0}]", route);
+            }
+        }
+
+        public IEnumerable<ScanRoute> Routes
+        {
+            get { return _routes; }
+        }
+
+        // Routes file, see ScanRouteConfig. A relative store config or audit file name is taken
+        // relative to the routes file.
+        public static ScanRouter Load(String routesFileName)
+        {
+            String text = File.ReadAllText(routesFileName);
+            var config = Newtonsoft.Json.JsonConvert.DeserializeObject<ScanRoutesConfig>(text);
+            if (config == null || config.Routes == null || config.Routes.Count == 0)
+            {
+                throw new PosHardwareException(String.Format("No scan routes in [{0}]", routesFileName));
+            }
+            String baseDirectory = Path.GetDirectoryName(Path.GetFullPath(routesFileName));
+            var routes = new List<ScanRoute>();
+            bool cloudBackedSeen = false;
+            foreach (var routeConfig in config.Routes)
+            {
+                ScanRoute route = routeConfig.Create(baseDirectory, !cloudBackedSeen);
+                cloudBackedSeen = cloudBackedSeen || IsCloudBacked(route.Sink);
+                routes.Add(route);
+            }
+            return new ScanRouter(routes);
+        }
+
+        public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
+        {
+            bool isConfiguration = Utils.IsConfigurationEvent(e);
+            var deliveries = new List<Task<ScanStoreEvent>>();
+            Task<ScanStoreEvent> reported = null;
+            foreach (var route in _routes)
+            {
+                bool matches = isConfiguration ? IsCloudBacked(route.Sink) : route.Rule.Matches(e.Codeline);
+                if (matches)
+                {
+                    Task<ScanStoreEvent> delivery = route.Offer(e);
+                    deliveries.Add(delivery);
+                    if (route.ReportsDelivery)
+                    {
+                        // also covers scans the route dropped, which never reach the store
+                        delivery.ContinueWith(task => NotifyListeners(task.Result));
+                        reported = reported ?? delivery;
+                    }
+                }
+            }
+
+            if (deliveries.Count == 0)
+            {
+                log.Info("Scan matched no route");
+                var none = new TaskCompletionSource<ScanStoreEvent>();
+                none.SetResult(new ScanStoreEvent(new PosHardwareException("Scan matched no route")));
+                return none.Task;
+            }
+            Task<ScanStoreEvent> result = reported ?? deliveries[0];
+            return Task.Factory.ContinueWhenAll(deliveries.ToArray(), all => result.Result);
+        }
+
+        private static bool IsCloudBacked(IScanStore sink)
+        {
+            return sink is ScanStoreCloud || sink is ScanStoreLocal;
+        }
+
+        private void NotifyListeners(ScanStoreEvent e)
+        {
+            try { OnScanStoreEvent(this, e); }
+            catch { }
+        }
+
+        public void Dispose()
+        {
+            foreach (var route in _routes)
+            {
+                route.Dispose();
+            }
+            log.Debug("ScanRouter disposed");
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ScanRouter Routes [{0}]", String.Join(", ", _routes));
+        }
+
+        private class ScanRoutesConfig
+        {
+            public List<ScanRouteConfig> Routes { get; set; }
+        }
+
+        // {"Name":"regional","Store":"cloud","Config":"AlikaPosRegional.txt","IssuingState":["DEU","AUT"],"Concurrency":1}
+        // {"Name":"audit","Store":"audit","Path":"scans.audit"}
+        // {"Name":"offline","Store":"local","Path":"scans","Config":"AlikaPosConfig.txt"}
+        private class ScanRouteConfig
+        {
+            public String Name { get; set; }
+            public String Store { get; set; }
+            public String Config { get; set; }
+            public String Path { get; set; }
+            public List<String> IssuingState { get; set; }
+            public List<String> DocType { get; set; }
+            public List<String> ValidationResult { get; set; }
+            public int? QueueCapacity { get; set; }
+            public int? Concurrency { get; set; }
+            public bool? ReportsDelivery { get; set; }
+
+            public ScanRoute Create(String baseDirectory, bool firstCloudBacked)
+            {
+                IScanStore sink;
+                if ("cloud".Equals(Store, StringComparison.OrdinalIgnoreCase))
+                {
+                    sink = new ScanStoreCloud(System.IO.Path.Combine(baseDirectory, Config));
+                }
+                else if ("local".Equals(Store, StringComparison.OrdinalIgnoreCase))
+                {
+                    // Config is the cloud store the kept scans are synced to, if any
+                    ScanStoreCloud cloud = Config == null ? null : new ScanStoreCloud(System.IO.Path.Combine(baseDirectory, Config));
+                    sink = new ScanStoreLocal(System.IO.Path.Combine(baseDirectory, Path), cloud);
+                }
+                else if ("audit".Equals(Store, StringComparison.OrdinalIgnoreCase))
+                {
+                    sink = new ScanStoreAuditFile(System.IO.Path.Combine(baseDirectory, Path));
+                }
+                else
+                {
+                    throw new PosHardwareException(String.Format("Unknown store [{0}] for scan route [{1}]", Store, Name));
+                }
+                var rule = new ScanRouteRule(IssuingState, DocType, ValidationResult);
+                // by default only the first cloud or local store reports to the tray app, two
+                // reporting routes would show two notifications for every scan
+                bool reportsDelivery = ReportsDelivery ?? (firstCloudBacked && IsCloudBacked(sink));
+                return new ScanRoute(Name, sink, rule,
+                    QueueCapacity ?? ScanRoute.DefaultQueueCapacity, Concurrency ?? ScanRoute.DefaultConcurrency, reportsDelivery);
+            }
+        }
+    }
+
+    public class ScanRoute : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<ScanRoute>();
+        public const int DefaultQueueCapacity = 100;
+        public const int DefaultConcurrency = 2;
+
+        private readonly Queue<Pending> _queue = new Queue<Pending>();
+        private readonly object _lock = new object();
+        private readonly int _queueCapacity;
+        private readonly int _concurrency;
+        private int _inFlight = 0;
+        private long _delivered;
+        private long _failed;
+        private long _dropped;
+
+        public String Name { get; private set; }
+        public IScanStore Sink { get; private set; }
+        public ScanRouteRule Rule { get; private set; }
+        public bool ReportsDelivery { get; private set; }
+
+        public long Delivered { get { return Interlocked.Read(ref _delivered); } }
+        public long Failed { get { return Interlocked.Read(ref _failed); } }
+        public long Dropped { get { return Interlocked.Read(ref _dropped); } }
+
+        public ScanRoute(String name, IScanStore sink, ScanRouteRule rule, int queueCapacity, int concurrency, bool reportsDelivery)
+        {
+            Name = name;
+            Sink = sink;
+            Rule = rule;
+            ReportsDelivery = reportsDelivery;
+            _queueCapacity = Math.Max(0, queueCapacity);
+            _concurrency = Math.Max(1, concurrency);
+        }
+
+        internal Task<ScanStoreEvent> Offer(CodeLineScanEvent e)
+        {
+            var pending = new Pending(e);
+            bool start = false;
+            lock (_lock)
+            {
+                if (_inFlight < _concurrency)
+                {
+                    _inFlight++;
+                    start = true;
+                }
+                else if (_queue.Count < _queueCapacity)
+                {
+                    _queue.Enqueue(pending);
+                }
+                else
+                {
+                    Interlocked.Increment(ref _dropped);
+                    log.WarnFormat("Queue of scan route [{0}] is full, scan dropped", Name);
+                    pending.Completion.SetResult(new ScanStoreEvent(new PosHardwareException(String.Format("Queue of scan route [{0}] is full", Name))));
+                }
+            }
+            if (start)
+            {
+                Start(pending);
+            }
+            return pending.Completion.Task;
+        }
+
+        private void Start(Pending pending)
+        {
+            Task<ScanStoreEvent> delivery;
+            try
+            {
+                delivery = Sink.CodeLineDataPutAsync(pending.Scan);
+            }
+            catch (Exception ex)
+            {
+                log.ErrorFormat("Scan route [{0}] failed to start delivery [{1}]", Name, ex.Message);
+                Completed(pending, new ScanStoreEvent(ex));
+                return;
+            }
+            delivery.ContinueWith(task =>
+            {
+                ScanStoreEvent result;
+                if (task.IsFaulted)
+                {
+                    result = new ScanStoreEvent(task.Exception.GetBaseException());
+                }
+                else if (task.IsCanceled)
+                {
+                    result = new ScanStoreEvent(new PosHardwareException(String.Format("Delivery on scan route [{0}] was cancelled", Name)));
+                }
+                else
+                {
+                    result = task.Result;
+                }
+                Completed(pending, result);
+            });
+        }
+
+        private void Completed(Pending pending, ScanStoreEvent result)
+        {
+            if (result.IsException)
+            {
+                Interlocked.Increment(ref _failed);
+            }
+            else
+            {
+                Interlocked.Increment(ref _delivered);
+            }
+            pending.Completion.SetResult(result);
+
+            Pending next = null;
+            lock (_lock)
+            {
+                if (_queue.Count > 0)
+                {
+                    next = _queue.Dequeue();
+                }
+                else
+                {
+                    _inFlight--;
+                }
+            }
+            if (next != null)
+            {
+                Start(next);
+            }
+        }
+
+        public void Dispose()
+        {
+            Sink.Dispose();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("ScanRoute Name [{0}] Sink [{1}] [{2}] ReportsDelivery [{3}] Concurrency [{4}] QueueCapacity [{5}] Delivered [{6}] Failed [{7}] Dropped [{8}]",
+                Name, Sink.GetType().Name, Rule, ReportsDelivery, _concurrency, _queueCapacity, Delivered, Failed, Dropped);
+        }
+
+        private class Pending
+        {
+            public CodeLineScanEvent Scan { get; private set; }
+            public TaskCompletionSource<ScanStoreEvent> Completion { get; private set; }
+
+            public Pending(CodeLineScanEvent scan)
+            {
+                Scan = scan;
+                Completion = new TaskCompletionSource<ScanStoreEvent>();
+            }
+        }
+    }
+}
@@ -11,7 +11,9 @@ namespace CH.Alika.POS.Hardware
         DEVICE_EVENT
     }
 
-    // Events such as when the device is connected and discconnected, reading errors, or data read
+    // Events such as when the device is connected and discconnected, reading errors, or data read.
+    // A source may reuse the event for the next one once its handlers returned, handlers copy
+    // what they need instead of keeping the event.
     public class ScanSourceEvent : EventArgs
     {
         
@@ -19,37 +21,82 @@ namespace CH.Alika.POS.Hardware
         public MMM.Readers.ErrorCode ErrorCode { get; private set; }
         public String ErrorMessage { get; private set; }
 
-        private object SwipeData { get; set; }
-        private MMM.Readers.Modules.Swipe.SwipeItem SwipeItem { get; set; }
+        // as the SDK delivered it, a CodelineData for OCR_CODELINE; null for a codeline a source
+        // decoded itself, which only comes as Codeline
+        public object SwipeData { get; private set; }
+        public MMM.Readers.Modules.Swipe.SwipeItem SwipeItem { get; private set; }
+        // The compact copy of an OCR_CODELINE that the scan's CodeLineScanEvent shares, null for
+        // other data
+        public CompactCodeline Codeline { get; private set; }
 
         public ScanSourceEventType EventType { get; private set; }
 
         public ScanSourceEvent(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData)
         {
+            SetData(swipeItem, swipeData);
+        }
+
+        public ScanSourceEvent(MMM.Readers.FullPage.EventCode eventCode)
+        {
+            SetDeviceEvent(eventCode);
+        }
+
+        public ScanSourceEvent(MMM.Readers.ErrorCode errorCode, string errorMessage)
+        {
+            SetError(errorCode, errorMessage);
+        }
+
+        // For reuse through the Set methods, see ScanSourceEventDispatcher
+        internal ScanSourceEvent()
+        {
+        }
+
+        internal void SetData(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData)
+        {
+            SetData(swipeItem, swipeData, null);
+        }
+
+        internal void SetData(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData, CompactCodeline codeline)
+        {
+            Clear();
             EventType = ScanSourceEventType.DATA_EVENT;
             SwipeItem = swipeItem;
             SwipeData = swipeData;
+            Codeline = codeline;
         }
 
-        public ScanSourceEvent(MMM.Readers.FullPage.EventCode eventCode)
+        internal void SetDeviceEvent(MMM.Readers.FullPage.EventCode eventCode)
         {
+            Clear();
             EventType = ScanSourceEventType.DEVICE_EVENT;
             EventCode = eventCode;
-            ErrorMessage = null;
         }
 
-        public ScanSourceEvent(MMM.Readers.ErrorCode errorCode, string errorMessage)
+        internal void SetError(MMM.Readers.ErrorCode errorCode, string errorMessage)
         {
+            Clear();
             EventType = ScanSourceEventType.ERROR_EVENT;
             ErrorCode = errorCode;
             ErrorMessage = errorMessage == null ? "no error message given" : errorMessage;
         }
 
+        // Drops the references to the data of the previous event
+        internal void Clear()
+        {
+            EventType = default(ScanSourceEventType);
+            EventCode = default(MMM.Readers.FullPage.EventCode);
+            ErrorCode = default(MMM.Readers.ErrorCode);
+            ErrorMessage = null;
+            SwipeData = null;
+            Codeline = null;
+            SwipeItem = default(MMM.Readers.Modules.Swipe.SwipeItem);
+        }
+
         public bool IsError
         {
             get
             {
-                return EventType != ScanSourceEventType.ERROR_EVENT;
+                return EventType == ScanSourceEventType.ERROR_EVENT;
             }
         }
 
@@ -57,7 +104,7 @@ namespace CH.Alika.POS.Hardware
         {
             get
             {
-                return EventType != ScanSourceEventType.DEVICE_EVENT;
+                return EventType == ScanSourceEventType.DEVICE_EVENT;
             }
         }
 
@@ -65,7 +112,7 @@ namespace CH.Alika.POS.Hardware
         {
             get
             {
-                return EventType != ScanSourceEventType.DATA_EVENT;
+                return EventType == ScanSourceEventType.DATA_EVENT;
             }
         }
 
@@ -74,7 +121,7 @@ namespace CH.Alika.POS.Hardware
             String msg;
             switch (EventType) {
                 case ScanSourceEventType.DATA_EVENT:
-                    msg = String.Format("ScanSourceEvent DATA SwipeItem [{0}] SwipeData [{1}]", SwipeItem, SwipeData);
+                    msg = String.Format("ScanSourceEvent DATA SwipeItem [{0}] SwipeData [{1}]", SwipeItem, SwipeData ?? Codeline);
                     break;
                 case ScanSourceEventType.DEVICE_EVENT:
                     msg = String.Format("ScanSourceEvent EVENT EventCode [{0}]", EventCode);
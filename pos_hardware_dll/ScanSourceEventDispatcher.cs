@@ -0,0 +1,162 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Turns the SDK's data, event and error callbacks into the events of a scan source. A
+    // ScanSourceEvent only lives for the call to its handlers and is handed out again for the
+    // next callback, and nothing is formatted for a log level that is off, so a swipe allocates
+    // no more than the scan it delivers: the CompactCodeline and its CodeLineScanEvent, which
+    // stores keep after the handlers returned. Callbacks may arrive on several SDK threads, the
+    // one that finds no spare event allocates its own. Each codeline starts a scan of ScanTrace,
+    // its CodeLineScanEvent carries the scan's id to the stages that handle it on other threads.
+    public class ScanSourceEventDispatcher
+    {
+        private static readonly ILog log = LogProvider.For<ScanSourceEventDispatcher>();
+        private static readonly MetricCounter scansReceived = MetricsRegistry.Default.Counter(
+            "alika_scans_received_total", "Codelines delivered by the reader");
+        private static readonly MetricHistogram scanParseTime = MetricsRegistry.Default.Histogram(
+            "alika_scan_parse_seconds", "Time to take over a codeline delivered by the reader", MetricHistogram.FastBucketsSeconds);
+        private static readonly MetricCounter readerErrors = MetricsRegistry.Default.Counter(
+            "alika_reader_errors_total", "Errors reported by the reader");
+        private const String TRACE_SCAN = "Reader.Scan";
+        private const String TRACE_PARSE = "Reader.Parse";
+        private const String TRACE_SCAN_SOURCE_LISTENERS = "Reader.ScanSourceListeners";
+        private const String TRACE_CODELINE_LISTENERS = "Reader.CodeLineScanListeners";
+
+        private readonly object _sender;
+        private ScanSourceEvent _spare;
+
+        public event EventHandler<CodeLineScanEvent> OnCodeLineScanEvent;
+        public event EventHandler<ScanSourceEvent> OnScanSourceEvent;
+
+        public ScanSourceEventDispatcher(object sender)
+        {
+            _sender = sender;
+            OnCodeLineScanEvent += delegate(Object s, CodeLineScanEvent e) { };
+            OnScanSourceEvent += delegate(Object s, ScanSourceEvent e) { };
+        }
+
+        public void DataReceived(MMM.Readers.Modules.Swipe.SwipeItem swipeItem, object swipeData)
+        {
+            if (log.IsDebugEnabled())
+            {
+                log.DebugFormat("Device data: swipe item [{0}], swipe data [{1}]", swipeItem, swipeData);
+            }
+            if (swipeItem == MMM.Readers.Modules.Swipe.SwipeItem.OCR_CODELINE && swipeData is MMM.Readers.CodelineData)
+            {
+                // boxed by the SDK's callback, unboxed once here
+                CodelineReceived((MMM.Readers.CodelineData)swipeData, swipeData);
+                return;
+            }
+            ScanSourceEvent e = Rent();
+            e.SetData(swipeItem, swipeData);
+            NotifyListeners(e);
+        }
+
+        // A codeline a source decoded itself, see RteSwipeReader. It reaches the handlers as the
+        // event's Codeline only, without being boxed into SwipeData.
+        public void CodelineReceived(MMM.Readers.CodelineData codeline)
+        {
+            if (log.IsDebugEnabled())
+            {
+                log.DebugFormat("Device data: codeline [{0}]", codeline.Data);
+            }
+            CodelineReceived(codeline, null);
+        }
+
+        // swipeData is the codeline as the SDK delivered it, null when it did not come from the SDK
+        private void CodelineReceived(MMM.Readers.CodelineData codeline, object swipeData)
+        {
+            ScanSourceEvent e = Rent();
+            long scanId = ScanTrace.NextScanId();
+            using (ScanTrace.Scope(TRACE_SCAN, scanId))
+            {
+                // the marshalled codeline is only kept for the ScanSourceEvent handlers, the
+                // CodeLineScanEvent holds the compact copy
+                long started = Stopwatch.GetTimestamp();
+                CompactCodeline codeLineData = CompactCodeline.From(codeline);
+                long parsed = Stopwatch.GetTimestamp();
+                scanParseTime.Record(parsed - started);
+                ScanTrace.Record(TRACE_PARSE, scanId, started, parsed);
+                scansReceived.Increment();
+                e.SetData(MMM.Readers.Modules.Swipe.SwipeItem.OCR_CODELINE, swipeData, codeLineData);
+                using (ScanTrace.Scope(TRACE_SCAN_SOURCE_LISTENERS))
+                {
+                    NotifyListeners(e);
+                }
+                bool infoEnabled = log.IsInfoEnabled();
+                using (infoEnabled ? LogProvider.OpenNestedContext(codeLineData.Surname) : null)
+                {
+                    if (infoEnabled)
+                    {
+                        log.InfoFormat("CodeLineData ValidationResult [{0}]", codeLineData.ValidationResult);
+                    }
+                    using (ScanTrace.Scope(TRACE_CODELINE_LISTENERS))
+                    {
+                        NotifyListeners(new CodeLineScanEvent(codeLineData) { TraceId = scanId });
+                    }
+                }
+            }
+        }
+
+        public void EventReceived(MMM.Readers.FullPage.EventCode eventCode)
+        {
+            ScanSourceEvent e = Rent();
+            e.SetDeviceEvent(eventCode);
+            NotifyListeners(e);
+        }
+
+        public void ErrorReceived(MMM.Readers.ErrorCode errorCode, string errorMessage)
+        {
+            readerErrors.Increment();
+            ScanSourceEvent e = Rent();
+            e.SetError(errorCode, errorMessage);
+            NotifyListeners(e);
+        }
+
+        private ScanSourceEvent Rent()
+        {
+            return Interlocked.Exchange(ref _spare, null) ?? new ScanSourceEvent();
+        }
+
+        private void NotifyListeners(CodeLineScanEvent scan)
+        {
+            log.Info("Notifying listeners of document scan");
+            bool debugEnabled = log.IsDebugEnabled();
+            if (debugEnabled)
+            {
+                log.DebugFormat("Begin notification of CodeLineScanEvent listeners [{0}]", scan.Codeline);
+            }
+            try { OnCodeLineScanEvent(_sender, scan); }
+            catch { };
+            if (debugEnabled)
+            {
+                log.DebugFormat("End notification of CodeLineScanEvent listeners [{0}]", scan.Codeline);
+            }
+        }
+
+        // Takes the event back once its handlers returned
+        private void NotifyListeners(ScanSourceEvent e)
+        {
+            bool debugEnabled = log.IsDebugEnabled();
+            if (debugEnabled)
+            {
+                log.DebugFormat("Begin notifying ScanSourceEvent listeners [{0}]", e);
+            }
+            try { OnScanSourceEvent(_sender, e); }
+            catch { };
+            if (debugEnabled)
+            {
+                log.Debug("End notifying ScanSourceEvent listeners");
+            }
+            e.Clear();
+            _spare = e;
+        }
+    }
+}
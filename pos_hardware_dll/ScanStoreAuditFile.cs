@@ -0,0 +1,119 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Appends every scan to a local text file, one line per scan: the UTC time it was stored, a
+    // tab, the codeline as JSON without its personal fields, a tab and the scan sealed by a
+    // ScanFieldCipher, base64 encoded. The cipher's key is kept next to the file in <file>.key,
+    // so only this machine can read the personal fields back, see ReadLine. Writes are
+    // serialized on one background task at a time, which also serializes the use of the cipher.
+    public class ScanStoreAuditFile : IScanStore
+    {
+        private static readonly ILog log = LogProvider.For<ScanStoreAuditFile>();
+        private const String TIME_FORMAT = "yyyy-MM-ddTHH:mm:ss.fffZ";
+        private static readonly byte[] tab = new byte[] { (byte)'\t' };
+        private static readonly byte[] newLine = new byte[] { (byte)'\n' };
+
+        private readonly String _fileName;
+        private readonly ScanFieldCipher _cipher;
+        private readonly object _lock = new object();
+        private CompactWriter _record = new CompactWriter(1024);
+        private Task _tail;
+
+        public event EventHandler<ScanStoreEvent> OnScanStoreEvent;
+
+        public ScanStoreAuditFile(String fileName)
+        {
+            log.InfoFormat("ScanStoreAuditFile writing to [{0}]", fileName);
+            _fileName = fileName;
+            _cipher = ScanFieldCipher.ForKeyFile(fileName + ".key");
+            _tail = Task.Factory.StartNew(() => { });
+            OnScanStoreEvent += delegate(Object sender, ScanStoreEvent e) { };
+        }
+
+        public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
+        {
+            Task<ScanStoreEvent> task;
+            lock (_lock)
+            {
+                // chained so that lines are appended in scan order
+                task = _tail.ContinueWith(previous => Append(e));
+                _tail = task;
+            }
+            return task;
+        }
+
+        private ScanStoreEvent Append(CodeLineScanEvent e)
+        {
+            ScanStoreEvent scanStoreEvent;
+            try
+            {
+                DateTime now = DateTime.UtcNow;
+                // to the millisecond written, the time is the context of the sealed fields
+                var stored = new DateTime(now.Ticks - now.Ticks % TimeSpan.TicksPerMillisecond, DateTimeKind.Utc);
+                byte[] time = Encoding.ASCII.GetBytes(stored.ToString(TIME_FORMAT, CultureInfo.InvariantCulture));
+                byte[] json = ScanPayloadJsonWriter.WriteCodeline(ScanFieldCipher.WithoutPersonalFields(e.CodeLineData));
+                _record.Reset();
+                _cipher.WriteRecord(ref _record, e.CodeLineData, stored.Ticks);
+                byte[] sealedScan = Encoding.ASCII.GetBytes(Convert.ToBase64String(_record.GetBuffer(), 0, _record.Length));
+                using (var file = new FileStream(_fileName, FileMode.Append, FileAccess.Write, FileShare.Read))
+                {
+                    file.Write(time, 0, time.Length);
+                    file.Write(tab, 0, tab.Length);
+                    file.Write(json, 0, json.Length);
+                    file.Write(tab, 0, tab.Length);
+                    file.Write(sealedScan, 0, sealedScan.Length);
+                    file.Write(newLine, 0, newLine.Length);
+                }
+                scanStoreEvent = new ScanStoreEvent(_fileName);
+            }
+            catch (Exception ex)
+            {
+                log.ErrorFormat("Exception while writing scan to audit file [{0}] [{1}]", _fileName, ex.Message);
+                scanStoreEvent = new ScanStoreEvent(ex);
+            }
+            try { OnScanStoreEvent(this, scanStoreEvent); }
+            catch { }
+            return scanStoreEvent;
+        }
+
+        // The scan of a line of an audit file, personal fields included, with the cipher of the
+        // file's key
+        public static MMM.Readers.CodelineData ReadLine(ScanFieldCipher cipher, String line)
+        {
+            String[] columns = line.Split('\t');
+            if (columns.Length != 3)
+            {
+                throw new FormatException("Audit line does not have a time, codeline and sealed scan");
+            }
+            DateTime stored = DateTime.ParseExact(columns[0], TIME_FORMAT, CultureInfo.InvariantCulture,
+                DateTimeStyles.AssumeUniversal | DateTimeStyles.AdjustToUniversal);
+            byte[] record = Convert.FromBase64String(columns[2]);
+            var reader = new CompactReader(record, 0, record.Length);
+            return cipher.ReadRecord(ref reader, stored.Ticks);
+        }
+
+        public void Dispose()
+        {
+            Task tail;
+            lock (_lock)
+            {
+                tail = _tail;
+            }
+            try { tail.Wait(TimeSpan.FromSeconds(5)); }
+            catch { }
+            if (tail.IsCompleted)
+            {
+                _cipher.Dispose();
+            }
+            log.Debug("ScanStoreAuditFile disposed");
+        }
+    }
+}
@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.Linq;
 using System.Text;
 using RestSharp;
@@ -12,6 +13,7 @@ namespace CH.Alika.POS.Hardware
     {
         private static readonly ILog log = LogProvider.For<ScanStoreCloud>();
         private string _configFileName;
+        private readonly DeliveryScheduler _scheduler = new DeliveryScheduler();
 
         public event EventHandler<ScanStoreEvent> OnScanStoreEvent;
         public ScanStoreCloud(String configFileName)
@@ -20,12 +22,74 @@ namespace CH.Alika.POS.Hardware
             _configFileName = configFileName;
         }
 
+        public DeliveryScheduler Scheduler
+        {
+            get { return _scheduler; }
+        }
+
         public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
         {
             log.DebugFormat("Put CodeLineData into store async [{0}]", e);
-            Task<ScanStoreEvent> task = Task.Factory.StartNew<ScanStoreEvent>(() =>
+            return Deliver(DeliveryLane.LIVE, e);
+        }
+
+        // Scans delivered late, e.g. after an outage; they never hold up a live scan
+        public Task<ScanStoreEvent> CodeLineDataReplayAsync(CodeLineScanEvent e)
+        {
+            log.DebugFormat("Replay CodeLineData into store async [{0}]", e);
+            return Deliver(DeliveryLane.BACKLOG, e);
+        }
+
+        // Scans held back while the store was unreachable, uploaded in batches where the store
+        // accepts them and one at a time otherwise. Listeners are not notified, the scans were
+        // reported when they were taken. Returns how many scans, from the first, were delivered,
+        // a scan counts only once the store answered 2xx for it. A scan delivered on its own
+        // carries the idempotency key of its live delivery.
+        public Task<int> CodeLineDataReplayBatchAsync(IList<StoredScan> scans)
+        {
+            log.DebugFormat("Replay [{0}] scans into store async", scans.Count);
+            return _scheduler.Enqueue<int>(DeliveryLane.BACKLOG, () =>
+            {
+                int delivered = 0;
+                using (LogProvider.OpenNestedContext("Task_CodeLineDataReplayBatch"))
+                {
+                    try
+                    {
+                        while (delivered < scans.Count)
+                        {
+                            var first = new CodeLineScanEvent(scans[delivered].CodeLineData);
+                            first.TraceId = scans[delivered].TraceId;
+                            ScanStoreRestImpl service = new ScanStoreRestImpl(_configFileName, first);
+                            if (service.SupportsBatches)
+                            {
+                                List<StoredScan> batch = scans.Skip(delivered).Take(ScanBatchCodec.MaxBatchSize).ToList();
+                                service.CodeLineDataPutBatch(batch.Select(s => s.CodeLineData).ToList(), batch.Select(s => s.TraceId).ToList());
+                                delivered += batch.Count;
+                            }
+                            else
+                            {
+                                service.CodeLineDataPut(first);
+                                delivered++;
+                            }
+                        }
+                    }
+                    catch (Exception ex)
+                    {
+                        log.ErrorFormat("Exception after replaying [{0}] of [{1}] scans into cloud [{2}]", delivered, scans.Count, ex.Message);
+                    }
+                }
+                return delivered;
+            });
+        }
+
+        private Task<ScanStoreEvent> Deliver(DeliveryLane lane, CodeLineScanEvent e)
+        {
+            long queued = Stopwatch.GetTimestamp();
+            Task<ScanStoreEvent> task = _scheduler.Enqueue<ScanStoreEvent>(lane, () =>
             {
                 ScanStoreEvent scanStoreEvent;
+                ScanTrace.Record("ScanStoreCloud.Queued", e.TraceId, queued, Stopwatch.GetTimestamp());
+                using (ScanTrace.Scope("ScanStoreCloud.Deliver", e.TraceId))
                 using (LogProvider.OpenNestedContext("Task_CodeLineDataPut"))
                 {
                     log.Info("Putting scan in cloud");
@@ -42,6 +106,7 @@ namespace CH.Alika.POS.Hardware
                         log.ErrorFormat("Exception while putting scan into cloud [{0}]", ex.Message);
                         scanStoreEvent = new ScanStoreEvent(ex);
                     }
+                    scanStoreEvent.TraceId = e.TraceId;
                     NotifyListeners(scanStoreEvent);
                 }
                 return scanStoreEvent;
@@ -68,7 +133,9 @@ namespace CH.Alika.POS.Hardware
 
         public void Dispose()
         {
-            log.Debug("ScanStoreCloud disposed");
+            _scheduler.Dispose();
+            log.DebugFormat("ScanStoreCloud disposed [{0}] [{1}]",
+                _scheduler.Metrics(DeliveryLane.LIVE), _scheduler.Metrics(DeliveryLane.BACKLOG));
         }
     }
 }
@@ -8,13 +8,30 @@ namespace CH.Alika.POS.Hardware
     public class ScanStoreEvent : EventArgs
     {
         private Exception _exception;
+        private DeliveryNotification _notification;
         public String DeliveryResponse { get; private set; }
+        // Scan that was delivered, see ScanTrace
+        public long TraceId { get; internal set; }
 
         public ScanStoreEvent(String deliveryResponse)
         {
             DeliveryResponse = deliveryResponse;
         }
 
+        // Parsed from DeliveryResponse on first use and kept, so the subscribers notified of
+        // a delivery share it; for a failed delivery only the one the store answered, if any
+        public DeliveryNotification Notification
+        {
+            get
+            {
+                if (IsException)
+                {
+                    return _notification ?? (_notification = DeliveryNotification.ParseRejected(DeliveryResponse));
+                }
+                return _notification ?? (_notification = DeliveryNotification.Parse(DeliveryResponse));
+            }
+        }
+
         public Boolean IsException
         {
             get { return _exception != null; }
@@ -23,9 +40,15 @@ namespace CH.Alika.POS.Hardware
         {
             get { return _exception; }
         }
+        // DeliveryResponse is what the store answered when it refused the scan, else null
         public ScanStoreEvent(Exception ex)
         {
             this._exception = ex;
+            var rejected = ex as ScanStoreRejectedException;
+            if (rejected != null && rejected.Response.Length > 0)
+            {
+                DeliveryResponse = rejected.Response;
+            }
         }
 
         public override string ToString()
@@ -0,0 +1,228 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Offline first scan store. Every scan is appended to a local ScanLog before anything else and
+    // then, when there is a cloud store, delivered live as before. A scan the cloud does not take
+    // is still reported as stored; the sync thread uploads whatever is not synced in bulk on the
+    // backlog lane once the cloud answers again, backing off while it does not. A live scan that
+    // gets through wakes the sync thread straight away.
+    public class ScanStoreLocal : IScanStore
+    {
+        private static readonly ILog log = LogProvider.For<ScanStoreLocal>();
+        // tray app balloon for a scan kept until it can be delivered, see BalloonTip
+        public const String STORED_RESPONSE = "{\"Title\":\"Document Scan Stored\",\"Text\":\"The scanned document was stored and will be delivered once the store can be reached\",\"Severity\":\"info\"}";
+        public static readonly TimeSpan DefaultSyncInterval = TimeSpan.FromSeconds(5);
+        public static readonly TimeSpan MaxSyncBackoff = TimeSpan.FromMinutes(5);
+        public static readonly TimeSpan CompactInterval = TimeSpan.FromMinutes(10);
+
+        private readonly ScanLog _scanLog;
+        private readonly ScanStoreCloud _cloud;
+        // scans being delivered live, the sync thread leaves them alone
+        private readonly HashSet<long> _inFlight = new HashSet<long>();
+        private readonly ManualResetEvent _stopping = new ManualResetEvent(false);
+        private readonly AutoResetEvent _cloudAnswered = new AutoResetEvent(false);
+        private readonly Thread _syncThread;
+
+        public event EventHandler<ScanStoreEvent> OnScanStoreEvent;
+
+        // Without a cloud store scans are only kept
+        public ScanStoreLocal(String directory, ScanStoreCloud cloud)
+        {
+            log.InfoFormat("ScanStoreLocal storing in [{0}] syncing to cloud [{1}]", directory, cloud != null);
+            // personal fields are sealed with a key only this machine can use
+            _scanLog = new ScanLog(directory, ScanLog.DefaultMaxSegmentBytes, ScanFieldCipher.ForKeyFile(System.IO.Path.Combine(directory, "scans.key")));
+            _cloud = cloud;
+            SyncInterval = DefaultSyncInterval;
+            OnScanStoreEvent += delegate(Object sender, ScanStoreEvent e) { };
+            _syncThread = new Thread(Sync);
+            _syncThread.Name = "ScanSync";
+            _syncThread.IsBackground = true;
+            _syncThread.Start();
+        }
+
+        public ScanLog ScanLog
+        {
+            get { return _scanLog; }
+        }
+
+        public TimeSpan SyncInterval { get; set; }
+
+        public Task<ScanStoreEvent> CodeLineDataPutAsync(CodeLineScanEvent e)
+        {
+            if (Utils.IsConfigurationEvent(e))
+            {
+                // carries the store credentials, it is not kept
+                if (_cloud == null)
+                {
+                    return Completed(new ScanStoreEvent(new PosHardwareException("No cloud store to configure")));
+                }
+                return _cloud.CodeLineDataPutAsync(e).ContinueWith(task =>
+                {
+                    NotifyListeners(task.Result);
+                    return task.Result;
+                });
+            }
+
+            StoredScan stored;
+            try
+            {
+                // appended and marked in flight together, see SyncPending. The trace id kept in
+                // the log record gives a replay the idempotency key of the live delivery.
+                lock (_inFlight)
+                {
+                    stored = _scanLog.Append(e.TraceId, e.CodeLineData);
+                    if (_cloud != null)
+                    {
+                        _inFlight.Add(stored.Sequence);
+                    }
+                }
+            }
+            catch (Exception ex)
+            {
+                log.ErrorFormat("Exception while storing scan [{0}]", ex.Message);
+                return Completed(new ScanStoreEvent(ex));
+            }
+            log.DebugFormat("Stored scan [{0}]", stored);
+            if (_cloud == null)
+            {
+                return Completed(new ScanStoreEvent(STORED_RESPONSE));
+            }
+
+            return _cloud.CodeLineDataPutAsync(e).ContinueWith(task =>
+            {
+                ScanStoreEvent delivered = task.Result;
+                if (delivered.IsException)
+                {
+                    log.InfoFormat("Scan [{0}] kept for sync [{1}]", stored.TraceId, delivered.Exception.Message);
+                }
+                else
+                {
+                    try { _scanLog.MarkSynced(new long[] { stored.Sequence }); }
+                    catch (Exception ex)
+                    {
+                        log.ErrorFormat("Exception while marking scan [{0}] synced [{1}]", stored.TraceId, ex.Message);
+                    }
+                    _cloudAnswered.Set();
+                }
+                lock (_inFlight)
+                {
+                    _inFlight.Remove(stored.Sequence);
+                }
+                ScanStoreEvent result = delivered.IsException ? new ScanStoreEvent(STORED_RESPONSE) : delivered;
+                NotifyListeners(result);
+                return result;
+            });
+        }
+
+        private Task<ScanStoreEvent> Completed(ScanStoreEvent scanStoreEvent)
+        {
+            NotifyListeners(scanStoreEvent);
+            var completion = new TaskCompletionSource<ScanStoreEvent>();
+            completion.SetResult(scanStoreEvent);
+            return completion.Task;
+        }
+
+        private void NotifyListeners(ScanStoreEvent scanStoreEvent)
+        {
+            try { OnScanStoreEvent(this, scanStoreEvent); }
+            catch { }
+        }
+
+        private void Sync()
+        {
+            int failures = 0;
+            DateTime nextCompaction = DateTime.UtcNow + CompactInterval;
+            TimeSpan wait = SyncInterval;
+            var handles = new WaitHandle[] { _stopping, _cloudAnswered };
+            int signalled;
+            while ((signalled = WaitHandle.WaitAny(handles, wait)) != 0)
+            {
+                if (signalled == 1)
+                {
+                    failures = 0;
+                }
+                try
+                {
+                    if (_cloud != null)
+                    {
+                        failures = SyncPending() ? 0 : failures + 1;
+                    }
+                    if (DateTime.UtcNow >= nextCompaction)
+                    {
+                        _scanLog.Compact();
+                        nextCompaction = DateTime.UtcNow + CompactInterval;
+                    }
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("Exception while syncing stored scans [{0}]", ex.Message);
+                    failures++;
+                }
+                long backoffMs = (long)SyncInterval.TotalMilliseconds << Math.Min(failures, 16);
+                wait = TimeSpan.FromMilliseconds(Math.Min(backoffMs, (long)MaxSyncBackoff.TotalMilliseconds));
+            }
+        }
+
+        // Uploads what is not synced until nothing is left or the cloud stops taking scans
+        private bool SyncPending()
+        {
+            while (!_stopping.WaitOne(0))
+            {
+                IList<StoredScan> pending;
+                // under the same lock as appending, a scan can not be picked up here before its
+                // live delivery is marked in flight
+                lock (_inFlight)
+                {
+                    pending = _scanLog.Unsynced(ScanBatchCodec.MaxBatchSize, _inFlight);
+                }
+                if (pending.Count == 0)
+                {
+                    return true;
+                }
+
+                int delivered;
+                try
+                {
+                    delivered = _cloud.CodeLineDataReplayBatchAsync(pending).Result;
+                }
+                catch (AggregateException)
+                {
+                    // the replay was cancelled, the cloud store is being disposed
+                    return false;
+                }
+                if (delivered > 0)
+                {
+                    _scanLog.MarkSynced(pending.Take(delivered).Select(s => s.Sequence));
+                }
+                log.InfoFormat("Synced [{0}] of [{1}] stored scans, [{2}] left", delivered, pending.Count, _scanLog.UnsyncedCount);
+                if (delivered < pending.Count)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        public void Dispose()
+        {
+            _stopping.Set();
+            if (_cloud != null)
+            {
+                _cloud.Dispose();
+            }
+            if (!_syncThread.Join(TimeSpan.FromSeconds(5)))
+            {
+                log.Warn("Scan sync did not stop in time");
+            }
+            _scanLog.Dispose();
+            log.Debug("ScanStoreLocal disposed");
+        }
+    }
+}
@@ -0,0 +1,23 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    // The scan store answered, but not 2xx, so it did not take the scan. Keeps what the store
+    // answered, which a failed ScanStoreEvent passes on to the tray.
+    public class ScanStoreRejectedException : PosHardwareException
+    {
+        public int StatusCode { get; private set; }
+        // Body of the store's answer, empty when it sent none
+        public String Response { get; private set; }
+
+        public ScanStoreRejectedException(String message, int statusCode, String response, Exception inner)
+            : base(message, inner)
+        {
+            StatusCode = statusCode;
+            Response = response ?? String.Empty;
+        }
+    }
+}
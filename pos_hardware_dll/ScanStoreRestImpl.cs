@@ -10,14 +10,16 @@ namespace CH.Alika.POS.Hardware
 
     public class ScanStoreRestImpl
     {
+        // Config Transport value that delivers over the endpoint's shared DeliveryChannel
+        public const String PERSISTENT_TRANSPORT = "persistent";
+
         private ScanStoreConfig Settings;
         public ScanStoreRestImpl(String configFileName, CodeLineScanEvent e)
         {
             try
             {
                 CreateScanStoreConfigFileIfNecessary(configFileName, e);
-                string text = System.IO.File.ReadAllText(configFileName);
-                Settings = Newtonsoft.Json.JsonConvert.DeserializeObject<ScanStoreConfig>(text);
+                Settings = ScanStoreConfig.ReadCached(configFileName);
             }
             catch (FileNotFoundException ex)
             {
@@ -42,12 +44,20 @@ namespace CH.Alika.POS.Hardware
             }
         }
 
-        private String Execute<T>(RestRequest request) where T : new()
+        private String Execute<T>(String idempotencyKey, String contentType, byte[] body) where T : new()
         {
             // See http://restsharp.org/
-            var client = new RestClient();
-            client.BaseUrl = new System.Uri(Settings.BaseUrl);
-            var response = client.Execute<T>(request);
+            IRestResponse response = CreateDeliveryPolicy().Execute(idempotencyKey, CircuitBreaker.For(Settings.BaseUrl), (key, timeoutMs) =>
+            {
+                var request = new RestRequest(Method.POST);
+                request.Timeout = timeoutMs;
+                request.AddHeader(DeliveryPolicy.IDEMPOTENCY_KEY_HEADER, key);
+                request.AddParameter(contentType, body, ParameterType.RequestBody);
+                using (ScanTrace.Scope("ScanStoreRestImpl.Send"))
+                {
+                    return Send<T>(request, timeoutMs);
+                }
+            });
 
             if (response.ErrorException != null)
             {
@@ -55,13 +65,65 @@ namespace CH.Alika.POS.Hardware
                 var twilioException = new ApplicationException(message, response.ErrorException);
                 throw twilioException;
             }
+            // only a 2xx answer means the store took the scan, anything else leaves it unsynced
+            int status = (int)response.StatusCode;
+            if (status < 200 || status > 299)
+            {
+                throw new ScanStoreRejectedException(String.Format("Scan store did not take the scan, it answered [{0} {1}]", status, response.StatusDescription),
+                    status, response.Content, null);
+            }
             return response.Content;
         }
 
+        // timeoutMs is what the delivery policy leaves the attempt, the channel's queue wait
+        // included. Blocks the calling DeliveryScheduler thread until answered.
+        private IRestResponse<T> Send<T>(RestRequest request, int timeoutMs) where T : new()
+        {
+            if (PERSISTENT_TRANSPORT.Equals(Settings.Transport, StringComparison.OrdinalIgnoreCase))
+            {
+                return DeliveryChannel.For(Settings.BaseUrl).Execute<T>(new System.Uri(Settings.BaseUrl), request, TimeSpan.FromMilliseconds(timeoutMs));
+            }
+            var client = new RestClient();
+            client.BaseUrl = new System.Uri(Settings.BaseUrl);
+            return client.Execute<T>(request);
+        }
+
+        private DeliveryPolicy CreateDeliveryPolicy()
+        {
+            var policy = new DeliveryPolicy();
+            int value;
+            if (Int32.TryParse(Settings.DeadlineMs, out value))
+            {
+                policy.Deadline = TimeSpan.FromMilliseconds(value);
+            }
+            if (Int32.TryParse(Settings.AttemptTimeoutMs, out value))
+            {
+                policy.AttemptTimeout = TimeSpan.FromMilliseconds(value);
+            }
+            if (Int32.TryParse(Settings.MaxRetries, out value))
+            {
+                policy.MaxRetries = value;
+            }
+            if (Int32.TryParse(Settings.HedgeAfterMs, out value))
+            {
+                policy.HedgeAfter = TimeSpan.FromMilliseconds(value);
+            }
+            bool idempotent;
+            if (Boolean.TryParse(Settings.IdempotentStore, out idempotent))
+            {
+                policy.IdempotentStore = idempotent;
+            }
+            return policy;
+        }
+
         public String CodeLineDataPut(CodeLineScanEvent e)
         {
             if (string.IsNullOrWhiteSpace(Settings.ProtocolVersion)) {
                 return CodeLineDataPutV1(e);
+            } else if (Settings.ProtocolVersion == "3") {
+                return CodeLineDataPutV3(e);
+            } else if (Settings.ProtocolVersion == "4") {
+                return CodeLineDataPutBatch(new MMM.Readers.CodelineData[] { e.CodeLineData }, new long[] { e.TraceId });
             } else {
                 return CodeLineDataPutV2(e);
             }
@@ -69,60 +131,122 @@ namespace CH.Alika.POS.Hardware
 
         private String CodeLineDataPutV1(CodeLineScanEvent e)
         {
-            var codeLineData = e.CodeLineData;
-            var request = new RestRequest(Method.POST);
-            Dictionary<string, object> parameters = new Dictionary<string, object>();
-            request.AddJsonBody(new JsonRpcRequestV1()
-            {
-                Method = "ci_put",
-                Params = new Dictionary<string, object>()
-                {
-                   { "clientId" , Settings.ClientId },
-                   { "accessKey", Settings.AccessKey },
-                   { "codeLineData" , codeLineData }
-                }
-            });
-            return Execute<VOID>(request);
+            byte[] body = ScanPayloadJsonWriter.WriteV1("ci_put", Settings.ClientId, Settings.AccessKey, e.CodeLineData);
+            return Execute<VOID>(DeliveryPolicy.IdempotencyKey(e.TraceId), ScanPayloadJsonWriter.ContentType, body);
         }
 
         private String CodeLineDataPutV2(CodeLineScanEvent e)
         {
-            var codeLineData = e.CodeLineData;
-            var request = new RestRequest(Method.POST);
-            Dictionary<string, object> parameters = new Dictionary<string, object>();
-            request.AddJsonBody(new Dictionary<string, object>()
-            {
-                { "clientId" , Settings.ClientId },
-                { "accessKey", Settings.AccessKey },
-                { "codeLineData" , codeLineData }
-            });
-            return Execute<VOID>(request);
+            byte[] body = ScanPayloadJsonWriter.WriteV2(Settings.ClientId, Settings.AccessKey, e.CodeLineData);
+            return Execute<VOID>(DeliveryPolicy.IdempotencyKey(e.TraceId), ScanPayloadJsonWriter.ContentType, body);
         }
 
-        private class VOID
+        // Compact binary scan record instead of JSON, see ScanRecordCodec
+        private String CodeLineDataPutV3(CodeLineScanEvent e)
+        {
+            byte[] body = ScanRecordCodec.EncodeEnvelope(Settings.ClientId, Settings.AccessKey, e.CodeLineData);
+            return Execute<VOID>(DeliveryPolicy.IdempotencyKey(e.TraceId), ScanRecordCodec.ContentType, body);
+        }
+
+        // Stores speaking protocol 4 accept several scans per upload, see ScanBatchCodec
+        public bool SupportsBatches
+        {
+            get { return Settings.ProtocolVersion == "4"; }
+        }
+
+        // traceIds are the scans' trace ids, the batch's idempotency key is derived from them
+        public String CodeLineDataPutBatch(IList<MMM.Readers.CodelineData> codeLineData, IList<long> traceIds)
         {
+            if (!SupportsBatches)
+            {
+                throw new PosHardwareException(String.Format("Scan store protocol version [{0}] does not accept batches", Settings.ProtocolVersion));
+            }
+            byte[] body = ScanBatchCodec.EncodeBatch(Settings.ClientId, Settings.AccessKey, codeLineData);
+            return Execute<VOID>(DeliveryPolicy.IdempotencyKey(traceIds), ScanBatchCodec.ContentType, body);
         }
 
-        private class JsonRpcRequestV1
+        private class VOID
         {
-            public string Method { get; set; }
-            public Object Params { get; set; }
         }
 
 
         private class ScanStoreConfig
         {
+            private static readonly object cacheLock = new object();
+            private static String cachedFileName;
+            private static DateTime cachedLastWriteTimeUtc;
+            private static long cachedLength;
+            private static ScanStoreConfig cachedConfig;
+
             public String BaseUrl { get; set; }
             public String ClientId { get; set; }
             public String AccessKey { get; set; }
             public String ProtocolVersion { get; set; }
+            public String Transport { get; set; }
+            public String DeadlineMs { get; set; }
+            public String AttemptTimeoutMs { get; set; }
+            public String MaxRetries { get; set; }
+            public String HedgeAfterMs { get; set; }
+            public String IdempotentStore { get; set; }
 
             public static ScanStoreConfig Read(String fileName)
             {
                 string text = System.IO.File.ReadAllText(fileName);
+                Dictionary<String, String> members;
+                if (FlatJsonReader.TryRead(text, out members))
+                {
+                    return FromMembers(members);
+                }
                 return Newtonsoft.Json.JsonConvert.DeserializeObject<ScanStoreConfig>(text);
             }
 
+            // The file only changes when the store is (re)configured, so it is parsed again only
+            // when its time stamp or size differ from the last read
+            public static ScanStoreConfig ReadCached(String fileName)
+            {
+                var info = new FileInfo(fileName);
+                if (!info.Exists)
+                {
+                    throw new FileNotFoundException("Scan store config not found", fileName);
+                }
+                lock (cacheLock)
+                {
+                    if (cachedConfig != null && cachedFileName == info.FullName
+                        && cachedLastWriteTimeUtc == info.LastWriteTimeUtc && cachedLength == info.Length)
+                    {
+                        return cachedConfig;
+                    }
+                    cachedConfig = Read(fileName);
+                    cachedFileName = info.FullName;
+                    cachedLastWriteTimeUtc = info.LastWriteTimeUtc;
+                    cachedLength = info.Length;
+                    return cachedConfig;
+                }
+            }
+
+            private static ScanStoreConfig FromMembers(Dictionary<String, String> members)
+            {
+                return new ScanStoreConfig()
+                {
+                    BaseUrl = Member(members, "BaseUrl"),
+                    ClientId = Member(members, "ClientId"),
+                    AccessKey = Member(members, "AccessKey"),
+                    ProtocolVersion = Member(members, "ProtocolVersion"),
+                    Transport = Member(members, "Transport"),
+                    DeadlineMs = Member(members, "DeadlineMs"),
+                    AttemptTimeoutMs = Member(members, "AttemptTimeoutMs"),
+                    MaxRetries = Member(members, "MaxRetries"),
+                    HedgeAfterMs = Member(members, "HedgeAfterMs"),
+                    IdempotentStore = Member(members, "IdempotentStore")
+                };
+            }
+
+            private static String Member(Dictionary<String, String> members, String name)
+            {
+                String value;
+                return members.TryGetValue(name, out value) ? value : null;
+            }
+
             public void Write(String fileName)
             {
                 System.IO.File.WriteAllText(fileName, Newtonsoft.Json.JsonConvert.SerializeObject(this));
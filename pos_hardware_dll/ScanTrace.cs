@@ -0,0 +1,219 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Always on record of where the time of a scan goes. The stages of a scan are timed with a
+    // using block around them:
+    //
+    //   using (ScanTrace.Scope("ScanStoreCloud.Deliver", e.TraceId)) { ... }
+    //
+    // Every thread records into a ring of RingCapacity stages of its own, overwriting its oldest,
+    // so recording takes no lock and, once the thread has its ring, allocates nothing. A scope
+    // opened without a scan id belongs to the scan of the enclosing scope on the same thread.
+    // WriteChromeTrace exports the stages of the last scans in the trace event format that
+    // chrome://tracing and Perfetto open.
+    public static class ScanTrace
+    {
+        public const int RingCapacity = 1024;
+
+        private static readonly object _lock = new object();
+        // replaced rather than changed, so exports read it without the lock
+        private static TraceRing[] _rings = new TraceRing[0];
+        // starts from the time the process started, so ids stay unique across restarts as long as
+        // fewer than a million scans are taken per millisecond the process ran, see ScanLog
+        private static long _lastScanId = (DateTime.UtcNow.Ticks / TimeSpan.TicksPerMillisecond) << 20;
+        [ThreadStatic]
+        private static TraceRing _ring;
+
+        // Id of a new scan, 0 is no scan
+        public static long NextScanId()
+        {
+            return Interlocked.Increment(ref _lastScanId);
+        }
+
+        public static TraceScope Scope(String stage)
+        {
+            return Scope(stage, 0);
+        }
+
+        public static TraceScope Scope(String stage, long scanId)
+        {
+            TraceRing ring = _ring ?? (_ring = Register());
+            return new TraceScope(ring, stage, scanId == 0 ? ring.CurrentScanId : scanId);
+        }
+
+        // Records a stage timed elsewhere, e.g. the time a scan waited in a queue
+        public static void Record(String stage, long scanId, long startedTimestamp, long endedTimestamp)
+        {
+            TraceRing ring = _ring ?? (_ring = Register());
+            ring.Record(stage, scanId, startedTimestamp, endedTimestamp);
+        }
+
+        private static TraceRing Register()
+        {
+            var ring = new TraceRing(Thread.CurrentThread);
+            lock (_lock)
+            {
+                // the stages of threads that ended go with their ring
+                _rings = _rings.Where(r => r.Owner.IsAlive).Concat(new[] { ring }).ToArray();
+            }
+            return ring;
+        }
+
+        // Chrome trace event format: one complete event per stage, timestamps in microseconds
+        public static void WriteChromeTrace(TextWriter writer, int scans)
+        {
+            long firstScanId = Interlocked.Read(ref _lastScanId) - scans + 1;
+            int pid = Process.GetCurrentProcess().Id;
+            bool first = true;
+            writer.Write("{\"traceEvents\":[");
+            foreach (TraceRing ring in _rings)
+            {
+                List<TraceStage> stages = ring.Snapshot().Where(s => s.ScanId > 0 && s.ScanId >= firstScanId).ToList();
+                if (stages.Count == 0)
+                {
+                    continue;
+                }
+                WriteSeparator(writer, ref first);
+                writer.Write("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{0},\"tid\":{1},\"args\":{{\"name\":\"{2}\"}}}}",
+                    pid, ring.ThreadId, Escape(ring.ThreadName));
+                foreach (TraceStage stage in stages)
+                {
+                    WriteSeparator(writer, ref first);
+                    writer.Write("{{\"name\":\"{0}\",\"cat\":\"scan\",\"ph\":\"X\",\"ts\":{1},\"dur\":{2},\"pid\":{3},\"tid\":{4},\"args\":{{\"scan\":{5}}}}}",
+                        Escape(stage.Name), Microseconds(stage.Started), Microseconds(stage.Ended - stage.Started),
+                        pid, ring.ThreadId, stage.ScanId);
+                }
+            }
+            writer.Write("],\"displayTimeUnit\":\"ms\"}");
+        }
+
+        public static String ChromeTrace(int scans)
+        {
+            var writer = new StringWriter(CultureInfo.InvariantCulture);
+            WriteChromeTrace(writer, scans);
+            return writer.ToString();
+        }
+
+        private static void WriteSeparator(TextWriter writer, ref bool first)
+        {
+            if (!first)
+            {
+                writer.Write(',');
+            }
+            first = false;
+        }
+
+        private static String Microseconds(long ticks)
+        {
+            return (ticks * 1000000.0 / Stopwatch.Frequency).ToString("0.###", CultureInfo.InvariantCulture);
+        }
+
+        private static String Escape(String value)
+        {
+            return value.Replace("\\", "\\\\").Replace("\"", "\\\"");
+        }
+    }
+
+    // Times a stage from its creation to Dispose, see ScanTrace
+    public struct TraceScope : IDisposable
+    {
+        private readonly TraceRing _ring;
+        private readonly String _stage;
+        private readonly long _scanId;
+        private readonly long _outerScanId;
+        private readonly long _started;
+
+        internal TraceScope(TraceRing ring, String stage, long scanId)
+        {
+            _ring = ring;
+            _stage = stage;
+            _scanId = scanId;
+            _outerScanId = ring.CurrentScanId;
+            ring.CurrentScanId = scanId;
+            _started = Stopwatch.GetTimestamp();
+        }
+
+        public void Dispose()
+        {
+            if (_ring == null)
+            {
+                return;
+            }
+            _ring.Record(_stage, _scanId, _started, Stopwatch.GetTimestamp());
+            _ring.CurrentScanId = _outerScanId;
+        }
+    }
+
+    internal struct TraceStage
+    {
+        public String Name;
+        public long ScanId;
+        public long Started;
+        public long Ended;
+    }
+
+    // Stages of one thread. Only the thread writes; an export copies the ring and drops what
+    // the thread overwrote while it was copied.
+    internal class TraceRing
+    {
+        private readonly TraceStage[] _stages = new TraceStage[ScanTrace.RingCapacity];
+        // number of stages ever recorded
+        private long _recorded;
+
+        public Thread Owner { get; private set; }
+        public int ThreadId { get; private set; }
+        public String ThreadName { get; private set; }
+        public long CurrentScanId { get; set; }
+
+        public TraceRing(Thread thread)
+        {
+            Owner = thread;
+            ThreadId = thread.ManagedThreadId;
+            ThreadName = thread.Name ?? "Thread " + thread.ManagedThreadId;
+        }
+
+        public void Record(String stage, long scanId, long started, long ended)
+        {
+            long recorded = _recorded;
+            int index = (int)(recorded % ScanTrace.RingCapacity);
+            _stages[index].Name = stage;
+            _stages[index].ScanId = scanId;
+            _stages[index].Started = started;
+            _stages[index].Ended = ended;
+            // published after the stage is written
+            Thread.VolatileWrite(ref _recorded, recorded + 1);
+        }
+
+        public List<TraceStage> Snapshot()
+        {
+            long end = Thread.VolatileRead(ref _recorded);
+            long start = Math.Max(0, end - ScanTrace.RingCapacity);
+            var stages = new List<TraceStage>((int)(end - start));
+            for (long i = start; i < end; i++)
+            {
+                stages.Add(_stages[(int)(i % ScanTrace.RingCapacity)]);
+            }
+            // the thread kept recording while copying, the oldest copies may be torn, including
+            // the one it may be writing right now
+            long overwritten = Thread.VolatileRead(ref _recorded) - ScanTrace.RingCapacity + 1;
+            if (overwritten > start)
+            {
+                stages.RemoveRange(0, (int)Math.Min(stages.Count, overwritten - start));
+            }
+            return stages;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("TraceRing Thread [{0}] Recorded [{1}]", ThreadName, Thread.VolatileRead(ref _recorded));
+        }
+    }
+}
@@ -0,0 +1,94 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO.Ports;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Hardware
+{
+    // ISerialPort over System.IO.Ports.SerialPort, configured from the same connection settings
+    // the SDK loads for the swipe reader.
+    public class SerialPortAdapter : ISerialPort
+    {
+        private static readonly ILog log = LogProvider.For<SerialPortAdapter>();
+        private static readonly int READ_TIMEOUT = 50;
+
+        private readonly SerialPort _port;
+
+        public SerialPortAdapter(Swipe.ConnectionSettings settings)
+        {
+            _port = new SerialPort(
+                "COM" + settings.PortNumber,
+                (int)settings.BaudRate,
+                ToParity(settings.Parity),
+                (int)settings.ByteSize,
+                ToStopBits(settings.StopBits));
+            _port.ReadTimeout = READ_TIMEOUT;
+        }
+
+        public void Open()
+        {
+            log.DebugFormat("Opening serial port [{0}] at [{1}] baud", _port.PortName, _port.BaudRate);
+            try
+            {
+                _port.Open();
+            }
+            catch (Exception ex)
+            {
+                throw new PosHardwareException(String.Format("Failed to open serial port {0} {1}", _port.PortName, ex.Message));
+            }
+        }
+
+        public int Read(byte[] buffer, int offset, int count)
+        {
+            try
+            {
+                return _port.Read(buffer, offset, count);
+            }
+            catch (TimeoutException)
+            {
+                return 0;
+            }
+        }
+
+        public void Write(byte[] buffer, int offset, int count)
+        {
+            _port.Write(buffer, offset, count);
+        }
+
+        private static Parity ToParity(Swipe.ParityType parity)
+        {
+            switch (parity)
+            {
+                case Swipe.ParityType.ODD: return Parity.Odd;
+                case Swipe.ParityType.EVEN: return Parity.Even;
+                case Swipe.ParityType.MARK: return Parity.Mark;
+                case Swipe.ParityType.SPACE: return Parity.Space;
+                default: return Parity.None;
+            }
+        }
+
+        private static StopBits ToStopBits(Swipe.StopBitType stopBits)
+        {
+            switch (stopBits)
+            {
+                case Swipe.StopBitType.ONE_POINT_FIVE: return StopBits.OnePointFive;
+                case Swipe.StopBitType.TWO: return StopBits.Two;
+                default: return StopBits.One;
+            }
+        }
+
+        public void Dispose()
+        {
+            log.DebugFormat("Closing serial port [{0}]", _port.PortName);
+            _port.Dispose();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SerialPortAdapter PortName [{0}] BaudRate [{1}]", _port.PortName, _port.BaudRate);
+        }
+    }
+}
@@ -0,0 +1,296 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Table driven decoder for every swipe item the SDK can deliver. Each item is decoded by a
+    // single array lookup into the SwipeRecord of the swipe in progress, so RTE, MUSE, CUTE,
+    // MagTek MSR and TECS readers all end up in the same normalized record. The SDK hands every
+    // item over as an object, so the table takes them as they come; a codeline is decoded from
+    // the event's CompactCodeline instead, which is never boxed.
+    public static class SwipeDataDecoder
+    {
+        private delegate bool ItemDecoder(object data, ref SwipeRecord record);
+
+        private static readonly ItemDecoder[] Decoders = CreateDecoders();
+
+        private static ItemDecoder[] CreateDecoders()
+        {
+            var decoders = new ItemDecoder[(int)Swipe.SwipeItem.NUM_SWIPE_ITEMS];
+            decoders[(int)Swipe.SwipeItem.WHOLE_DATA] = DecodeWholeData;
+            decoders[(int)Swipe.SwipeItem.MESSAGE_CONTENT] = DecodeMessageContent;
+            decoders[(int)Swipe.SwipeItem.OCR_CODELINE] = DecodeCodeline;
+            decoders[(int)Swipe.SwipeItem.MSR_DATA] = DecodeMsr;
+            decoders[(int)Swipe.SwipeItem.SWIPE_BARCODE_PDF417] = DecodePdf417;
+            decoders[(int)Swipe.SwipeItem.SWIPE_BARCODE_1D_128] = DecodeCode128;
+            decoders[(int)Swipe.SwipeItem.SWIPE_BARCODE_1D_3_OF_9] = DecodeCode39;
+            decoders[(int)Swipe.SwipeItem.ATB_DATA] = DecodeAtb;
+            decoders[(int)Swipe.SwipeItem.RTE_QA_DATA] = DecodeIgnored;
+            decoders[(int)Swipe.SwipeItem.RTE_DATA] = DecodeRte;
+            decoders[(int)Swipe.SwipeItem.MUSE_DATA] = DecodeMuse;
+            decoders[(int)Swipe.SwipeItem.CUTE_DATA] = DecodeCute;
+            decoders[(int)Swipe.SwipeItem.MAGMSR_DATA] = DecodeMagtekMsr;
+            decoders[(int)Swipe.SwipeItem.TECS_DATA] = DecodeTecs;
+            decoders[(int)Swipe.SwipeItem.SWIPE_AAMVA_DATA] = DecodeIgnored;
+            return decoders;
+        }
+
+        // Returns false when the item is unknown or its data is not of the type the item implies
+        public static bool Decode(Swipe.SwipeItem item, object data, ref SwipeRecord record)
+        {
+            int index = (int)item;
+            if (index < 0 || index >= Decoders.Length || Decoders[index] == null || data == null)
+            {
+                return false;
+            }
+            if (!Decoders[index](data, ref record))
+            {
+                return false;
+            }
+            record.Present |= 1u << index;
+            return true;
+        }
+
+        public static bool Decode(CompactCodeline codeline, ref SwipeRecord record)
+        {
+            if (codeline == null)
+            {
+                return false;
+            }
+            record.Codeline = codeline;
+            record.Present |= 1u << (int)Swipe.SwipeItem.OCR_CODELINE;
+            return true;
+        }
+
+        private static bool DecodeWholeData(object data, ref SwipeRecord record)
+        {
+            var bytes = data as byte[];
+            if (bytes != null)
+            {
+                record.WholeData = bytes;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeMessageContent(object data, ref SwipeRecord record)
+        {
+            var content = data as String;
+            if (content != null)
+            {
+                record.MessageContent = content;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeCodeline(object data, ref SwipeRecord record)
+        {
+            var codeline = data as CompactCodeline;
+            if (codeline == null && data is MMM.Readers.CodelineData)
+            {
+                codeline = CompactCodeline.From((MMM.Readers.CodelineData)data);
+            }
+            if (codeline != null)
+            {
+                record.Codeline = codeline;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeMsr(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.MsrData)
+            {
+                var msr = (Swipe.MsrData)data;
+                record.Track1 = msr.Track1;
+                record.Track2 = msr.Track2;
+                record.Track3 = msr.Track3;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodePdf417(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.SwipeBarcodePDF417Data)
+            {
+                record.Barcode = ((Swipe.SwipeBarcodePDF417Data)data).DataField;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeCode128(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.SwipeBarcodeCode128Data)
+            {
+                record.Barcode = ((Swipe.SwipeBarcodeCode128Data)data).DataField;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeCode39(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.SwipeBarcodeCode39Data)
+            {
+                record.Barcode = ((Swipe.SwipeBarcodeCode39Data)data).DataField;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeAtb(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.AtbData)
+            {
+                var atb = (Swipe.AtbData)data;
+                record.Track1 = String.Concat(atb.Track1.Block1, atb.Track1.Block2, atb.Track1.Block3);
+                record.Track2 = String.Concat(atb.Track2.Block1, atb.Track2.Block2, atb.Track2.Block3);
+                record.Track3 = String.Concat(atb.Track3.Block1, atb.Track3.Block2, atb.Track3.Block3);
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeRte(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.RTESwipeData)
+            {
+                var rte = (Swipe.RTESwipeData)data;
+                record.Protocol = SwipeProtocol.RTE;
+                record.DeviceType = (byte)rte.DeviceType;
+                record.MessageType = (byte)rte.MessageType;
+                record.Checksum1 = rte.BCC;
+                record.Flags = rte.OCRFlagByte;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeMuse(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.MuseSwipeData)
+            {
+                var muse = (Swipe.MuseSwipeData)data;
+                record.Protocol = SwipeProtocol.MUSE;
+                record.DeviceType = (byte)muse.DeviceType;
+                record.Checksum1 = muse.CrcHigh;
+                record.Checksum2 = muse.CrcLow;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeCute(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.CuteSwipeData)
+            {
+                record.Protocol = SwipeProtocol.CUTE;
+                record.DeviceType = (byte)((Swipe.CuteSwipeData)data).DeviceType;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeMagtekMsr(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.MagtekMsrSwipeData)
+            {
+                record.Protocol = SwipeProtocol.MAGTEK_MSR;
+                record.DeviceType = (byte)((Swipe.MagtekMsrSwipeData)data).CardEncodeType;
+                return true;
+            }
+            return false;
+        }
+
+        private static bool DecodeTecs(object data, ref SwipeRecord record)
+        {
+            if (data is Swipe.TecsSwipeData)
+            {
+                record.Protocol = SwipeProtocol.TECS;
+                record.DeviceType = (byte)((Swipe.TecsSwipeData)data).DeviceType;
+                return true;
+            }
+            return false;
+        }
+
+        // Items handled elsewhere (QaMeasurementStore) or not normalized are only marked present
+        private static bool DecodeIgnored(object data, ref SwipeRecord record)
+        {
+            return true;
+        }
+    }
+
+    // Collects the swipe items delivered between START_OF_SWIPE_DATA and END_OF_SWIPE_DATA into a
+    // single SwipeRecord and publishes it once the swipe is complete.
+    public class SwipeRecordAssembler
+    {
+        private static readonly ILog log = LogProvider.For<SwipeRecordAssembler>();
+
+        private readonly object _lock = new object();
+        private SwipeRecord _record = new SwipeRecord();
+        private long _undecodedItems = 0;
+
+        public event EventHandler<SwipeRecordEvent> OnSwipeRecordEvent;
+
+        public SwipeRecordAssembler()
+        {
+            OnSwipeRecordEvent += delegate(Object sender, SwipeRecordEvent e) { };
+        }
+
+        public long UndecodedItems
+        {
+            get { lock (_lock) { return _undecodedItems; } }
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            if (e.IsDataEvent)
+            {
+                lock (_lock)
+                {
+                    // the compact copy of a codeline rather than converting it again
+                    bool decoded = e.Codeline != null
+                        ? SwipeDataDecoder.Decode(e.Codeline, ref _record)
+                        : SwipeDataDecoder.Decode(e.SwipeItem, e.SwipeData, ref _record);
+                    if (!decoded)
+                    {
+                        _undecodedItems++;
+                        log.DebugFormat("Unable to decode swipe item [{0}]", e.SwipeItem);
+                    }
+                }
+            }
+            else if (e.IsDeviceEvent &&
+                (e.EventCode == MMM.Readers.FullPage.EventCode.START_OF_SWIPE_DATA ||
+                 e.EventCode == MMM.Readers.FullPage.EventCode.END_OF_SWIPE_DATA))
+            {
+                // a swipe that never signalled its end is flushed when the next one starts
+                Flush();
+            }
+        }
+
+        public void Flush()
+        {
+            SwipeRecord record;
+            lock (_lock)
+            {
+                if (_record.IsEmpty)
+                {
+                    return;
+                }
+                record = _record;
+                _record.Clear();
+            }
+            log.DebugFormat("Swipe record assembled [{0}]", record);
+            try { OnSwipeRecordEvent(this, new SwipeRecordEvent(record)); }
+            catch { }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum SwipeProtocol : byte
+    {
+        UNKNOWN,
+        RTE,
+        MUSE,
+        CUTE,
+        MAGTEK_MSR,
+        TECS
+    }
+
+    // Normalized result of one swipe, assembled from all the swipe items the SDK delivers for it
+    // regardless of the protocol spoken by the reader. Present records which items were seen as a
+    // bit mask indexed by SwipeItem.
+    public struct SwipeRecord
+    {
+        public uint Present;
+        public SwipeProtocol Protocol;
+
+        // protocol control values, meaning depends on Protocol
+        public byte DeviceType;
+        public byte MessageType;
+        public byte Checksum1;
+        public byte Checksum2;
+        public byte Flags;
+
+        public byte[] WholeData;
+        public String MessageContent;
+        public CompactCodeline Codeline;
+        public String Track1;
+        public String Track2;
+        public String Track3;
+        public String Barcode;
+
+        public bool Has(MMM.Readers.Modules.Swipe.SwipeItem item)
+        {
+            return (Present & (1u << (int)item)) != 0;
+        }
+
+        public bool IsEmpty
+        {
+            get { return Present == 0; }
+        }
+
+        public void Clear()
+        {
+            this = new SwipeRecord();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SwipeRecord Protocol [{0}] DeviceType [{1}] Present [0x{2:X4}] Codeline [{3}] MessageContentLength [{4}]",
+                Protocol, DeviceType, Present,
+                Has(MMM.Readers.Modules.Swipe.SwipeItem.OCR_CODELINE) ? Codeline.ValidationResult.ToString() : "none",
+                MessageContent == null ? 0 : MessageContent.Length);
+        }
+    }
+
+    public class SwipeRecordEvent : EventArgs
+    {
+        public SwipeRecord Record { get; private set; }
+
+        public SwipeRecordEvent(SwipeRecord record)
+        {
+            Record = record;
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SwipeRecordEvent [{0}]", Record);
+        }
+    }
+}
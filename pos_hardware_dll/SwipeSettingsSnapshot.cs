@@ -0,0 +1,242 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+using Swipe = MMM.Readers.Modules.Swipe;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Binary snapshot of the SwipeSettings the SDK parses out of its INI hierarchy. The snapshot
+    // records the name, size, modification time and content hash of the root MMMReader.ini next
+    // to the application, which names the config directory, and of every INI file in the SDK
+    // config directory; it is used instead of Reader.LoadSwipeSettings for as long as none of
+    // them changed. A file whose time changed but whose content hash did not (e.g. copied over
+    // by an installer) does not invalidate it.
+    public static class SwipeSettingsSnapshot
+    {
+        private static readonly ILog log = LogProvider.GetLogger(typeof(SwipeSettingsSnapshot));
+        private const uint MAGIC = 0x53535041; // "APSS"
+        private const int FORMAT_VERSION = 1;
+        private const String ROOT_INI_FILE = "MMMReader.ini";
+
+        public static String DefaultPath
+        {
+            get
+            {
+                return Path.Combine(
+                    Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.CommonApplicationData), "AlikaPos"),
+                    "SwipeSettings.snapshot");
+            }
+        }
+
+        public static bool TryLoad(String snapshotPath, String configDir, out Swipe.SwipeSettings settings)
+        {
+            return TryLoad(snapshotPath, configDir, AppDomain.CurrentDomain.BaseDirectory, out settings);
+        }
+
+        // rootDir is where the root MMMReader.ini is looked for
+        internal static bool TryLoad(String snapshotPath, String configDir, String rootDir, out Swipe.SwipeSettings settings)
+        {
+            settings = new Swipe.SwipeSettings();
+            if (!File.Exists(snapshotPath))
+            {
+                log.DebugFormat("No swipe settings snapshot at [{0}]", snapshotPath);
+                return false;
+            }
+
+            try
+            {
+                using (var mapped = MemoryMappedFile.CreateFromFile(snapshotPath, FileMode.Open, null, 0, MemoryMappedFileAccess.Read))
+                using (var view = mapped.CreateViewStream(0, 0, MemoryMappedFileAccess.Read))
+                using (var reader = new BinaryReader(view, Encoding.UTF8))
+                {
+                    if (reader.ReadUInt32() != MAGIC || reader.ReadInt32() != FORMAT_VERSION)
+                    {
+                        log.Info("Swipe settings snapshot has an unknown format, ignoring it");
+                        return false;
+                    }
+                    if (reader.ReadString() != SdkVersion())
+                    {
+                        log.Info("Swipe settings snapshot was taken with another SDK version, ignoring it");
+                        return false;
+                    }
+                    if (!IniFilesUnchanged(reader, configDir, rootDir))
+                    {
+                        return false;
+                    }
+                    settings = ReadSettings(reader);
+                    // the mapped view is padded with zeros, a truncated snapshot ends without it
+                    if (reader.ReadUInt32() != MAGIC)
+                    {
+                        log.Info("Swipe settings snapshot is truncated, ignoring it");
+                        return false;
+                    }
+                    return true;
+                }
+            }
+            catch (Exception ex)
+            {
+                log.WarnFormat("Unable to read swipe settings snapshot [{0}] [{1}]", snapshotPath, ex.Message);
+                return false;
+            }
+        }
+
+        public static void Save(String snapshotPath, String configDir, Swipe.SwipeSettings settings)
+        {
+            Save(snapshotPath, configDir, AppDomain.CurrentDomain.BaseDirectory, settings);
+        }
+
+        internal static void Save(String snapshotPath, String configDir, String rootDir, Swipe.SwipeSettings settings)
+        {
+            Directory.CreateDirectory(Path.GetDirectoryName(snapshotPath));
+            String tempPath = snapshotPath + ".tmp";
+            using (var writer = new BinaryWriter(File.Create(tempPath), Encoding.UTF8))
+            {
+                writer.Write(MAGIC);
+                writer.Write(FORMAT_VERSION);
+                writer.Write(SdkVersion());
+                List<String> iniFiles = ListIniFiles(configDir, rootDir);
+                writer.Write(iniFiles.Count);
+                foreach (var iniFile in iniFiles)
+                {
+                    var info = new FileInfo(iniFile);
+                    writer.Write(info.Name.ToLowerInvariant());
+                    writer.Write(info.Length);
+                    writer.Write(info.LastWriteTimeUtc.Ticks);
+                    writer.Write(Hash(iniFile));
+                }
+                WriteSettings(writer, settings);
+                writer.Write(MAGIC);
+            }
+            if (File.Exists(snapshotPath))
+            {
+                File.Delete(snapshotPath);
+            }
+            File.Move(tempPath, snapshotPath);
+            log.InfoFormat("Saved swipe settings snapshot [{0}]", snapshotPath);
+        }
+
+        private static bool IniFilesUnchanged(BinaryReader reader, String configDir, String rootDir)
+        {
+            List<String> iniFiles = ListIniFiles(configDir, rootDir);
+            int count = reader.ReadInt32();
+            if (count != iniFiles.Count)
+            {
+                log.Info("INI files were added or removed since the swipe settings snapshot was taken");
+                return false;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                String name = reader.ReadString();
+                long length = reader.ReadInt64();
+                long lastWriteTicks = reader.ReadInt64();
+                ulong hash = reader.ReadUInt64();
+
+                var info = new FileInfo(iniFiles[i]);
+                if (info.Name.ToLowerInvariant() != name || info.Length != length)
+                {
+                    log.InfoFormat("INI file [{0}] changed since the swipe settings snapshot was taken", info.Name);
+                    return false;
+                }
+                // only pay for hashing when the time stamp says the file may have changed
+                if (info.LastWriteTimeUtc.Ticks != lastWriteTicks && Hash(iniFiles[i]) != hash)
+                {
+                    log.InfoFormat("INI file [{0}] changed since the swipe settings snapshot was taken", info.Name);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // The root INI first, then the config directory's in name order
+        private static List<String> ListIniFiles(String configDir, String rootDir)
+        {
+            var iniFiles = new List<String>();
+            if (!String.IsNullOrEmpty(configDir) && Directory.Exists(configDir))
+            {
+                iniFiles.AddRange(Directory.GetFiles(configDir, "*.ini", SearchOption.AllDirectories));
+            }
+            iniFiles.Sort(StringComparer.OrdinalIgnoreCase);
+            String rootIniFile = Path.GetFullPath(Path.Combine(rootDir, ROOT_INI_FILE));
+            if (File.Exists(rootIniFile) && !iniFiles.Any(f => String.Equals(Path.GetFullPath(f), rootIniFile, StringComparison.OrdinalIgnoreCase)))
+            {
+                iniFiles.Insert(0, rootIniFile);
+            }
+            return iniFiles;
+        }
+
+        // FNV-1a, the INI files are a few kilobytes at most
+        private static ulong Hash(String path)
+        {
+            ulong hash = 14695981039346656037UL;
+            foreach (byte b in File.ReadAllBytes(path))
+            {
+                hash ^= b;
+                hash *= 1099511628211UL;
+            }
+            return hash;
+        }
+
+        private static String SdkVersion()
+        {
+            return typeof(Swipe).Assembly.GetName().Version.ToString();
+        }
+
+        private static void WriteSettings(BinaryWriter writer, Swipe.SwipeSettings settings)
+        {
+            writer.Write((int)settings.Hardware.DeviceType);
+            writer.Write(settings.Hardware.RebootOnFailedConnection);
+            writer.Write(settings.Hardware.RebootRetryAttempts);
+            writer.Write(settings.Hardware.RebootWaitTimeout);
+            writer.Write(settings.Hardware.RecoverWaitTimeout);
+            writer.Write((int)settings.Hardware.ConnectionType);
+            writer.Write(settings.Hardware.USBAutoDetect);
+
+            writer.Write(settings.Connection.PortNumber);
+            writer.Write(settings.Connection.BaudRate);
+            writer.Write(settings.Connection.ByteSize);
+            writer.Write((int)settings.Connection.Parity);
+            writer.Write((int)settings.Connection.StopBits);
+
+            // the array length is the fixed size the SDK marshals, keep it
+            char[] protocolName = settings.Protocol.ProtocolName ?? new char[0];
+            writer.Write(protocolName.Length);
+            writer.Write(protocolName);
+            writer.Write(settings.Protocol.CommandTimeout);
+            writer.Write(settings.Protocol.RTE.UseBCC);
+            writer.Write(settings.Protocol.RTE.AutoSendEnableDevice);
+
+            writer.Write(settings.puDataToSend.puAAMVA);
+        }
+
+        private static Swipe.SwipeSettings ReadSettings(BinaryReader reader)
+        {
+            var settings = new Swipe.SwipeSettings();
+            settings.Hardware.DeviceType = (Swipe.DeviceType)reader.ReadInt32();
+            settings.Hardware.RebootOnFailedConnection = reader.ReadByte();
+            settings.Hardware.RebootRetryAttempts = reader.ReadUInt32();
+            settings.Hardware.RebootWaitTimeout = reader.ReadUInt32();
+            settings.Hardware.RecoverWaitTimeout = reader.ReadUInt32();
+            settings.Hardware.ConnectionType = (Swipe.ConnectionType)reader.ReadInt32();
+            settings.Hardware.USBAutoDetect = reader.ReadByte();
+
+            settings.Connection.PortNumber = reader.ReadUInt32();
+            settings.Connection.BaudRate = reader.ReadUInt32();
+            settings.Connection.ByteSize = reader.ReadUInt32();
+            settings.Connection.Parity = (Swipe.ParityType)reader.ReadInt32();
+            settings.Connection.StopBits = (Swipe.StopBitType)reader.ReadInt32();
+
+            int protocolNameLength = reader.ReadInt32();
+            settings.Protocol.ProtocolName = reader.ReadChars(protocolNameLength);
+            settings.Protocol.CommandTimeout = reader.ReadUInt32();
+            settings.Protocol.RTE.UseBCC = reader.ReadByte();
+            settings.Protocol.RTE.AutoSendEnableDevice = reader.ReadByte();
+
+            settings.puDataToSend.puAAMVA = reader.ReadInt32();
+            return settings;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    // Records the data, event and error callbacks of a scan source with their timing, see
+    // SwipeTrafficRecording for the format and what is kept of a scan. Attach it to
+    // OnScanSourceEvent of the reader. Every entry is handed to the operating system as it is
+    // recorded, so the recording survives the service; once MaxEntries are recorded the rest of
+    // the traffic is dropped.
+    public class SwipeTrafficRecorder : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<SwipeTrafficRecorder>();
+        public const int DefaultMaxEntries = 1000000;
+
+        private readonly object _lock = new object();
+        private readonly String _fileName;
+        private readonly int _maxEntries;
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private FileStream _stream;
+        private CompactWriter _writer = new CompactWriter(64);
+        private long _previousTicks = 0;
+        private int _entries = 0;
+
+        public SwipeTrafficRecorder(String fileName)
+            : this(fileName, DefaultMaxEntries)
+        {
+        }
+
+        public SwipeTrafficRecorder(String fileName, int maxEntries)
+        {
+            _fileName = fileName;
+            _maxEntries = maxEntries;
+            _stream = new FileStream(fileName, FileMode.Create, FileAccess.Write, FileShare.Read);
+            SwipeTrafficRecording.WriteHeader(ref _writer, DateTime.UtcNow);
+            Flush();
+            log.InfoFormat("Recording swipe traffic to [{0}]", fileName);
+        }
+
+        public int Entries
+        {
+            get { lock (_lock) { return _entries; } }
+        }
+
+        public void HandleScanSourceEvent(object sender, ScanSourceEvent e)
+        {
+            lock (_lock)
+            {
+                if (_stream == null || _entries >= _maxEntries)
+                {
+                    return;
+                }
+                long ticks = _clock.ElapsedTicks;
+                long delayMicroseconds = (ticks - _previousTicks) * 1000000 / Stopwatch.Frequency;
+                _previousTicks = ticks;
+                try
+                {
+                    SwipeTrafficRecording.WriteEntry(ref _writer, e, delayMicroseconds);
+                    Flush();
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("Stopped recording swipe traffic to [{0}] [{1}]", _fileName, ex);
+                    Close();
+                    return;
+                }
+                if (++_entries == _maxEntries)
+                {
+                    log.WarnFormat("Swipe traffic recording [{0}] is full after [{1}] entries", _fileName, _entries);
+                }
+            }
+        }
+
+        private void Flush()
+        {
+            _stream.Write(_writer.GetBuffer(), 0, _writer.Length);
+            _stream.Flush();
+            _writer.Reset();
+        }
+
+        private void Close()
+        {
+            if (_stream != null)
+            {
+                try { _stream.Dispose(); }
+                catch { }
+                _stream = null;
+            }
+        }
+
+        public void Dispose()
+        {
+            lock (_lock)
+            {
+                Close();
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("SwipeTrafficRecorder FileName [{0}] Entries [{1}]", _fileName, Entries);
+        }
+    }
+}
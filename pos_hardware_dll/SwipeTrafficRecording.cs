@@ -0,0 +1,201 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Hardware.Logging;
+
+namespace CH.Alika.POS.Hardware
+{
+    public enum SwipeTrafficEntryType : byte
+    {
+        DATA = 1,
+        DEVICE_EVENT = 2,
+        ERROR = 3
+    }
+
+    // One reader callback of a recorded swipe stream. A codeline is kept by its shape only: the
+    // document type, the issuing state, the line lengths and the validation result; nothing
+    // that identifies the holder.
+    public class SwipeTrafficEntry
+    {
+        public SwipeTrafficEntryType EntryType { get; set; }
+        // since the previous callback
+        public long DelayMicroseconds { get; set; }
+        public MMM.Readers.Modules.Swipe.SwipeItem SwipeItem { get; set; }
+        public bool IsCodeline { get; set; }
+        public int LineCount { get; set; }
+        // LINE1 to LINE3, -1 for a line that was null
+        public int[] LineLengths { get; set; }
+        public String DocType { get; set; }
+        public String IssuingState { get; set; }
+        public MMM.Readers.CheckDigitResult ValidationResult { get; set; }
+        public MMM.Readers.FullPage.EventCode EventCode { get; set; }
+        public MMM.Readers.ErrorCode ErrorCode { get; set; }
+
+        public override string ToString()
+        {
+            switch (EntryType)
+            {
+                case SwipeTrafficEntryType.DATA:
+                    return IsCodeline
+                        ? String.Format("SwipeTrafficEntry Delay [{0}us] Codeline [{1}] [{2}] Lines [{3}] ValidationResult [{4}]",
+                            DelayMicroseconds, DocType, IssuingState, String.Join(",", LineLengths.Select(l => l.ToString()).ToArray()), ValidationResult)
+                        : String.Format("SwipeTrafficEntry Delay [{0}us] SwipeItem [{1}]", DelayMicroseconds, SwipeItem);
+                case SwipeTrafficEntryType.DEVICE_EVENT:
+                    return String.Format("SwipeTrafficEntry Delay [{0}us] EventCode [{1}]", DelayMicroseconds, EventCode);
+                default:
+                    return String.Format("SwipeTrafficEntry Delay [{0}us] ErrorCode [{1}]", DelayMicroseconds, ErrorCode);
+            }
+        }
+    }
+
+    // Swipe stream written by SwipeTrafficRecorder, for replaying the traffic of a production
+    // reader against a build without the device.
+    //
+    //   file  : 'A' 'T' [version] [recorded at, UTC ticks fixed64] entry...
+    //   entry : [type] [microseconds since the previous entry, varint] payload
+    //   data  : [swipe item, varint] 0
+    //           or for a codeline 1 [line count, varint] [length of LINE1 to LINE3 plus one,
+    //           varint, zero for null] [doc type, string] [issuing state, string]
+    //           [validation result, varint]
+    //   event : [event code, varint]
+    //   error : [error code, varint]
+    //
+    // Error messages are not kept, the SDK may quote scanned data in them. Delays are capped at
+    // uint.MaxValue microseconds, a little over an hour.
+    public class SwipeTrafficRecording
+    {
+        private static readonly ILog log = LogProvider.For<SwipeTrafficRecording>();
+        public const byte FormatVersion = 1;
+        internal const int HEADER_LENGTH = 11;
+
+        public DateTime RecordedAtUtc { get; private set; }
+        public IList<SwipeTrafficEntry> Entries { get; private set; }
+
+        private SwipeTrafficRecording(DateTime recordedAtUtc, IList<SwipeTrafficEntry> entries)
+        {
+            RecordedAtUtc = recordedAtUtc;
+            Entries = entries;
+        }
+
+        public int CodelineCount
+        {
+            get { return Entries.Count(e => e.IsCodeline); }
+        }
+
+        public static SwipeTrafficRecording Load(String fileName)
+        {
+            byte[] content = File.ReadAllBytes(fileName);
+            if (content.Length < HEADER_LENGTH || content[0] != 'A' || content[1] != 'T')
+            {
+                throw new PosHardwareException(String.Format("Not a swipe traffic recording [{0}]", fileName));
+            }
+            if (content[2] != FormatVersion)
+            {
+                throw new PosHardwareException(String.Format("Swipe traffic recording [{0}] has unsupported version [{1}]", fileName, content[2]));
+            }
+
+            var reader = new CompactReader(content, 3, content.Length - 3);
+            var recordedAtUtc = new DateTime((long)reader.ReadFixed64(), DateTimeKind.Utc);
+            var entries = new List<SwipeTrafficEntry>();
+            try
+            {
+                while (!reader.AtEnd)
+                {
+                    entries.Add(ReadEntry(ref reader));
+                }
+            }
+            catch (FormatException ex)
+            {
+                // the service may have stopped in the middle of writing the last entry
+                if (!entries.Any())
+                {
+                    throw new PosHardwareException(String.Format("Swipe traffic recording [{0}] is corrupt", fileName), ex);
+                }
+                log.WarnFormat("Swipe traffic recording [{0}] ends after [{1}] entries in an unreadable one [{2}]", fileName, entries.Count, ex.Message);
+            }
+            return new SwipeTrafficRecording(recordedAtUtc, entries);
+        }
+
+        internal static void WriteHeader(ref CompactWriter writer, DateTime recordedAtUtc)
+        {
+            writer.WriteByte((byte)'A');
+            writer.WriteByte((byte)'T');
+            writer.WriteByte(FormatVersion);
+            writer.WriteFixed64((ulong)recordedAtUtc.Ticks);
+        }
+
+        internal static void WriteEntry(ref CompactWriter writer, ScanSourceEvent e, long delayMicroseconds)
+        {
+            uint delay = (uint)Math.Min(delayMicroseconds, uint.MaxValue);
+            if (e.IsDataEvent)
+            {
+                writer.WriteByte((byte)SwipeTrafficEntryType.DATA);
+                writer.WriteVarint(delay);
+                writer.WriteVarint((uint)e.SwipeItem);
+                CompactCodeline codeline = e.Codeline;
+                if (codeline == null)
+                {
+                    writer.WriteByte(0);
+                    return;
+                }
+                writer.WriteByte(1);
+                writer.WriteVarint((uint)codeline.LineCount);
+                writer.WriteVarint((uint)(codeline.FieldLength(CodelineField.LINE1) + 1));
+                writer.WriteVarint((uint)(codeline.FieldLength(CodelineField.LINE2) + 1));
+                writer.WriteVarint((uint)(codeline.FieldLength(CodelineField.LINE3) + 1));
+                codeline.WriteField(ref writer, CodelineField.DOC_TYPE);
+                codeline.WriteField(ref writer, CodelineField.ISSUING_STATE);
+                writer.WriteVarint((uint)codeline.ValidationResult);
+            }
+            else if (e.IsDeviceEvent)
+            {
+                writer.WriteByte((byte)SwipeTrafficEntryType.DEVICE_EVENT);
+                writer.WriteVarint(delay);
+                writer.WriteVarint((uint)e.EventCode);
+            }
+            else
+            {
+                writer.WriteByte((byte)SwipeTrafficEntryType.ERROR);
+                writer.WriteVarint(delay);
+                writer.WriteVarint((uint)e.ErrorCode);
+            }
+        }
+
+        private static SwipeTrafficEntry ReadEntry(ref CompactReader reader)
+        {
+            var entry = new SwipeTrafficEntry();
+            entry.EntryType = (SwipeTrafficEntryType)reader.ReadByte();
+            entry.DelayMicroseconds = reader.ReadVarint();
+            switch (entry.EntryType)
+            {
+                case SwipeTrafficEntryType.DATA:
+                    entry.SwipeItem = (MMM.Readers.Modules.Swipe.SwipeItem)reader.ReadVarint();
+                    entry.IsCodeline = reader.ReadByte() != 0;
+                    if (entry.IsCodeline)
+                    {
+                        entry.LineCount = (int)reader.ReadVarint();
+                        entry.LineLengths = new int[3];
+                        for (int i = 0; i < entry.LineLengths.Length; i++)
+                        {
+                            entry.LineLengths[i] = (int)reader.ReadVarint() - 1;
+                        }
+                        entry.DocType = reader.ReadString();
+                        entry.IssuingState = reader.ReadString();
+                        entry.ValidationResult = (MMM.Readers.CheckDigitResult)reader.ReadVarint();
+                    }
+                    break;
+                case SwipeTrafficEntryType.DEVICE_EVENT:
+                    entry.EventCode = (MMM.Readers.FullPage.EventCode)reader.ReadVarint();
+                    break;
+                case SwipeTrafficEntryType.ERROR:
+                    entry.ErrorCode = (MMM.Readers.ErrorCode)reader.ReadVarint();
+                    break;
+                default:
+                    throw new FormatException(String.Format("Unknown swipe traffic entry type [{0}]", entry.EntryType));
+            }
+            return entry;
+        }
+    }
+}
@@ -30,16 +30,16 @@ namespace CH.Alika.POS.Hardware
 
         public static bool IsConfigurationEvent(CodeLineScanEvent e)
         {
-            MMM.Readers.CodelineData data = e.CodeLineData;
-            bool result = (data.CodelineValidationResult == MMM.Readers.CheckDigitResult.CDR_Valid) 
-                && data.Line1.StartsWith("PZXXX");
+            CompactCodeline data = e.Codeline;
+            bool result = (data.ValidationResult == MMM.Readers.CheckDigitResult.CDR_Valid) 
+                && data.FieldStartsWith(CodelineField.LINE1, "PZXXX");
 
             return result;
         }
 
         public static MrzBasedConfigurationData ConfigurationData(CodeLineScanEvent e)
         {
-            MMM.Readers.CodelineData data = e.CodeLineData;
+            CompactCodeline data = e.Codeline;
             return new MrzBasedConfigurationData(data.Line1, data.Line2);
         }
     }
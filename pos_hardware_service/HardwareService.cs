@@ -44,16 +44,43 @@ namespace CH.Alika.POS.Service
     {
         private static readonly ILog log = LogProvider.For<HardwareService>();
         private static readonly String _configFileName = AppDomain.CurrentDomain.BaseDirectory + "AlikaPosConfig.txt";
-        private MMMSwipeReader scanner = null;
+        // optional, see ScanRouter
+        private static readonly String _routesFileName = AppDomain.CurrentDomain.BaseDirectory + "AlikaPosRoutes.txt";
+        private static readonly MetricCounter deliveryFailures = MetricsRegistry.Default.Counter(
+            "alika_delivery_failures_total", "Scans the scan store failed to deliver");
+        // ERROR_EXCEPTION_IN_SERVICE, reported to the SCM when the service failed
+        private const int EXIT_CODE_FAILED = 1064;
+        private static readonly TimeSpan RUNNING_WAIT = TimeSpan.FromSeconds(30);
+        private IRecoverableScanSource scanner = null;
         private IScanStore scanStoreCloud = null;
         private ServiceHost serviceHost = null;
         private SubscriberGroup subscribers = null;
+        private QaMeasurementStore qaMeasurements = null;
+        private ReaderHealthMonitor readerHealth = null;
+        private ReaderMaintenanceScheduler readerMaintenance = null;
+        private DirtDetectionMaintenanceTask dirtDetection = null;
+        private ReaderRecoveryMonitor readerRecovery = null;
+        private SwipeTrafficRecorder trafficRecorder = null;
+        private Task serviceHostOpening = null;
+        private Task metricsStarting = null;
+        private MetricsHttpEndpoint metricsEndpoint = null;
+        private MetricsPerformanceCounters performanceCounters = null;
 
         public HardwareService()
         {
             InitializeComponent();
         }
 
+        // Without a reader or service host, scans are handed to HandleCodeLineScan directly, see
+        // pos_hardware_benchmark
+        internal HardwareService(IScanStore scanStore, SubscriberGroup subscribers)
+            : this()
+        {
+            this.scanStoreCloud = scanStore;
+            this.subscribers = subscribers;
+            scanStore.OnScanStoreEvent += HandleScanStoreEvent;
+        }
+
         private SubscriberAsync GetSubscriberAsync()
         {
             return new SubscriberAsync(OperationContext.Current.GetCallbackChannel<ISubscriber>());
@@ -81,17 +108,74 @@ namespace CH.Alika.POS.Service
         {
             base.OnStart(args);
             log.Info("Service starting");
+            // -mex publishes the metadata exchange endpoint, -serialstart opens the WCF host
+            // before activating the scanner as earlier versions did, -recordtraffic records the
+            // reader callbacks for replaying them with pos_hardware_benchmark, -rteengine drives an
+            // RTE interrupt or polled reader with RteSwipeReader instead of the SDK's swipe module
+            bool withMetadataExchange = args != null && args.Contains("-mex");
+            bool serialStart = args != null && args.Contains("-serialstart");
+            bool recordTraffic = args != null && args.Contains("-recordtraffic");
+            bool rteEngine = args != null && args.Contains("-rteengine");
+            StartupTracer tracer = new StartupTracer();
             try
             {
-                subscribers = new SubscriberGroup();
-                scanner = new MMMSwipeReader();
-                scanStoreCloud = new ScanStoreCloud(_configFileName);
-                serviceHost = RemoteFactory.CreateServiceHost(this);
-                BindScanSourceToScanStore(scanner, scanStoreCloud);
+                using (tracer.Phase("Construct"))
+                {
+                    subscribers = new SubscriberGroup();
+                    scanner = rteEngine ? (IRecoverableScanSource)RteSwipeReader.FromSdkSettings() : new MMMSwipeReader();
+                    scanStoreCloud = CreateScanStore();
+                    qaMeasurements = new QaMeasurementStore();
+                    readerHealth = new ReaderHealthMonitor(ReaderHealthMonitor.DefaultBaselinePath);
+                    readerMaintenance = new ReaderMaintenanceScheduler();
+                    // checks the next scans after an idle period, for at most half an hour
+                    dirtDetection = new DirtDetectionMaintenanceTask(TimeSpan.FromMinutes(30));
+                    readerMaintenance.Add(dirtDetection);
+                    readerRecovery = new ReaderRecoveryMonitor(scanner);
+                    BindScanSourceToScanStore(scanner, scanStoreCloud);
+                    BindScanSourceToReaderHealth(scanner, qaMeasurements, readerHealth);
+                    scanner.OnScanSourceEvent += readerMaintenance.HandleScanSourceEvent;
+                    scanner.OnScanSourceEvent += dirtDetection.HandleScanSourceEvent;
+                    scanner.OnScanSourceEvent += readerRecovery.HandleScanSourceEvent;
+                    readerRecovery.OnReaderRecoveryEvent += HandleReaderRecoveryEvent;
+                    if (recordTraffic)
+                    {
+                        trafficRecorder = new SwipeTrafficRecorder(String.Format("{0}AlikaPosTraffic-{1:yyyyMMddHHmmss}.swt",
+                            AppDomain.CurrentDomain.BaseDirectory, DateTime.UtcNow));
+                        scanner.OnScanSourceEvent += trafficRecorder.HandleScanSourceEvent;
+                    }
+                }
+
+                if (serialStart)
+                {
+                    OpenServiceHost(tracer, withMetadataExchange);
+                }
+                else
+                {
+                    // Scans are delivered to the cloud without any subscriber, so the service is
+                    // reported running once the scanner is live and the host finishes opening
+                    // in the background
+                    serviceHostOpening = Task.Factory.StartNew(() => OpenServiceHost(tracer, withMetadataExchange));
+                }
+
+                // creating the performance counter category may take a while on the first start
+                metricsStarting = Task.Factory.StartNew(StartMetrics);
 
-                serviceHost.Open();
-                scanner.Activate();
-                log.InfoFormat("Service started and listening at ",RemoteFactory.PipeLocation);
+                using (tracer.Phase("ScannerActivate"))
+                {
+                    scanner.Activate();
+                }
+                readerMaintenance.Start();
+                if (serviceHostOpening != null)
+                {
+                    // a host that failed to open by now fails the start, one failing later stops
+                    // the service once the SCM reports it running
+                    if (serviceHostOpening.IsFaulted)
+                    {
+                        throw new PosHardwareException("Failed to open the service host", serviceHostOpening.Exception.GetBaseException());
+                    }
+                    serviceHostOpening.ContinueWith(HandleServiceHostOpenFailure, TaskContinuationOptions.OnlyOnFaulted);
+                }
+                log.InfoFormat("Service started and listening at [{0}] [{1}]", RemoteFactory.PipeLocation, tracer);
             }
             catch (Exception e)
             {
@@ -100,42 +184,157 @@ namespace CH.Alika.POS.Service
                                        System.Diagnostics.EventLogEntryType.Warning);
                 EventLog.WriteEntry(this.ServiceName, e.StackTrace,
                                        System.Diagnostics.EventLogEntryType.Warning);
+                ExitCode = EXIT_CODE_FAILED;
                 OnStop();
                 throw e;
             }
         }
 
+        private void OpenServiceHost(StartupTracer tracer, bool withMetadataExchange)
+        {
+            using (tracer.Phase("ServiceHostOpen"))
+            {
+                ServiceHost host = RemoteFactory.CreateServiceHost(this, withMetadataExchange);
+                host.Open();
+                serviceHost = host;
+            }
+        }
+
+        private void HandleServiceHostOpenFailure(Task opening)
+        {
+            Exception e = opening.Exception.GetBaseException();
+            log.ErrorFormat("Service exception while opening service host [{0}]", e);
+            EventLog.WriteEntry(this.ServiceName, e.Message,
+                                   System.Diagnostics.EventLogEntryType.Warning);
+            if (Environment.UserInteractive)
+            {
+                // started from the console, see Program, which stops it on ENTER
+                return;
+            }
+            ExitCode = EXIT_CODE_FAILED;
+            // stopped through the SCM rather than by Stop(), which would race with the SCM
+            // reporting the service running
+            try
+            {
+                using (var controller = new ServiceController(ServiceName))
+                {
+                    controller.WaitForStatus(ServiceControllerStatus.Running, RUNNING_WAIT);
+                    controller.Stop();
+                }
+            }
+            catch (Exception ex)
+            {
+                log.ErrorFormat("Unable to stop the service after its service host failed [{0}]", ex.Message);
+            }
+        }
+
+        // The service runs on without metrics when they can not be exported
+        private void StartMetrics()
+        {
+            try
+            {
+                metricsEndpoint = new MetricsHttpEndpoint(MetricsRegistry.Default, MetricsHttpEndpoint.DefaultPort);
+            }
+            catch (Exception e)
+            {
+                log.WarnFormat("Metrics are not served over HTTP [{0}]", e.Message);
+            }
+            try
+            {
+                performanceCounters = new MetricsPerformanceCounters(MetricsRegistry.Default);
+            }
+            catch (Exception e)
+            {
+                log.WarnFormat("Metrics are not published as performance counters [{0}]", e.Message);
+            }
+        }
+
+        private IScanStore CreateScanStore()
+        {
+            if (System.IO.File.Exists(_routesFileName))
+            {
+                log.InfoFormat("Routing scans as configured in [{0}]", _routesFileName);
+                return ScanRouter.Load(_routesFileName);
+            }
+            return new ScanStoreCloud(_configFileName);
+        }
+
         private void BindScanSourceToScanStore(IScanSource scanSource, IScanStore scanSink)
         {
             scanSink.OnScanStoreEvent += HandleScanStoreEvent;
             scanner.OnCodeLineScanEvent += HandleCodeLineScan;
         }
 
-        private void HandleCodeLineScan(object sender, CodeLineScanEvent e)
+        private void BindScanSourceToReaderHealth(IScanSource scanSource, QaMeasurementStore store, ReaderHealthMonitor monitor)
         {
-            log.Info("Handling CodeLineScan");
-            log.DebugFormat("Begin processing Scan", e);
-            subscribers.NotifyAll(e);
+            scanSource.OnScanSourceEvent += store.HandleScanSourceEvent;
+            monitor.Attach(store);
+            monitor.OnReaderHealthEvent += HandleReaderHealthEvent;
+        }
 
-            try
+        private void HandleReaderHealthEvent(object sender, ReaderHealthEvent e)
+        {
+            log.InfoFormat("Handle change of reader health [{0}]", e);
+            if (e.Status == ReaderHealthStatus.DEGRADED)
             {
-                log.Info("Putting scanned document asynchronously into cloud");
-                scanStoreCloud.CodeLineDataPutAsync(e);
+                EventLog.WriteEntry(this.ServiceName, "Document reader should be cleaned: " + e.Reason,
+                                       System.Diagnostics.EventLogEntryType.Warning, 102);
             }
-            catch (Exception ex)
+        }
+
+        private void HandleReaderRecoveryEvent(object sender, ReaderRecoveryEvent e)
+        {
+            log.InfoFormat("Handle reader recovery [{0}]", e);
+            if (e.State == ReaderConnectionState.FAILED)
             {
-                log.ErrorFormat("Exception during delivery of scan [{0}]", ex);
+                EventLog.WriteEntry(this.ServiceName, "Document reader could not be reconnected, check the cable",
+                                       System.Diagnostics.EventLogEntryType.Warning, 103);
             }
+        }
 
-            log.Debug("End processing Scan");
+        internal void HandleCodeLineScan(object sender, CodeLineScanEvent e)
+        {
+            using (ScanTrace.Scope("HardwareService.HandleScan", e.TraceId))
+            {
+                log.Info("Handling CodeLineScan");
+                log.DebugFormat("Begin processing Scan", e);
+                using (ScanTrace.Scope("HardwareService.NotifySubscribers"))
+                {
+                    subscribers.NotifyAll(e);
+                }
+
+                try
+                {
+                    log.Info("Putting scanned document asynchronously into cloud");
+                    using (ScanTrace.Scope("HardwareService.PutAsync"))
+                    {
+                        scanStoreCloud.CodeLineDataPutAsync(e);
+                    }
+                }
+                catch (Exception ex)
+                {
+                    log.ErrorFormat("Exception during delivery of scan [{0}]", ex);
+                }
+
+                log.Debug("End processing Scan");
+            }
         }
 
         private void HandleScanStoreEvent(object sender, ScanStoreEvent e)
+        {
+            using (ScanTrace.Scope("HardwareService.HandleDeliveryResult", e.TraceId))
+            {
+                HandleDeliveryResult(e);
+            }
+        }
+
+        private void HandleDeliveryResult(ScanStoreEvent e)
         {
             log.Info("Handle result of delivery of scan");
             log.DebugFormat("Begin handling Scan delivery result [{0}]", e);
             if (e.IsException)
             {
+                deliveryFailures.Increment();
                 log.InfoFormat("Create Windows Event Log Entry of [{0}]", e);
                 EventLog.WriteEntry(this.ServiceName, e.Exception.Message,
                                        System.Diagnostics.EventLogEntryType.Warning, 101);
@@ -148,18 +347,45 @@ namespace CH.Alika.POS.Service
         protected override void OnStop()
         {
             log.Info("Service stopping");
+            if (serviceHostOpening != null)
+            {
+                // let a host that is still opening finish so that it is closed below
+                try { serviceHostOpening.Wait(); }
+                catch { }
+                serviceHostOpening = null;
+            }
             if (serviceHost != null)
             {
                 serviceHost.Close();
                 serviceHost = null;
             }
+            if (metricsStarting != null)
+            {
+                try { metricsStarting.Wait(); }
+                catch { }
+                metricsStarting = null;
+            }
+            cleanup(metricsEndpoint);
+            metricsEndpoint = null;
+            cleanup(performanceCounters);
+            performanceCounters = null;
 
+            cleanup(readerMaintenance);
+            readerMaintenance = null;
+            cleanup(dirtDetection);
+            dirtDetection = null;
+            cleanup(readerRecovery);
+            readerRecovery = null;
             cleanup(scanner);
             scanner = null;
+            cleanup(trafficRecorder);
+            trafficRecorder = null;
             cleanup(scanStoreCloud);
             scanStoreCloud = null;
             cleanup(subscribers);
             subscribers = null;
+            qaMeasurements = null;
+            readerHealth = null;
             log.Info("Service stopped");
         }
 
@@ -0,0 +1,112 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Net;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+using CH.Alika.POS.Service.Logging;
+
+namespace CH.Alika.POS.Service
+{
+    // Serves the metrics in the Prometheus text format at http://localhost:<port>/metrics/ for a
+    // scraper on the same machine, and the stages of the last scans as a Chrome trace at
+    // http://localhost:<port>/trace/?scans=<n>, see ScanTrace. Requests are answered one after
+    // the other on a thread of its own; a request only reads, it never waits on a scan.
+    class MetricsHttpEndpoint : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<MetricsHttpEndpoint>();
+        public const int DefaultPort = 9464;
+        private const String CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8";
+        private const String TRACE_CONTENT_TYPE = "application/json; charset=utf-8";
+        public const int DefaultTraceScans = 20;
+
+        private readonly MetricsRegistry _registry;
+        private readonly HttpListener _listener = new HttpListener();
+        private readonly Thread _thread;
+
+        public MetricsHttpEndpoint(MetricsRegistry registry, int port)
+        {
+            _registry = registry;
+            _listener.Prefixes.Add(String.Format("http://localhost:{0}/metrics/", port));
+            _listener.Prefixes.Add(String.Format("http://localhost:{0}/trace/", port));
+            _listener.Start();
+            _thread = new Thread(Serve);
+            _thread.Name = "MetricsHttpEndpoint";
+            _thread.IsBackground = true;
+            _thread.Start();
+            log.InfoFormat("Serving metrics and scan traces at [{0}]", String.Join(", ", _listener.Prefixes));
+        }
+
+        private void Serve()
+        {
+            while (true)
+            {
+                HttpListenerContext context;
+                try
+                {
+                    context = _listener.GetContext();
+                }
+                catch (Exception)
+                {
+                    // stopped
+                    return;
+                }
+                try
+                {
+                    Respond(context);
+                }
+                catch (Exception ex)
+                {
+                    log.WarnFormat("Failed to serve metrics [{0}]", ex.Message);
+                }
+            }
+        }
+
+        private void Respond(HttpListenerContext context)
+        {
+            using (HttpListenerResponse response = context.Response)
+            {
+                if (context.Request.HttpMethod != "GET" && context.Request.HttpMethod != "HEAD")
+                {
+                    response.StatusCode = 405;
+                    return;
+                }
+                var text = new StringWriter();
+                if (context.Request.Url.AbsolutePath.StartsWith("/trace", StringComparison.OrdinalIgnoreCase))
+                {
+                    int scans;
+                    if (!Int32.TryParse(context.Request.QueryString["scans"], out scans) || scans <= 0)
+                    {
+                        scans = DefaultTraceScans;
+                    }
+                    ScanTrace.WriteChromeTrace(text, scans);
+                    response.ContentType = TRACE_CONTENT_TYPE;
+                }
+                else
+                {
+                    _registry.WritePrometheus(text);
+                    response.ContentType = CONTENT_TYPE;
+                }
+                byte[] body = Encoding.UTF8.GetBytes(text.ToString());
+                response.ContentLength64 = body.Length;
+                if (context.Request.HttpMethod == "GET")
+                {
+                    response.OutputStream.Write(body, 0, body.Length);
+                }
+            }
+        }
+
+        public void Dispose()
+        {
+            try { _listener.Close(); }
+            catch { }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("MetricsHttpEndpoint Prefixes [{0}]", String.Join(", ", _listener.Prefixes));
+        }
+    }
+}
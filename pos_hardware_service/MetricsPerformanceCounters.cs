@@ -0,0 +1,159 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.Hardware;
+using CH.Alika.POS.Service.Logging;
+
+namespace CH.Alika.POS.Service
+{
+    // Publishes the metrics as Windows performance counters of the category CategoryName, once
+    // every PublishInterval. Counters and gauges become one counter each, a histogram becomes
+    // the number of recordings and their mean over the last interval in microseconds. The
+    // category is created, or recreated when the metrics changed, on start; metrics registered
+    // after that are only served over HTTP.
+    class MetricsPerformanceCounters : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<MetricsPerformanceCounters>();
+        public const String CategoryName = "Alika POS Service";
+        public static readonly TimeSpan PublishInterval = TimeSpan.FromSeconds(1);
+
+        private readonly List<Publication> _publications = new List<Publication>();
+        private readonly Timer _timer;
+
+        public MetricsPerformanceCounters(MetricsRegistry registry)
+        {
+            var counters = new CounterCreationDataCollection();
+            foreach (IMetric metric in registry.Metrics)
+            {
+                var histogram = metric as MetricHistogram;
+                String name = CounterName(metric);
+                counters.Add(new CounterCreationData(name, metric.Help, PerformanceCounterType.NumberOfItems64));
+                if (histogram != null)
+                {
+                    counters.Add(new CounterCreationData(name + " mean us", metric.Help + ", mean of the last interval in microseconds",
+                        PerformanceCounterType.NumberOfItems64));
+                }
+                _publications.Add(new Publication(metric, name, histogram != null));
+            }
+            CreateCategory(counters);
+            foreach (Publication publication in _publications)
+            {
+                publication.Open();
+            }
+            _timer = new Timer(Publish, null, TimeSpan.Zero, PublishInterval);
+            log.InfoFormat("Publishing [{0}] metrics as performance counters of [{1}]", _publications.Count, CategoryName);
+        }
+
+        private static String CounterName(IMetric metric)
+        {
+            return metric.Labels == null ? metric.Name : String.Format("{0} ({1})", metric.Name, metric.Labels.Replace("\"", ""));
+        }
+
+        private static void CreateCategory(CounterCreationDataCollection counters)
+        {
+            if (PerformanceCounterCategory.Exists(CategoryName))
+            {
+                bool current = counters.Cast<CounterCreationData>().All(c => PerformanceCounterCategory.CounterExists(c.CounterName, CategoryName));
+                if (current)
+                {
+                    return;
+                }
+                log.InfoFormat("Recreating performance counter category [{0}] for changed metrics", CategoryName);
+                PerformanceCounterCategory.Delete(CategoryName);
+            }
+            PerformanceCounterCategory.Create(CategoryName, "Metrics of the Alika Point-Of-Sale Service",
+                PerformanceCounterCategoryType.SingleInstance, counters);
+        }
+
+        private void Publish(object state)
+        {
+            try
+            {
+                foreach (Publication publication in _publications)
+                {
+                    publication.Publish();
+                }
+            }
+            catch (Exception ex)
+            {
+                log.WarnFormat("Failed to publish performance counters [{0}]", ex.Message);
+            }
+        }
+
+        public void Dispose()
+        {
+            using (var disposed = new ManualResetEvent(false))
+            {
+                if (_timer.Dispose(disposed))
+                {
+                    disposed.WaitOne(PublishInterval);
+                }
+            }
+            foreach (Publication publication in _publications)
+            {
+                publication.Dispose();
+            }
+        }
+
+        public override string ToString()
+        {
+            return String.Format("MetricsPerformanceCounters Category [{0}] Metrics [{1}]", CategoryName, _publications.Count);
+        }
+
+        private class Publication : IDisposable
+        {
+            private readonly IMetric _metric;
+            private readonly String _name;
+            private readonly bool _withMean;
+            private PerformanceCounter _value;
+            private PerformanceCounter _mean;
+            private long _lastCount;
+            private long _lastSumTicks;
+
+            public Publication(IMetric metric, String name, bool withMean)
+            {
+                _metric = metric;
+                _name = name;
+                _withMean = withMean;
+            }
+
+            public void Open()
+            {
+                _value = new PerformanceCounter(CategoryName, _name, false);
+                if (_withMean)
+                {
+                    _mean = new PerformanceCounter(CategoryName, _name + " mean us", false);
+                }
+            }
+
+            public void Publish()
+            {
+                long value = _metric.Value;
+                _value.RawValue = value;
+                if (_mean != null)
+                {
+                    long sumTicks = ((MetricHistogram)_metric).SumTicks;
+                    long count = value - _lastCount;
+                    _mean.RawValue = count <= 0 ? 0 : (sumTicks - _lastSumTicks) * 1000000 / Stopwatch.Frequency / count;
+                    _lastCount = value;
+                    _lastSumTicks = sumTicks;
+                }
+            }
+
+            public void Dispose()
+            {
+                if (_value != null)
+                {
+                    _value.Dispose();
+                }
+                if (_mean != null)
+                {
+                    _mean.Dispose();
+                }
+            }
+        }
+    }
+}
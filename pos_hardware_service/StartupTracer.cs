@@ -0,0 +1,73 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using CH.Alika.POS.Service.Logging;
+
+namespace CH.Alika.POS.Service
+{
+    // Records how long each phase of service start takes, relative to the start of OnStart, so a
+    // slow POS box that hits the SCM start timeout shows which phase to blame. Phases may run on
+    // different threads at the same time.
+    public class StartupTracer
+    {
+        private static readonly ILog log = LogProvider.For<StartupTracer>();
+
+        private readonly object _lock = new object();
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private readonly List<String> _phases = new List<String>();
+
+        public TimeSpan Elapsed
+        {
+            get { return _clock.Elapsed; }
+        }
+
+        public IDisposable Phase(String name)
+        {
+            return new PhaseScope(this, name, _clock.ElapsedMilliseconds);
+        }
+
+        private void Record(String name, long startedMs, long finishedMs)
+        {
+            String phase = String.Format("{0} [{1}ms..{2}ms]", name, startedMs, finishedMs);
+            lock (_lock)
+            {
+                _phases.Add(phase);
+            }
+            log.InfoFormat("Startup phase {0} took [{1}ms]", phase, finishedMs - startedMs);
+        }
+
+        public override string ToString()
+        {
+            lock (_lock)
+            {
+                return String.Format("StartupTracer Elapsed [{0}ms] Phases [{1}]", _clock.ElapsedMilliseconds, String.Join(", ", _phases));
+            }
+        }
+
+        private class PhaseScope : IDisposable
+        {
+            private readonly StartupTracer _tracer;
+            private readonly String _name;
+            private readonly long _startedMs;
+            private bool _disposed = false;
+
+            public PhaseScope(StartupTracer tracer, String name, long startedMs)
+            {
+                _tracer = tracer;
+                _name = name;
+                _startedMs = startedMs;
+            }
+
+            public void Dispose()
+            {
+                if (!_disposed)
+                {
+                    _disposed = true;
+                    _tracer.Record(_name, _startedMs, _tracer._clock.ElapsedMilliseconds);
+                }
+            }
+        }
+    }
+}
@@ -13,6 +13,8 @@ namespace CH.Alika.POS.Service
     class SubscriberAsync
     {
         private static readonly ILog log = LogProvider.For<SubscriberAsync>();
+        private static readonly MetricCounter faults = MetricsRegistry.Default.Counter(
+            "alika_subscriber_faults_total", "Tray apps dropped because their channel faulted or a notification failed");
 
         public bool IsOpen
         {
@@ -53,6 +55,7 @@ namespace CH.Alika.POS.Service
         private void CommunicationObject_Faulted(object sender, EventArgs e)
         {
             log.DebugFormat("Communcation channel faulted [{0}]", e);
+            faults.Increment();
             IsOpen = false;
         }
 
@@ -66,6 +69,7 @@ namespace CH.Alika.POS.Service
         {
             return Task.Factory.StartNew(() =>
             {
+                using (ScanTrace.Scope("SubscriberAsync.NotifyScan", e.TraceId))
                 using (LogProvider.OpenNestedContext("Task_NotifySubscriber_CodeLineScan"))
                 {
                     log.Info("Notify remote subscriber of scan");
@@ -73,12 +77,13 @@ namespace CH.Alika.POS.Service
                     try
                     {
                         _subscriber.HandlerScan(
-                            new ScanResult { ValidationResult = (int)(e.CodeLineData.CodelineValidationResult), Contents = e.CodeLineData.Surname }
+                            new ScanResult { ValidationResult = (int)(e.Codeline.ValidationResult), Contents = e.Codeline.Surname }
                             );
                     }
                     catch (Exception ex)
                     {
                         log.WarnFormat("Unable to notify remote subscriber of scan  [{0}]", ex.Message);
+                        faults.Increment();
                         IsOpen = false;
                     }
                     log.DebugFormat("End call remote notification of scan");
@@ -90,21 +95,30 @@ namespace CH.Alika.POS.Service
         {
             return Task.Factory.StartNew(() =>
             {
+                using (ScanTrace.Scope("SubscriberAsync.NotifyDelivery", e.TraceId))
                 using (LogProvider.OpenNestedContext("Task_NofitySubscriber_ScanDelivery"))
                 {
                     log.Info("Notify remote subscriber of scan delivery result");
                     log.DebugFormat("Begin call remote notification of scan delivery result [{0}]", e);
                     try
                     {
-                        _subscriber.HandleScanDelivered(
-                            new ScanDeliveryResult { 
+                        // a refused scan keeps the reason, the store's own message comes as the notification
+                        var result = new ScanDeliveryResult { 
                                 WasDelivered = !e.IsException, 
-                                DeliveryResponse = e.IsException ? e.Exception.Message : e.DeliveryResponse }
-                            );
+                                DeliveryResponse = e.IsException ? e.Exception.Message : e.DeliveryResponse };
+                        DeliveryNotification notification = e.Notification;
+                        if (notification != null)
+                        {
+                            result.NotificationTitle = notification.Title;
+                            result.NotificationText = notification.Text;
+                            result.NotificationSeverity = notification.Severity;
+                        }
+                        _subscriber.HandleScanDelivered(result);
                     }
                     catch (Exception ex)
                     {
                         log.WarnFormat("Unable to notify remote subscriber of scan delivery result [{0}]", ex.Message);
+                        faults.Increment();
                         IsOpen = false;
                     }
                     log.DebugFormat("End call remote subscriber scan delivery result [{0}]", e);
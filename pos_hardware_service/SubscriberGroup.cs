@@ -12,6 +12,8 @@ namespace CH.Alika.POS.Service
     class SubscriberGroup : IDisposable
     {
         private static readonly ILog log = LogProvider.For<SubscriberGroup>();
+        private static readonly MetricGauge subscriberCount = MetricsRegistry.Default.Gauge(
+            "alika_subscribers", "Tray apps subscribed to scans");
         private ConcurrentDictionary<SubscriberAsync, SubscriberAsync> _subscribers = new ConcurrentDictionary<SubscriberAsync, SubscriberAsync>();
 
         private void Subscriber_Closed(object sender, EventArgs e)
@@ -35,6 +37,7 @@ namespace CH.Alika.POS.Service
             {
                 log.Info("Subscriber joined group");
                 subscriber.Closed += Subscriber_Closed;
+                subscriberCount.Set(_subscribers.Count);
             }
         }
 
@@ -46,6 +49,7 @@ namespace CH.Alika.POS.Service
             {
                 log.Info("Subscriber left group");
                 subscriber.Closed -= Subscriber_Closed;
+                subscriberCount.Set(_subscribers.Count);
             }
         }
 
@@ -94,6 +98,7 @@ namespace CH.Alika.POS.Service
                 subscriber.Closed -= new EventHandler(Subscriber_Closed);
             }
             _subscribers.Clear();
+            subscriberCount.Set(0);
         }
     }
 }
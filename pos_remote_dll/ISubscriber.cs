@@ -34,5 +34,18 @@ namespace CH.Alika.POS.Remote
 
         [DataMember]
         public string DeliveryResponse { get; set; }
+
+        // Balloon tip of a delivered scan, parsed from DeliveryResponse by the service. Null
+        // when the service predates them, the tray app then parses DeliveryResponse itself.
+        // For a scan the store refused, the balloon tip it answered with, if any.
+        [DataMember]
+        public string NotificationTitle { get; set; }
+
+        [DataMember]
+        public string NotificationText { get; set; }
+
+        // info, warn, error or none
+        [DataMember]
+        public string NotificationSeverity { get; set; }
     }
 }
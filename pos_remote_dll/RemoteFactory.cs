@@ -24,9 +24,25 @@ namespace CH.Alika.POS.Remote
 
         public static ServiceHost CreateServiceHost(IScanner scanner)
         {
-            log.DebugFormat("Create service host at [{0}]", PipeLocation);
+            return CreateServiceHost(scanner, true);
+        }
+
+        // The MEX endpoint is only needed to generate client proxies, leaving it out saves
+        // building the metadata behavior while the service is starting
+        public static ServiceHost CreateServiceHost(IScanner scanner, bool withMetadataExchange)
+        {
+            log.DebugFormat("Create service host at [{0}] with metadata exchange [{1}]", PipeLocation, withMetadataExchange);
             ServiceHost selfHost = new ServiceHost(scanner);
             selfHost.AddServiceEndpoint(typeof(IScanner), new NetNamedPipeBinding(NetNamedPipeSecurityMode.None), PipeLocation);
+            if (withMetadataExchange)
+            {
+                AddMetadataExchange(selfHost);
+            }
+            return selfHost;
+        }
+
+        private static void AddMetadataExchange(ServiceHost selfHost)
+        {
             ServiceMetadataBehavior smb = new ServiceMetadataBehavior();
             smb.MetadataExporter.PolicyVersion = PolicyVersion.Policy15;
             selfHost.Description.Behaviors.Add(smb);
@@ -37,7 +53,6 @@ namespace CH.Alika.POS.Remote
                 MetadataExchangeBindings.CreateMexNamedPipeBinding(),
                 PipeLocation + "/mex"
                 );
-            return selfHost;
-        } 
+        }
     }
 }
@@ -3,6 +3,7 @@ using System.Collections.Generic;
 using System.Linq;
 using System.Text;
 using System.Windows.Forms;
+using CH.Alika.POS.Hardware;
 
 namespace CH.Alika.POS.TrayApp
 {
@@ -15,21 +16,22 @@ namespace CH.Alika.POS.TrayApp
         {
             get
             {
-                var severity = Severity.ToLower();
-                if ("warn".Equals(severity)) 
-                    return ToolTipIcon.Warning;
-                
-                if ("error".Equals(severity))
-                    return ToolTipIcon.Error;
-                
-                if ("info".Equals(severity))
-                    return ToolTipIcon.Info;
+                return IconFor(Severity);
+            }
+        }
 
-                if ("none".Equals(severity))
-                    return ToolTipIcon.None;
+        public static ToolTipIcon IconFor(String severity)
+        {
+            if ("warn".Equals(severity, StringComparison.OrdinalIgnoreCase))
+                return ToolTipIcon.Warning;
 
-                return ToolTipIcon.None;
-            }
+            if ("error".Equals(severity, StringComparison.OrdinalIgnoreCase))
+                return ToolTipIcon.Error;
+
+            if ("info".Equals(severity, StringComparison.OrdinalIgnoreCase))
+                return ToolTipIcon.Info;
+
+            return ToolTipIcon.None;
         }
 
         public BalloonTip()
@@ -38,5 +40,30 @@ namespace CH.Alika.POS.TrayApp
             Text = "A scanned document was delivered to cloud";
             Severity = "info";
         }
+
+        // Delivery responses are a flat object, only unusual ones go through Newtonsoft
+        public static BalloonTip Parse(String json)
+        {
+            Dictionary<String, String> members;
+            if (!FlatJsonReader.TryRead(json, out members))
+            {
+                return Newtonsoft.Json.JsonConvert.DeserializeObject<BalloonTip>(json);
+            }
+            var balloonTip = new BalloonTip();
+            String value;
+            if (members.TryGetValue("Title", out value))
+            {
+                balloonTip.Title = value;
+            }
+            if (members.TryGetValue("Text", out value))
+            {
+                balloonTip.Text = value;
+            }
+            if (members.TryGetValue("Severity", out value))
+            {
+                balloonTip.Severity = value;
+            }
+            return balloonTip;
+        }
     }
 }
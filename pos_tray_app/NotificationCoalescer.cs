@@ -0,0 +1,135 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using CH.Alika.POS.TrayApp.Logging;
+
+namespace CH.Alika.POS.TrayApp
+{
+    // Hands notifications to the UI thread without letting them queue up behind the balloon tip.
+    // Every notification type has a slot that keeps only the latest notification offered, and
+    // at most one UI update is posted at a time and no more than one per interval, the time a
+    // balloon tip is on display. A UI update shows the most recent of the notifications offered
+    // since the last one, except that a failed delivery is not hidden by a later scan. So a burst
+    // shows its first notification at once and then one balloon tip, with its sound, for the
+    // last result of each interval, rather than one for every notification.
+    class NotificationCoalescer : IDisposable
+    {
+        private static readonly ILog log = LogProvider.For<NotificationCoalescer>();
+
+        private readonly SynchronizationContext _uiThreadContext;
+        private readonly TimeSpan _interval;
+        private readonly Action<TrayNotification> _show;
+        private readonly TrayNotification[] _slots = new TrayNotification[Enum.GetValues(typeof(TrayNotificationType)).Length];
+        private readonly Timer _timer;
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
+        private long _sequence;
+        // 1 while a UI update is posted or waiting for the interval to pass
+        private int _scheduled;
+        // _clock milliseconds before which no UI update is posted
+        private long _notBefore;
+        private long _offered;
+        private long _shown;
+
+        public NotificationCoalescer(SynchronizationContext uiThreadContext, TimeSpan interval, Action<TrayNotification> show)
+        {
+            _uiThreadContext = uiThreadContext;
+            _interval = interval;
+            _show = show;
+            _timer = new Timer(state => Post(), null, Timeout.Infinite, Timeout.Infinite);
+        }
+
+        public long Offered
+        {
+            get { return Interlocked.Read(ref _offered); }
+        }
+
+        // UI updates, at most one per burst of notifications
+        public long Shown
+        {
+            get { return Interlocked.Read(ref _shown); }
+        }
+
+        // Any thread
+        public void Offer(TrayNotification notification)
+        {
+            notification.Sequence = Interlocked.Increment(ref _sequence);
+            Interlocked.Exchange(ref _slots[(int)notification.Type], notification);
+            Interlocked.Increment(ref _offered);
+            if (Interlocked.CompareExchange(ref _scheduled, 1, 0) == 0)
+            {
+                Schedule();
+            }
+        }
+
+        private void Schedule()
+        {
+            long wait = Interlocked.Read(ref _notBefore) - _clock.ElapsedMilliseconds;
+            if (wait > 0)
+            {
+                try { _timer.Change(wait, Timeout.Infinite); }
+                catch (ObjectDisposedException) { }
+            }
+            else
+            {
+                Post();
+            }
+        }
+
+        private void Post()
+        {
+            _uiThreadContext.Post(Update, null);
+        }
+
+        private void Update(object state)
+        {
+            // a notification offered from now on schedules the next update, one interval later
+            Interlocked.Exchange(ref _notBefore, _clock.ElapsedMilliseconds + (long)_interval.TotalMilliseconds);
+            Thread.VolatileWrite(ref _scheduled, 0);
+            TrayNotification latest = null;
+            for (int i = 0; i < _slots.Length; i++)
+            {
+                TrayNotification notification = Interlocked.Exchange(ref _slots[i], null);
+                if (notification != null && (latest == null || Outranks(notification, latest)))
+                {
+                    latest = notification;
+                }
+            }
+            if (latest == null)
+            {
+                return;
+            }
+            Interlocked.Increment(ref _shown);
+            try { _show(latest); }
+            catch (Exception ex)
+            {
+                log.WarnFormat("Unable to show notification [{0}] exception [{1}]", latest, ex.Message);
+            }
+        }
+
+        private static bool Outranks(TrayNotification notification, TrayNotification other)
+        {
+            if (notification.Type == TrayNotificationType.DELIVERY && notification.IsProblem && other.Type == TrayNotificationType.SCAN)
+            {
+                return true;
+            }
+            if (other.Type == TrayNotificationType.DELIVERY && other.IsProblem && notification.Type == TrayNotificationType.SCAN)
+            {
+                return false;
+            }
+            return notification.Sequence > other.Sequence;
+        }
+
+        public void Dispose()
+        {
+            _timer.Dispose();
+        }
+
+        public override string ToString()
+        {
+            return String.Format("NotificationCoalescer Interval [{0}] Offered [{1}] Shown [{2}]", _interval, Offered, Shown);
+        }
+    }
+}
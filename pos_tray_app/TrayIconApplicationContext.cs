@@ -13,10 +13,14 @@ namespace CH.Alika.POS.TrayApp
     class TrayIconApplicationContext : ApplicationContext
     {
         private static readonly string _DefaultTooltip = "Alika Point-Of-Sale";
+        // how long a balloon tip is shown, and so how often notifications of scans can follow
+        // each other, see NotificationCoalescer
+        public static readonly TimeSpan BalloonDisplayTime = TimeSpan.FromSeconds(3);
         private System.ComponentModel.Container components;
         private NotifyIcon notifyIcon;
         private SubscriptionProxy subscriptionProxy;
         private SynchronizationContext _uiThreadContext;
+        private NotificationCoalescer notifications;
 
         public TrayIconApplicationContext()
         {
@@ -51,6 +55,7 @@ namespace CH.Alika.POS.TrayApp
             };
 
             _uiThreadContext = new WindowsFormsSynchronizationContext();
+            notifications = new NotificationCoalescer(_uiThreadContext, BalloonDisplayTime, ShowNotification);
             notifyIcon.ContextMenuStrip.Opening += ContextMenuStrip_Opening;
             notifyIcon.Click += NotifyIcon_Click;
             // notifyIcon.DoubleClick += notifyIcon_DoubleClick;
@@ -91,52 +96,34 @@ namespace CH.Alika.POS.TrayApp
 
         private void HandleScanEvent(object source, ScanEvent e)
         {
-            _uiThreadContext.Post((SendOrPostCallback)delegate
-            {
-                notifyIcon.BalloonTipText = "A document was successfully scanned.";
-                notifyIcon.BalloonTipTitle = "Document Scanned";
-                notifyIcon.BalloonTipIcon = ToolTipIcon.Info;
-                notifyIcon.ShowBalloonTip(3);
-            }, null);
+            notifications.Offer(TrayNotification.ForScan(e));
         }
 
         private void HandleScanDeliveredEvent(object source, ScanDeliveryEvent e)
         {
-            _uiThreadContext.Post((SendOrPostCallback)delegate
+            notifications.Offer(TrayNotification.ForDelivery(e));
+        }
+
+        // UI thread, once per burst of notifications
+        private void ShowNotification(TrayNotification notification)
+        {
+            notifyIcon.BalloonTipTitle = notification.Title;
+            notifyIcon.BalloonTipText = notification.Text;
+            notifyIcon.BalloonTipIcon = notification.Icon;
+            if (notification.Sound != null)
             {
-                if (e.ScanDeliveryResult.WasDelivered)
-                {
-                    try
-                    {
-                        var balloonTip = Newtonsoft.Json.JsonConvert.DeserializeObject<BalloonTip>(e.ScanDeliveryResult.DeliveryResponse);
-                        notifyIcon.BalloonTipTitle = balloonTip.Title;
-                        notifyIcon.BalloonTipText = balloonTip.Text;
-                        notifyIcon.BalloonTipIcon = balloonTip.Icon;
-                    }
-                    catch
-                    {
-                        var balloonTip = new BalloonTip();
-                        notifyIcon.BalloonTipText = balloonTip.Text;
-                        notifyIcon.BalloonTipTitle = balloonTip.Title;
-                        notifyIcon.BalloonTipIcon = balloonTip.Icon;
-                    }
-                }
-                else
-                {
-                    notifyIcon.BalloonTipText = "Error: " + e.ScanDeliveryResult.DeliveryResponse;
-                    notifyIcon.BalloonTipTitle = "Document Scan Delivery Failed";
-                    notifyIcon.BalloonTipIcon = ToolTipIcon.Error;
-                }
-                if (ToolTipIcon.Error.Equals(notifyIcon.BalloonTipIcon) || ToolTipIcon.Warning.Equals(notifyIcon.BalloonTipIcon))
-                {
-                    System.Media.SystemSounds.Beep.Play();
-                }
-                else
-                {
-                    System.Media.SystemSounds.Asterisk.Play(); 
-                }
-                notifyIcon.ShowBalloonTip(3);
-            }, null);
+                notification.Sound.Play();
+            }
+            notifyIcon.ShowBalloonTip((int)BalloonDisplayTime.TotalMilliseconds);
+        }
+
+        protected override void Dispose(bool disposing)
+        {
+            if (disposing)
+            {
+                notifications.Dispose();
+            }
+            base.Dispose(disposing);
         }
     }
 }
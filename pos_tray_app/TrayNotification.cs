@@ -0,0 +1,92 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Media;
+using System.Text;
+using System.Windows.Forms;
+
+namespace CH.Alika.POS.TrayApp
+{
+    enum TrayNotificationType
+    {
+        SCAN,
+        DELIVERY
+    }
+
+    // Balloon tip and sound for an event of the service, prepared off the UI thread
+    class TrayNotification
+    {
+        public TrayNotificationType Type { get; private set; }
+        public String Title { get; private set; }
+        public String Text { get; private set; }
+        public ToolTipIcon Icon { get; private set; }
+        // null for none
+        public SystemSound Sound { get; private set; }
+        // order in which the notifications were offered, see NotificationCoalescer
+        internal long Sequence { get; set; }
+
+        public TrayNotification(TrayNotificationType type, String title, String text, ToolTipIcon icon, SystemSound sound)
+        {
+            Type = type;
+            Title = title;
+            Text = text;
+            Icon = icon;
+            Sound = sound;
+        }
+
+        public bool IsProblem
+        {
+            get { return Icon == ToolTipIcon.Error || Icon == ToolTipIcon.Warning; }
+        }
+
+        public static TrayNotification ForScan(ScanEvent e)
+        {
+            return new TrayNotification(TrayNotificationType.SCAN, "Document Scanned", "A document was successfully scanned.",
+                ToolTipIcon.Info, null);
+        }
+
+        public static TrayNotification ForDelivery(ScanDeliveryEvent e)
+        {
+            if (!e.ScanDeliveryResult.WasDelivered)
+            {
+                if (e.ScanDeliveryResult.NotificationTitle != null)
+                {
+                    // the store's answer to a scan it refused
+                    return new TrayNotification(TrayNotificationType.DELIVERY, e.ScanDeliveryResult.NotificationTitle,
+                        e.ScanDeliveryResult.NotificationText, ToolTipIcon.Error, SystemSounds.Beep);
+                }
+                return new TrayNotification(TrayNotificationType.DELIVERY, "Document Scan Delivery Failed",
+                    "Error: " + e.ScanDeliveryResult.DeliveryResponse, ToolTipIcon.Error, SystemSounds.Beep);
+            }
+            if (e.ScanDeliveryResult.NotificationTitle != null)
+            {
+                // parsed by the service
+                return ForBalloonTip(e.ScanDeliveryResult.NotificationTitle, e.ScanDeliveryResult.NotificationText,
+                    BalloonTip.IconFor(e.ScanDeliveryResult.NotificationSeverity));
+            }
+            // a service of an earlier version only sends the response
+            BalloonTip balloonTip;
+            try
+            {
+                balloonTip = BalloonTip.Parse(e.ScanDeliveryResult.DeliveryResponse) ?? new BalloonTip();
+            }
+            catch
+            {
+                balloonTip = new BalloonTip();
+            }
+            return ForBalloonTip(balloonTip.Title, balloonTip.Text, balloonTip.Icon);
+        }
+
+        private static TrayNotification ForBalloonTip(String title, String text, ToolTipIcon icon)
+        {
+            bool isProblem = icon == ToolTipIcon.Error || icon == ToolTipIcon.Warning;
+            return new TrayNotification(TrayNotificationType.DELIVERY, title, text, icon,
+                isProblem ? SystemSounds.Beep : SystemSounds.Asterisk);
+        }
+
+        public override string ToString()
+        {
+            return String.Format("TrayNotification Type [{0}] Title [{1}] Icon [{2}]", Type, Title, Icon);
+        }
+    }
+}